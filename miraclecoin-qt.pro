@@ -102,6 +102,16 @@ contains(USE_IPV6, -) {
     DEFINES += USE_IPV6=$$USE_IPV6
 }
 
+# use: qmake "USE_SECP256K1=1" (built-in ECDSA verification; default)
+#  or: qmake "USE_SECP256K1=0" (verify through OpenSSL)
+# needs a 64-bit compiler with 128-bit integers, falls back to OpenSSL otherwise
+count(USE_SECP256K1, 0) {
+    USE_SECP256K1=1
+}
+contains(USE_SECP256K1, 1) {
+    DEFINES += USE_SECP256K1
+}
+
 contains(BITCOIN_NEED_QT_PLUGINS, 1) {
     DEFINES += BITCOIN_NEED_QT_PLUGINS
     QTPLUGIN += qcncodecs qjpcodecs qtwcodecs qkrcodecs qtaccessiblewidgets
@@ -152,11 +162,18 @@ HEADERS += src/qt/bitcoingui.h \
     src/serialize.h \
     src/strlcpy.h \
     src/main.h \
+    src/blockstore.h \
+    src/checkqueue.h \
     src/net.h \
     src/key.h \
+    src/secp256k1_verify.h \
+    src/sha256.h \
     src/db.h \
+    src/kvstore.h \
+    src/lsmdb.h \
     src/walletdb.h \
     src/script.h \
+    src/scriptstack.h \
     src/init.h \
     src/irc.h \
     src/mruset.h \
@@ -196,12 +213,14 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/notificator.h \
     src/qt/qtipcserver.h \
     src/allocators.h \
+    src/uint256map.h \
     src/ui_interface.h \
     src/qt/rpcconsole.h \
     src/version.h \
     src/netbase.h \
     src/clientversion.h \
     src/hashblock.h \
+    src/hashx11.h \
     src/sph_blake.h \
     src/sph_bmw.h \
     src/sph_cubehash.h \
@@ -243,14 +262,20 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/util.cpp \
     src/netbase.cpp \
     src/key.cpp \
+    src/secp256k1_verify.cpp \
+    src/sha256.cpp \
+    src/sha256_x86.cpp \
     src/script.cpp \
     src/main.cpp \
+    src/blockstore.cpp \
     src/init.cpp \
     src/net.cpp \
     src/irc.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/db.cpp \
+    src/kvstore.cpp \
+    src/lsmdb.cpp \
     src/walletdb.cpp \
     src/qt/clientmodel.cpp \
     src/qt/guiutil.cpp \
@@ -305,6 +330,9 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/skein.c \
     src/fugue.c \
     src/hamsi.c \
+    src/hashx11.cpp \
+    src/hashx11_aesni.cpp \
+    src/hashx11_x86.cpp \
     src/scrypt.cpp \
     src/qt/httpsocket.cpp \
     src/qt/notifications.cpp \
@@ -9,6 +9,7 @@
 #include <string>
 #include <boost/thread/mutex.hpp>
 #include <map>
+#include <vector>
 
 #ifdef WIN32
 #ifdef _WIN32_WINNT
@@ -254,4 +255,89 @@ struct zero_after_free_allocator : public std::allocator<T>
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
+
+/**
+ * Memory for many small objects of one type, carved out of chunks of
+ * nChunkSize objects.  Allocated one by one from the heap, each object would
+ * carry the heap's bookkeeping and could land anywhere; from the pool they
+ * come without overhead and next to each other.
+ *
+ * Freed slots are kept for reuse, the chunks are only given back when the
+ * pool is destroyed, so an object must not outlive its pool.  Classes use it
+ * through their own operator new and operator delete.
+ */
+template<typename T, size_t nChunkSize = 4096>
+class CObjectPool
+{
+private:
+    union CSlot
+    {
+        CSlot* pnextFree;
+        double dAlign;
+        char data[sizeof(T)];
+    };
+
+    mutable boost::mutex mutex;
+    std::vector<CSlot*> vChunks;
+    CSlot* pfree;
+    size_t nChunkUsed;
+    size_t nAllocated;
+
+    CObjectPool(const CObjectPool&);
+    void operator=(const CObjectPool&);
+
+public:
+    CObjectPool() : pfree(NULL), nChunkUsed(nChunkSize), nAllocated(0) { }
+
+    ~CObjectPool()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+    }
+
+    void* Allocate()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        CSlot* pslot = pfree;
+        if (pslot)
+            pfree = pslot->pnextFree;
+        else
+        {
+            if (nChunkUsed == nChunkSize)
+            {
+                vChunks.push_back(static_cast<CSlot*>(::operator new(sizeof(CSlot) * nChunkSize)));
+                nChunkUsed = 0;
+            }
+            pslot = &vChunks.back()[nChunkUsed++];
+        }
+        nAllocated++;
+        return pslot;
+    }
+
+    void Free(void* p)
+    {
+        if (p == NULL)
+            return;
+        boost::mutex::scoped_lock lock(mutex);
+        CSlot* pslot = static_cast<CSlot*>(p);
+        pslot->pnextFree = pfree;
+        pfree = pslot;
+        nAllocated--;
+    }
+
+    // Objects allocated and not freed
+    size_t GetAllocatedCount() const
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return nAllocated;
+    }
+
+    // Bytes taken from the heap
+    size_t GetReservedBytes() const
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return vChunks.size() * nChunkSize * sizeof(CSlot);
+    }
+};
+
 #endif
@@ -0,0 +1,118 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "main.h"
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/time.h>
+#endif
+
+int64_t GetBenchTimeNanos()
+{
+#if defined(CLOCK_MONOTONIC) && !defined(WIN32)
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return (int64_t)t.tv_sec * 1000000000 + (int64_t)t.tv_usec * 1000;
+#endif
+}
+
+struct CBenchEntry
+{
+    BenchFunction func;
+    uint64_t nBytesPerIteration;
+};
+
+// Constructed on first use, so registrations from any translation unit's
+// static initializers are safe
+static std::map<std::string, CBenchEntry>& GetBenchmarks()
+{
+    static std::map<std::string, CBenchEntry> mapBenchmarks;
+    return mapBenchmarks;
+}
+
+void RegisterBenchmark(const std::string& strName, BenchFunction func, uint64_t nBytesPerIteration)
+{
+    CBenchEntry entry;
+    entry.func = func;
+    entry.nBytesPerIteration = nBytesPerIteration;
+    GetBenchmarks()[strName] = entry;
+}
+
+static int64_t RunSample(const CBenchEntry& entry, uint64_t nIterations)
+{
+    CBenchState state(nIterations);
+    entry.func(state);
+    return std::max(state.GetElapsedNanos(), (int64_t)1);
+}
+
+void RunBenchmarks(const std::string& strFilter, int64_t nSampleMillis, int nSamples)
+{
+    const int64_t nSampleNanos = nSampleMillis * 1000000;
+
+    printf("%-32s %12s %12s %12s %10s\n", "# benchmark", "iterations", "min ns/op", "median ns/op", "MB/s");
+    for (std::map<std::string, CBenchEntry>::const_iterator it = GetBenchmarks().begin(); it != GetBenchmarks().end(); ++it)
+    {
+        const std::string& strName = it->first;
+        const CBenchEntry& entry = it->second;
+        if (strName.find(strFilter) == std::string::npos)
+            continue;
+
+        // Grow the iteration count until one sample takes long enough for
+        // timer resolution and warm-up to stop mattering
+        uint64_t nIterations = 1;
+        while (true)
+        {
+            int64_t nElapsed = RunSample(entry, nIterations);
+            if (nElapsed >= nSampleNanos)
+                break;
+            double dScale = 1.2 * nSampleNanos / nElapsed;
+            nIterations = (uint64_t)(nIterations * std::min(std::max(dScale, 2.0), 100.0));
+        }
+
+        std::vector<double> vPerOp;
+        for (int i = 0; i < nSamples; i++)
+            vPerOp.push_back((double)RunSample(entry, nIterations) / nIterations);
+        std::sort(vPerOp.begin(), vPerOp.end());
+        double dMedian = vPerOp[vPerOp.size() / 2];
+
+        if (entry.nBytesPerIteration)
+            printf("%-32s %12llu %12.1f %12.1f %10.2f\n", strName.c_str(), (unsigned long long)nIterations,
+                   vPerOp.front(), dMedian, entry.nBytesPerIteration * 1000.0 / dMedian);
+        else
+            printf("%-32s %12llu %12.1f %12.1f %10s\n", strName.c_str(), (unsigned long long)nIterations,
+                   vPerOp.front(), dMedian, "-");
+        fflush(stdout);
+    }
+}
+
+// One input spending a pay-to-pubkey-hash output, two such outputs: the
+// shape of the bulk of transactions on the network
+CTransaction MakeBenchTransaction(unsigned int n)
+{
+    CTransaction tx;
+    tx.nTime = 1408199514 + n;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = Hash(BEGIN(n), END(n));
+    tx.vin[0].prevout.n = n & 3;
+    tx.vin[0].scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    tx.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        tx.vout[i].nValue = (n + i + 1) * CENT;
+        tx.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
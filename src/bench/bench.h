@@ -0,0 +1,86 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_BENCH_H
+#define MIRACLECOIN_BENCH_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/** Monotonic clock in nanoseconds, for timing benchmark samples. */
+int64_t GetBenchTimeNanos();
+
+/** Handed to each benchmark; the benchmark does its setup, then loops
+ * while KeepRunning() returns true.  Only the loop itself is timed.
+ *
+ *     static void Hash9Header(CBenchState& state)
+ *     {
+ *         CBlock block;
+ *         while (state.KeepRunning())
+ *             Hash9(BEGIN(block.nVersion), END(block.nNonce));
+ *     }
+ *     BENCHMARK(Hash9Header, 80);
+ */
+class CBenchState
+{
+private:
+    uint64_t nIterations;
+    uint64_t nTarget;
+    int64_t nStart;
+    int64_t nEnd;
+
+public:
+    CBenchState(uint64_t nTargetIn) : nIterations(0), nTarget(nTargetIn), nStart(0), nEnd(0) { }
+
+    bool KeepRunning()
+    {
+        if (nIterations == 0)
+            nStart = GetBenchTimeNanos();
+        if (nIterations < nTarget)
+        {
+            nIterations++;
+            return true;
+        }
+        nEnd = GetBenchTimeNanos();
+        return false;
+    }
+
+    uint64_t GetIterations() const { return nIterations; }
+    int64_t GetElapsedNanos() const { return nEnd - nStart; }
+};
+
+typedef boost::function<void(CBenchState&)> BenchFunction;
+
+/** Add a benchmark to the run.  nBytesPerIteration is the amount of data
+ * one iteration processes, or 0 when a throughput figure makes no sense.
+ */
+void RegisterBenchmark(const std::string& strName, BenchFunction func, uint64_t nBytesPerIteration);
+
+/** Run every registered benchmark whose name contains strFilter and print
+ * one line of results for each.  Each benchmark is first calibrated to
+ * take at least nSampleMillis per sample, then sampled nSamples times;
+ * the minimum and median of the samples are reported, which keeps the
+ * numbers comparable from one run to the next.
+ */
+void RunBenchmarks(const std::string& strFilter, int64_t nSampleMillis, int nSamples);
+
+struct CBenchRegistration
+{
+    CBenchRegistration(const std::string& strName, BenchFunction func, uint64_t nBytesPerIteration)
+    {
+        RegisterBenchmark(strName, func, nBytesPerIteration);
+    }
+};
+
+/** A one-in, two-out pay-to-pubkey-hash transaction, distinct for each n. */
+class CTransaction;
+CTransaction MakeBenchTransaction(unsigned int n);
+
+#define BENCHMARK(name, nBytesPerIteration) \
+    static CBenchRegistration BOOST_PP_CAT(instance_of_bench_, BOOST_PP_CAT(name, __LINE__))(BOOST_PP_STRINGIZE(name), name, nBytesPerIteration)
+
+#endif // MIRACLECOIN_BENCH_H
@@ -0,0 +1,57 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "hashx11.h"
+#include "main.h"
+#include "wallet.h"
+
+#include <stdio.h>
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+
+void Shutdown(void* parg)
+{
+    exit(0);
+}
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("--help"))
+    {
+        fprintf(stdout, "Usage: bench_miraclecoin [options]\n\n"
+            "  -filter=<str>     Only run benchmarks whose name contains <str>\n"
+            "  -x11accel         Use the accelerated X11 kernels the CPU supports (default: 1)\n"
+            "  -sha256accel      Use the accelerated SHA256 kernels the CPU supports (default: 1)\n"
+            "  -samplems=<n>     Minimum duration of one sample in milliseconds (default: 200)\n"
+            "  -samples=<n>      Number of samples per benchmark (default: 5)\n");
+        return 0;
+    }
+
+    // Errors raised on purpose by the benchmarks should not end up anywhere
+    fPrintToDebugger = true;
+
+    X11SelectEngine(GetBoolArg("-x11accel", true) ? X11DetectCPU() : 0);
+    const CX11Engine& engine = X11GetEngine();
+    fprintf(stdout, "# %s\n# X11 kernels:", FormatFullVersion().c_str());
+    for (int i = 0; i < X11_STAGE_COUNT; i++)
+        fprintf(stdout, " %s", engine.pszImpl[i]);
+    fprintf(stdout, "\n# X11 batch kernels:");
+    for (int i = 0; i < X11_STAGE_COUNT; i++)
+        fprintf(stdout, " %s", engine.pszImpl4[i]);
+    fprintf(stdout, "\n");
+    SHA256SelectEngine(GetBoolArg("-sha256accel", true) ? SHA256DetectCPU() : 0);
+    fprintf(stdout, "# SHA256 kernels: %s, batches: %s\n", SHA256GetEngine().pszImpl, SHA256GetEngine().pszImplD64);
+
+    RunBenchmarks(GetArg("-filter", ""), std::max(GetArg("-samplems", 200), (int64)1), std::max((int)GetArg("-samples", 5), 1));
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "kernel.h"
+#include "main.h"
+
+static void MerkleBench(CBenchState& state, unsigned int nTx)
+{
+    CBlock block;
+    for (unsigned int i = 0; i < nTx; i++)
+        block.vtx.push_back(MakeBenchTransaction(i));
+    // Transaction hashes are cached after the first call, so the loop
+    // measures the tree itself
+    block.BuildMerkleTree();
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+static void MerkleRoot_10(CBenchState& state) { MerkleBench(state, 10); }
+BENCHMARK(MerkleRoot_10, 0);
+static void MerkleRoot_1000(CBenchState& state) { MerkleBench(state, 1000); }
+BENCHMARK(MerkleRoot_1000, 0);
+
+// What a miner does per extranonce: new coinbase, same transactions
+static void MerkleUpdateCoinbase_1000(CBenchState& state)
+{
+    CBlock block;
+    for (unsigned int i = 0; i < 1000; i++)
+        block.vtx.push_back(MakeBenchTransaction(i));
+    block.BuildMerkleTree();
+    unsigned int nExtraNonce = 0;
+    while (state.KeepRunning())
+    {
+        block.vtx[0].vin[0].scriptSig = CScript() << ++nExtraNonce;
+        block.vtx[0].InvalidateHash();
+        block.UpdateMerkleTreeCoinbase();
+    }
+}
+BENCHMARK(MerkleUpdateCoinbase_1000, 0);
+
+static void StakeKernelHash(CBenchState& state)
+{
+    // A short chain with a fresh stake modifier every hour, long enough
+    // for GetKernelStakeModifier() to find one a selection interval past
+    // the block holding the staked output
+    static const int nBlocks = 72;
+    static const unsigned int nTimeStart = 1408199514;
+    std::vector<CBlock> vBlock(nBlocks);
+    std::vector<CBlockIndex*> vpindex;
+    for (int i = 0; i < nBlocks; i++)
+    {
+        vBlock[i].nVersion = 1;
+        vBlock[i].nTime = nTimeStart + i * 60 * 60;
+        vBlock[i].nBits = 0x1e0fffff;
+        vBlock[i].nNonce = i;
+        if (i > 0)
+            vBlock[i].hashPrevBlock = vBlock[i - 1].GetHash();
+
+        CBlockIndex* pindex = new CBlockIndex(0, 0, vBlock[i]);
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(vBlock[i].GetHash(), pindex)).first->first;
+        pindex->nHeight = i;
+        pindex->SetStakeModifier(Hash(BEGIN(i), END(i)).Get64(), true);
+        if (i > 0)
+        {
+            pindex->pprev = vpindex.back();
+            vpindex.back()->pnext = pindex;
+        }
+        vpindex.push_back(pindex);
+    }
+
+    const CBlock& blockFrom = vBlock[0];
+    CTransaction txPrev = MakeBenchTransaction(0);
+    txPrev.nTime = blockFrom.nTime;
+    txPrev.vout[0].nValue = 1000 * COIN;
+    COutPoint prevout(txPrev.GetHash(), 0);
+    unsigned int nTimeTx = nTimeStart + 30 * 24 * 60 * 60;
+    uint256 hashProofOfStake;
+
+    while (state.KeepRunning())
+        CheckStakeKernelHash(0x1e0fffff, blockFrom, 81, txPrev, prevout, nTimeTx++, hashProofOfStake);
+
+    BOOST_FOREACH(CBlockIndex* pindex, vpindex)
+    {
+        uint256 hash = *pindex->phashBlock;
+        mapBlockIndex.erase(hash);
+        delete pindex;
+    }
+}
+BENCHMARK(StakeKernelHash, 0);
@@ -0,0 +1,113 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "hashblock.h"
+#include "hashx11.h"
+#include "main.h"
+#include "sha256.h"
+
+#include <boost/bind.hpp>
+
+static void X11StageBench(CBenchState& state, int nStage)
+{
+    unsigned char buf[2][64] = {};
+    X11StageFunc func = X11GetEngine().stage[nStage];
+    int n = 0;
+    while (state.KeepRunning())
+    {
+        // Chain outputs back into inputs so iterations can't overlap
+        func(buf[n & 1], buf[(n + 1) & 1]);
+        n++;
+    }
+}
+
+// The kernel behind each stage is chosen at run time, so the benchmark
+// names carry only the stage; main() prints which kernel each one used.
+static struct CX11StageBenchRegistration
+{
+    CX11StageBenchRegistration()
+    {
+        static const char* const pszStage[X11_STAGE_COUNT] = {
+            "blake", "bmw", "groestl", "skein", "jh", "keccak", "luffa",
+            "cubehash", "shavite", "simd", "echo", "hamsi", "fugue"
+        };
+        for (int i = 0; i < X11_STAGE_COUNT; i++)
+        {
+            char pszName[32];
+            sprintf(pszName, "X11Stage%02d_%s", i, pszStage[i]);
+            RegisterBenchmark(pszName, boost::bind(&X11StageBench, _1, i), 64);
+        }
+    }
+} instance_of_cx11stagebenchregistration;
+
+static void Hash9Header(CBenchState& state)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.nTime = 1408199514;
+    block.nBits = 0x1e0fffff;
+    while (state.KeepRunning())
+    {
+        block.hashPrevBlock = Hash9(BEGIN(block.nVersion), END(block.nNonce));
+        block.nNonce++;
+    }
+}
+BENCHMARK(Hash9Header, 80);
+
+static void Hash9Batch(CBenchState& state)
+{
+    static const size_t nCount = 256;
+    std::vector<unsigned char> vchData(nCount * 80);
+    std::vector<unsigned char> vchHash(nCount * 64);
+    for (size_t i = 0; i < vchData.size(); i++)
+        vchData[i] = i * 7;
+    while (state.KeepRunning())
+        X11HashBatch(&vchData[0], 80, nCount, &vchHash[0]);
+}
+BENCHMARK(Hash9Batch, 256 * 80);
+
+static void SHA256dBench(CBenchState& state, size_t nSize)
+{
+    std::vector<unsigned char> vch(nSize);
+    uint256 hash;
+    while (state.KeepRunning())
+    {
+        hash = Hash(vch.begin(), vch.end());
+        vch[0] = hash.Get64();
+    }
+}
+
+static void SHA256d_64(CBenchState& state) { SHA256dBench(state, 64); }
+BENCHMARK(SHA256d_64, 64);
+static void SHA256d_1K(CBenchState& state) { SHA256dBench(state, 1024); }
+BENCHMARK(SHA256d_1K, 1024);
+static void SHA256d_1M(CBenchState& state) { SHA256dBench(state, 1024 * 1024); }
+BENCHMARK(SHA256d_1M, 1024 * 1024);
+
+// A merkle tree level's worth of 64-byte messages through the batch API
+static void SHA256D64_1024(CBenchState& state)
+{
+    static const size_t nCount = 1024;
+    std::vector<unsigned char> vchIn(nCount * 64);
+    std::vector<unsigned char> vchOut(nCount * 32);
+    for (size_t i = 0; i < vchIn.size(); i++)
+        vchIn[i] = i * 13;
+    while (state.KeepRunning())
+        SHA256D64(&vchOut[0], &vchIn[0], nCount);
+}
+BENCHMARK(SHA256D64_1024, 1024 * 64);
+
+static void SerializeHashTransaction(CBenchState& state)
+{
+    CTransaction tx = MakeBenchTransaction(0);
+    while (state.KeepRunning())
+    {
+        // Straight to SerializeHash: tx.GetHash() would hit the hash cache
+        uint256 hash = SerializeHash(tx);
+        tx.nLockTime = hash.Get64() & 0xffff;
+    }
+}
+BENCHMARK(SerializeHashTransaction, ::GetSerializeSize(MakeBenchTransaction(0), SER_NETWORK, PROTOCOL_VERSION));
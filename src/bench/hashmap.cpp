@@ -0,0 +1,105 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "main.h"
+#include "uint256map.h"
+
+#include <map>
+
+// Lookups in a table of block or transaction hashes, as std::map and as
+// uint256_map, at about the size of the block index and of a busy memory
+// pool.  The keys are looked up in a scattered order, as they arrive from
+// the network, so most of the table is out of the cache.
+
+static const std::vector<uint256>& GetBenchKeys(unsigned int nCount)
+{
+    static std::map<unsigned int, std::vector<uint256> > mapKeys;
+    std::vector<uint256>& vKey = mapKeys[nCount];
+    if (vKey.empty())
+    {
+        for (unsigned int i = 0; i < nCount; i++)
+            vKey.push_back(Hash(BEGIN(i), END(i)));
+    }
+    return vKey;
+}
+
+template <typename M>
+static const M& GetBenchMap(unsigned int nCount)
+{
+    static std::map<unsigned int, M*> mapMaps;
+    M*& pmap = mapMaps[nCount];
+    if (!pmap)
+    {
+        pmap = new M();
+        const std::vector<uint256>& vKey = GetBenchKeys(nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+            pmap->insert(std::make_pair(vKey[i], (CBlockIndex*)NULL));
+    }
+    return *pmap;
+}
+
+template <typename M>
+static void LookupBench(CBenchState& state, unsigned int nCount, bool fMissing)
+{
+    const M& map = GetBenchMap<M>(nCount);
+    const std::vector<uint256>& vKey = GetBenchKeys(nCount);
+    uint256 hashMissing = ~uint256(0);
+    unsigned int nFound = 0;
+    unsigned int i = 0;
+    while (state.KeepRunning())
+    {
+        // A stride coprime to the table size visits every key
+        i = (i + 7919) % nCount;
+        if (fMissing)
+        {
+            hashMissing ^= vKey[i];
+            nFound += map.count(hashMissing);
+        }
+        else
+            nFound += map.count(vKey[i]);
+    }
+    if (nFound == 0 && !fMissing)
+        printf("LookupBench : no keys found\n");
+}
+
+typedef std::map<uint256, CBlockIndex*> BenchTreeMap;
+typedef uint256_map<CBlockIndex*> BenchHashMap;
+
+static void BlockIndexFind_map(CBenchState& state) { LookupBench<BenchTreeMap>(state, 1000000, false); }
+BENCHMARK(BlockIndexFind_map, 0);
+static void BlockIndexFind_uint256map(CBenchState& state) { LookupBench<BenchHashMap>(state, 1000000, false); }
+BENCHMARK(BlockIndexFind_uint256map, 0);
+static void BlockIndexMiss_map(CBenchState& state) { LookupBench<BenchTreeMap>(state, 1000000, true); }
+BENCHMARK(BlockIndexMiss_map, 0);
+static void BlockIndexMiss_uint256map(CBenchState& state) { LookupBench<BenchHashMap>(state, 1000000, true); }
+BENCHMARK(BlockIndexMiss_uint256map, 0);
+static void MempoolFind_map(CBenchState& state) { LookupBench<BenchTreeMap>(state, 50000, false); }
+BENCHMARK(MempoolFind_map, 0);
+static void MempoolFind_uint256map(CBenchState& state) { LookupBench<BenchHashMap>(state, 50000, false); }
+BENCHMARK(MempoolFind_uint256map, 0);
+
+template <typename M>
+static void InsertBench(CBenchState& state)
+{
+    const std::vector<uint256>& vKey = GetBenchKeys(1000000);
+    M map;
+    unsigned int i = 0;
+    while (state.KeepRunning())
+    {
+        // Start over when full, so every sample includes the growth
+        if (i == vKey.size())
+        {
+            map.clear();
+            i = 0;
+        }
+        map.insert(std::make_pair(vKey[i++], (CBlockIndex*)NULL));
+    }
+}
+
+static void BlockIndexInsert_map(CBenchState& state) { InsertBench<BenchTreeMap>(state); }
+BENCHMARK(BlockIndexInsert_map, 0);
+static void BlockIndexInsert_uint256map(CBenchState& state) { InsertBench<BenchHashMap>(state); }
+BENCHMARK(BlockIndexInsert_uint256map, 0);
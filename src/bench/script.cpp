@@ -0,0 +1,46 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "key.h"
+#include "script.h"
+
+static void SolverBench(CBenchState& state, const CScript& scriptPubKey)
+{
+    CScriptSolution solution;
+    while (state.KeepRunning())
+        Solver(scriptPubKey, solution);
+}
+
+static void Solver_PubKeyHash(CBenchState& state)
+{
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(CKeyID(Hash160(std::vector<unsigned char>(33, 2))));
+    SolverBench(state, scriptPubKey);
+}
+BENCHMARK(Solver_PubKeyHash, 0);
+
+static void Solver_Multisig(CBenchState& state)
+{
+    CScript scriptPubKey;
+    scriptPubKey << OP_2 << std::vector<unsigned char>(33, 2) << std::vector<unsigned char>(33, 3)
+                 << std::vector<unsigned char>(65, 4) << OP_3 << OP_CHECKMULTISIG;
+    SolverBench(state, scriptPubKey);
+}
+BENCHMARK(Solver_Multisig, 0);
+
+// What wallet scanning does for each output it looks at
+static void IsMine_PubKeyHash(CBenchState& state)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    while (state.KeepRunning())
+        IsMine(keystore, scriptPubKey);
+}
+BENCHMARK(IsMine_PubKeyHash, 0);
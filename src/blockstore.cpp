@@ -0,0 +1,99 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace std;
+using namespace boost::interprocess;
+
+
+CBlockStore::CBlockStore(PathFunc pfnPathIn, unsigned int nMaxWindowsIn) :
+    pfnPath(pfnPathIn), nMaxWindows(max(nMaxWindowsIn, 1U)), nUseCounter(0)
+{
+}
+
+bool CBlockStore::MapWindow(unsigned int nFile, unsigned int nWindow, CWindow& windowRet)
+{
+    boost::filesystem::path path = pfnPath(nFile);
+    uint64 nStart = (uint64)nWindow * WINDOW_STEP;
+    try {
+        uint64 nFileSize = boost::filesystem::file_size(path);
+        if (nFileSize <= nStart)
+            return false;
+        windowRet.nLength = (size_t)min(nFileSize - nStart, (uint64)2 * WINDOW_STEP);
+        file_mapping mapping(path.string().c_str(), read_only);
+        windowRet.pregion.reset(new mapped_region(mapping, read_only, nStart, windowRet.nLength));
+    }
+    catch (std::exception& e) {
+        return error("CBlockStore::MapWindow() : can't map %s at %"PRI64u" : %s", path.string().c_str(), nStart, e.what());
+    }
+    return true;
+}
+
+bool CBlockStore::GetView(unsigned int nFile, unsigned int nPos, CBlockFileView& viewRet)
+{
+    unsigned int nWindow = nPos / WINDOW_STEP;
+    size_t nOffset = nPos % WINDOW_STEP;
+
+    LOCK(cs);
+    MapType::iterator mi = mapWindows.find(make_pair(nFile, nWindow));
+    if (mi == mapWindows.end())
+    {
+        CWindow window;
+        if (!MapWindow(nFile, nWindow, window))
+            return false;
+
+        // Make room by dropping the window used longest ago
+        if (mapWindows.size() >= nMaxWindows)
+        {
+            MapType::iterator miOldest = mapWindows.begin();
+            for (MapType::iterator it = mapWindows.begin(); it != mapWindows.end(); ++it)
+                if (it->second.nLastUsed < miOldest->second.nLastUsed)
+                    miOldest = it;
+            mapWindows.erase(miOldest);
+        }
+        mi = mapWindows.insert(make_pair(make_pair(nFile, nWindow), window)).first;
+    }
+
+    CWindow& window = mi->second;
+    window.nLastUsed = ++nUseCounter;
+    if (nOffset >= window.nLength)
+        return false;
+    const char* pbegin = (const char*)window.pregion->get_address();
+    viewRet.pregion = window.pregion;
+    viewRet.pcur = pbegin + nOffset;
+    viewRet.pend = pbegin + window.nLength;
+    return true;
+}
+
+void CBlockStore::Appended(unsigned int nFile, unsigned int nSize)
+{
+    LOCK(cs);
+    MapType::iterator mi = mapWindows.lower_bound(make_pair(nFile, 0U));
+    while (mi != mapWindows.end() && mi->first.first == nFile)
+    {
+        uint64 nEnd = (uint64)mi->first.second * WINDOW_STEP + mi->second.nLength;
+        if (mi->second.nLength < 2 * WINDOW_STEP && nEnd < nSize)
+            mapWindows.erase(mi++);
+        else
+            ++mi;
+    }
+}
+
+void CBlockStore::Clear()
+{
+    LOCK(cs);
+    mapWindows.clear();
+}
+
+unsigned int CBlockStore::GetMappedCount() const
+{
+    LOCK(cs);
+    return mapWindows.size();
+}
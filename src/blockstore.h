@@ -0,0 +1,120 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_BLOCKSTORE_H
+#define MIRACLECOIN_BLOCKSTORE_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <map>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+/** Part of a block file, read in place from its memory mapping.  Objects are
+ * unserialized from it as from a CAutoFile, without reading the file into a
+ * buffer first.  The mapping stays valid as long as the view does.
+ */
+class CBlockFileView
+{
+private:
+    boost::shared_ptr<boost::interprocess::mapped_region> pregion;
+    const char* pcur;
+    const char* pend;
+
+    friend class CBlockStore;
+
+public:
+    int nType;
+    int nVersion;
+
+    CBlockFileView(int nTypeIn, int nVersionIn) : pcur(NULL), pend(NULL), nType(nTypeIn), nVersion(nVersionIn) { }
+
+    // Bytes from the current position to the end of the mapped data
+    size_t size() const { return pend - pcur; }
+    const char* begin() const { return pcur; }
+
+    //
+    // Stream subset
+    //
+    void SetType(int n)          { nType = n; }
+    int GetType()                { return nType; }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion()             { return nVersion; }
+
+    CBlockFileView& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CBlockFileView::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CBlockFileView& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Keeps the block files mapped read-only into memory, so reading a block or
+ * a transaction needs neither an open nor a seek.
+ *
+ * Files are mapped in windows of twice WINDOW_STEP bytes that start at
+ * multiples of WINDOW_STEP, so an object no larger than WINDOW_STEP that
+ * starts in a window ends in it too.  Only the most recently used windows
+ * stay mapped, which bounds the address space taken on 32-bit systems.  A
+ * window that reached the end of a file still being appended to is mapped
+ * again after Appended() tells it the file has grown.
+ */
+class CBlockStore
+{
+public:
+    typedef boost::filesystem::path (*PathFunc)(unsigned int nFile);
+
+    static const unsigned int WINDOW_STEP = 16 << 20;
+
+private:
+    struct CWindow
+    {
+        boost::shared_ptr<boost::interprocess::mapped_region> pregion;
+        size_t nLength;
+        uint64 nLastUsed;
+    };
+
+    typedef std::map<std::pair<unsigned int, unsigned int>, CWindow> MapType;
+
+    mutable CCriticalSection cs;
+    PathFunc pfnPath;
+    unsigned int nMaxWindows;
+    MapType mapWindows;
+    uint64 nUseCounter;
+
+    bool MapWindow(unsigned int nFile, unsigned int nWindow, CWindow& windowRet);
+
+public:
+    CBlockStore(PathFunc pfnPathIn, unsigned int nMaxWindowsIn = (sizeof(void*) >= 8 ? 256 : 8));
+
+    /** Point viewRet at nPos in block file nFile.  False if that is past the
+     * end of the file or the file can't be mapped; the caller can still read
+     * it with stdio then. */
+    bool GetView(unsigned int nFile, unsigned int nPos, CBlockFileView& viewRet);
+
+    /** Called after appending to block file nFile, which is now nSize bytes
+     * long.  Windows that ended at the old end of the file are dropped. */
+    void Appended(unsigned int nFile, unsigned int nSize);
+
+    /** Unmap everything, the views handed out stay valid */
+    void Clear();
+
+    unsigned int GetMappedCount() const;
+};
+
+#endif
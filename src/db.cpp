@@ -9,9 +9,11 @@
 #include "util.h"
 #include "main.h"
 #include "kernel.h"
+#include "lsmdb.h"
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #ifndef WIN32
 #include "sys/stat.h"
@@ -480,10 +482,294 @@ void CDBEnv::Flush(bool fShutdown)
 
 
 
+//
+// CBDBKeyValueStore
+//
+
+class CBDBKeyValueCursor : public CKeyValueCursor
+{
+private:
+    Dbc* pcursor;
+    bool fValid;
+    bool fFailed;
+    std::string strKey;
+    std::string strValue;
+
+    void Get(unsigned int fFlags)
+    {
+        Dbt datKey;
+        if (fFlags == DB_SET_RANGE)
+        {
+            datKey.set_data((void*)strKey.data());
+            datKey.set_size(strKey.size());
+        }
+        Dbt datValue;
+        datKey.set_flags(DB_DBT_MALLOC);
+        datValue.set_flags(DB_DBT_MALLOC);
+        int ret = pcursor ? pcursor->get(&datKey, &datValue, fFlags) : DB_NOTFOUND;
+        fValid = (ret == 0 && datKey.get_data() != NULL && datValue.get_data() != NULL);
+        fFailed = (ret != 0 && ret != DB_NOTFOUND);
+        if (fValid)
+        {
+            strKey.assign((const char*)datKey.get_data(), datKey.get_size());
+            strValue.assign((const char*)datValue.get_data(), datValue.get_size());
+        }
+        if (ret == 0)
+        {
+            free(datKey.get_data());
+            free(datValue.get_data());
+        }
+    }
+
+public:
+    explicit CBDBKeyValueCursor(Dbc* pcursorIn) : pcursor(pcursorIn), fValid(false), fFailed(pcursorIn == NULL) { }
+
+    ~CBDBKeyValueCursor()
+    {
+        if (pcursor)
+            pcursor->close();
+    }
+
+    void Seek(const std::string& strKeyIn)
+    {
+        strKey = strKeyIn;
+        Get(DB_SET_RANGE);
+    }
+
+    void Next() { Get(DB_NEXT); }
+    bool Valid() const { return fValid; }
+    const std::string& GetKey() const { return strKey; }
+    const std::string& GetValue() const { return strValue; }
+    bool Failed() const { return fFailed; }
+};
+
+bool CBDBKeyValueStore::Read(const string& strKey, string& strValueRet)
+{
+    if (!pdb)
+        return false;
+    Dbt datKey((void*)strKey.data(), strKey.size());
+    Dbt datValue;
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
+    if (datValue.get_data() == NULL)
+        return false;
+    strValueRet.assign((const char*)datValue.get_data(), datValue.get_size());
+    free(datValue.get_data());
+    return (ret == 0);
+}
+
+bool CBDBKeyValueStore::Exists(const string& strKey)
+{
+    if (!pdb)
+        return false;
+    Dbt datKey((void*)strKey.data(), strKey.size());
+    return (pdb->exists(activeTxn, &datKey, 0) == 0);
+}
+
+bool CBDBKeyValueStore::Write(const CKeyValueBatch& batch, bool fSync)
+{
+    if (!pdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Write called on database in read-only mode");
+
+    // A single change is atomic by itself (DB_AUTO_COMMIT)
+    bool fTxn = (batch.size() > 1);
+    if (fTxn && !TxnBegin())
+        return false;
+    for (CKeyValueBatch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        Dbt datKey((void*)it->first.data(), it->first.size());
+        int ret;
+        if (it->second.first)
+        {
+            ret = pdb->del(activeTxn, &datKey, 0);
+            if (ret == DB_NOTFOUND)
+                ret = 0;
+        }
+        else
+        {
+            Dbt datValue((void*)it->second.second.data(), it->second.second.size());
+            ret = pdb->put(activeTxn, &datKey, &datValue, 0);
+        }
+        if (ret != 0)
+        {
+            if (fTxn)
+                TxnAbort();
+            return false;
+        }
+    }
+    if (fTxn && !TxnCommit())
+        return false;
+    return !fSync || Sync();
+}
+
+CKeyValueCursor* CBDBKeyValueStore::NewCursor()
+{
+    return new CBDBKeyValueCursor(GetCursor());
+}
+
+bool CBDBKeyValueStore::Sync()
+{
+    return (bitdb.dbenv.log_flush(NULL) == 0);
+}
+
+
+
+
 //
 // CTxDB
 //
 
+CKeyValueStore* CTxDB::pstoreShared = NULL;
+bool CTxDB::fSharedStore = false;
+CKeyValueCache CTxDB::cache;
+int64 CTxDB::nFlushInterval = 300;
+int64 CTxDB::nLastFlushTime = 0;
+
+CTxDB::CTxDB(const char* pszMode) : fTxn(false)
+{
+    fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
+    fOwnStore = !fSharedStore;
+    if (fOwnStore)
+        pstore = new CBDBKeyValueStore("blkindex.dat", pszMode);
+    else
+    {
+        // Every read and write fails on a CTxDB without a store
+        pstore = pstoreShared;
+        if (!pstore)
+            error("CTxDB() : the transaction database is already closed");
+    }
+}
+
+void CTxDB::Close()
+{
+    if (!pstore)
+        return;
+    TxnAbort();
+    if (fOwnStore)
+        delete pstore;
+    pstore = NULL;
+}
+
+bool CTxDB::OpenStore(const string& strEngine)
+{
+    if (strEngine == "bdb")
+        return true;
+    if (strEngine != "lsm")
+        return error("CTxDB::OpenStore() : unknown engine %s", strEngine.c_str());
+
+    CLSMStore* pstoreLSM = new CLSMStore();
+    if (!pstoreLSM->Open(GetDataDir() / "txdb"))
+    {
+        delete pstoreLSM;
+        return false;
+    }
+    pstoreShared = pstoreLSM;
+    fSharedStore = true;
+
+    // As CDB does for a new file
+    CTxDB txdb("cr+");
+    if (!txdb.Exists(string("version")))
+        txdb.WriteVersion(CLIENT_VERSION);
+    return true;
+}
+
+void CTxDB::CloseStore()
+{
+    if (cache.IsDirty())
+    {
+        try {
+            CTxDB txdb;
+            txdb.Flush(true);
+        }
+        catch (std::exception& e) {
+            PrintExceptionContinue(&e, "CTxDB::CloseStore()");
+        }
+    }
+    delete pstoreShared;
+    pstoreShared = NULL;
+}
+
+void CTxDB::SetCacheSize(size_t nBytes)
+{
+    cache.SetMaxBytes(nBytes);
+}
+
+void CTxDB::SetFlushPolicy(int64 nIntervalIn, bool (*pfnBeforeFlush)())
+{
+    nFlushInterval = nIntervalIn;
+    nLastFlushTime = GetTime();
+    cache.SetBeforeFlush(pfnBeforeFlush);
+}
+
+bool CTxDB::Flush(bool fSync)
+{
+    if (!pstore || !cache.Flush(*pstore, fSync))
+        return false;
+    nLastFlushTime = GetTime();
+    return true;
+}
+
+bool CTxDB::PeriodicFlush(bool fNearTip)
+{
+    if (!cache.IsDirty())
+        return true;
+    if (!fNearTip && GetTime() - nLastFlushTime < nFlushInterval)
+        return true;
+    return Flush(true);
+}
+
+bool CTxDB::ReadRaw(const string& strKey, string& strValueRet)
+{
+    if (!pstore)
+        return false;
+    bool fErased;
+    if (fTxn && batch.Get(strKey, fErased, strValueRet))
+        return !fErased;
+    return cache.Read(*pstore, strKey, strValueRet);
+}
+
+bool CTxDB::WriteRaw(const string& strKey, const string& strValue, bool fErase)
+{
+    if (!pstore)
+        return false;
+    CKeyValueBatch batchOne;
+    CKeyValueBatch& batchWrite = (fTxn ? batch : batchOne);
+    if (fErase)
+        batchWrite.Erase(strKey);
+    else
+        batchWrite.Write(strKey, strValue);
+    return fTxn || cache.Write(*pstore, batchOne);
+}
+
+bool CTxDB::TxnBegin()
+{
+    if (!pstore || fTxn)
+        return false;
+    fTxn = true;
+    return true;
+}
+
+bool CTxDB::TxnCommit()
+{
+    if (!pstore || !fTxn)
+        return false;
+    fTxn = false;
+    bool fOk = cache.Write(*pstore, batch);
+    batch.clear();
+    return fOk;
+}
+
+bool CTxDB::TxnAbort()
+{
+    if (!pstore || !fTxn)
+        return false;
+    fTxn = false;
+    batch.clear();
+    return true;
+}
+
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
 {
     assert(!fClient);
@@ -515,6 +801,12 @@ bool CTxDB::EraseTxIndex(const CTransaction& tx)
     return Erase(make_pair(string("tx"), hash));
 }
 
+bool CTxDB::EraseTxIndex(uint256 hash)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("tx"), hash));
+}
+
 bool CTxDB::ContainsTx(uint256 hash)
 {
     assert(!fClient);
@@ -552,6 +844,142 @@ bool CTxDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair(string("blockindex"), blockindex.GetBlockHash()), blockindex);
 }
 
+bool CTxDB::ReadBlockUndo(uint256 hash, CBlockUndo& undo)
+{
+    assert(!fClient);
+    undo.SetNull();
+    return Read(make_pair(string("blockundo"), hash), undo);
+}
+
+bool CTxDB::WriteBlockUndo(uint256 hash, const CBlockUndo& undo)
+{
+    assert(!fClient);
+    return Write(make_pair(string("blockundo"), hash), undo);
+}
+
+bool CTxDB::EraseBlockUndo(uint256 hash)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("blockundo"), hash));
+}
+
+bool CTxDB::WriteAddrIndex(const CAddrIndexKey& key, const CAddrIndexValue& value)
+{
+    return Write(make_pair(string("addr"), key), value);
+}
+
+bool CTxDB::EraseAddrIndex(const CAddrIndexKey& key)
+{
+    return Erase(make_pair(string("addr"), key));
+}
+
+bool CTxDB::ReadAddrIndexUndo(uint256 hash, vector<CAddrIndexDest>& vSpentRet)
+{
+    vSpentRet.clear();
+    return Read(make_pair(string("addrundo"), hash), vSpentRet);
+}
+
+bool CTxDB::WriteAddrIndexUndo(uint256 hash, const vector<CAddrIndexDest>& vSpent)
+{
+    return Write(make_pair(string("addrundo"), hash), vSpent);
+}
+
+bool CTxDB::EraseAddrIndexUndo(uint256 hash)
+{
+    return Erase(make_pair(string("addrundo"), hash));
+}
+
+// Version of the address index layout, kept in its built flag.  The first
+// layout filed outputs under the hash of their script and kept a bool
+// there; an index of any other version reads as not built and is rebuilt.
+static const int ADDRINDEX_VERSION = 2;
+
+bool CTxDB::ReadAddrIndexBuilt()
+{
+    int nVersion = 0;
+    return Read(string("addrindexbuilt"), nVersion) && nVersion == ADDRINDEX_VERSION;
+}
+
+bool CTxDB::WriteAddrIndexBuilt(bool fBuilt)
+{
+    if (!fBuilt)
+        return Erase(string("addrindexbuilt"));
+    return Write(string("addrindexbuilt"), ADDRINDEX_VERSION);
+}
+
+bool CTxDB::ReadAddrIndex(const CAddrIndexDest& dest, CAddrIndexVisitor& visitor)
+{
+    if (!pstore)
+        return false;
+
+    string strPrefix = KeyToString(make_pair(string("addr"), dest));
+    boost::scoped_ptr<CKeyValueCursor> pcursor(cache.NewCursor(*pstore, strPrefix));
+    for (pcursor->Seek(strPrefix); pcursor->Valid(); pcursor->Next())
+    {
+        const string& strKey = pcursor->GetKey();
+        if (strKey.compare(0, strPrefix.size(), strPrefix) != 0)
+            break;
+        pair<string, CAddrIndexKey> key;
+        CAddrIndexValue value;
+        try {
+            CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+            ssKey >> key;
+            const string& strValue = pcursor->GetValue();
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> value;
+        }
+        catch (std::exception &e) {
+            return error("CTxDB::ReadAddrIndex() : deserialize error");
+        }
+        if (!visitor.Visit(key.second, value))
+            return true;
+    }
+    if (pcursor->Failed())
+        return error("CTxDB::ReadAddrIndex() : cursor read failed");
+    return true;
+}
+
+bool CTxDB::ErasePrefix(const string& strPrefix)
+{
+    if (!pstore || !Flush())
+        return false;
+
+    // A chunk at a time, letting go of the cursor before writing
+    static const unsigned int nChunkSize = 10000;
+    vector<string> vErase;
+    do
+    {
+        vErase.clear();
+        {
+            boost::scoped_ptr<CKeyValueCursor> pcursor(pstore->NewCursor());
+            for (pcursor->Seek(strPrefix); pcursor->Valid() && vErase.size() < nChunkSize; pcursor->Next())
+            {
+                const string& strKey = pcursor->GetKey();
+                if (strKey.compare(0, strPrefix.size(), strPrefix) != 0)
+                    break;
+                vErase.push_back(strKey);
+            }
+            if (pcursor->Failed())
+                return error("CTxDB::ErasePrefix() : cursor read failed");
+        }
+
+        if (!TxnBegin())
+            return error("CTxDB::ErasePrefix() : TxnBegin failed");
+        BOOST_FOREACH(const string& strKey, vErase)
+            WriteRaw(strKey, string(), true);
+        if (!TxnCommit() || !Flush())
+            return error("CTxDB::ErasePrefix() : write failed");
+    } while (vErase.size() >= nChunkSize);
+    return true;
+}
+
+bool CTxDB::ClearAddrIndex()
+{
+    if (!WriteAddrIndexBuilt(false))
+        return false;
+    return ErasePrefix(KeyToString(string("addr"))) && ErasePrefix(KeyToString(string("addrundo")));
+}
+
 bool CTxDB::ReadHashBestChain(uint256& hashBestChain)
 {
     return Read(string("hashBestChain"), hashBestChain);
@@ -562,14 +990,19 @@ bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
     return Write(string("hashBestChain"), hashBestChain);
 }
 
-bool CTxDB::ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust)
+// Written as a CBigNum, as it always was
+bool CTxDB::ReadBestInvalidTrust(uint256& nBestInvalidTrust)
 {
-    return Read(string("bnBestInvalidTrust"), bnBestInvalidTrust);
+    CBigNum bnBestInvalidTrust;
+    if (!Read(string("bnBestInvalidTrust"), bnBestInvalidTrust))
+        return false;
+    nBestInvalidTrust = bnBestInvalidTrust.getuint256();
+    return true;
 }
 
-bool CTxDB::WriteBestInvalidTrust(CBigNum bnBestInvalidTrust)
+bool CTxDB::WriteBestInvalidTrust(uint256 nBestInvalidTrust)
 {
-    return Write(string("bnBestInvalidTrust"), bnBestInvalidTrust);
+    return Write(string("bnBestInvalidTrust"), CBigNum(nBestInvalidTrust));
 }
 
 bool CTxDB::ReadSyncCheckpoint(uint256& hashCheckpoint)
@@ -598,7 +1031,7 @@ CBlockIndex static * InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
@@ -612,15 +1045,33 @@ CBlockIndex static * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+void CTxDB::ClearBlockIndex()
+{
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    {
+        delete mi->second->pstake;
+        delete mi->second;
+    }
+    mapBlockIndex.clear();
+    setStakeSeen.clear();
+    pindexGenesisBlock = NULL;
+}
+
 bool CTxDB::LoadBlockIndex()
 {
-    if (!LoadBlockIndexGuts())
-        return false;
+    bool fSnapshot = LoadBlockIndexSnapshot();
+    if (!fSnapshot)
+    {
+        // A snapshot that failed part way has left some entries behind
+        ClearBlockIndex();
+        if (!LoadBlockIndexGuts())
+            return false;
+    }
 
     if (fRequestShutdown)
         return true;
 
-    // Calculate bnChainTrust
+    // Calculate nChainTrust
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -632,9 +1083,12 @@ bool CTxDB::LoadBlockIndex()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->bnChainTrust = (pindex->pprev ? pindex->pprev->bnChainTrust : 0) + pindex->GetBlockTrust();
-        // ppcoin: calculate stake modifier checksum
-        pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+        if (!fSnapshot)
+        {
+            pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + pindex->GetBlockTrust();
+            // ppcoin: calculate stake modifier checksum
+            pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+        }
         if (!CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
             return error("CTxDB::LoadBlockIndex() : Failed stake modifier checkpoint height=%d, modifier=0x%016"PRI64x, pindex->nHeight, pindex->nStakeModifier);
     }
@@ -650,9 +1104,9 @@ bool CTxDB::LoadBlockIndex()
         return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
-    bnBestChainTrust = pindexBest->bnChainTrust;
+    nBestChainTrust = pindexBest->nChainTrust;
     printf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s  date=%s\n",
-      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainTrust.ToString().c_str(),
+      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, CBigNum(nBestChainTrust).ToString().c_str(),
       DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()).c_str());
 
     // ppcoin: load hashSyncCheckpoint
@@ -660,8 +1114,8 @@ bool CTxDB::LoadBlockIndex()
         return error("CTxDB::LoadBlockIndex() : hashSyncCheckpoint not loaded");
     printf("LoadBlockIndex(): synchronized checkpoint %s\n", Checkpoints::hashSyncCheckpoint.ToString().c_str());
 
-    // Load bnBestInvalidTrust, OK if it doesn't exist
-    ReadBestInvalidTrust(bnBestInvalidTrust);
+    // Load nBestInvalidTrust, OK if it doesn't exist
+    ReadBestInvalidTrust(nBestInvalidTrust);
 
     // Verify blocks in the best chain
     int nCheckLevel = GetArg("-checklevel", 1);
@@ -715,12 +1169,13 @@ bool CTxDB::LoadBlockIndex()
                             }
                     }
                     // check level 4: check whether spent txouts were spent within the main chain
-                    unsigned int nOutput = 0;
+                    // (only possible where -txindexspenders recorded the spending transaction)
                     if (nCheckLevel>3)
                     {
-                        BOOST_FOREACH(const CDiskTxPos &txpos, txindex.vSpent)
+                        for (unsigned int nOutput = 0; nOutput < txindex.GetOutputCount(); nOutput++)
                         {
-                            if (!txpos.IsNull())
+                            CDiskTxPos txpos;
+                            if (txindex.GetSpender(nOutput, txpos))
                             {
                                 pair<unsigned int, unsigned int> posFind = make_pair(txpos.nFile, txpos.nBlockPos);
                                 if (!mapBlockPos.count(posFind))
@@ -756,7 +1211,6 @@ bool CTxDB::LoadBlockIndex()
                                     }
                                 }
                             }
-                            nOutput++;
                         }
                     }
                 }
@@ -767,7 +1221,7 @@ bool CTxDB::LoadBlockIndex()
                      {
                           CTxIndex txindex;
                           if (ReadTxIndex(txin.prevout.hash, txindex))
-                              if (txindex.vSpent.size()-1 < txin.prevout.n || txindex.vSpent[txin.prevout.n].IsNull())
+                              if (!txindex.IsSpent(txin.prevout.n))
                               {
                                   printf("LoadBlockIndex(): *** found unspent prevout %s:%i in %s\n", txin.prevout.hash.ToString().c_str(), txin.prevout.n, hashTx.ToString().c_str());
                                   pindexFork = pindex->pprev;
@@ -793,69 +1247,317 @@ bool CTxDB::LoadBlockIndex()
 
 
 
-bool CTxDB::LoadBlockIndexGuts()
+// Insert a batch of records read by LoadBlockIndexGuts.  The X11 hashes of
+// the headers are computed together up front, see PrecomputeBlockHashes().
+static bool LoadDiskBlockIndex(const uint256& hashBlock, const CDiskBlockIndex& diskindex, CBlockIndex*& pindexRet)
 {
-    // Get database cursor
-    Dbc* pcursor = GetCursor();
-    if (!pcursor)
+    // Construct block index object
+    CBlockIndex* pindexNew = InsertBlockIndex(hashBlock);
+    pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+    pindexNew->nFile          = diskindex.nFile;
+    pindexNew->nBlockPos      = diskindex.nBlockPos;
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nMint          = diskindex.nMint;
+    pindexNew->nMoneySupply   = diskindex.nMoneySupply;
+    pindexNew->nFlags         = diskindex.nFlags;
+    pindexNew->nStakeModifier = diskindex.nStakeModifier;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+    if (pindexNew->IsProofOfStake())
+        pindexNew->SetStake(diskindex.prevoutStake, diskindex.nStakeTime, diskindex.hashProofOfStake);
+    pindexRet = pindexNew;
+
+    // Watch for genesis block
+    if (pindexGenesisBlock == NULL && hashBlock == (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet))
+        pindexGenesisBlock = pindexNew;
+
+    if (!pindexNew->CheckIndex())
+        return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
+
+    // ppcoin: build setStakeSeen
+    if (pindexNew->IsProofOfStake())
+        setStakeSeen.insert(make_pair(pindexNew->GetPrevoutStake(), pindexNew->GetStakeTime()));
+    return true;
+}
+
+static bool LoadBlockIndexBatch(const vector<CDiskBlockIndex>& vDiskIndex)
+{
+    vector<CBlock> vHeader;
+    vHeader.reserve(vDiskIndex.size());
+    vector<const CBlock*> vpHeader;
+    vpHeader.reserve(vDiskIndex.size());
+    BOOST_FOREACH(const CDiskBlockIndex& diskindex, vDiskIndex)
+    {
+        vHeader.push_back(diskindex.GetBlockHeader());
+        vpHeader.push_back(&vHeader.back());
+    }
+    PrecomputeBlockHashes(vpHeader);
+
+    for (unsigned int i = 0; i < vDiskIndex.size(); i++)
+    {
+        CBlockIndex* pindexNew;
+        if (!LoadDiskBlockIndex(vHeader[i].GetHash(), vDiskIndex[i], pindexNew))
+            return false;
+    }
+    return true;
+}
+
+//
+// Block index snapshot
+//
+// blkindex.snapshot holds the whole block index as it was at the last clean
+// shutdown, with the block hashes and the chain trust already worked out,
+// and is read in one go at the next start.  It is removed as soon as it has
+// been read, so it is never used after the database could have changed.
+//
+// Layout: magic, client version, hashBestChain, record count, then per block
+// its hash, CDiskBlockIndex, nChainTrust and nStakeModifierChecksum, and
+// the hash of all that at the end.  The magic changes with the layout.
+//
+
+static const unsigned int BLOCKINDEX_SNAPSHOT_MAGIC = 0x32646962;
+
+static boost::filesystem::path BlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blkindex.snapshot";
+}
+
+bool CTxDB::WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+
+    // Not if startup stopped before the block index was fully loaded
+    if (pindexBest == NULL)
         return false;
 
-    // Load mapBlockIndex
-    unsigned int fFlags = DB_SET_RANGE;
-    INFINITE_LOOP
+    int64 nStart = GetTimeMillis();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(mapBlockIndex.size() * 240);
+    ss << BLOCKINDEX_SNAPSHOT_MAGIC << CLIENT_VERSION << hashBestChain << (uint64)mapBlockIndex.size();
+    for (BlockMap::const_iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
-        // Read next record
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fFlags == DB_SET_RANGE)
-            ssKey << make_pair(string("blockindex"), uint256(0));
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
-        fFlags = DB_NEXT;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
+        CBlockIndex* pindex = mi->second;
+        ss << mi->first << CDiskBlockIndex(pindex) << pindex->nChainTrust << pindex->nStakeModifierChecksum;
+    }
+    ss << Hash(ss.begin(), ss.end());
+
+    boost::filesystem::path pathSnapshot = BlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = pathSnapshot.string() + ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("CTxDB::WriteBlockIndexSnapshot() : can't create %s", pathTmp.string().c_str());
+    bool fOk = (fwrite(&ss[0], 1, ss.size(), file) == ss.size() && fflush(file) == 0);
+    if (fOk)
+        FileCommit(file);
+    fclose(file);
+    if (!fOk || !RenameOver(pathTmp, pathSnapshot))
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("CTxDB::WriteBlockIndexSnapshot() : write of %s failed", pathSnapshot.string().c_str());
+    }
+    printf("CTxDB::WriteBlockIndexSnapshot() : %"PRIszu" blocks, %"PRIszu" bytes in %"PRI64d"ms\n",
+           mapBlockIndex.size(), ss.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CTxDB::LoadBlockIndexSnapshot()
+{
+    boost::filesystem::path pathSnapshot = BlockIndexSnapshotPath();
+    if (!boost::filesystem::exists(pathSnapshot))
+        return false;
+    if (!GetBoolArg("-blockindexsnapshot", true))
+    {
+        boost::filesystem::remove(pathSnapshot);
+        return false;
+    }
+
+    int64 nStart = GetTimeMillis();
+    vector<char> vch;
+    FILE* file = fopen(pathSnapshot.string().c_str(), "rb");
+    if (file)
+    {
+        if (fseek(file, 0, SEEK_END) == 0)
+        {
+            long nSize = ftell(file);
+            if (nSize > 0 && fseek(file, 0, SEEK_SET) == 0)
+            {
+                vch.resize(nSize);
+                if (fread(&vch[0], 1, nSize, file) != (size_t)nSize)
+                    vch.clear();
+            }
+        }
+        fclose(file);
+    }
+    boost::filesystem::remove(pathSnapshot);
+
+    // Check it is whole and matches the database
+    if (vch.size() < sizeof(uint256))
+        return error("CTxDB::LoadBlockIndexSnapshot() : can't read %s", pathSnapshot.string().c_str());
+    uint256 hashChecksum;
+    memcpy(&hashChecksum, &vch[vch.size() - sizeof(uint256)], sizeof(uint256));
+    if (Hash(vch.begin(), vch.end() - sizeof(uint256)) != hashChecksum)
+        return error("CTxDB::LoadBlockIndexSnapshot() : checksum mismatch");
+
+    vector<pair<uint256, CDiskBlockIndex> > vDiskIndex;
+    vector<pair<uint256, unsigned int> > vTrust;
+    try {
+        CDataStream ss(&vch[0], &vch[0] + vch.size() - sizeof(uint256), SER_DISK, CLIENT_VERSION);
+        unsigned int nMagic;
+        int nVersion;
+        uint256 hashBestChainSnapshot, hashBestChainDB;
+        uint64 nBlocks;
+        ss >> nMagic >> nVersion >> hashBestChainSnapshot >> nBlocks;
+        if (nMagic != BLOCKINDEX_SNAPSHOT_MAGIC || nVersion != CLIENT_VERSION)
+            return error("CTxDB::LoadBlockIndexSnapshot() : written by another version");
+        if (!ReadHashBestChain(hashBestChainDB) || hashBestChainDB != hashBestChainSnapshot)
+            return error("CTxDB::LoadBlockIndexSnapshot() : stale, best chain %s in the database",
+                         hashBestChainDB.ToString().substr(0,20).c_str());
+        vDiskIndex.resize(nBlocks);
+        vTrust.resize(nBlocks);
+        for (uint64 i = 0; i < nBlocks; i++)
+            ss >> vDiskIndex[i].first >> vDiskIndex[i].second >> vTrust[i].first >> vTrust[i].second;
+    }
+    catch (std::exception &e) {
+        return error("CTxDB::LoadBlockIndexSnapshot() : deserialize error");
+    }
+
+    mapBlockIndex.reserve(vDiskIndex.size());
+    for (unsigned int i = 0; i < vDiskIndex.size(); i++)
+    {
+        CBlockIndex* pindexNew;
+        if (!LoadDiskBlockIndex(vDiskIndex[i].first, vDiskIndex[i].second, pindexNew))
             return false;
+        pindexNew->nChainTrust = vTrust[i].first;
+        pindexNew->nStakeModifierChecksum = vTrust[i].second;
+    }
+    printf("CTxDB::LoadBlockIndexSnapshot() : %"PRIszu" blocks in %"PRI64d"ms\n", vDiskIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+// Rewrite the tx index records that predate the spent bitmap.  They can be
+// read as they are, but are much larger and cost as much again every time an
+// output is spent.  Done in chunks so it can be interrupted and resumed.
+bool CTxDB::UpgradeTxIndex()
+{
+    int nFormat = 0;
+    if (Read(string("txindexformat"), nFormat) && nFormat >= 1)
+        return true;
+    if (!pstore || !Flush())
+        return false;
+
+    static const unsigned int nChunkSize = 10000;
+    int64 nStart = GetTimeMillis();
+    uint64 nRecords = 0, nUpgraded = 0, nBytesBefore = 0, nBytesAfter = 0;
+    string strPrefix = KeyToString(string("tx"));
+    string strSeek = strPrefix;
+    vector<pair<string, CTxIndex> > vUpgrade;
+    while (true)
+    {
+        if (fRequestShutdown)
+            return Flush(true);
+
+        // Collect a chunk, then let go of the cursor before writing
+        bool fDone = true;
+        vUpgrade.clear();
+        {
+            boost::scoped_ptr<CKeyValueCursor> pcursor(pstore->NewCursor());
+            for (pcursor->Seek(strSeek); pcursor->Valid(); pcursor->Next())
+            {
+                const string& strKey = pcursor->GetKey();
+                if (strKey.compare(0, strPrefix.size(), strPrefix) != 0)
+                    break;
+                if (strKey == strSeek)
+                    continue;
+                strSeek = strKey;
+                nRecords++;
+
+                const string& strValue = pcursor->GetValue();
+                int nRecordVersion = 0;
+                if (strValue.size() >= sizeof(nRecordVersion))
+                    memcpy(&nRecordVersion, strValue.data(), sizeof(nRecordVersion));
+                if (nRecordVersion & TXINDEX_COMPACT)
+                    continue;
+                try {
+                    CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+                    CTxIndex txindex;
+                    ssValue >> txindex;
+                    vUpgrade.push_back(make_pair(strKey, txindex));
+                    nBytesBefore += strValue.size();
+                }
+                catch (std::exception &e) {
+                    return error("CTxDB::UpgradeTxIndex() : deserialize error");
+                }
+                if (vUpgrade.size() >= nChunkSize)
+                {
+                    fDone = false;
+                    break;
+                }
+            }
+            if (pcursor->Failed())
+                return error("CTxDB::UpgradeTxIndex() : cursor read failed");
+        }
 
+        if (!TxnBegin())
+            return error("CTxDB::UpgradeTxIndex() : TxnBegin failed");
+        for (vector<pair<string, CTxIndex> >::const_iterator it = vUpgrade.begin(); it != vUpgrade.end(); ++it)
+        {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            ssValue << it->second;
+            nBytesAfter += ssValue.size();
+            WriteRaw(it->first, string(ssValue.begin(), ssValue.end()), false);
+        }
+        if (!TxnCommit() || !Flush())
+            return error("CTxDB::UpgradeTxIndex() : write failed");
+        nUpgraded += vUpgrade.size();
+        if (fDone)
+            break;
+        printf("CTxDB::UpgradeTxIndex() : %"PRI64u" records upgraded\n", nUpgraded);
+    }
+
+    if (!Write(string("txindexformat"), (int)1) || !Flush(true))
+        return error("CTxDB::UpgradeTxIndex() : write of txindexformat failed");
+    printf("CTxDB::UpgradeTxIndex() : upgraded %"PRI64u" of %"PRI64u" records, %"PRI64u" bytes to %"PRI64u", in %"PRI64d"ms\n",
+           nUpgraded, nRecords, nBytesBefore, nBytesAfter, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CTxDB::LoadBlockIndexGuts()
+{
+    // Get database cursor
+    if (!pstore || !Flush())
+        return false;
+    boost::scoped_ptr<CKeyValueCursor> pcursor(pstore->NewCursor());
+
+    // Load mapBlockIndex, a batch of records at a time
+    static const unsigned int nBatchSize = 4096;
+    vector<CDiskBlockIndex> vDiskIndex;
+    vDiskIndex.reserve(nBatchSize);
+    for (pcursor->Seek(KeyToString(make_pair(string("blockindex"), uint256(0)))); pcursor->Valid(); pcursor->Next())
+    {
         // Unserialize
 
         try {
+        const string& strKey = pcursor->GetKey();
+        CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
         string strType;
         ssKey >> strType;
         if (strType == "blockindex" && !fRequestShutdown)
         {
+            const string& strValue = pcursor->GetValue();
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             CDiskBlockIndex diskindex;
             ssValue >> diskindex;
-
-            // Construct block index object
-            CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-            pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
-            pindexNew->nFile          = diskindex.nFile;
-            pindexNew->nBlockPos      = diskindex.nBlockPos;
-            pindexNew->nHeight        = diskindex.nHeight;
-            pindexNew->nMint          = diskindex.nMint;
-            pindexNew->nMoneySupply   = diskindex.nMoneySupply;
-            pindexNew->nFlags         = diskindex.nFlags;
-            pindexNew->nStakeModifier = diskindex.nStakeModifier;
-            pindexNew->prevoutStake   = diskindex.prevoutStake;
-            pindexNew->nStakeTime     = diskindex.nStakeTime;
-            pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-            pindexNew->nVersion       = diskindex.nVersion;
-            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-            pindexNew->nTime          = diskindex.nTime;
-            pindexNew->nBits          = diskindex.nBits;
-            pindexNew->nNonce         = diskindex.nNonce;
-
-            // Watch for genesis block
-            if (pindexGenesisBlock == NULL && diskindex.GetBlockHash() == (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet))
-                pindexGenesisBlock = pindexNew;
-
-            if (!pindexNew->CheckIndex())
-                return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
-
-            // ppcoin: build setStakeSeen
-            if (pindexNew->IsProofOfStake())
-                setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+            vDiskIndex.push_back(diskindex);
+            if (vDiskIndex.size() >= nBatchSize)
+            {
+                if (!LoadBlockIndexBatch(vDiskIndex))
+                    return false;
+                vDiskIndex.clear();
+            }
         }
         else
         {
@@ -866,9 +1568,10 @@ bool CTxDB::LoadBlockIndexGuts()
             return error("%s() : deserialize error", BOOST_CURRENT_FUNCTION);
         }
     }
-    pcursor->close();
+    if (pcursor->Failed())
+        return error("CTxDB::LoadBlockIndexGuts() : cursor read failed");
 
-    return true;
+    return LoadBlockIndexBatch(vDiskIndex);
 }
 
 
@@ -6,6 +6,7 @@
 #define BITCOIN_DB_H
 
 #include "main.h"
+#include "kvstore.h"
 
 #include <map>
 #include <string>
@@ -16,6 +17,7 @@
 class CAddress;
 class CAddrMan;
 class CBlockLocator;
+class CBlockUndo;
 class CDiskBlockIndex;
 class CDiskTxPos;
 class CMasterKey;
@@ -317,36 +319,208 @@ public:
 
 
 
-/** Access to the transaction database (blkindex.dat) */
-class CTxDB : public CDB
+/** CKeyValueStore over a Berkeley DB file, the -txdb=bdb engine */
+class CBDBKeyValueStore : public CDB, public CKeyValueStore
 {
 public:
-    CTxDB(const char* pszMode="r+") : CDB("blkindex.dat", pszMode) { }
+    explicit CBDBKeyValueStore(const char* pszFile, const char* pszMode="r+") : CDB(pszFile, pszMode) { }
+
+    bool Read(const std::string& strKey, std::string& strValueRet);
+    bool Exists(const std::string& strKey);
+    bool Write(const CKeyValueBatch& batch, bool fSync);
+    CKeyValueCursor* NewCursor();
+    bool Sync();
+};
+
+
+
+
+/** Receives the address index entries of a destination from
+ * CTxDB::ReadAddrIndex, one at a time in key order */
+class CAddrIndexVisitor
+{
+public:
+    virtual ~CAddrIndexVisitor() { }
+
+    // Return false to end the scan early
+    virtual bool Visit(const CAddrIndexKey& key, const CAddrIndexValue& value) = 0;
+};
+
+
+/** Access to the transaction database (blkindex.dat, or txdb/ with -txdb=lsm) */
+class CTxDB
+{
+public:
+    CTxDB(const char* pszMode="r+");
+    ~CTxDB() { Close(); }
+
+    void Close();
+
+    // Open the engine named by -txdb.  Berkeley DB files are opened by each
+    // CTxDB; other engines are opened here once and shared.
+    static bool OpenStore(const std::string& strEngine);
+    static void CloseStore();
+
+    // Budget of the write-back cache all CTxDB share (-dbcache)
+    static void SetCacheSize(size_t nBytes);
+
+    // When PeriodicFlush writes the cache out away from the tip
+    // (-dbflushinterval), and what to make durable before any flush
+    static void SetFlushPolicy(int64 nIntervalIn, bool (*pfnBeforeFlush)());
+
+    // Write out the changes held in the cache
+    bool Flush(bool fSync = false);
+
+    // Called once a block is connected.  At the tip every block is flushed,
+    // during initial download the blocks of an interval go out as one batch,
+    // or sooner when they outgrow the cache.  hashBestChain is in each batch,
+    // so after a crash the database is as of the last one.
+    bool PeriodicFlush(bool fNearTip);
+
 private:
+    static CKeyValueStore* pstoreShared;
+    // Whether OpenStore() opened a shared engine, so a CTxDB made once it is
+    // closed has nothing to use rather than blkindex.dat
+    static bool fSharedStore;
+    static CKeyValueCache cache;
+    static int64 nFlushInterval;
+    static int64 nLastFlushTime;
+
+    CKeyValueStore* pstore;
+    bool fOwnStore;
+    bool fReadOnly;
+
+    // Changes made since TxnBegin, handed to the cache as one batch by
+    // TxnCommit, so a block that fails to connect never reaches it.  Reads
+    // look here first.
+    bool fTxn;
+    CKeyValueBatch batch;
+
     CTxDB(const CTxDB&);
     void operator=(const CTxDB&);
+
+    template<typename K>
+    static std::string KeyToString(const K& key)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        return std::string(ssKey.begin(), ssKey.end());
+    }
+
+    bool ReadRaw(const std::string& strKey, std::string& strValueRet);
+    bool WriteRaw(const std::string& strKey, const std::string& strValue, bool fErase);
+
+    template<typename K, typename T>
+    bool Read(const K& key, T& value)
+    {
+        std::string strValue;
+        if (!ReadRaw(KeyToString(key), strValue))
+            return false;
+
+        // Unserialize value
+        try {
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> value;
+        }
+        catch (std::exception &e) {
+            return false;
+        }
+        return true;
+    }
+
+    template<typename K, typename T>
+    bool Write(const K& key, const T& value)
+    {
+        if (fReadOnly)
+            assert(!"Write called on database in read-only mode");
+
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(10000);
+        ssValue << value;
+        return WriteRaw(KeyToString(key), std::string(ssValue.begin(), ssValue.end()), false);
+    }
+
+    template<typename K>
+    bool Erase(const K& key)
+    {
+        if (fReadOnly)
+            assert(!"Erase called on database in read-only mode");
+        return WriteRaw(KeyToString(key), std::string(), true);
+    }
+
+    template<typename K>
+    bool Exists(const K& key)
+    {
+        std::string strValue;
+        return ReadRaw(KeyToString(key), strValue);
+    }
+
 public:
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+
+    bool ReadVersion(int& nVersion)
+    {
+        nVersion = 0;
+        return Read(std::string("version"), nVersion);
+    }
+
+    bool WriteVersion(int nVersion)
+    {
+        return Write(std::string("version"), nVersion);
+    }
+
     bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
     bool EraseTxIndex(const CTransaction& tx);
+    bool EraseTxIndex(uint256 hash);
     bool ContainsTx(uint256 hash);
     bool ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex);
     bool ReadDiskTx(uint256 hash, CTransaction& tx);
     bool ReadDiskTx(COutPoint outpoint, CTransaction& tx, CTxIndex& txindex);
     bool ReadDiskTx(COutPoint outpoint, CTransaction& tx);
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool ReadBlockUndo(uint256 hash, CBlockUndo& undo);
+    bool WriteBlockUndo(uint256 hash, const CBlockUndo& undo);
+    bool EraseBlockUndo(uint256 hash);
+    bool WriteAddrIndex(const CAddrIndexKey& key, const CAddrIndexValue& value);
+    bool EraseAddrIndex(const CAddrIndexKey& key);
+    bool ReadAddrIndexUndo(uint256 hash, std::vector<CAddrIndexDest>& vSpentRet);
+    bool WriteAddrIndexUndo(uint256 hash, const std::vector<CAddrIndexDest>& vSpent);
+    bool EraseAddrIndexUndo(uint256 hash);
+    bool ReadAddrIndexBuilt();
+    bool WriteAddrIndexBuilt(bool fBuilt);
+
+    // Pass the address index entries of a destination to the visitor, as
+    // committed so far, including the changes not yet flushed
+    bool ReadAddrIndex(const CAddrIndexDest& dest, CAddrIndexVisitor& visitor);
+
+    // Remove the whole address index, before it is built again
+    bool ClearAddrIndex();
     bool ReadHashBestChain(uint256& hashBestChain);
     bool WriteHashBestChain(uint256 hashBestChain);
-    bool ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust);
-    bool WriteBestInvalidTrust(CBigNum bnBestInvalidTrust);
+    bool ReadBestInvalidTrust(uint256& nBestInvalidTrust);
+    bool WriteBestInvalidTrust(uint256 nBestInvalidTrust);
     bool ReadSyncCheckpoint(uint256& hashCheckpoint);
     bool WriteSyncCheckpoint(uint256 hashCheckpoint);
     bool ReadCheckpointPubKey(std::string& strPubKey);
     bool WriteCheckpointPubKey(const std::string& strPubKey);
     bool LoadBlockIndex();
+    bool UpgradeTxIndex();
+
+    // Save the block index for a quick start next time (-blockindexsnapshot)
+    static bool WriteBlockIndexSnapshot();
+    // Load the saved block index, false if there is none that can be used.
+    // On failure some entries may have been loaded, see ClearBlockIndex().
+    bool LoadBlockIndexSnapshot();
+    // Forget the block index entries loaded so far
+    static void ClearBlockIndex();
 private:
     bool LoadBlockIndexGuts();
+    bool ErasePrefix(const std::string& strPrefix);
 };
 
 
@@ -0,0 +1,252 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hashx11.h"
+
+#include <string.h>
+
+#include "sph_blake.h"
+#include "sph_bmw.h"
+#include "sph_groestl.h"
+#include "sph_jh.h"
+#include "sph_keccak.h"
+#include "sph_skein.h"
+#include "sph_luffa.h"
+#include "sph_cubehash.h"
+#include "sph_shavite.h"
+#include "sph_simd.h"
+#include "sph_echo.h"
+#include "sph_hamsi.h"
+#include "sph_fugue.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+//
+// Reference kernels: the portable sph_* implementations
+//
+
+#define X11_REFERENCE_STAGE(name)                                           \
+static void X11Ref_##name(const unsigned char* pin, unsigned char* pout)    \
+{                                                                           \
+    sph_##name##512_context ctx;                                            \
+    sph_##name##512_init(&ctx);                                             \
+    sph_##name##512(&ctx, pin, 64);                                         \
+    sph_##name##512_close(&ctx, pout);                                      \
+}                                                                           \
+static void X11Ref4_##name(const unsigned char* const* ppin, unsigned char* const* ppout) \
+{                                                                           \
+    for (int i = 0; i < 4; i++)                                             \
+        X11Ref_##name(ppin[i], ppout[i]);                                   \
+}
+
+X11_REFERENCE_STAGE(blake)
+X11_REFERENCE_STAGE(bmw)
+X11_REFERENCE_STAGE(groestl)
+X11_REFERENCE_STAGE(skein)
+X11_REFERENCE_STAGE(jh)
+X11_REFERENCE_STAGE(keccak)
+X11_REFERENCE_STAGE(luffa)
+X11_REFERENCE_STAGE(cubehash)
+X11_REFERENCE_STAGE(shavite)
+X11_REFERENCE_STAGE(simd)
+X11_REFERENCE_STAGE(echo)
+X11_REFERENCE_STAGE(hamsi)
+X11_REFERENCE_STAGE(fugue)
+
+#undef X11_REFERENCE_STAGE
+
+static CX11Engine MakeReferenceEngine()
+{
+    CX11Engine engine;
+    engine.stage[X11_BLAKE] = X11Ref_blake;
+    engine.stage4[X11_BLAKE] = X11Ref4_blake;
+    engine.stage[X11_BMW] = X11Ref_bmw;
+    engine.stage4[X11_BMW] = X11Ref4_bmw;
+    engine.stage[X11_GROESTL] = X11Ref_groestl;
+    engine.stage4[X11_GROESTL] = X11Ref4_groestl;
+    engine.stage[X11_SKEIN] = X11Ref_skein;
+    engine.stage4[X11_SKEIN] = X11Ref4_skein;
+    engine.stage[X11_JH] = X11Ref_jh;
+    engine.stage4[X11_JH] = X11Ref4_jh;
+    engine.stage[X11_KECCAK] = X11Ref_keccak;
+    engine.stage4[X11_KECCAK] = X11Ref4_keccak;
+    engine.stage[X11_LUFFA] = X11Ref_luffa;
+    engine.stage4[X11_LUFFA] = X11Ref4_luffa;
+    engine.stage[X11_CUBEHASH] = X11Ref_cubehash;
+    engine.stage4[X11_CUBEHASH] = X11Ref4_cubehash;
+    engine.stage[X11_SHAVITE] = X11Ref_shavite;
+    engine.stage4[X11_SHAVITE] = X11Ref4_shavite;
+    engine.stage[X11_SIMD] = X11Ref_simd;
+    engine.stage4[X11_SIMD] = X11Ref4_simd;
+    engine.stage[X11_ECHO] = X11Ref_echo;
+    engine.stage4[X11_ECHO] = X11Ref4_echo;
+    engine.stage[X11_HAMSI] = X11Ref_hamsi;
+    engine.stage4[X11_HAMSI] = X11Ref4_hamsi;
+    engine.stage[X11_FUGUE] = X11Ref_fugue;
+    engine.stage4[X11_FUGUE] = X11Ref4_fugue;
+    for (int i = 0; i < X11_STAGE_COUNT; i++)
+    {
+        engine.pszImpl[i] = "sph";
+        engine.pszImpl4[i] = "sph";
+    }
+    return engine;
+}
+
+static const CX11Engine engineReference = MakeReferenceEngine();
+static CX11Engine engineCurrent = engineReference;
+
+unsigned int X11DetectCPU()
+{
+    unsigned int nFeatures = 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    unsigned int eax, ebx, ecx, edx;
+    bool fOSSaveYMM = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        if (ecx & bit_SSE4_1)
+            nFeatures |= X11_CPU_SSE41;
+        if (ecx & bit_AES)
+            nFeatures |= X11_CPU_AES;
+        // AVX2 is only usable if the OS saves the upper halves of the ymm registers
+        if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+        {
+            unsigned int nXCR0Low, nXCR0High;
+            __asm__("xgetbv" : "=a"(nXCR0Low), "=d"(nXCR0High) : "c"(0));
+            fOSSaveYMM = (nXCR0Low & 6) == 6;
+        }
+    }
+    if (__get_cpuid_max(0, NULL) >= 7)
+    {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if ((ebx & bit_AVX2) && fOSSaveYMM)
+            nFeatures |= X11_CPU_AVX2;
+    }
+#endif
+    return nFeatures;
+}
+
+void X11SelectEngine(unsigned int nCPUFeatures)
+{
+    CX11Engine engine = engineReference;
+
+    if (X11HaveAESNIKernels() && (nCPUFeatures & X11_CPU_AES) && (nCPUFeatures & X11_CPU_SSE41))
+    {
+        engine.stage[X11_GROESTL] = X11GroestlAESNI;
+        engine.stage4[X11_GROESTL] = X11GroestlAESNIx4;
+        engine.pszImpl[X11_GROESTL] = "aesni";
+        engine.pszImpl4[X11_GROESTL] = "aesni";
+        engine.stage[X11_SHAVITE] = X11ShaviteAESNI;
+        engine.stage4[X11_SHAVITE] = X11ShaviteAESNIx4;
+        engine.pszImpl[X11_SHAVITE] = "aesni";
+        engine.pszImpl4[X11_SHAVITE] = "aesni";
+        engine.stage[X11_ECHO] = X11EchoAESNI;
+        engine.stage4[X11_ECHO] = X11EchoAESNIx4;
+        engine.pszImpl[X11_ECHO] = "aesni";
+        engine.pszImpl4[X11_ECHO] = "aesni";
+    }
+
+    // BMW, Luffa and SIMD only gain from running four lanes side by side, so
+    // they replace the batch kernels and leave single hashes on sph
+    if (X11HaveX86Kernels() && (nCPUFeatures & X11_CPU_SSE41))
+    {
+        engine.stage4[X11_LUFFA] = X11LuffaSSE41x4;
+        engine.pszImpl4[X11_LUFFA] = "sse4.1";
+        engine.stage4[X11_SIMD] = X11SimdSSE41x4;
+        engine.pszImpl4[X11_SIMD] = "sse4.1";
+    }
+    if (X11HaveX86Kernels() && (nCPUFeatures & X11_CPU_AVX2))
+    {
+        engine.stage4[X11_BMW] = X11BmwAVX2x4;
+        engine.pszImpl4[X11_BMW] = "avx2";
+    }
+
+    engineCurrent = engine;
+}
+
+const CX11Engine& X11GetEngine()
+{
+    return engineCurrent;
+}
+
+const CX11Engine& X11GetReferenceEngine()
+{
+    return engineReference;
+}
+
+static void X11HashWith(const CX11Engine& engine, const void* pdata, size_t nLen, unsigned char* pout)
+{
+    static const unsigned char pblank[1] = { 0 };
+    unsigned char hash[2][64];
+
+    // The first stage takes the message itself, which need not be 64 bytes
+    sph_blake512_context ctx_blake;
+    sph_blake512_init(&ctx_blake);
+    sph_blake512(&ctx_blake, nLen ? pdata : pblank, nLen);
+    sph_blake512_close(&ctx_blake, hash[0]);
+
+    for (int i = X11_BMW; i < X11_FUGUE; i++)
+        engine.stage[i](hash[(i - 1) & 1], hash[i & 1]);
+    engine.stage[X11_FUGUE](hash[(X11_FUGUE - 1) & 1], pout);
+}
+
+void X11Hash(const void* pdata, size_t nLen, unsigned char* pout)
+{
+    X11HashWith(engineCurrent, pdata, nLen, pout);
+}
+
+void X11HashReference(const void* pdata, size_t nLen, unsigned char* pout)
+{
+    X11HashWith(engineReference, pdata, nLen, pout);
+}
+
+void X11HashBatch(const unsigned char* pdata, size_t nLen, size_t nCount, unsigned char* pout)
+{
+    static const unsigned char pblank[1] = { 0 };
+    const CX11Engine& engine = engineCurrent;
+
+    // Work through the batch in groups small enough to stay in L1
+    static const size_t nGroup = 64;
+    unsigned char buf[2][nGroup][64];
+
+    for (size_t nStart = 0; nStart < nCount; nStart += nGroup)
+    {
+        size_t n = nCount - nStart < nGroup ? nCount - nStart : nGroup;
+
+        for (size_t j = 0; j < n; j++)
+        {
+            sph_blake512_context ctx_blake;
+            sph_blake512_init(&ctx_blake);
+            sph_blake512(&ctx_blake, nLen ? pdata + (nStart + j) * nLen : pblank, nLen);
+            sph_blake512_close(&ctx_blake, buf[0][j]);
+        }
+
+        for (int i = X11_BMW; i < X11_STAGE_COUNT; i++)
+        {
+            unsigned char (*pin)[64] = buf[(i - 1) & 1];
+            unsigned char (*pstageout)[64] = buf[i & 1];
+            size_t j = 0;
+            for (; j + 4 <= n; j += 4)
+            {
+                const unsigned char* ppin[4] = { pin[j], pin[j + 1], pin[j + 2], pin[j + 3] };
+                unsigned char* ppout[4] = { pstageout[j], pstageout[j + 1], pstageout[j + 2], pstageout[j + 3] };
+                engine.stage4[i](ppin, ppout);
+            }
+            for (; j < n; j++)
+                engine.stage[i](pin[j], pstageout[j]);
+        }
+
+        memcpy(pout + nStart * 64, buf[(X11_STAGE_COUNT - 1) & 1], n * 64);
+    }
+}
+
+// Select the kernels before main() runs, so Hash9 never sees a half-built engine
+static struct CX11EngineInit
+{
+    CX11EngineInit()
+    {
+        X11SelectEngine(X11DetectCPU());
+    }
+} instance_of_cx11engineinit;
@@ -0,0 +1,97 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_HASHX11_H
+#define MIRACLECOIN_HASHX11_H
+
+#include <stddef.h>
+
+/** The thirteen stages of the X11 chain, in the order Hash9 applies them.
+ * Every stage after the first hashes the 64-byte output of the previous one.
+ */
+enum X11Stage
+{
+    X11_BLAKE,
+    X11_BMW,
+    X11_GROESTL,
+    X11_SKEIN,
+    X11_JH,
+    X11_KECCAK,
+    X11_LUFFA,
+    X11_CUBEHASH,
+    X11_SHAVITE,
+    X11_SIMD,
+    X11_ECHO,
+    X11_HAMSI,
+    X11_FUGUE,
+
+    X11_STAGE_COUNT
+};
+
+/** A single stage kernel: 64 bytes in, 64 bytes out. */
+typedef void (*X11StageFunc)(const unsigned char* pin, unsigned char* pout);
+
+/** The same stage over four independent inputs at once. */
+typedef void (*X11StageFunc4)(const unsigned char* const* ppin, unsigned char* const* ppout);
+
+/** The set of kernels Hash9 runs, one per stage. */
+struct CX11Engine
+{
+    X11StageFunc stage[X11_STAGE_COUNT];
+    X11StageFunc4 stage4[X11_STAGE_COUNT];
+    const char* pszImpl[X11_STAGE_COUNT];
+    const char* pszImpl4[X11_STAGE_COUNT]; // the kernels X11HashBatch runs
+};
+
+/** CPU features relevant to the accelerated kernels. */
+enum
+{
+    X11_CPU_SSE41 = (1U << 0),
+    X11_CPU_AES   = (1U << 1),
+    X11_CPU_AVX2  = (1U << 2), // set only if the OS saves the ymm registers
+};
+
+/** Feature bits of the running CPU (0 on non-x86 builds). */
+unsigned int X11DetectCPU();
+
+/** Pick the fastest kernel for each stage among those the given feature
+ * bits allow.  Called once automatically at startup with X11DetectCPU();
+ * calling it with 0 forces the portable sph_* reference kernels.
+ */
+void X11SelectEngine(unsigned int nCPUFeatures);
+
+/** The engine currently in use. */
+const CX11Engine& X11GetEngine();
+
+/** The engine made only of the portable sph_* reference kernels. */
+const CX11Engine& X11GetReferenceEngine();
+
+/** Full X11 over an arbitrary-length message; pout receives 64 bytes. */
+void X11Hash(const void* pdata, size_t nLen, unsigned char* pout);
+
+/** Same as X11Hash, always using the reference kernels. */
+void X11HashReference(const void* pdata, size_t nLen, unsigned char* pout);
+
+/** X11 of nCount independent messages of nLen bytes each, stored back to
+ * back at pdata; pout receives 64 bytes per message.  The chain runs one
+ * stage at a time across the whole batch, four lanes at a time, which keeps
+ * each stage's tables hot and lets the interleaved kernels overlap lanes.
+ */
+void X11HashBatch(const unsigned char* pdata, size_t nLen, size_t nCount, unsigned char* pout);
+
+// Accelerated kernels, see hashx11_aesni.cpp
+bool X11HaveAESNIKernels();
+void X11GroestlAESNI(const unsigned char* pin, unsigned char* pout);
+void X11ShaviteAESNI(const unsigned char* pin, unsigned char* pout);
+void X11EchoAESNI(const unsigned char* pin, unsigned char* pout);
+void X11GroestlAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout);
+void X11ShaviteAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout);
+void X11EchoAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout);
+
+// Four-lane vector kernels, see hashx11_x86.cpp
+bool X11HaveX86Kernels();
+void X11BmwAVX2x4(const unsigned char* const* ppin, unsigned char* const* ppout);
+void X11LuffaSSE41x4(const unsigned char* const* ppin, unsigned char* const* ppout);
+void X11SimdSSE41x4(const unsigned char* const* ppin, unsigned char* const* ppout);
+
+#endif // MIRACLECOIN_HASHX11_H
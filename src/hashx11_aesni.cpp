@@ -0,0 +1,557 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// AES-NI kernels for the AES-round based X11 stages, specialised for the
+// single 64-byte message every stage after the first one hashes.  They must
+// produce exactly what groestl.c, shavite.c and echo.c produce; hashx11_tests
+// checks that against the sph_* reference kernels.
+//
+// The functions carry their own target attribute so this file builds with
+// the default flags, and only runs when X11SelectEngine saw AES-NI + SSE4.1.
+//
+
+#include "hashx11.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X11_AESNI 1
+#endif
+
+#ifdef USE_X11_AESNI
+
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+
+#define X11_AESNI_TARGET __attribute__((target("aes,sse4.1")))
+
+bool X11HaveAESNIKernels()
+{
+    return true;
+}
+
+// Byte-wise doubling in GF(2^8) modulo the AES polynomial, which Groestl's
+// MixBytes and ECHO's MixColumns both use
+X11_AESNI_TARGET
+static inline __m128i GFMul2(__m128i x)
+{
+    const __m128i poly = _mm_set1_epi8(0x1B);
+    __m128i hi = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(hi, poly));
+}
+
+//
+// Groestl-512
+//
+// The 8x16 byte state is held one row per register.  The 64-byte message
+// fills columns 0-7 and a single padding block fills columns 8-15, so the
+// compression is h' = P(h ^ m) ^ Q(m) ^ h and the digest is the right half
+// of P(h') ^ h'.  SubBytes is aesenclast with a zero key, after a pshufb
+// that undoes its ShiftRows and applies Groestl's row shift instead.
+//
+
+// Transposes the column-major 64-byte message into the left halves of
+// eight rows
+X11_AESNI_TARGET
+static inline void GroestlLoadColumns(const unsigned char* pin, __m128i* x)
+{
+    const __m128i pair = _mm_set_epi8(15, 7, 14, 6, 13, 5, 12, 4, 11, 3, 10, 2, 9, 1, 8, 0);
+    __m128i t0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pin +  0)), pair);
+    __m128i t1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pin + 16)), pair);
+    __m128i t2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pin + 32)), pair);
+    __m128i t3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pin + 48)), pair);
+    __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+    __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+    __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+    __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+    __m128i v0 = _mm_unpacklo_epi32(u0, u2);
+    __m128i v1 = _mm_unpackhi_epi32(u0, u2);
+    __m128i v2 = _mm_unpacklo_epi32(u1, u3);
+    __m128i v3 = _mm_unpackhi_epi32(u1, u3);
+    x[0] = _mm_move_epi64(v0);
+    x[1] = _mm_srli_si128(v0, 8);
+    x[2] = _mm_move_epi64(v1);
+    x[3] = _mm_srli_si128(v1, 8);
+    x[4] = _mm_move_epi64(v2);
+    x[5] = _mm_srli_si128(v2, 8);
+    x[6] = _mm_move_epi64(v3);
+    x[7] = _mm_srli_si128(v3, 8);
+}
+
+// Writes columns 8-15 of the state back out column-major
+X11_AESNI_TARGET
+static inline void GroestlStoreColumns(const __m128i* x, unsigned char* pout)
+{
+    __m128i t0 = _mm_unpackhi_epi8(x[0], x[1]);
+    __m128i t1 = _mm_unpackhi_epi8(x[2], x[3]);
+    __m128i t2 = _mm_unpackhi_epi8(x[4], x[5]);
+    __m128i t3 = _mm_unpackhi_epi8(x[6], x[7]);
+    __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+    __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+    __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+    __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+    _mm_storeu_si128((__m128i*)(pout +  0), _mm_unpacklo_epi32(u0, u2));
+    _mm_storeu_si128((__m128i*)(pout + 16), _mm_unpackhi_epi32(u0, u2));
+    _mm_storeu_si128((__m128i*)(pout + 32), _mm_unpacklo_epi32(u1, u3));
+    _mm_storeu_si128((__m128i*)(pout + 48), _mm_unpackhi_epi32(u1, u3));
+}
+
+// y[i] = 2x[i] ^ 2x[i+1] ^ 3x[i+2] ^ 4x[i+3] ^ 5x[i+4] ^ 3x[i+5] ^ 5x[i+6] ^ 7x[i+7],
+// computed as a ^ 2(b ^ 2c) with a, b and c the rows under each bit of the
+// coefficients
+X11_AESNI_TARGET
+static inline void GroestlMixBytes(__m128i* x)
+{
+    __m128i p0 = _mm_xor_si128(x[0], x[1]);
+    __m128i p1 = _mm_xor_si128(x[1], x[2]);
+    __m128i p2 = _mm_xor_si128(x[2], x[3]);
+    __m128i p3 = _mm_xor_si128(x[3], x[4]);
+    __m128i p4 = _mm_xor_si128(x[4], x[5]);
+    __m128i p5 = _mm_xor_si128(x[5], x[6]);
+    __m128i p6 = _mm_xor_si128(x[6], x[7]);
+    __m128i p7 = _mm_xor_si128(x[7], x[0]);
+    __m128i y0, y1, y2, y3, y4, y5, y6, y7;
+
+#define GROESTL_MIX_ROW(y, x2, x5, x7, pi, pi3, pi4, pi6)                                          \
+    do {                                                                                        \
+        __m128i a = _mm_xor_si128(x2, _mm_xor_si128(pi4, pi6));                                 \
+        __m128i b = _mm_xor_si128(_mm_xor_si128(pi, x2), _mm_xor_si128(x5, x7));                \
+        __m128i c = _mm_xor_si128(pi3, pi6);                                                    \
+        y = _mm_xor_si128(a, GFMul2(_mm_xor_si128(b, GFMul2(c))));                              \
+    } while (0)
+
+    GROESTL_MIX_ROW(y0, x[2], x[5], x[7], p0, p3, p4, p6);
+    GROESTL_MIX_ROW(y1, x[3], x[6], x[0], p1, p4, p5, p7);
+    GROESTL_MIX_ROW(y2, x[4], x[7], x[1], p2, p5, p6, p0);
+    GROESTL_MIX_ROW(y3, x[5], x[0], x[2], p3, p6, p7, p1);
+    GROESTL_MIX_ROW(y4, x[6], x[1], x[3], p4, p7, p0, p2);
+    GROESTL_MIX_ROW(y5, x[7], x[2], x[4], p5, p0, p1, p3);
+    GROESTL_MIX_ROW(y6, x[0], x[3], x[5], p6, p1, p2, p4);
+    GROESTL_MIX_ROW(y7, x[1], x[4], x[6], p7, p2, p3, p5);
+
+#undef GROESTL_MIX_ROW
+
+    x[0] = y0;
+    x[1] = y1;
+    x[2] = y2;
+    x[3] = y3;
+    x[4] = y4;
+    x[5] = y5;
+    x[6] = y6;
+    x[7] = y7;
+}
+
+// Row i of P shifts left by 0, 1, 2, 3, 4, 5, 6, 11; row i of Q by
+// 1, 3, 5, 11, 0, 2, 4, 6.  The pshufb masks pre-apply the inverse of
+// aesenclast's ShiftRows, so the two together move each byte where
+// Groestl wants it.
+#define GROESTL_SHIFT(n) _mm_and_si128(_mm_add_epi8(invshiftrows, _mm_set1_epi8(n)), fifteen)
+
+template<int N, bool fQ>
+X11_AESNI_TARGET
+static inline void GroestlPermute(__m128i (*x)[8])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(-1);
+    const __m128i column = _mm_set_epi8(-16, -32, -48, -64, -80, -96, -112, -128, 112, 96, 80, 64, 48, 32, 16, 0);
+    const __m128i invshiftrows = _mm_set_epi8(3, 6, 9, 12, 15, 2, 5, 8, 11, 14, 1, 4, 7, 10, 13, 0);
+    const __m128i fifteen = _mm_set1_epi8(15);
+    const __m128i shift0 = GROESTL_SHIFT(fQ ? 1 : 0);
+    const __m128i shift1 = GROESTL_SHIFT(fQ ? 3 : 1);
+    const __m128i shift2 = GROESTL_SHIFT(fQ ? 5 : 2);
+    const __m128i shift3 = GROESTL_SHIFT(fQ ? 11 : 3);
+    const __m128i shift4 = GROESTL_SHIFT(fQ ? 0 : 4);
+    const __m128i shift5 = GROESTL_SHIFT(fQ ? 2 : 5);
+    const __m128i shift6 = GROESTL_SHIFT(fQ ? 4 : 6);
+    const __m128i shift7 = GROESTL_SHIFT(fQ ? 6 : 11);
+
+    for (int r = 0; r < 14; r++)
+    {
+        const __m128i round = _mm_xor_si128(column, _mm_set1_epi8(r));
+        for (int l = 0; l < N; l++)
+        {
+            __m128i* s = x[l];
+            if (fQ)
+            {
+                s[0] = _mm_xor_si128(s[0], ones);
+                s[1] = _mm_xor_si128(s[1], ones);
+                s[2] = _mm_xor_si128(s[2], ones);
+                s[3] = _mm_xor_si128(s[3], ones);
+                s[4] = _mm_xor_si128(s[4], ones);
+                s[5] = _mm_xor_si128(s[5], ones);
+                s[6] = _mm_xor_si128(s[6], ones);
+                s[7] = _mm_xor_si128(s[7], _mm_xor_si128(round, ones));
+            }
+            else
+                s[0] = _mm_xor_si128(s[0], round);
+            s[0] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[0], shift0), zero);
+            s[1] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[1], shift1), zero);
+            s[2] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[2], shift2), zero);
+            s[3] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[3], shift3), zero);
+            s[4] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[4], shift4), zero);
+            s[5] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[5], shift5), zero);
+            s[6] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[6], shift6), zero);
+            s[7] = _mm_aesenclast_si128(_mm_shuffle_epi8(s[7], shift7), zero);
+            GroestlMixBytes(s);
+        }
+    }
+}
+
+#undef GROESTL_SHIFT
+
+template<int N>
+X11_AESNI_TARGET
+static inline void GroestlLanes(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    // Padding columns: 0x80 after the message and a block count of one;
+    // the IV only differs from zero in the 512-bit digest size
+    const __m128i pad0 = _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pad7 = _mm_set_epi8(1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i iv6 = _mm_set_epi8(2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i p[N][8], q[N][8];
+
+    for (int l = 0; l < N; l++)
+    {
+        GroestlLoadColumns(ppin[l], q[l]);
+        q[l][0] = _mm_xor_si128(q[l][0], pad0);
+        q[l][7] = _mm_xor_si128(q[l][7], pad7);
+        for (int i = 0; i < 8; i++)
+            p[l][i] = q[l][i];
+        p[l][6] = _mm_xor_si128(p[l][6], iv6);
+    }
+
+    GroestlPermute<N, false>(p);
+    GroestlPermute<N, true>(q);
+
+    for (int l = 0; l < N; l++)
+    {
+        for (int i = 0; i < 8; i++)
+            p[l][i] = q[l][i] = _mm_xor_si128(p[l][i], q[l][i]);
+        p[l][6] = q[l][6] = _mm_xor_si128(p[l][6], iv6);
+    }
+
+    GroestlPermute<N, false>(p);
+
+    for (int l = 0; l < N; l++)
+    {
+        for (int i = 0; i < 8; i++)
+            p[l][i] = _mm_xor_si128(p[l][i], q[l][i]);
+        GroestlStoreColumns(p[l], ppout[l]);
+    }
+}
+
+X11_AESNI_TARGET
+void X11GroestlAESNI(const unsigned char* pin, unsigned char* pout)
+{
+    GroestlLanes<1>(&pin, &pout);
+}
+
+X11_AESNI_TARGET
+void X11GroestlAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    GroestlLanes<4>(ppin, ppout);
+}
+
+//
+// SHAvite-3-512
+//
+// One compression of a 128-byte block: the 64-byte message, 0x80 padding,
+// the 512-bit message length at byte 110 and the 512-bit digest size at 126.
+//
+
+static const unsigned int pnShaviteIV512[16] = {
+    0x72FCCDD8, 0x79CA4727, 0x128A077B, 0x40D55AEC,
+    0xD1901A06, 0x430AE307, 0xB29F5CD1, 0xDF07FBFC,
+    0x8E45D73D, 0x681AB538, 0xBDE86578, 0xDD577E47,
+    0xE275EADE, 0x502D9FCD, 0xB9357178, 0x022A4B9A
+};
+
+template<int N>
+X11_AESNI_TARGET
+static inline void ShaviteLanes(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    // Counter words as c512 sees them: count0 = 512 bits, the rest zero
+    static const unsigned int nCount0 = 512, nCount1 = 0, nCount2 = 0, nCount3 = 0;
+    const __m128i zero = _mm_setzero_si128();
+    unsigned int rk[N][448] __attribute__((aligned(16)));
+
+    for (int l = 0; l < N; l++)
+    {
+        unsigned char* block = (unsigned char*)rk[l];
+        memcpy(block, ppin[l], 64);
+        block[64] = 0x80;
+        memset(block + 65, 0, 110 - 65);
+        memcpy(block + 110, &nCount0, 4);
+        memcpy(block + 114, &nCount1, 4);
+        memcpy(block + 118, &nCount2, 4);
+        memcpy(block + 122, &nCount3, 4);
+        block[126] = 0x00;
+        block[127] = 0x02;
+    }
+
+    // Message expansion; the counter is mixed into four of the round keys
+    size_t u = 32;
+    for (;;)
+    {
+        for (int s = 0; s < 8; s++)
+        {
+            for (int l = 0; l < N; l++)
+            {
+                __m128i x = _mm_load_si128((const __m128i*)&rk[l][u - 32]);
+                x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 3, 2, 1));
+                x = _mm_aesenc_si128(x, zero);
+                x = _mm_xor_si128(x, _mm_load_si128((const __m128i*)&rk[l][u - 4]));
+                _mm_store_si128((__m128i*)&rk[l][u], x);
+            }
+            for (int l = 0; l < N; l++)
+            {
+                unsigned int* r = rk[l];
+                if (u == 32)
+                {
+                    r[32] ^= nCount0;
+                    r[33] ^= nCount1;
+                    r[34] ^= nCount2;
+                    r[35] ^= ~nCount3;
+                }
+                else if (u == 164)
+                {
+                    r[164] ^= nCount3;
+                    r[165] ^= nCount2;
+                    r[166] ^= nCount1;
+                    r[167] ^= ~nCount0;
+                }
+                else if (u == 316)
+                {
+                    r[316] ^= nCount2;
+                    r[317] ^= nCount3;
+                    r[318] ^= nCount0;
+                    r[319] ^= ~nCount1;
+                }
+                else if (u == 440)
+                {
+                    r[440] ^= nCount1;
+                    r[441] ^= nCount0;
+                    r[442] ^= nCount3;
+                    r[443] ^= ~nCount2;
+                }
+            }
+            u += 4;
+        }
+        if (u == 448)
+            break;
+        for (int s = 0; s < 8; s++)
+        {
+            for (int l = 0; l < N; l++)
+            {
+                __m128i x = _mm_load_si128((const __m128i*)&rk[l][u - 32]);
+                x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)&rk[l][u - 7]));
+                _mm_store_si128((__m128i*)&rk[l][u], x);
+            }
+            u += 4;
+        }
+    }
+
+    const __m128i h0 = _mm_loadu_si128((const __m128i*)&pnShaviteIV512[0]);
+    const __m128i h1 = _mm_loadu_si128((const __m128i*)&pnShaviteIV512[4]);
+    const __m128i h2 = _mm_loadu_si128((const __m128i*)&pnShaviteIV512[8]);
+    const __m128i h3 = _mm_loadu_si128((const __m128i*)&pnShaviteIV512[12]);
+    __m128i p0[N], p1[N], p2[N], p3[N];
+    for (int l = 0; l < N; l++)
+    {
+        p0[l] = h0;
+        p1[l] = h1;
+        p2[l] = h2;
+        p3[l] = h3;
+    }
+
+    for (int r = 0; r < 14; r++)
+    {
+        // Four keyed AES rounds per half; aesenc adds the key after the
+        // round, so each sph "xor key, round" pair becomes one aesenc
+        for (int l = 0; l < N; l++)
+        {
+            const __m128i* pk = (const __m128i*)rk[l] + 8 * r;
+            __m128i x = _mm_xor_si128(p1[l], pk[0]);
+            __m128i y = _mm_xor_si128(p3[l], pk[4]);
+            x = _mm_aesenc_si128(x, pk[1]);
+            y = _mm_aesenc_si128(y, pk[5]);
+            x = _mm_aesenc_si128(x, pk[2]);
+            y = _mm_aesenc_si128(y, pk[6]);
+            x = _mm_aesenc_si128(x, pk[3]);
+            y = _mm_aesenc_si128(y, pk[7]);
+            x = _mm_aesenc_si128(x, zero);
+            y = _mm_aesenc_si128(y, zero);
+
+            __m128i t = p3[l];
+            p3[l] = _mm_xor_si128(p2[l], y);
+            p2[l] = p1[l];
+            p1[l] = _mm_xor_si128(p0[l], x);
+            p0[l] = t;
+        }
+    }
+
+    for (int l = 0; l < N; l++)
+    {
+        _mm_storeu_si128((__m128i*)(ppout[l] +  0), _mm_xor_si128(h0, p0[l]));
+        _mm_storeu_si128((__m128i*)(ppout[l] + 16), _mm_xor_si128(h1, p1[l]));
+        _mm_storeu_si128((__m128i*)(ppout[l] + 32), _mm_xor_si128(h2, p2[l]));
+        _mm_storeu_si128((__m128i*)(ppout[l] + 48), _mm_xor_si128(h3, p3[l]));
+    }
+}
+
+X11_AESNI_TARGET
+void X11ShaviteAESNI(const unsigned char* pin, unsigned char* pout)
+{
+    ShaviteLanes<1>(&pin, &pout);
+}
+
+X11_AESNI_TARGET
+void X11ShaviteAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    ShaviteLanes<4>(ppin, ppout);
+}
+
+//
+// ECHO-512
+//
+// Sixteen 128-bit words: eight of chaining value (the digest size in bits)
+// and eight of message block, which holds the 64-byte message, 0x80
+// padding, the digest size at byte 110 and the bit counter at byte 112.
+// Each of the ten rounds is two AES rounds per word keyed by a running
+// 128-bit counter, a word-wise ShiftRows and a byte-wise MixColumns.
+//
+
+X11_AESNI_TARGET
+static inline void EchoMixColumn(__m128i* W, int ia, int ib, int ic, int id)
+{
+    __m128i a = W[ia], b = W[ib], c = W[ic], d = W[id];
+    __m128i ab = _mm_xor_si128(a, b);
+    __m128i bc = _mm_xor_si128(b, c);
+    __m128i cd = _mm_xor_si128(c, d);
+    __m128i abx = GFMul2(ab);
+    __m128i bcx = GFMul2(bc);
+    __m128i cdx = GFMul2(cd);
+    W[ia] = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+    W[ib] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+    W[ic] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+    W[id] = _mm_xor_si128(_mm_xor_si128(abx, bcx), _mm_xor_si128(cdx, _mm_xor_si128(ab, c)));
+}
+
+template<int N>
+X11_AESNI_TARGET
+static inline void EchoLanes(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    const __m128i iv = _mm_set_epi32(0, 0, 0, 512);
+    __m128i W[N][16];
+
+    // Message block words past the 64-byte message are the same for every lane
+    unsigned char tail[64];
+    tail[0] = 0x80;
+    memset(tail + 1, 0, 63);
+    tail[46] = 0x00;
+    tail[47] = 0x02;
+    tail[48] = 0x00;
+    tail[49] = 0x02;
+    __m128i M[8];
+    for (int i = 4; i < 8; i++)
+        M[i] = _mm_loadu_si128((const __m128i*)(tail + 16 * (i - 4)));
+
+    for (int l = 0; l < N; l++)
+    {
+        for (int i = 0; i < 8; i++)
+            W[l][i] = iv;
+        for (int i = 0; i < 4; i++)
+            W[l][i + 8] = _mm_loadu_si128((const __m128i*)(ppin[l] + 16 * i));
+        for (int i = 4; i < 8; i++)
+            W[l][i + 8] = M[i];
+    }
+
+    // The 128-bit counter starts at the message length in bits and only
+    // reaches 512 + 160, so the low word never carries
+    __m128i k = _mm_set_epi32(0, 0, 0, 512);
+    for (int r = 0; r < 10; r++)
+    {
+        for (int n = 0; n < 16; n++)
+        {
+            for (int l = 0; l < N; l++)
+                W[l][n] = _mm_aesenc_si128(_mm_aesenc_si128(W[l][n], k), zero);
+            k = _mm_add_epi32(k, one);
+        }
+
+        for (int l = 0; l < N; l++)
+        {
+            __m128i* w = W[l];
+            __m128i t;
+            // Row 1 rotates left by one, row 2 by two, row 3 by three
+            t = w[1]; w[1] = w[5]; w[5] = w[9]; w[9] = w[13]; w[13] = t;
+            t = w[2]; w[2] = w[10]; w[10] = t;
+            t = w[6]; w[6] = w[14]; w[14] = t;
+            t = w[15]; w[15] = w[11]; w[11] = w[7]; w[7] = w[3]; w[3] = t;
+
+            EchoMixColumn(w, 0, 1, 2, 3);
+            EchoMixColumn(w, 4, 5, 6, 7);
+            EchoMixColumn(w, 8, 9, 10, 11);
+            EchoMixColumn(w, 12, 13, 14, 15);
+        }
+    }
+
+    for (int l = 0; l < N; l++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            __m128i v = _mm_xor_si128(iv, _mm_loadu_si128((const __m128i*)(ppin[l] + 16 * i)));
+            v = _mm_xor_si128(v, _mm_xor_si128(W[l][i], W[l][i + 8]));
+            _mm_storeu_si128((__m128i*)(ppout[l] + 16 * i), v);
+        }
+    }
+}
+
+X11_AESNI_TARGET
+void X11EchoAESNI(const unsigned char* pin, unsigned char* pout)
+{
+    EchoLanes<1>(&pin, &pout);
+}
+
+X11_AESNI_TARGET
+void X11EchoAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    EchoLanes<4>(ppin, ppout);
+}
+
+#else
+
+bool X11HaveAESNIKernels()
+{
+    return false;
+}
+
+void X11GroestlAESNI(const unsigned char* pin, unsigned char* pout)
+{
+}
+
+void X11GroestlAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+}
+
+void X11ShaviteAESNI(const unsigned char* pin, unsigned char* pout)
+{
+}
+
+void X11EchoAESNI(const unsigned char* pin, unsigned char* pout)
+{
+}
+
+void X11ShaviteAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+}
+
+void X11EchoAESNIx4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+}
+
+#endif // USE_X11_AESNI
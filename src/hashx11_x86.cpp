@@ -0,0 +1,746 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// x86 vector kernels for the X11 stages built from plain 32- and 64-bit
+// word arithmetic: BMW-512, Luffa-512 and SIMD-512.  Like the multi-lane
+// SHA-256 kernels they keep one word of each of four messages per vector
+// element, written with GCC vector extensions.  They must produce exactly
+// what bmw.c, luffa.c and simd.c produce; hashx11_tests checks that against
+// the sph_* reference kernels.
+//
+// The functions carry their own target attribute so this file builds with
+// the default flags, and only runs when X11SelectEngine saw the feature.
+//
+
+#include "hashx11.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X11_X86 1
+#endif
+
+#ifdef USE_X11_X86
+
+// The lane helpers pass vectors by value, but are always inlined into
+// functions built for the matching ISA
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+#define X11_SSE41_TARGET __attribute__((target("sse4.1")))
+#define X11_AVX2_TARGET __attribute__((target("avx2")))
+#define X11_LANES_INLINE inline __attribute__((always_inline))
+
+typedef uint32_t X11Vec4 __attribute__((vector_size(16)));
+typedef int32_t X11Vec4s __attribute__((vector_size(16)));
+typedef uint64_t X11Vec4q __attribute__((vector_size(32)));
+
+bool X11HaveX86Kernels()
+{
+    return true;
+}
+
+static X11_LANES_INLINE X11Vec4 Splat32(uint32_t n)
+{
+    X11Vec4 v = { n, n, n, n };
+    return v;
+}
+
+static X11_LANES_INLINE X11Vec4s Splat32s(int32_t n)
+{
+    X11Vec4s v = { n, n, n, n };
+    return v;
+}
+
+static X11_LANES_INLINE X11Vec4q Splat64(uint64_t n)
+{
+    X11Vec4q v = { n, n, n, n };
+    return v;
+}
+
+static inline uint32_t ReadLE32(const unsigned char* p)
+{
+    uint32_t n;
+    memcpy(&n, p, 4);
+    return n;
+}
+
+static inline uint64_t ReadLE64(const unsigned char* p)
+{
+    uint64_t n;
+    memcpy(&n, p, 8);
+    return n;
+}
+
+static inline void WriteLE32(unsigned char* p, uint32_t n)
+{
+    memcpy(p, &n, 4);
+}
+
+static inline void WriteLE64(unsigned char* p, uint64_t n)
+{
+    memcpy(p, &n, 8);
+}
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t n)
+{
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+#define RotlD(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define RotlQ(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+//
+// BMW-512
+//
+// The padded message (0x80 and the 512-bit length) is a single 128-byte
+// block.  Its compression is followed by the final compression of the
+// result under the constant 0xaaaaaaaaaaaaaaa0 + i chaining value, whose
+// upper half is the digest.
+//
+
+static const uint64_t pnBmwIV512[16] = {
+    0x8081828384858687, 0x88898a8b8c8d8e8f, 0x9091929394959697, 0x98999a9b9c9d9e9f,
+    0xa0a1a2a3a4a5a6a7, 0xa8a9aaabacadaeaf, 0xb0b1b2b3b4b5b6b7, 0xb8b9babbbcbdbebf,
+    0xc0c1c2c3c4c5c6c7, 0xc8c9cacbcccdcecf, 0xd0d1d2d3d4d5d6d7, 0xd8d9dadbdcdddedf,
+    0xe0e1e2e3e4e5e6e7, 0xe8e9eaebecedeeef, 0xf0f1f2f3f4f5f6f7, 0xf8f9fafbfcfdfeff
+};
+
+#define BmwS0(x) (((x) >> 1) ^ ((x) << 3) ^ RotlQ(x, 4) ^ RotlQ(x, 37))
+#define BmwS1(x) (((x) >> 1) ^ ((x) << 2) ^ RotlQ(x, 13) ^ RotlQ(x, 43))
+#define BmwS2(x) (((x) >> 2) ^ ((x) << 1) ^ RotlQ(x, 19) ^ RotlQ(x, 53))
+#define BmwS3(x) (((x) >> 2) ^ ((x) << 2) ^ RotlQ(x, 28) ^ RotlQ(x, 59))
+#define BmwS4(x) (((x) >> 1) ^ (x))
+#define BmwS5(x) (((x) >> 2) ^ (x))
+
+static X11_LANES_INLINE void BmwCompress(const X11Vec4q* m, const X11Vec4q* h, X11Vec4q* dh)
+{
+    X11Vec4q mh[16], w[16], q[32], mr[16];
+
+    for (int i = 0; i < 16; i++)
+        mh[i] = m[i] ^ h[i];
+    w[0] = mh[5] - mh[7] + mh[10] + mh[13] + mh[14];
+    w[1] = mh[6] - mh[8] + mh[11] + mh[14] - mh[15];
+    w[2] = mh[0] + mh[7] + mh[9] - mh[12] + mh[15];
+    w[3] = mh[0] - mh[1] + mh[8] - mh[10] + mh[13];
+    w[4] = mh[1] + mh[2] + mh[9] - mh[11] - mh[14];
+    w[5] = mh[3] - mh[2] + mh[10] - mh[12] + mh[15];
+    w[6] = mh[4] - mh[0] - mh[3] - mh[11] + mh[13];
+    w[7] = mh[1] - mh[4] - mh[5] - mh[12] - mh[14];
+    w[8] = mh[2] - mh[5] - mh[6] + mh[13] - mh[15];
+    w[9] = mh[0] - mh[3] + mh[6] - mh[7] + mh[14];
+    w[10] = mh[8] - mh[1] - mh[4] - mh[7] + mh[15];
+    w[11] = mh[8] - mh[0] - mh[2] - mh[5] + mh[9];
+    w[12] = mh[1] + mh[3] - mh[6] - mh[9] + mh[10];
+    w[13] = mh[2] + mh[4] + mh[7] + mh[10] + mh[11];
+    w[14] = mh[3] - mh[5] + mh[8] - mh[11] - mh[12];
+    w[15] = mh[12] - mh[4] - mh[6] - mh[9] + mh[13];
+
+    for (int i = 0; i < 15; i += 5)
+    {
+        q[i + 0] = BmwS0(w[i + 0]) + h[i + 1];
+        q[i + 1] = BmwS1(w[i + 1]) + h[i + 2];
+        q[i + 2] = BmwS2(w[i + 2]) + h[i + 3];
+        q[i + 3] = BmwS3(w[i + 3]) + h[i + 4];
+        q[i + 4] = BmwS4(w[i + 4]) + h[i + 5];
+    }
+    q[15] = BmwS0(w[15]) + h[0];
+
+    // Expansion; message word j always enters rotated left by j + 1
+    for (int i = 0; i < 16; i++)
+        mr[i] = RotlQ(m[i], i + 1);
+    for (int i = 16; i < 32; i++)
+    {
+        int j = i - 16;
+        X11Vec4q e = (mr[j] + mr[(j + 3) & 15] - mr[(j + 10) & 15] + Splat64(i * 0x0555555555555555ULL)) ^ h[(j + 7) & 15];
+        if (i < 18)
+            q[i] = BmwS1(q[i - 16]) + BmwS2(q[i - 15]) + BmwS3(q[i - 14]) + BmwS0(q[i - 13]) +
+                   BmwS1(q[i - 12]) + BmwS2(q[i - 11]) + BmwS3(q[i - 10]) + BmwS0(q[i - 9]) +
+                   BmwS1(q[i - 8]) + BmwS2(q[i - 7]) + BmwS3(q[i - 6]) + BmwS0(q[i - 5]) +
+                   BmwS1(q[i - 4]) + BmwS2(q[i - 3]) + BmwS3(q[i - 2]) + BmwS0(q[i - 1]) + e;
+        else
+            q[i] = q[i - 16] + RotlQ(q[i - 15], 5) + q[i - 14] + RotlQ(q[i - 13], 11) +
+                   q[i - 12] + RotlQ(q[i - 11], 27) + q[i - 10] + RotlQ(q[i - 9], 32) +
+                   q[i - 8] + RotlQ(q[i - 7], 37) + q[i - 6] + RotlQ(q[i - 5], 43) +
+                   q[i - 4] + RotlQ(q[i - 3], 53) + BmwS4(q[i - 2]) + BmwS5(q[i - 1]) + e;
+    }
+
+    X11Vec4q xl = q[16] ^ q[17] ^ q[18] ^ q[19] ^ q[20] ^ q[21] ^ q[22] ^ q[23];
+    X11Vec4q xh = xl ^ q[24] ^ q[25] ^ q[26] ^ q[27] ^ q[28] ^ q[29] ^ q[30] ^ q[31];
+    dh[0] = ((xh << 5) ^ (q[16] >> 5) ^ m[0]) + (xl ^ q[24] ^ q[0]);
+    dh[1] = ((xh >> 7) ^ (q[17] << 8) ^ m[1]) + (xl ^ q[25] ^ q[1]);
+    dh[2] = ((xh >> 5) ^ (q[18] << 5) ^ m[2]) + (xl ^ q[26] ^ q[2]);
+    dh[3] = ((xh >> 1) ^ (q[19] << 5) ^ m[3]) + (xl ^ q[27] ^ q[3]);
+    dh[4] = ((xh >> 3) ^ q[20] ^ m[4]) + (xl ^ q[28] ^ q[4]);
+    dh[5] = ((xh << 6) ^ (q[21] >> 6) ^ m[5]) + (xl ^ q[29] ^ q[5]);
+    dh[6] = ((xh >> 4) ^ (q[22] << 6) ^ m[6]) + (xl ^ q[30] ^ q[6]);
+    dh[7] = ((xh >> 11) ^ (q[23] << 2) ^ m[7]) + (xl ^ q[31] ^ q[7]);
+    dh[8] = RotlQ(dh[4], 9) + (xh ^ q[24] ^ m[8]) + ((xl << 8) ^ q[23] ^ q[8]);
+    dh[9] = RotlQ(dh[5], 10) + (xh ^ q[25] ^ m[9]) + ((xl >> 6) ^ q[16] ^ q[9]);
+    dh[10] = RotlQ(dh[6], 11) + (xh ^ q[26] ^ m[10]) + ((xl << 6) ^ q[17] ^ q[10]);
+    dh[11] = RotlQ(dh[7], 12) + (xh ^ q[27] ^ m[11]) + ((xl << 4) ^ q[18] ^ q[11]);
+    dh[12] = RotlQ(dh[0], 13) + (xh ^ q[28] ^ m[12]) + ((xl >> 3) ^ q[19] ^ q[12]);
+    dh[13] = RotlQ(dh[1], 14) + (xh ^ q[29] ^ m[13]) + ((xl >> 4) ^ q[20] ^ q[13]);
+    dh[14] = RotlQ(dh[2], 15) + (xh ^ q[30] ^ m[14]) + ((xl >> 7) ^ q[21] ^ q[14]);
+    dh[15] = RotlQ(dh[3], 16) + (xh ^ q[31] ^ m[15]) + ((xl >> 2) ^ q[22] ^ q[15]);
+}
+
+#undef BmwS0
+#undef BmwS1
+#undef BmwS2
+#undef BmwS3
+#undef BmwS4
+#undef BmwS5
+
+X11_AVX2_TARGET
+void X11BmwAVX2x4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    X11Vec4q m[16], h[16], dh[16];
+
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < 4; l++)
+            m[i][l] = ReadLE64(ppin[l] + 8 * i);
+    m[8] = Splat64(0x80);
+    for (int i = 9; i < 15; i++)
+        m[i] = Splat64(0);
+    m[15] = Splat64(512);
+    for (int i = 0; i < 16; i++)
+        h[i] = Splat64(pnBmwIV512[i]);
+    BmwCompress(m, h, dh);
+
+    for (int i = 0; i < 16; i++)
+        h[i] = Splat64(0xaaaaaaaaaaaaaaa0ULL + i);
+    BmwCompress(dh, h, m);
+
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < 4; l++)
+            WriteLE64(ppout[l] + 8 * i, m[i + 8][l]);
+}
+
+//
+// Luffa-512
+//
+// Five 256-bit sub-states, mixed together by the message injection and
+// then each stepped by its own permutation.  The message is two 32-byte
+// blocks; after them come the 0x80 padding block and two blank rounds,
+// each of which yields half of the digest.
+//
+
+static const uint32_t pnLuffaIV[5][8] = {
+    { 0x6d251e69, 0x44b051e0, 0x4eaa6fb4, 0xdbf78465, 0x6e292011, 0x90152df4, 0xee058139, 0xdef610bb },
+    { 0xc3b44b95, 0xd9d2f256, 0x70eee9a0, 0xde099fa3, 0x5d9b0557, 0x8fc944b3, 0xcf1ccf0e, 0x746cd581 },
+    { 0xf7efc89d, 0x5dba5781, 0x04016ce5, 0xad659c05, 0x0306194f, 0x666d1836, 0x24aa230a, 0x8b264ae7 },
+    { 0x858075d5, 0x36d79cce, 0xe571f7d7, 0x204b1f67, 0x35870c6a, 0x57e9e923, 0x14bcb808, 0x7cde72ce },
+    { 0x6c68e9be, 0x5ec41e22, 0xc825b7c7, 0xaffb4363, 0xf5df3999, 0x0fc688f1, 0xb07224cc, 0x03e86cea }
+};
+
+// Step constants, added to words 0 and 4 of each sub-state
+static const uint32_t pnLuffaRC[5][2][8] = {
+    {
+        { 0x303994a6, 0xc0e65299, 0x6cc33a12, 0xdc56983e, 0x1e00108f, 0x7800423d, 0x8f5b7882, 0x96e1db12 },
+        { 0xe0337818, 0x441ba90d, 0x7f34d442, 0x9389217f, 0xe5a8bce6, 0x5274baf4, 0x26889ba7, 0x9a226e9d }
+    },
+    {
+        { 0xb6de10ed, 0x70f47aae, 0x0707a3d4, 0x1c1e8f51, 0x707a3d45, 0xaeb28562, 0xbaca1589, 0x40a46f3e },
+        { 0x01685f3d, 0x05a17cf4, 0xbd09caca, 0xf4272b28, 0x144ae5cc, 0xfaa7ae2b, 0x2e48f1c1, 0xb923c704 }
+    },
+    {
+        { 0xfc20d9d2, 0x34552e25, 0x7ad8818f, 0x8438764a, 0xbb6de032, 0xedb780c8, 0xd9847356, 0xa2c78434 },
+        { 0xe25e72c1, 0xe623bb72, 0x5c58a4a4, 0x1e38e2e7, 0x78e38b9d, 0x27586719, 0x36eda57f, 0x703aace7 }
+    },
+    {
+        { 0xb213afa5, 0xc84ebe95, 0x4e608a22, 0x56d858fe, 0x343b138f, 0xd0ec4e3d, 0x2ceb4882, 0xb3ad2208 },
+        { 0xe028c9bf, 0x44756f91, 0x7e8fce32, 0x956548be, 0xfe191be2, 0x3cb226e5, 0x5944a28e, 0xa1c4c355 }
+    },
+    {
+        { 0xf0d2e9e3, 0xac11d7fa, 0x1bcb66f2, 0x6f2d9bc9, 0x78602649, 0x8edae952, 0x3b6ba548, 0xedae9520 },
+        { 0x5090d577, 0x2d1925ab, 0xb46496ac, 0xd1925ab0, 0x29131ab6, 0x0fc053c3, 0x3f014f0c, 0xfc053c31 }
+    }
+};
+
+// Multiplication by x in the ring the message injection works in; d may
+// be s
+static X11_LANES_INLINE void LuffaMul2(X11Vec4* d, const X11Vec4* s)
+{
+    X11Vec4 t = s[7];
+    d[7] = s[6];
+    d[6] = s[5];
+    d[5] = s[4];
+    d[4] = s[3] ^ t;
+    d[3] = s[2] ^ t;
+    d[2] = s[1];
+    d[1] = s[0] ^ t;
+    d[0] = t;
+}
+
+static X11_LANES_INLINE void LuffaXor(X11Vec4* d, const X11Vec4* s)
+{
+    for (int k = 0; k < 8; k++)
+        d[k] ^= s[k];
+}
+
+static X11_LANES_INLINE void LuffaSubCrumb(X11Vec4& a0, X11Vec4& a1, X11Vec4& a2, X11Vec4& a3)
+{
+    X11Vec4 t = a0;
+    a0 |= a1;
+    a2 ^= a3;
+    a1 = ~a1;
+    a0 ^= a3;
+    a3 &= t;
+    a1 ^= a3;
+    a3 ^= a2;
+    a2 &= a0;
+    a0 = ~a0;
+    a2 ^= a1;
+    a1 |= a3;
+    t ^= a1;
+    a3 ^= a2;
+    a2 &= a1;
+    a1 ^= a0;
+    a0 = t;
+}
+
+static X11_LANES_INLINE void LuffaMixWord(X11Vec4& u, X11Vec4& v)
+{
+    v ^= u;
+    u = RotlD(u, 2) ^ v;
+    v = RotlD(v, 14) ^ u;
+    u = RotlD(u, 10) ^ v;
+    v = RotlD(v, 1);
+}
+
+// One round: message injection of m (NULL for a blank block), the tweak
+// and the five permutations
+static X11_LANES_INLINE void LuffaRound(X11Vec4 (*v)[8], const X11Vec4* m)
+{
+    X11Vec4 a[8], b[8];
+
+    for (int k = 0; k < 8; k++)
+        a[k] = v[0][k] ^ v[1][k] ^ v[2][k] ^ v[3][k] ^ v[4][k];
+    LuffaMul2(a, a);
+    for (int j = 0; j < 5; j++)
+        LuffaXor(v[j], a);
+    LuffaMul2(b, v[0]);
+    LuffaXor(b, v[1]);
+    LuffaMul2(v[1], v[1]);
+    LuffaXor(v[1], v[2]);
+    LuffaMul2(v[2], v[2]);
+    LuffaXor(v[2], v[3]);
+    LuffaMul2(v[3], v[3]);
+    LuffaXor(v[3], v[4]);
+    LuffaMul2(v[4], v[4]);
+    LuffaXor(v[4], v[0]);
+    LuffaMul2(v[0], b);
+    LuffaXor(v[0], v[4]);
+    LuffaMul2(v[4], v[4]);
+    LuffaXor(v[4], v[3]);
+    LuffaMul2(v[3], v[3]);
+    LuffaXor(v[3], v[2]);
+    LuffaMul2(v[2], v[2]);
+    LuffaXor(v[2], v[1]);
+    LuffaMul2(v[1], v[1]);
+    LuffaXor(v[1], b);
+    if (m)
+    {
+        X11Vec4 mt[8];
+        for (int k = 0; k < 8; k++)
+            mt[k] = m[k];
+        for (int j = 0; j < 5; j++)
+        {
+            if (j > 0)
+                LuffaMul2(mt, mt);
+            LuffaXor(v[j], mt);
+        }
+    }
+
+    for (int j = 1; j < 5; j++)
+        for (int k = 4; k < 8; k++)
+            v[j][k] = RotlD(v[j][k], j);
+
+    for (int j = 0; j < 5; j++)
+    {
+        X11Vec4* s = v[j];
+        for (int r = 0; r < 8; r++)
+        {
+            LuffaSubCrumb(s[0], s[1], s[2], s[3]);
+            LuffaSubCrumb(s[5], s[6], s[7], s[4]);
+            LuffaMixWord(s[0], s[4]);
+            LuffaMixWord(s[1], s[5]);
+            LuffaMixWord(s[2], s[6]);
+            LuffaMixWord(s[3], s[7]);
+            s[0] ^= Splat32(pnLuffaRC[j][0][r]);
+            s[4] ^= Splat32(pnLuffaRC[j][1][r]);
+        }
+    }
+}
+
+X11_SSE41_TARGET
+void X11LuffaSSE41x4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    X11Vec4 v[5][8], m[8];
+
+    for (int j = 0; j < 5; j++)
+        for (int k = 0; k < 8; k++)
+            v[j][k] = Splat32(pnLuffaIV[j][k]);
+
+    for (int nBlock = 0; nBlock < 2; nBlock++)
+    {
+        for (int k = 0; k < 8; k++)
+            for (int l = 0; l < 4; l++)
+                m[k][l] = ReadBE32(ppin[l] + 32 * nBlock + 4 * k);
+        LuffaRound(v, m);
+    }
+
+    m[0] = Splat32(0x80000000);
+    for (int k = 1; k < 8; k++)
+        m[k] = Splat32(0);
+    LuffaRound(v, m);
+
+    for (int nHalf = 0; nHalf < 2; nHalf++)
+    {
+        LuffaRound(v, NULL);
+        for (int k = 0; k < 8; k++)
+        {
+            X11Vec4 x = v[0][k] ^ v[1][k] ^ v[2][k] ^ v[3][k] ^ v[4][k];
+            for (int l = 0; l < 4; l++)
+                WriteBE32(ppout[l] + 32 * nHalf + 4 * k, x[l]);
+        }
+    }
+}
+
+//
+// SIMD-512
+//
+// The message is expanded by a 256-point number-theoretic transform over
+// Z/257, then fed through four rounds of eight Feistel-like steps and a
+// final four steps keyed by the previous chaining value.  The 64-byte
+// message plus zero padding is one 128-byte block; a second block holds
+// only the 512-bit length and is compressed with a different transform
+// offset.
+//
+
+static const uint32_t pnSimdIV512[32] = {
+    0x0ba16b95, 0x72f999ad, 0x9fecc2ae, 0xba3264fc, 0x5e894929, 0x8e9f30e5, 0x2f1daa37, 0xf0f2c558,
+    0xac506643, 0xa90635a5, 0xe25b878b, 0xaab7878f, 0x88817f7a, 0x0a02892b, 0x559a7550, 0x598f657e,
+    0x7eef60a1, 0x6b70e3e8, 0x9c1714d1, 0xb958e2a8, 0xab02675e, 0xed1c014f, 0xcd8d65bb, 0xfdb7a257,
+    0x09254899, 0xd699c7bc, 0x9019b6dc, 0x2b9022e4, 0x8fa14956, 0x21bf9bd3, 0xb94d0943, 0x6ffddc22
+};
+
+// Powers of 41, a 256th root of unity mod 257; the transform only needs
+// the first 128
+static const int32_t pnSimdAlpha[128] = {
+      1,  41, 139,  45,  46,  87, 226,  14,  60, 147, 116, 130, 190,  80, 196,  69,
+      2,  82,  21,  90,  92, 174, 195,  28, 120,  37, 232,   3, 123, 160, 135, 138,
+      4, 164,  42, 180, 184,  91, 133,  56, 240,  74, 207,   6, 246,  63,  13,  19,
+      8,  71,  84, 103, 111, 182,   9, 112, 223, 148, 157,  12, 235, 126,  26,  38,
+     16, 142, 168, 206, 222, 107,  18, 224, 189,  39,  57,  24, 213, 252,  52,  76,
+     32,  27,  79, 155, 187, 214,  36, 191, 121,  78, 114,  48, 169, 247, 104, 152,
+     64,  54, 158,  53, 117, 171,  72, 125, 242, 156, 228,  96,  81, 237, 208,  47,
+    128, 108,  59, 106, 234,  85, 144, 250, 227,  55, 199, 192, 162, 217, 159,  94
+};
+
+// Added to the transform output: beta^(255 * i) for the message blocks and
+// beta^(255 * i) + beta^(253 * i) for the final block, mod 257
+static const int32_t pnSimdYoffN[256] = {
+      1, 163,  98,  40,  95,  65,  58, 202,  30,   7, 113, 172,  23, 151, 198, 149,
+    129, 210,  49,  20, 176, 161,  29, 101,  15, 132, 185,  86, 140, 204,  99, 203,
+    193, 105, 153,  10,  88, 209, 143, 179, 136,  66, 221,  43,  70, 102, 178, 230,
+    225, 181, 205,   5,  44, 233, 200, 218,  68,  33, 239, 150,  35,  51,  89, 115,
+    241, 219, 231, 131,  22, 245, 100, 109,  34, 145, 248,  75, 146, 154, 173, 186,
+    249, 238, 244, 194,  11, 251,  50, 183,  17, 201, 124, 166,  73,  77, 215,  93,
+    253, 119, 122,  97, 134, 254,  25, 220, 137, 229,  62,  83, 165, 167, 236, 175,
+    255, 188,  61, 177,  67, 127, 141, 110, 197, 243,  31, 170, 211, 212, 118, 216,
+    256,  94, 159, 217, 162, 192, 199,  55, 227, 250, 144,  85, 234, 106,  59, 108,
+    128,  47, 208, 237,  81,  96, 228, 156, 242, 125,  72, 171, 117,  53, 158,  54,
+     64, 152, 104, 247, 169,  48, 114,  78, 121, 191,  36, 214, 187, 155,  79,  27,
+     32,  76,  52, 252, 213,  24,  57,  39, 189, 224,  18, 107, 222, 206, 168, 142,
+     16,  38,  26, 126, 235,  12, 157, 148, 223, 112,   9, 182, 111, 103,  84,  71,
+      8,  19,  13,  63, 246,   6, 207,  74, 240,  56, 133,  91, 184, 180,  42, 164,
+      4, 138, 135, 160, 123,   3, 232,  37, 120,  28, 195, 174,  92,  90,  21,  82,
+      2,  69, 196,  80, 190, 130, 116, 147,  60,  14, 226,  87,  46,  45, 139,  41
+};
+
+static const int32_t pnSimdYoffF[256] = {
+      2, 203, 156,  47, 118, 214, 107, 106,  45,  93, 212,  20, 111,  73, 162, 251,
+     97, 215, 249,  53, 211,  19,   3,  89,  49, 207, 101,  67, 151, 130, 223,  23,
+    189, 202, 178, 239, 253, 127, 204,  49,  76, 236,  82, 137, 232, 157,  65,  79,
+     96, 161, 176, 130, 161,  30,  47,   9, 189, 247,  61, 226, 248,  90, 107,  64,
+      0,  88, 131, 243, 133,  59, 113, 115,  17, 236,  33, 213,  12, 191, 111,  19,
+    251,  61, 103, 208,  57,  35, 148, 248,  47, 116,  65, 119, 249, 178, 143,  40,
+    189, 129,   8, 163, 204, 227, 230, 196, 205, 122, 151,  45, 187,  19, 227,  72,
+    247, 125, 111, 121, 140, 220,   6, 107,  77,  69,  10, 101,  21,  65, 149, 171,
+    255,  54, 101, 210, 139,  43, 150, 151, 212, 164,  45, 237, 146, 184,  95,   6,
+    160,  42,   8, 204,  46, 238, 254, 168, 208,  50, 156, 190, 106, 127,  34, 234,
+     68,  55,  79,  18,   4, 130,  53, 208, 181,  21, 175, 120,  25, 100, 192, 178,
+    161,  96,  81, 127,  96, 227, 210, 248,  68,  10, 196,  31,   9, 167, 150, 193,
+      0, 169, 126,  14, 124, 198, 144, 142, 240,  21, 224,  44, 245,  66, 146, 238,
+      6, 196, 154,  49, 200, 222, 109,   9, 210, 141, 192, 138,   8,  79, 114, 217,
+     68, 128, 249,  94,  53,  30,  27,  61,  52, 135, 106, 212,  70, 238,  30, 185,
+     10, 132, 146, 136, 117,  37, 251, 150, 180, 188, 247, 156, 236, 192, 108,  86
+};
+
+// Partial reductions mod 257 that keep the transform inside 32 bits
+#define SimdReds1(x) (((x) & 0xFF) - ((x) >> 8))
+#define SimdReds2(x) (((x) & 0xFFFF) + ((x) >> 16))
+
+// One level of butterflies over q[0..2hk), the upper half scaled by
+// alpha^(u * as)
+static X11_LANES_INLINE void SimdFFTLoop(X11Vec4s* q, int hk, int as)
+{
+    X11Vec4s m = q[0], n = q[hk];
+    q[0] = m + n;
+    q[hk] = m - n;
+    for (int u = 1; u < hk; u++)
+    {
+        m = q[u];
+        n = q[u + hk];
+        X11Vec4s t = n * Splat32s(pnSimdAlpha[u * as]);
+        t = SimdReds2(t);
+        q[u] = m + t;
+        q[u + hk] = m - t;
+    }
+}
+
+static X11_LANES_INLINE void SimdFFT8(const X11Vec4s* x, int xs, X11Vec4s* d)
+{
+    X11Vec4s x0 = x[0], x1 = x[xs], x2 = x[2 * xs], x3 = x[3 * xs];
+    X11Vec4s a0 = x0 + x2;
+    X11Vec4s a1 = x0 + (x2 << 4);
+    X11Vec4s a2 = x0 - x2;
+    X11Vec4s a3 = x0 - (x2 << 4);
+    X11Vec4s b0 = x1 + x3;
+    X11Vec4s b1 = (x1 << 2) + (x3 << 6);
+    X11Vec4s b2 = (x1 << 4) - (x3 << 4);
+    X11Vec4s b3 = (x1 << 6) + (x3 << 2);
+    b1 = SimdReds1(b1);
+    b3 = SimdReds1(b3);
+    d[0] = a0 + b0;
+    d[1] = a1 + b1;
+    d[2] = a2 + b2;
+    d[3] = a3 + b3;
+    d[4] = a0 - b0;
+    d[5] = a1 - b1;
+    d[6] = a2 - b2;
+    d[7] = a3 - b3;
+}
+
+// alpha is 2 at this size, so the twiddles are shifts
+static X11_LANES_INLINE void SimdFFT16(const X11Vec4s* x, int xs, X11Vec4s* q)
+{
+    X11Vec4s d1[8], d2[8];
+    SimdFFT8(x, xs << 1, d1);
+    SimdFFT8(x + xs, xs << 1, d2);
+    for (int k = 0; k < 8; k++)
+    {
+        q[k] = d1[k] + (d2[k] << k);
+        q[k + 8] = d1[k] - (d2[k] << k);
+    }
+}
+
+X11_SSE41_TARGET
+static void SimdFFT64(const X11Vec4s* x, int xs, X11Vec4s* q)
+{
+    SimdFFT16(x, xs << 2, q);
+    SimdFFT16(x + 2 * xs, xs << 2, q + 16);
+    SimdFFTLoop(q, 16, 8);
+    SimdFFT16(x + xs, xs << 2, q + 32);
+    SimdFFT16(x + 3 * xs, xs << 2, q + 48);
+    SimdFFTLoop(q + 32, 16, 8);
+    SimdFFTLoop(q, 32, 4);
+}
+
+#define SimdIf(x, y, z) ((((y) ^ (z)) & (x)) ^ (z))
+#define SimdMaj(x, y, z) (((x) & (y)) | (((x) | (y)) & (z)))
+
+// One step over the 32-word state A0-7, B0-7, C0-7, D0-7
+static X11_LANES_INLINE void SimdStep(X11Vec4* s, const X11Vec4* w, bool fMaj, int r, int sh, int pp)
+{
+    X11Vec4* A = s;
+    X11Vec4* B = s + 8;
+    X11Vec4* C = s + 16;
+    X11Vec4* D = s + 24;
+    X11Vec4 tA[8];
+    for (int n = 0; n < 8; n++)
+        tA[n] = RotlD(A[n], r);
+    for (int n = 0; n < 8; n++)
+    {
+        X11Vec4 f = fMaj ? SimdMaj(A[n], B[n], C[n]) : SimdIf(A[n], B[n], C[n]);
+        X11Vec4 tt = D[n] + w[n] + f;
+        A[n] = RotlD(tt, sh) + tA[pp ^ n];
+        D[n] = C[n];
+        C[n] = B[n];
+        B[n] = tA[n];
+    }
+}
+
+#undef SimdIf
+#undef SimdMaj
+
+// Transforms a 128-byte block, given as one byte per element, into the 256
+// words the four rounds consume
+X11_SSE41_TARGET
+static void SimdExpand(const X11Vec4s* x, bool fFinal, X11Vec4* w)
+{
+    static const int pnWordBlock[32] = {
+         4,  6,  0,  2,  7,  5,  3,  1, 15, 11, 12,  8,  9, 13, 10, 14,
+        17, 18, 23, 20, 22, 21, 16, 19, 30, 24, 25, 31, 27, 29, 28, 26
+    };
+    X11Vec4s q[256];
+
+    SimdFFT64(x, 4, q);
+    SimdFFT64(x + 2, 4, q + 64);
+    SimdFFTLoop(q, 64, 2);
+    SimdFFT64(x + 1, 4, q + 128);
+    SimdFFT64(x + 3, 4, q + 192);
+    SimdFFTLoop(q + 128, 64, 2);
+    SimdFFTLoop(q, 128, 1);
+
+    // Bring every coefficient to -128..128
+    const int32_t* pnYoff = fFinal ? pnSimdYoffF : pnSimdYoffN;
+    for (int i = 0; i < 256; i++)
+    {
+        X11Vec4s t = q[i] + Splat32s(pnYoff[i]);
+        t = SimdReds2(t);
+        t = SimdReds1(t);
+        t = SimdReds1(t);
+        q[i] = t - ((t > Splat32s(128)) & Splat32s(257));
+    }
+
+    // Pairs of coefficients become 32-bit words, multiplied by 185 for the
+    // first two rounds and 233 for the last two
+    static const int pnLow[4] = { 0, 0, -256, -383 };
+    static const int pnHigh[4] = { 1, 1, -128, -255 };
+    for (int nRound = 0; nRound < 4; nRound++)
+    {
+        const X11Vec4s mul = Splat32s(nRound < 2 ? 185 : 233);
+        for (int u = 0; u < 8; u++)
+        {
+            int v = pnWordBlock[8 * nRound + u] << 4;
+            for (int k = 0; k < 8; k++)
+            {
+                X11Vec4 lo = (X11Vec4)(q[v + 2 * k + pnLow[nRound]] * mul);
+                X11Vec4 hi = (X11Vec4)(q[v + 2 * k + pnHigh[nRound]] * mul);
+                w[64 * nRound + 8 * u + k] = (lo & Splat32(0xFFFF)) + (hi << 16);
+            }
+        }
+    }
+}
+
+// xw is the block as 32 little-endian words, w its expansion
+X11_SSE41_TARGET
+static void SimdCompress(X11Vec4* chain, const X11Vec4* xw, const X11Vec4* w)
+{
+    static const int pnRoundShift[4][4] = {
+        { 3, 23, 17, 27 }, { 28, 19, 22, 7 }, { 29, 9, 15, 5 }, { 4, 13, 10, 25 }
+    };
+    static const int pnRoundPerm[11] = { 1, 6, 2, 3, 5, 7, 4, 1, 6, 2, 3 };
+    X11Vec4 state[32];
+
+    for (int i = 0; i < 32; i++)
+        state[i] = chain[i] ^ xw[i];
+
+    for (int nRound = 0; nRound < 4; nRound++)
+    {
+        const int* p = pnRoundShift[nRound];
+        for (int nStep = 0; nStep < 8; nStep++)
+            SimdStep(state, w + 64 * nRound + 8 * nStep, nStep >= 4, p[nStep & 3], p[(nStep + 1) & 3], pnRoundPerm[nRound + nStep]);
+    }
+
+    SimdStep(state, chain + 0, false, 4, 13, 5);
+    SimdStep(state, chain + 8, false, 13, 10, 7);
+    SimdStep(state, chain + 16, false, 10, 25, 4);
+    SimdStep(state, chain + 24, false, 25, 4, 1);
+
+    for (int i = 0; i < 32; i++)
+        chain[i] = state[i];
+}
+
+// The final block only holds the message length, 512 bits, so it and its
+// expansion are the same for every message
+struct CSimdFinalBlock
+{
+    X11Vec4 xw[32];
+    X11Vec4 w[256];
+};
+
+X11_SSE41_TARGET
+static CSimdFinalBlock SimdMakeFinalBlock()
+{
+    CSimdFinalBlock block;
+    X11Vec4s x[128];
+    for (int i = 0; i < 128; i++)
+        x[i] = Splat32s(0);
+    x[1] = Splat32s(2);
+    block.xw[0] = Splat32(512);
+    for (int i = 1; i < 32; i++)
+        block.xw[i] = Splat32(0);
+    SimdExpand(x, true, block.w);
+    return block;
+}
+
+X11_SSE41_TARGET
+void X11SimdSSE41x4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+    static const CSimdFinalBlock blockFinal = SimdMakeFinalBlock();
+    X11Vec4 chain[32], xw[32], w[256];
+    X11Vec4s x[128];
+
+    for (int i = 0; i < 32; i++)
+        chain[i] = Splat32(pnSimdIV512[i]);
+
+    // Message block: the 64 bytes and zero padding
+    for (int i = 0; i < 64; i++)
+        for (int l = 0; l < 4; l++)
+            x[i][l] = ppin[l][i];
+    for (int i = 64; i < 128; i++)
+        x[i] = Splat32s(0);
+    for (int i = 0; i < 16; i++)
+        for (int l = 0; l < 4; l++)
+            xw[i][l] = ReadLE32(ppin[l] + 4 * i);
+    for (int i = 16; i < 32; i++)
+        xw[i] = Splat32(0);
+    SimdExpand(x, false, w);
+    SimdCompress(chain, xw, w);
+
+    SimdCompress(chain, blockFinal.xw, blockFinal.w);
+
+    for (int i = 0; i < 16; i++)
+        for (int l = 0; l < 4; l++)
+            WriteLE32(ppout[l] + 4 * i, chain[i][l]);
+}
+
+#undef SimdReds1
+#undef SimdReds2
+#undef RotlD
+#undef RotlQ
+
+#else
+
+bool X11HaveX86Kernels()
+{
+    return false;
+}
+
+void X11BmwAVX2x4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+}
+
+void X11LuffaSSE41x4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+}
+
+void X11SimdSSE41x4(const unsigned char* const* ppin, unsigned char* const* ppout)
+{
+}
+
+#endif // USE_X11_X86
@@ -75,7 +75,10 @@ void Shutdown(void* parg)
         nTransactionsUpdated++;
         bitdb.Flush(false);
         StopNode();
+        CTxDB::CloseStore();
         bitdb.Flush(true);
+        if (GetBoolArg("-blockindexsnapshot", true))
+            CTxDB::WriteBlockIndexSnapshot();
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
         delete pwalletMain;
@@ -223,9 +226,15 @@ std::string HelpMessage()
         "  -pid=<file>            " + _("Specify pid file (default: MiracleCoind.pid)") + "\n" +
         "  -gen                   " + _("Generate coins") + "\n" +
         "  -gen=0                 " + _("Don't generate coins") + "\n" +
+        "  -genproclimit=<n>      " + _("Number of proof-of-work miner threads, -1 for one per core (default: -1)") + "\n" +
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -dbflushinterval=<n>   " + _("During initial download, write the database cache out every <n> seconds (default: 300)") + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
+        "  -txdb=<engine>         " + _("Store the transaction index with engine bdb (blkindex.dat) or lsm (txdb directory) (default: bdb)") + "\n" +
+        "  -txindexspenders       " + _("Record which transaction spends each output in the transaction index (default: 0)") + "\n" +
+        "  -addrindex             " + _("Maintain an index of the transactions of every address, for the getaddress* RPCs (default: 0)") + "\n" +
+        "  -blockindexsnapshot    " + _("Save the block index at shutdown and load it from there at the next start (default: 1)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -285,7 +294,10 @@ std::string HelpMessage()
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
-        "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
+        "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
+        "  -x11accel              " + _("Use CPU-specific X11 hashing kernels when available (default: 1)") + "\n" +
+        "  -sha256accel           " + _("Use CPU-specific SHA256 hashing kernels when available (default: 1)") + "\n" +
+        "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file (- = read standard input)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -400,6 +412,15 @@ bool AppInit2()
 
     fStaking = GetBoolArg("-staking", true);
 
+    // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
+    nScriptCheckThreads = GetArg("-par", 0);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
     bitdb.SetDetach(GetBoolArg("-detachdb", false));
 
 #if !defined(WIN32) && !defined(QT_GUI)
@@ -482,6 +503,19 @@ bool AppInit2()
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("MiracleCoin version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    X11SelectEngine(GetBoolArg("-x11accel", true) ? X11DetectCPU() : 0);
+    {
+        const CX11Engine& engine = X11GetEngine();
+        std::string strImpl, strImpl4;
+        for (int i = 0; i < X11_STAGE_COUNT; i++)
+        {
+            strImpl += strprintf("%s%s", i ? " " : "", engine.pszImpl[i]);
+            strImpl4 += strprintf("%s%s", i ? " " : "", engine.pszImpl4[i]);
+        }
+        printf("Using X11 kernels: %s, batches: %s\n", strImpl.c_str(), strImpl4.c_str());
+    }
+    SHA256SelectEngine(GetBoolArg("-sha256accel", true) ? SHA256DetectCPU() : 0);
+    printf("Using SHA256 kernels: %s, batches: %s\n", SHA256GetEngine().pszImpl, SHA256GetEngine().pszImplD64);
     if (!fLogTimestamps)
         printf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
@@ -491,6 +525,12 @@ bool AppInit2()
     if (fDaemon)
         fprintf(stdout, "MiracleCoin server starting\n");
 
+    if (nScriptCheckThreads) {
+        printf("Using %u threads for script verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            NewThread(ThreadScriptCheck, NULL);
+    }
+
     int64 nStart;
 
     // ********************************************************* Step 5: verify database integrity
@@ -662,6 +702,27 @@ bool AppInit2()
         return InitError(msg);
     }
 
+    string strTxDBEngine = GetArg("-txdb", "bdb");
+    if (strTxDBEngine == "lsm" && !filesystem::exists(GetDataDir() / "txdb") && filesystem::exists(GetDataDir() / "blkindex.dat"))
+        return InitError(_("The transaction index is still in blkindex.dat. Convert it with migratetxdb before using -txdb=lsm."));
+    if (!CTxDB::OpenStore(strTxDBEngine))
+        return InitError(strprintf(_("Error opening the %s transaction database"), strTxDBEngine.c_str()));
+    CTxDB::SetCacheSize(max(GetArg("-dbcache", 25), (int64)0) << 20);
+    CTxDB::SetFlushPolicy(max(GetArg("-dbflushinterval", 300), (int64)0), CommitBlockFiles);
+    CTxIndex::fKeepSpenders = GetBoolArg("-txindexspenders");
+
+    uiInterface.InitMessage(_("Upgrading transaction index..."));
+    {
+        CTxDB txdb("cr+");
+        if (!txdb.UpgradeTxIndex())
+            return InitError(_("Error upgrading the transaction index"));
+    }
+    if (fRequestShutdown)
+    {
+        printf("Shutdown requested. Exiting.\n");
+        return false;
+    }
+
     if (GetBoolArg("-loadblockindextest"))
     {
         CTxDB txdb("r");
@@ -686,6 +747,27 @@ bool AppInit2()
     }
     printf(" block index %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    fAddrIndex = GetBoolArg("-addrindex");
+    if (fAddrIndex)
+    {
+        uiInterface.InitMessage(_("Building address index..."));
+        if (!BuildAddrIndex())
+            return InitError(_("Error building the address index"));
+        if (fRequestShutdown)
+        {
+            printf("Shutdown requested. Exiting.\n");
+            return false;
+        }
+    }
+    else
+    {
+        // Blocks connected from now on are not indexed, so an index left
+        // from an earlier run is built again the next time it is used
+        CTxDB txdb("r+");
+        if (txdb.ReadAddrIndexBuilt() && !txdb.WriteAddrIndexBuilt(false))
+            return InitError(_("Error writing the transaction database"));
+    }
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
         PrintBlockTree();
@@ -696,7 +778,7 @@ bool AppInit2()
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -806,7 +888,9 @@ bool AppInit2()
 
         BOOST_FOREACH(string strFile, mapMultiArgs["-loadblock"])
         {
-            FILE *file = fopen(strFile.c_str(), "rb");
+            if (fRequestShutdown)
+                break;
+            FILE *file = (strFile == "-" ? stdin : fopen(strFile.c_str(), "rb"));
             if (file)
                 LoadExternalBlockFile(file);
         }
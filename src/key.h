@@ -96,6 +96,10 @@ public:
     std::vector<unsigned char> Raw() const {
         return vchPubKey;
     }
+
+    // Verify a DER signature without setting up an OpenSSL key; uses the
+    // built-in secp256k1 verifier when it is compiled in
+    bool Verify(uint256 hash, const std::vector<unsigned char>& vchSig) const;
 };
 
 
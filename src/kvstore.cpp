@@ -0,0 +1,236 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kvstore.h"
+#include "util.h"
+
+using namespace std;
+
+
+//
+// CKeyValueOverlayCursor
+//
+
+CKeyValueOverlayCursor::CKeyValueOverlayCursor(CKeyValueCursor* pcursorIn, const CKeyValueBatch& batchIn) : pcursor(pcursorIn), batch(batchIn)
+{
+    it = batch.end();
+    fInBatch = false;
+}
+
+CKeyValueOverlayCursor::~CKeyValueOverlayCursor()
+{
+    delete pcursor;
+}
+
+// Move to the lower of the two records, letting the batch hide the record
+// of the store with the same key and skipping what it erases
+void CKeyValueOverlayCursor::Settle()
+{
+    while (it != batch.end())
+    {
+        if (pcursor->Valid())
+        {
+            int nCompare = pcursor->GetKey().compare(it->first);
+            if (nCompare < 0)
+                break;
+            if (nCompare == 0)
+                pcursor->Next();
+        }
+        if (!it->second.first)
+        {
+            fInBatch = true;
+            return;
+        }
+        ++it;
+    }
+    fInBatch = false;
+}
+
+void CKeyValueOverlayCursor::Seek(const string& strKey)
+{
+    pcursor->Seek(strKey);
+    it = batch.lower_bound(strKey);
+    Settle();
+}
+
+bool CKeyValueOverlayCursor::Valid() const
+{
+    return fInBatch || pcursor->Valid();
+}
+
+void CKeyValueOverlayCursor::Next()
+{
+    if (fInBatch)
+        ++it;
+    else
+        pcursor->Next();
+    Settle();
+}
+
+const string& CKeyValueOverlayCursor::GetKey() const
+{
+    return fInBatch ? it->first : pcursor->GetKey();
+}
+
+const string& CKeyValueOverlayCursor::GetValue() const
+{
+    return fInBatch ? it->second.second : pcursor->GetValue();
+}
+
+bool CKeyValueOverlayCursor::Failed() const
+{
+    return pcursor->Failed();
+}
+
+
+
+
+//
+// CKeyValueCache
+//
+
+void CKeyValueCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+}
+
+void CKeyValueCache::SetBeforeFlush(bool (*pfnBeforeFlushIn)())
+{
+    LOCK(cs);
+    pfnBeforeFlush = pfnBeforeFlushIn;
+}
+
+bool CKeyValueCache::Read(CKeyValueStore& store, const string& strKey, string& strValueRet)
+{
+    LOCK(cs);
+    MapType::const_iterator mi = mapEntries.find(strKey);
+    if (mi != mapEntries.end())
+    {
+        if (!mi->second.fExists)
+            return false;
+        strValueRet = mi->second.strValue;
+        return true;
+    }
+
+    CEntry entry;
+    entry.fExists = store.Read(strKey, entry.strValue);
+    if (entry.fExists)
+        strValueRet = entry.strValue;
+    if (nMaxBytes > 0)
+    {
+        // Reads alone never need a flush to make room
+        if (nBytes >= nMaxBytes && nDirty == 0)
+        {
+            mapEntries.clear();
+            nBytes = 0;
+        }
+        nBytes += EntrySize(strKey, entry);
+        mapEntries.insert(make_pair(strKey, entry));
+    }
+    return entry.fExists;
+}
+
+bool CKeyValueCache::Write(CKeyValueStore& store, const CKeyValueBatch& batch)
+{
+    LOCK(cs);
+    if (nMaxBytes == 0 && mapEntries.empty())
+    {
+        if (pfnBeforeFlush && !pfnBeforeFlush())
+            return error("CKeyValueCache::Write() : not written, the data it refers to could not be made durable");
+        return store.Write(batch, false);
+    }
+
+    for (CKeyValueBatch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        pair<MapType::iterator, bool> ret = mapEntries.insert(make_pair(it->first, CEntry()));
+        CEntry& entry = ret.first->second;
+        if (!ret.second)
+            nBytes -= EntrySize(it->first, entry);
+        if (!entry.fDirty)
+            nDirty++;
+        entry.fExists = !it->second.first;
+        entry.fDirty = true;
+        entry.strValue = it->second.second;
+        nBytes += EntrySize(it->first, entry);
+    }
+    if (nBytes < nMaxBytes)
+        return true;
+    return FlushLocked(store, false);
+}
+
+bool CKeyValueCache::FlushLocked(CKeyValueStore& store, bool fSync)
+{
+    if (nDirty > 0)
+    {
+        if (pfnBeforeFlush && !pfnBeforeFlush())
+            return error("CKeyValueCache::Flush() : not flushed, the data it refers to could not be made durable");
+
+        int64 nStart = GetTimeMillis();
+        CKeyValueBatch batch;
+        for (MapType::const_iterator mi = mapEntries.begin(); mi != mapEntries.end(); ++mi)
+        {
+            if (!mi->second.fDirty)
+                continue;
+            if (mi->second.fExists)
+                batch.Write(mi->first, mi->second.strValue);
+            else
+                batch.Erase(mi->first);
+        }
+        if (!store.Write(batch, fSync))
+            return error("CKeyValueCache::Flush() : write of %"PRIszu" records failed", batch.size());
+        for (MapType::iterator mi = mapEntries.begin(); mi != mapEntries.end(); ++mi)
+            mi->second.fDirty = false;
+        nDirty = 0;
+        if (fDebug)
+            printf("CKeyValueCache::Flush() : wrote %"PRIszu" records, %"PRIszu" bytes in %"PRI64d"ms\n",
+                   batch.size(), batch.GetDataSize(), GetTimeMillis() - nStart);
+    }
+    else if (fSync && !store.Sync())
+        return false;
+
+    if (nBytes >= nMaxBytes)
+    {
+        mapEntries.clear();
+        nBytes = 0;
+    }
+    return true;
+}
+
+bool CKeyValueCache::Flush(CKeyValueStore& store, bool fSync)
+{
+    LOCK(cs);
+    return FlushLocked(store, fSync);
+}
+
+CKeyValueCursor* CKeyValueCache::NewCursor(CKeyValueStore& store, const string& strPrefix)
+{
+    // Under the lock, so nothing is flushed in between and missed by both
+    LOCK(cs);
+    CKeyValueBatch batch;
+    for (MapType::const_iterator mi = mapEntries.lower_bound(strPrefix); mi != mapEntries.end(); ++mi)
+    {
+        if (mi->first.compare(0, strPrefix.size(), strPrefix) != 0)
+            break;
+        if (!mi->second.fDirty)
+            continue;
+        if (mi->second.fExists)
+            batch.Write(mi->first, mi->second.strValue);
+        else
+            batch.Erase(mi->first);
+    }
+    return new CKeyValueOverlayCursor(store.NewCursor(), batch);
+}
+
+bool CKeyValueCache::IsDirty() const
+{
+    LOCK(cs);
+    return nDirty > 0;
+}
+
+size_t CKeyValueCache::GetBytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
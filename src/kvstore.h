@@ -0,0 +1,204 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_KVSTORE_H
+#define MIRACLECOIN_KVSTORE_H
+
+#include "sync.h"
+
+#include <map>
+#include <string>
+#include <utility>
+
+/** Changes to a key-value store that are written together: either all of
+ * them reach the store or none do.  A later change to a key replaces an
+ * earlier one, and the changes are kept in key order, the order the stores
+ * like best to apply them in.
+ */
+class CKeyValueBatch
+{
+public:
+    // Key -> (erased, new value)
+    typedef std::map<std::string, std::pair<bool, std::string> > MapType;
+    typedef MapType::const_iterator const_iterator;
+
+private:
+    MapType mapChanges;
+    size_t nBytes;
+
+    void Set(const std::string& strKey, bool fErase, const std::string& strValue)
+    {
+        std::pair<MapType::iterator, bool> ret = mapChanges.insert(std::make_pair(strKey, std::make_pair(fErase, strValue)));
+        if (!ret.second)
+        {
+            nBytes -= ret.first->second.second.size();
+            ret.first->second = std::make_pair(fErase, strValue);
+        }
+        else
+            nBytes += strKey.size();
+        nBytes += strValue.size();
+    }
+
+public:
+    CKeyValueBatch() : nBytes(0) { }
+
+    void Write(const std::string& strKey, const std::string& strValue) { Set(strKey, false, strValue); }
+    void Erase(const std::string& strKey) { Set(strKey, true, std::string()); }
+
+    // Whether the batch changes strKey, and if so, to what
+    bool Get(const std::string& strKey, bool& fErasedRet, std::string& strValueRet) const
+    {
+        const_iterator it = mapChanges.find(strKey);
+        if (it == mapChanges.end())
+            return false;
+        fErasedRet = it->second.first;
+        strValueRet = it->second.second;
+        return true;
+    }
+
+    const_iterator begin() const { return mapChanges.begin(); }
+    const_iterator end() const { return mapChanges.end(); }
+    const_iterator lower_bound(const std::string& strKey) const { return mapChanges.lower_bound(strKey); }
+    size_t size() const { return mapChanges.size(); }
+    bool empty() const { return mapChanges.empty(); }
+
+    // Bytes of keys and values
+    size_t GetDataSize() const { return nBytes; }
+
+    void clear()
+    {
+        mapChanges.clear();
+        nBytes = 0;
+    }
+};
+
+
+/** Walks the records of a key-value store in key order (bytewise, unsigned). */
+class CKeyValueCursor
+{
+public:
+    virtual ~CKeyValueCursor() { }
+
+    // Move to the first record whose key is not less than strKey
+    virtual void Seek(const std::string& strKey) = 0;
+    virtual bool Valid() const = 0;
+    virtual void Next() = 0;
+    virtual const std::string& GetKey() const = 0;
+    virtual const std::string& GetValue() const = 0;
+
+    // True if the cursor became invalid because of an error rather than
+    // by reaching the end
+    virtual bool Failed() const = 0;
+};
+
+
+/** A cursor over a store as a batch of changes would leave it, without
+ * applying them: records the batch writes replace or add to those of the
+ * store, and records it erases are skipped.
+ */
+class CKeyValueOverlayCursor : public CKeyValueCursor
+{
+private:
+    CKeyValueCursor* pcursor;
+    CKeyValueBatch batch;
+    CKeyValueBatch::const_iterator it;
+    bool fInBatch; // whether the current record comes from the batch
+
+    void Settle();
+
+public:
+    // Takes over pcursorIn, and copies the batch
+    CKeyValueOverlayCursor(CKeyValueCursor* pcursorIn, const CKeyValueBatch& batchIn);
+    ~CKeyValueOverlayCursor();
+
+    void Seek(const std::string& strKey);
+    bool Valid() const;
+    void Next();
+    const std::string& GetKey() const;
+    const std::string& GetValue() const;
+    bool Failed() const;
+};
+
+
+/** The storage engine under CTxDB.  Keys and values are opaque byte
+ * strings; CTxDB serializes its records into them.  Implementations are
+ * safe to use from several threads at once.
+ */
+class CKeyValueStore
+{
+public:
+    virtual ~CKeyValueStore() { }
+
+    virtual bool Read(const std::string& strKey, std::string& strValueRet) = 0;
+    virtual bool Exists(const std::string& strKey) = 0;
+
+    // Apply the batch atomically.  With fSync the changes are on disk when
+    // this returns; otherwise they survive the process but maybe not the OS.
+    virtual bool Write(const CKeyValueBatch& batch, bool fSync) = 0;
+
+    // The caller deletes the cursor, before the store
+    virtual CKeyValueCursor* NewCursor() = 0;
+
+    // Make everything written so far durable
+    virtual bool Sync() = 0;
+};
+
+
+/** Write-back cache in front of a CKeyValueStore.  Reads are remembered,
+ * including the keys found missing, and batches are applied in memory
+ * only.  Once the cache outgrows its budget the changes are written to the
+ * store as one batch, in key order, and the cache starts over empty, so the
+ * store always holds the state as of some flush.  A budget of 0 makes it
+ * write-through.
+ */
+class CKeyValueCache
+{
+private:
+    class CEntry
+    {
+    public:
+        bool fExists;
+        bool fDirty;
+        std::string strValue;
+
+        CEntry() : fExists(false), fDirty(false) { }
+    };
+
+    typedef std::map<std::string, CEntry> MapType;
+
+    mutable CCriticalSection cs;
+    MapType mapEntries;
+    size_t nBytes;
+    size_t nDirty;
+    size_t nMaxBytes;
+    bool (*pfnBeforeFlush)();
+
+    static size_t EntrySize(const std::string& strKey, const CEntry& entry) { return strKey.size() + entry.strValue.size() + 96; }
+    bool FlushLocked(CKeyValueStore& store, bool fSync);
+
+public:
+    explicit CKeyValueCache(size_t nMaxBytesIn = 0) : nBytes(0), nDirty(0), nMaxBytes(nMaxBytesIn), pfnBeforeFlush(NULL) { }
+
+    void SetMaxBytes(size_t nMaxBytesIn);
+
+    // Called before changes are written to the store, to make whatever they
+    // refer to durable first.  The flush fails if it returns false.
+    void SetBeforeFlush(bool (*pfnBeforeFlushIn)());
+
+    bool Read(CKeyValueStore& store, const std::string& strKey, std::string& strValueRet);
+    bool Write(CKeyValueStore& store, const CKeyValueBatch& batch);
+
+    // Write the changes held in memory to the store
+    bool Flush(CKeyValueStore& store, bool fSync);
+
+    // Walk the records starting with strPrefix without a flush: the changes
+    // held in memory for them are laid over a cursor on the store.  They
+    // are copied, so the cursor sees later writes or not.  The caller
+    // deletes the cursor, before the store.
+    CKeyValueCursor* NewCursor(CKeyValueStore& store, const std::string& strPrefix);
+
+    bool IsDirty() const;
+    size_t GetBytes() const;
+};
+
+#endif // MIRACLECOIN_KVSTORE_H
@@ -0,0 +1,1643 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lsmdb.h"
+#include "serialize.h"
+#include "util.h"
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+
+using namespace std;
+
+
+//
+// Encoding
+//
+
+static void PutFixed32(string& str, uint32_t n)
+{
+    char buf[4] = { (char)n, (char)(n >> 8), (char)(n >> 16), (char)(n >> 24) };
+    str.append(buf, 4);
+}
+
+static void PutFixed64(string& str, uint64 n)
+{
+    PutFixed32(str, (uint32_t)n);
+    PutFixed32(str, (uint32_t)(n >> 32));
+}
+
+static uint32_t GetFixed32(const char* p)
+{
+    const unsigned char* pu = (const unsigned char*)p;
+    return pu[0] | (pu[1] << 8) | (pu[2] << 16) | ((uint32_t)pu[3] << 24);
+}
+
+static uint64 GetFixed64(const char* p)
+{
+    return GetFixed32(p) | ((uint64)GetFixed32(p + 4) << 32);
+}
+
+static void PutVarInt(string& str, uint64 n)
+{
+    while (n >= 0x80)
+    {
+        str.push_back((char)(n | 0x80));
+        n >>= 7;
+    }
+    str.push_back((char)n);
+}
+
+static bool GetVarInt(const char*& p, const char* pend, uint64& nRet)
+{
+    nRet = 0;
+    for (int nShift = 0; nShift < 64 && p < pend; nShift += 7)
+    {
+        unsigned char ch = *p++;
+        nRet |= (uint64)(ch & 0x7f) << nShift;
+        if (!(ch & 0x80))
+            return true;
+    }
+    return false;
+}
+
+class CCRC32Table
+{
+public:
+    uint32_t table[256];
+
+    CCRC32Table()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+};
+
+static const CCRC32Table crc32Table;
+
+static uint32_t CRC32(const char* p, size_t nSize)
+{
+    uint32_t c = 0xffffffff;
+    for (size_t i = 0; i < nSize; i++)
+        c = crc32Table.table[(c ^ (unsigned char)p[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+// Batches are logged as a varint count followed by, for each change, a flag
+// byte, the key and (unless erased) the value, each with a varint length
+static void EncodeBatch(const CKeyValueBatch& batch, string& strRet)
+{
+    PutVarInt(strRet, batch.size());
+    for (CKeyValueBatch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        strRet.push_back(it->second.first ? 1 : 0);
+        PutVarInt(strRet, it->first.size());
+        strRet += it->first;
+        if (!it->second.first)
+        {
+            PutVarInt(strRet, it->second.second.size());
+            strRet += it->second.second;
+        }
+    }
+}
+
+static bool DecodeBatch(const char* p, size_t nSize, CKeyValueBatch& batchRet)
+{
+    const char* pend = p + nSize;
+    uint64 nCount, nLen;
+    if (!GetVarInt(p, pend, nCount))
+        return false;
+    for (uint64 i = 0; i < nCount; i++)
+    {
+        if (p >= pend)
+            return false;
+        bool fErased = (*p++ & 1);
+        if (!GetVarInt(p, pend, nLen) || (uint64)(pend - p) < nLen)
+            return false;
+        string strKey(p, nLen);
+        p += nLen;
+        if (fErased)
+        {
+            batchRet.Erase(strKey);
+            continue;
+        }
+        if (!GetVarInt(p, pend, nLen) || (uint64)(pend - p) < nLen)
+            return false;
+        batchRet.Write(strKey, string(p, nLen));
+        p += nLen;
+    }
+    return p == pend;
+}
+
+
+//
+// Bloom filters, one per table, about 1% false positives
+//
+
+static const unsigned int BLOOM_BITS_PER_KEY = 10;
+static const unsigned int BLOOM_HASHES = 6;
+
+static uint64 BloomHash(const string& str)
+{
+    // FNV-1a, then a finalizer so both halves depend on every byte
+    uint64 h = 14695981039346656037ULL;
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void BuildBloomFilter(const vector<uint64>& vHash, string& strFilterRet)
+{
+    size_t nBytes = (max((size_t)64, vHash.size() * BLOOM_BITS_PER_KEY) + 7) / 8;
+    size_t nBits = nBytes * 8;
+    strFilterRet.assign(nBytes, 0);
+    BOOST_FOREACH(uint64 h, vHash)
+    {
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+        for (unsigned int i = 0; i < BLOOM_HASHES; i++)
+        {
+            size_t nBit = (uint32_t)(h1 + i * h2) % nBits;
+            strFilterRet[nBit / 8] |= 1 << (nBit % 8);
+        }
+    }
+}
+
+static bool BloomMayContain(const string& strFilter, uint64 h)
+{
+    if (strFilter.empty())
+        return true;
+    size_t nBits = strFilter.size() * 8;
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+    for (unsigned int i = 0; i < BLOOM_HASHES; i++)
+    {
+        size_t nBit = (uint32_t)(h1 + i * h2) % nBits;
+        if (!(strFilter[nBit / 8] & (1 << (nBit % 8))))
+            return false;
+    }
+    return true;
+}
+
+
+//
+// Memory tables
+//
+
+// A value, or the note that the key was erased, which has to hide older
+// values of the key until compaction reaches the bottom level
+class CLSMValue
+{
+public:
+    bool fErased;
+    string strValue;
+
+    CLSMValue() : fErased(false) { }
+    CLSMValue(bool fErasedIn, const string& strValueIn) : fErased(fErasedIn), strValue(strValueIn) { }
+};
+
+class CLSMMemTable
+{
+public:
+    typedef map<string, CLSMValue> MapType;
+
+    MapType mapEntries;
+    size_t nBytes;
+
+    CLSMMemTable() : nBytes(0) { }
+
+    void Set(const string& strKey, bool fErased, const string& strValue)
+    {
+        pair<MapType::iterator, bool> ret = mapEntries.insert(make_pair(strKey, CLSMValue(fErased, strValue)));
+        if (!ret.second)
+        {
+            nBytes -= ret.first->second.strValue.size();
+            ret.first->second.fErased = fErased;
+            ret.first->second.strValue = strValue;
+        }
+        else
+            nBytes += strKey.size() + 64;
+        nBytes += strValue.size();
+    }
+
+    void Apply(const CKeyValueBatch& batch)
+    {
+        for (CKeyValueBatch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+            Set(it->first, it->second.first, it->second.second);
+    }
+};
+
+
+//
+// Tables
+//
+// A table file is a run of data blocks of about TABLE_BLOCK_SIZE, then an
+// index block with the last key, offset and size of each data block, then a
+// bloom filter block, each followed by its CRC32, and finally a fixed size
+// footer locating the index and filter.  Keys in a data block share their
+// prefix with the key before: each entry is varint shared length, varint
+// unshared length, varint value length, a flag byte (1 = erased), the
+// unshared part of the key and the value.
+//
+
+static const size_t TABLE_BLOCK_SIZE = 4096;
+static const size_t TABLE_FOOTER_SIZE = 44;
+static const uint32_t TABLE_MAGIC = 0x314d534c;
+
+// Walks the entries of one data block
+class CLSMBlockReader
+{
+private:
+    const char* p;
+    const char* pend;
+    bool fCorrupt;
+
+public:
+    string strKey;
+    bool fErased;
+    const char* pValue;
+    size_t nValueSize;
+
+    CLSMBlockReader() : p(NULL), pend(NULL), fCorrupt(false), fErased(false), pValue(NULL), nValueSize(0) { }
+
+    void Reset(const string& strBlock)
+    {
+        p = strBlock.data();
+        pend = p + strBlock.size();
+        fCorrupt = false;
+        strKey.clear();
+    }
+
+    // Step to the next entry, false at the end of the block or on bad data
+    bool Next()
+    {
+        if (p >= pend)
+            return false;
+        uint64 nShared, nUnshared, nValue;
+        if (!GetVarInt(p, pend, nShared) || !GetVarInt(p, pend, nUnshared) || !GetVarInt(p, pend, nValue) ||
+            nShared > strKey.size() || (uint64)(pend - p) < 1 + nUnshared + nValue)
+        {
+            fCorrupt = true;
+            p = pend;
+            return false;
+        }
+        fErased = (*p++ & 1);
+        strKey.resize(nShared);
+        strKey.append(p, nUnshared);
+        p += nUnshared;
+        pValue = p;
+        nValueSize = nValue;
+        p += nValue;
+        return true;
+    }
+
+    bool IsCorrupt() const { return fCorrupt; }
+};
+
+class CLSMTable
+{
+public:
+    unsigned int nNumber;
+    uint64 nFileSize;
+    string strSmallest;
+    string strLargest;
+
+    // Set when the table has been compacted away; the file goes when the
+    // last version using it does
+    bool fObsolete;
+
+private:
+    boost::filesystem::path pathFile;
+    FILE* file;
+    mutable boost::mutex mutexFile;
+    vector<string> vBlockLastKey;
+    vector<uint64> vBlockOffset;
+    vector<uint64> vBlockSize;
+    string strFilter;
+
+    CLSMTable(const CLSMTable&);
+    void operator=(const CLSMTable&);
+
+    bool ReadRaw(uint64 nOffset, uint64 nSize, string& strRet, bool fVerify) const
+    {
+        if (nSize < 4 || nOffset + nSize > nFileSize)
+            return error("CLSMTable::ReadRaw() : bad block location in %s", pathFile.string().c_str());
+        strRet.resize(nSize);
+        {
+            boost::lock_guard<boost::mutex> lock(mutexFile);
+            if (fseek(file, nOffset, SEEK_SET) != 0 || fread(&strRet[0], 1, nSize, file) != nSize)
+                return error("CLSMTable::ReadRaw() : read failed in %s", pathFile.string().c_str());
+        }
+        if (fVerify && CRC32(strRet.data(), nSize - 4) != GetFixed32(&strRet[nSize - 4]))
+            return error("CLSMTable::ReadRaw() : checksum mismatch in %s", pathFile.string().c_str());
+        strRet.resize(nSize - 4);
+        return true;
+    }
+
+public:
+    CLSMTable(const boost::filesystem::path& pathFileIn, unsigned int nNumberIn)
+        : nNumber(nNumberIn), nFileSize(0), fObsolete(false), pathFile(pathFileIn), file(NULL) { }
+
+    ~CLSMTable()
+    {
+        if (file)
+            fclose(file);
+        if (fObsolete)
+        {
+            try {
+                boost::filesystem::remove(pathFile);
+            } catch (std::exception& e) {
+                printf("CLSMTable : can't remove %s: %s\n", pathFile.string().c_str(), e.what());
+            }
+        }
+    }
+
+    bool Open()
+    {
+        file = fopen(pathFile.string().c_str(), "rb");
+        if (!file)
+            return error("CLSMTable::Open() : can't open %s", pathFile.string().c_str());
+        if (fseek(file, 0, SEEK_END) != 0)
+            return error("CLSMTable::Open() : seek failed in %s", pathFile.string().c_str());
+        long nEnd = ftell(file);
+        if (nEnd < (long)TABLE_FOOTER_SIZE)
+            return error("CLSMTable::Open() : %s is truncated", pathFile.string().c_str());
+        nFileSize = nEnd;
+
+        char footer[TABLE_FOOTER_SIZE];
+        if (fseek(file, nEnd - TABLE_FOOTER_SIZE, SEEK_SET) != 0 || fread(footer, 1, TABLE_FOOTER_SIZE, file) != TABLE_FOOTER_SIZE)
+            return error("CLSMTable::Open() : can't read footer of %s", pathFile.string().c_str());
+        if (GetFixed32(footer + 40) != TABLE_MAGIC)
+            return error("CLSMTable::Open() : %s is not a table", pathFile.string().c_str());
+
+        string strIndex;
+        if (!ReadRaw(GetFixed64(footer), GetFixed64(footer + 8), strIndex, true) ||
+            !ReadRaw(GetFixed64(footer + 16), GetFixed64(footer + 24), strFilter, true))
+            return false;
+
+        const char* p = strIndex.data();
+        const char* pend = p + strIndex.size();
+        while (p < pend)
+        {
+            uint64 nLen, nOffset, nSize;
+            if (!GetVarInt(p, pend, nLen) || (uint64)(pend - p) < nLen)
+                return error("CLSMTable::Open() : bad index in %s", pathFile.string().c_str());
+            vBlockLastKey.push_back(string(p, nLen));
+            p += nLen;
+            if (!GetVarInt(p, pend, nOffset) || !GetVarInt(p, pend, nSize))
+                return error("CLSMTable::Open() : bad index in %s", pathFile.string().c_str());
+            vBlockOffset.push_back(nOffset);
+            vBlockSize.push_back(nSize);
+        }
+        if (vBlockOffset.empty())
+            return error("CLSMTable::Open() : %s has no data", pathFile.string().c_str());
+        return true;
+    }
+
+    unsigned int GetBlockCount() const { return vBlockOffset.size(); }
+
+    // First block that can hold strKey, GetBlockCount() if none
+    unsigned int FindBlock(const string& strKey) const
+    {
+        return lower_bound(vBlockLastKey.begin(), vBlockLastKey.end(), strKey) - vBlockLastKey.begin();
+    }
+
+    bool ReadBlock(unsigned int nBlock, string& strBlockRet, bool fVerify) const
+    {
+        return ReadRaw(vBlockOffset[nBlock], vBlockSize[nBlock], strBlockRet, fVerify);
+    }
+
+    // Point lookups skip the checksum; a damaged block is still caught by
+    // compaction and cursors, which check every block they read
+    bool Get(const string& strKey, uint64 nHash, bool& fFoundRet, CLSMValue& valueRet) const
+    {
+        fFoundRet = false;
+        if (!BloomMayContain(strFilter, nHash))
+            return true;
+        unsigned int nBlock = FindBlock(strKey);
+        if (nBlock == GetBlockCount())
+            return true;
+        string strBlock;
+        if (!ReadBlock(nBlock, strBlock, false))
+            return false;
+        CLSMBlockReader reader;
+        reader.Reset(strBlock);
+        while (reader.Next())
+        {
+            int nCompare = reader.strKey.compare(strKey);
+            if (nCompare < 0)
+                continue;
+            if (nCompare == 0)
+            {
+                fFoundRet = true;
+                valueRet.fErased = reader.fErased;
+                valueRet.strValue.assign(reader.pValue, reader.nValueSize);
+            }
+            return true;
+        }
+        if (reader.IsCorrupt())
+            return error("CLSMTable::Get() : corrupt block in %s", pathFile.string().c_str());
+        return true;
+    }
+};
+
+class CLSMTableBuilder
+{
+private:
+    FILE* file;
+    boost::filesystem::path pathFile;
+    string strBlock;
+    string strLastKey;
+    string strIndex;
+    vector<uint64> vHash;
+    uint64 nOffset;
+    uint64 nEntries;
+    bool fError;
+
+    void WriteRaw(const string& str)
+    {
+        string strCRC;
+        PutFixed32(strCRC, CRC32(str.data(), str.size()));
+        if (fwrite(str.data(), 1, str.size(), file) != str.size() || fwrite(strCRC.data(), 1, 4, file) != 4)
+            fError = true;
+        nOffset += str.size() + 4;
+    }
+
+    void FlushBlock()
+    {
+        if (strBlock.empty())
+            return;
+        PutVarInt(strIndex, strLastKey.size());
+        strIndex += strLastKey;
+        PutVarInt(strIndex, nOffset);
+        PutVarInt(strIndex, strBlock.size() + 4);
+        WriteRaw(strBlock);
+        strBlock.clear();
+    }
+
+public:
+    string strSmallest;
+
+    CLSMTableBuilder() : file(NULL), nOffset(0), nEntries(0), fError(false) { }
+
+    ~CLSMTableBuilder()
+    {
+        if (file)
+            fclose(file);
+    }
+
+    bool Open(const boost::filesystem::path& pathFileIn)
+    {
+        pathFile = pathFileIn;
+        file = fopen(pathFile.string().c_str(), "wb");
+        return file != NULL;
+    }
+
+    // Keys must come in increasing order
+    void Add(const string& strKey, bool fErased, const string& strValue)
+    {
+        if (nEntries == 0)
+            strSmallest = strKey;
+        size_t nShared = 0;
+        if (!strBlock.empty())
+            while (nShared < strLastKey.size() && nShared < strKey.size() && strLastKey[nShared] == strKey[nShared])
+                nShared++;
+        PutVarInt(strBlock, nShared);
+        PutVarInt(strBlock, strKey.size() - nShared);
+        PutVarInt(strBlock, strValue.size());
+        strBlock.push_back(fErased ? 1 : 0);
+        strBlock.append(strKey, nShared, string::npos);
+        strBlock += strValue;
+        strLastKey = strKey;
+        vHash.push_back(BloomHash(strKey));
+        nEntries++;
+        if (strBlock.size() >= TABLE_BLOCK_SIZE)
+            FlushBlock();
+    }
+
+    uint64 GetFileSize() const { return nOffset + strBlock.size(); }
+    const string& GetLastKey() const { return strLastKey; }
+
+    bool Finish()
+    {
+        FlushBlock();
+        uint64 nIndexOffset = nOffset;
+        WriteRaw(strIndex);
+        uint64 nFilterOffset = nOffset;
+        string strFilter;
+        BuildBloomFilter(vHash, strFilter);
+        WriteRaw(strFilter);
+
+        string strFooter;
+        PutFixed64(strFooter, nIndexOffset);
+        PutFixed64(strFooter, nFilterOffset - nIndexOffset);
+        PutFixed64(strFooter, nFilterOffset);
+        PutFixed64(strFooter, nOffset - nFilterOffset);
+        PutFixed64(strFooter, nEntries);
+        PutFixed32(strFooter, TABLE_MAGIC);
+        if (fwrite(strFooter.data(), 1, strFooter.size(), file) != strFooter.size() || fflush(file) != 0)
+            fError = true;
+        FileCommit(file);
+        fclose(file);
+        file = NULL;
+        return !fError;
+    }
+
+    void Abandon()
+    {
+        if (file)
+            fclose(file);
+        file = NULL;
+        remove(pathFile.string().c_str());
+    }
+};
+
+
+//
+// Iterators
+//
+
+class CLSMIterator
+{
+public:
+    virtual ~CLSMIterator() { }
+    virtual void Seek(const string& strKey) = 0;
+    virtual bool Valid() const = 0;
+    virtual void Next() = 0;
+    virtual const string& Key() const = 0;
+    virtual bool IsErased() const = 0;
+    virtual const string& Value() const = 0;
+    virtual bool Failed() const = 0;
+};
+
+// Locks a mutex if there is one
+class CLSMOptionalLock
+{
+private:
+    boost::mutex* pmutex;
+
+public:
+    explicit CLSMOptionalLock(boost::mutex* pmutexIn) : pmutex(pmutexIn)
+    {
+        if (pmutex)
+            pmutex->lock();
+    }
+
+    ~CLSMOptionalLock()
+    {
+        if (pmutex)
+            pmutex->unlock();
+    }
+};
+
+// Over a memory table.  The live one is written to under the store mutex,
+// so pmutex is given for it and each step copies its entry out under it.
+class CLSMMemIterator : public CLSMIterator
+{
+private:
+    boost::shared_ptr<CLSMMemTable> pmem;
+    boost::mutex* pmutex;
+    bool fValid;
+    string strKey;
+    CLSMValue value;
+
+    void Load(CLSMMemTable::MapType::const_iterator it)
+    {
+        fValid = (it != pmem->mapEntries.end());
+        if (fValid)
+        {
+            strKey = it->first;
+            value = it->second;
+        }
+    }
+
+public:
+    CLSMMemIterator(boost::shared_ptr<CLSMMemTable> pmemIn, boost::mutex* pmutexIn) : pmem(pmemIn), pmutex(pmutexIn), fValid(false) { }
+
+    void Seek(const string& strKeyIn)
+    {
+        CLSMOptionalLock lock(pmutex);
+        Load(pmem->mapEntries.lower_bound(strKeyIn));
+    }
+
+    void Next()
+    {
+        CLSMOptionalLock lock(pmutex);
+        Load(pmem->mapEntries.upper_bound(strKey));
+    }
+
+    bool Valid() const { return fValid; }
+    const string& Key() const { return strKey; }
+    bool IsErased() const { return value.fErased; }
+    const string& Value() const { return value.strValue; }
+    bool Failed() const { return false; }
+};
+
+class CLSMTableIterator : public CLSMIterator
+{
+private:
+    CLSMStore::TablePtr ptable;
+    unsigned int nBlock;
+    string strBlock;
+    CLSMBlockReader reader;
+    string strValue;
+    bool fValid;
+    bool fFailed;
+
+    bool Step()
+    {
+        fValid = reader.Next();
+        if (fValid)
+            strValue.assign(reader.pValue, reader.nValueSize);
+        else if (reader.IsCorrupt())
+        {
+            error("CLSMTableIterator : corrupt block in table %u", ptable->nNumber);
+            fFailed = true;
+        }
+        return fValid;
+    }
+
+    // Move to the first entry at or after block nBlock
+    void LoadBlock()
+    {
+        fValid = false;
+        for (; nBlock < ptable->GetBlockCount() && !fFailed; nBlock++)
+        {
+            if (!ptable->ReadBlock(nBlock, strBlock, true))
+            {
+                fFailed = true;
+                return;
+            }
+            reader.Reset(strBlock);
+            if (Step())
+                return;
+        }
+    }
+
+public:
+    explicit CLSMTableIterator(CLSMStore::TablePtr ptableIn) : ptable(ptableIn), nBlock(0), fValid(false), fFailed(false) { }
+
+    void Seek(const string& strKey)
+    {
+        fFailed = false;
+        nBlock = ptable->FindBlock(strKey);
+        LoadBlock();
+        while (fValid && reader.strKey < strKey)
+            Next();
+    }
+
+    void Next()
+    {
+        if (Step() || fFailed)
+            return;
+        nBlock++;
+        LoadBlock();
+    }
+
+    bool Valid() const { return fValid; }
+    const string& Key() const { return reader.strKey; }
+    bool IsErased() const { return reader.fErased; }
+    const string& Value() const { return strValue; }
+    bool Failed() const { return fFailed; }
+};
+
+struct CLSMLargestKeyLess
+{
+    bool operator()(const CLSMStore::TablePtr& ptable, const string& strKey) const { return ptable->strLargest < strKey; }
+};
+
+// Over the disjoint, sorted tables of a level below 0
+class CLSMLevelIterator : public CLSMIterator
+{
+private:
+    vector<CLSMStore::TablePtr> vTables;
+    unsigned int nTable;
+    boost::scoped_ptr<CLSMTableIterator> pit;
+
+    void SkipEmpty()
+    {
+        while (!pit->Valid() && !pit->Failed() && ++nTable < vTables.size())
+        {
+            pit.reset(new CLSMTableIterator(vTables[nTable]));
+            pit->Seek(string());
+        }
+    }
+
+public:
+    explicit CLSMLevelIterator(const vector<CLSMStore::TablePtr>& vTablesIn) : vTables(vTablesIn), nTable(0) { }
+
+    void Seek(const string& strKey)
+    {
+        nTable = lower_bound(vTables.begin(), vTables.end(), strKey, CLSMLargestKeyLess()) - vTables.begin();
+        if (nTable == vTables.size())
+        {
+            pit.reset();
+            return;
+        }
+        pit.reset(new CLSMTableIterator(vTables[nTable]));
+        pit->Seek(strKey);
+        SkipEmpty();
+    }
+
+    void Next()
+    {
+        pit->Next();
+        SkipEmpty();
+    }
+
+    bool Valid() const { return pit && pit->Valid(); }
+    const string& Key() const { return pit->Key(); }
+    bool IsErased() const { return pit->IsErased(); }
+    const string& Value() const { return pit->Value(); }
+    bool Failed() const { return pit && pit->Failed(); }
+};
+
+// Merges sources given newest first.  Where several have the same key the
+// newest entry is the one seen and the others are skipped.
+class CLSMMergingIterator : public CLSMIterator
+{
+private:
+    vector<CLSMIterator*> vSources;
+    int nCurrent;
+
+    void FindSmallest()
+    {
+        nCurrent = -1;
+        for (unsigned int i = 0; i < vSources.size(); i++)
+            if (vSources[i]->Valid() && (nCurrent < 0 || vSources[i]->Key() < vSources[nCurrent]->Key()))
+                nCurrent = i;
+    }
+
+public:
+    // Takes ownership of the sources
+    explicit CLSMMergingIterator(const vector<CLSMIterator*>& vSourcesIn) : vSources(vSourcesIn), nCurrent(-1) { }
+
+    ~CLSMMergingIterator()
+    {
+        BOOST_FOREACH(CLSMIterator* pit, vSources)
+            delete pit;
+    }
+
+    void Seek(const string& strKey)
+    {
+        BOOST_FOREACH(CLSMIterator* pit, vSources)
+            pit->Seek(strKey);
+        FindSmallest();
+    }
+
+    void Next()
+    {
+        string strKey = vSources[nCurrent]->Key();
+        BOOST_FOREACH(CLSMIterator* pit, vSources)
+            if (pit->Valid() && pit->Key() == strKey)
+                pit->Next();
+        FindSmallest();
+    }
+
+    bool Valid() const { return nCurrent >= 0 && !Failed(); }
+    const string& Key() const { return vSources[nCurrent]->Key(); }
+    bool IsErased() const { return vSources[nCurrent]->IsErased(); }
+    const string& Value() const { return vSources[nCurrent]->Value(); }
+
+    bool Failed() const
+    {
+        BOOST_FOREACH(const CLSMIterator* pit, vSources)
+            if (pit->Failed())
+                return true;
+        return false;
+    }
+};
+
+class CLSMCursor : public CKeyValueCursor
+{
+private:
+    boost::scoped_ptr<CLSMIterator> pit;
+
+    void SkipErased()
+    {
+        while (pit->Valid() && pit->IsErased())
+            pit->Next();
+    }
+
+public:
+    explicit CLSMCursor(CLSMIterator* pitIn) : pit(pitIn) { }
+
+    void Seek(const string& strKey)
+    {
+        pit->Seek(strKey);
+        SkipErased();
+    }
+
+    void Next()
+    {
+        pit->Next();
+        SkipErased();
+    }
+
+    bool Valid() const { return pit->Valid(); }
+    const string& GetKey() const { return pit->Key(); }
+    const string& GetValue() const { return pit->Value(); }
+    bool Failed() const { return pit->Failed(); }
+};
+
+
+//
+// Versions: the set of live tables, replaced as a whole by each flush and
+// compaction so readers can keep using the one they started with
+//
+
+class CLSMVersion
+{
+public:
+    // Level 0 newest first, the others by key range
+    vector<CLSMStore::TablePtr> vLevel[CLSMStore::NUM_LEVELS];
+
+    static bool NewerFirst(const CLSMStore::TablePtr& a, const CLSMStore::TablePtr& b) { return a->nNumber > b->nNumber; }
+    static bool SmallestFirst(const CLSMStore::TablePtr& a, const CLSMStore::TablePtr& b) { return a->strSmallest < b->strSmallest; }
+
+    void SortLevels()
+    {
+        sort(vLevel[0].begin(), vLevel[0].end(), NewerFirst);
+        for (int nLevel = 1; nLevel < CLSMStore::NUM_LEVELS; nLevel++)
+            sort(vLevel[nLevel].begin(), vLevel[nLevel].end(), SmallestFirst);
+    }
+
+    uint64 GetLevelBytes(int nLevel) const
+    {
+        uint64 nBytes = 0;
+        BOOST_FOREACH(const CLSMStore::TablePtr& ptable, vLevel[nLevel])
+            nBytes += ptable->nFileSize;
+        return nBytes;
+    }
+
+    bool Get(const string& strKey, uint64 nHash, bool& fFoundRet, CLSMValue& valueRet) const
+    {
+        fFoundRet = false;
+        BOOST_FOREACH(const CLSMStore::TablePtr& ptable, vLevel[0])
+        {
+            if (strKey < ptable->strSmallest || ptable->strLargest < strKey)
+                continue;
+            if (!ptable->Get(strKey, nHash, fFoundRet, valueRet))
+                return false;
+            if (fFoundRet)
+                return true;
+        }
+        for (int nLevel = 1; nLevel < CLSMStore::NUM_LEVELS; nLevel++)
+        {
+            const vector<CLSMStore::TablePtr>& vTables = vLevel[nLevel];
+            vector<CLSMStore::TablePtr>::const_iterator it = lower_bound(vTables.begin(), vTables.end(), strKey, CLSMLargestKeyLess());
+            if (it == vTables.end() || strKey < (*it)->strSmallest)
+                continue;
+            if (!(*it)->Get(strKey, nHash, fFoundRet, valueRet))
+                return false;
+            if (fFoundRet)
+                return true;
+        }
+        return true;
+    }
+
+    void GetOverlapping(int nLevel, const string& strBegin, const string& strEnd, vector<CLSMStore::TablePtr>& vRet) const
+    {
+        BOOST_FOREACH(const CLSMStore::TablePtr& ptable, vLevel[nLevel])
+            if (!(ptable->strLargest < strBegin || strEnd < ptable->strSmallest))
+                vRet.push_back(ptable);
+    }
+
+    // Whether no level below nLevel can have strKey, so an erasure written
+    // to nLevel has nothing left to hide
+    bool IsBaseLevelForKey(int nLevel, const string& strKey) const
+    {
+        for (int nDeeper = nLevel + 1; nDeeper < CLSMStore::NUM_LEVELS; nDeeper++)
+        {
+            const vector<CLSMStore::TablePtr>& vTables = vLevel[nDeeper];
+            vector<CLSMStore::TablePtr>::const_iterator it = lower_bound(vTables.begin(), vTables.end(), strKey, CLSMLargestKeyLess());
+            if (it != vTables.end() && !(strKey < (*it)->strSmallest))
+                return false;
+        }
+        return true;
+    }
+
+    void AddIterators(vector<CLSMIterator*>& vIter) const
+    {
+        BOOST_FOREACH(const CLSMStore::TablePtr& ptable, vLevel[0])
+            vIter.push_back(new CLSMTableIterator(ptable));
+        for (int nLevel = 1; nLevel < CLSMStore::NUM_LEVELS; nLevel++)
+            if (!vLevel[nLevel].empty())
+                vIter.push_back(new CLSMLevelIterator(vLevel[nLevel]));
+    }
+};
+
+class CLSMTableInfo
+{
+public:
+    int nLevel;
+    unsigned int nNumber;
+    uint64 nFileSize;
+    string strSmallest;
+    string strLargest;
+
+    CLSMTableInfo() : nLevel(0), nNumber(0), nFileSize(0) { }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nLevel);
+        READWRITE(nNumber);
+        READWRITE(nFileSize);
+        READWRITE(strSmallest);
+        READWRITE(strLargest);
+    )
+};
+
+// Tables written for a level are split at this size, so compacting one of
+// them later touches a bounded amount of the level below
+static uint64 MaxTableSize(int nLevel)
+{
+    return (uint64)(2 << 20) << min(max(nLevel - 1, 0), 3);
+}
+
+static uint64 MaxBytesForLevel(int nLevel)
+{
+    uint64 nBytes = 10 << 20;
+    while (--nLevel > 0)
+        nBytes *= 10;
+    return nBytes;
+}
+
+
+//
+// CLSMStore
+//
+
+CLSMStore::CLSMStore()
+{
+    nWriteBufferSize = DEFAULT_WRITE_BUFFER_SIZE;
+    pthreadCompact = NULL;
+    fStopping = false;
+    fileLog = NULL;
+    nLogNumber = 0;
+    nImmLogNumber = 0;
+    nNextFile = 1;
+}
+
+CLSMStore::~CLSMStore()
+{
+    Close();
+}
+
+boost::filesystem::path CLSMStore::GetFilePath(unsigned int nNumber, const char* pszExt) const
+{
+    return pathDir / strprintf("%06u.%s", nNumber, pszExt);
+}
+
+unsigned int CLSMStore::NewFileNumber()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return nNextFile++;
+}
+
+bool CLSMStore::ReadManifest(vector<CLSMTableInfo>& vInfoRet, unsigned int& nLogNumberRet)
+{
+    boost::filesystem::path pathManifest = pathDir / "MANIFEST";
+    FILE* file = fopen(pathManifest.string().c_str(), "rb");
+    if (!file)
+        return error("CLSMStore::ReadManifest() : can't open %s", pathManifest.string().c_str());
+    vector<char> vchData;
+    char buf[65536];
+    size_t nRead;
+    while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+        vchData.insert(vchData.end(), buf, buf + nRead);
+    fclose(file);
+
+    if (vchData.size() < sizeof(uint256))
+        return error("CLSMStore::ReadManifest() : %s is truncated", pathManifest.string().c_str());
+    uint256 hashIn;
+    memcpy(hashIn.begin(), &vchData[vchData.size() - sizeof(uint256)], sizeof(uint256));
+    vchData.resize(vchData.size() - sizeof(uint256));
+    if (Hash(vchData.begin(), vchData.end()) != hashIn)
+        return error("CLSMStore::ReadManifest() : checksum mismatch in %s", pathManifest.string().c_str());
+
+    CDataStream ss(vchData, SER_DISK, CLIENT_VERSION);
+    int nManifestVersion;
+    vector<string> vPointer;
+    try {
+        ss >> nManifestVersion >> nNextFile >> nLogNumberRet >> vInfoRet >> vPointer;
+    }
+    catch (std::exception &e) {
+        return error("CLSMStore::ReadManifest() : I/O error or stream data corrupted");
+    }
+    if (nManifestVersion != 1)
+        return error("CLSMStore::ReadManifest() : unknown manifest version %d", nManifestVersion);
+    for (unsigned int i = 0; i < vPointer.size() && i < NUM_LEVELS; i++)
+        vCompactPointer[i] = vPointer[i];
+    return true;
+}
+
+bool CLSMStore::WriteManifest(const CLSMVersion& version, unsigned int nLogNumberIn)
+{
+    vector<CLSMTableInfo> vInfo;
+    for (int nLevel = 0; nLevel < NUM_LEVELS; nLevel++)
+    {
+        BOOST_FOREACH(const TablePtr& ptable, version.vLevel[nLevel])
+        {
+            CLSMTableInfo info;
+            info.nLevel = nLevel;
+            info.nNumber = ptable->nNumber;
+            info.nFileSize = ptable->nFileSize;
+            info.strSmallest = ptable->strSmallest;
+            info.strLargest = ptable->strLargest;
+            vInfo.push_back(info);
+        }
+    }
+    vector<string> vPointer(vCompactPointer, vCompactPointer + NUM_LEVELS);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << (int)1 << nNextFile << nLogNumberIn << vInfo << vPointer;
+    uint256 hash = Hash(ss.begin(), ss.end());
+    ss << hash;
+
+    boost::filesystem::path pathTmp = pathDir / "MANIFEST.tmp";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("CLSMStore::WriteManifest() : can't open %s", pathTmp.string().c_str());
+    bool fOk = (fwrite(&ss[0], 1, ss.size(), file) == ss.size() && fflush(file) == 0);
+    FileCommit(file);
+    fclose(file);
+    if (!fOk)
+        return error("CLSMStore::WriteManifest() : write to %s failed", pathTmp.string().c_str());
+    if (!RenameOver(pathTmp, pathDir / "MANIFEST"))
+        return error("CLSMStore::WriteManifest() : rename of %s failed", pathTmp.string().c_str());
+    return true;
+}
+
+bool CLSMStore::ReplayLog(unsigned int nNumber, CLSMMemTable& mem)
+{
+    boost::filesystem::path pathLog = GetFilePath(nNumber, "log");
+    FILE* file = fopen(pathLog.string().c_str(), "rb");
+    if (!file)
+        return error("CLSMStore::ReplayLog() : can't open %s", pathLog.string().c_str());
+    string strData;
+    char buf[65536];
+    size_t nRead;
+    while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+        strData.append(buf, nRead);
+    fclose(file);
+
+    // Records are a CRC32 and a length, then the encoded batch.  A crash
+    // can leave the last one incomplete; it was never acknowledged.
+    const char* p = strData.data();
+    const char* pend = p + strData.size();
+    unsigned int nRecords = 0;
+    while (pend - p >= 8)
+    {
+        uint32_t nCRC = GetFixed32(p);
+        uint32_t nLen = GetFixed32(p + 4);
+        if ((size_t)(pend - p - 8) < nLen || CRC32(p + 8, nLen) != nCRC)
+            break;
+        CKeyValueBatch batch;
+        if (!DecodeBatch(p + 8, nLen, batch))
+            break;
+        mem.Apply(batch);
+        p += 8 + nLen;
+        nRecords++;
+    }
+    if (p != pend)
+        printf("CLSMStore::ReplayLog() : ignored %"PRIszu" bytes of an incomplete write at the end of %s\n", (size_t)(pend - p), pathLog.string().c_str());
+    if (fDebug)
+        printf("CLSMStore::ReplayLog() : %u writes from %s\n", nRecords, pathLog.string().c_str());
+    return true;
+}
+
+bool CLSMStore::BuildTables(CLSMIterator& it, const CLSMVersion* pversionBase, int nOutputLevel, vector<TablePtr>& vOutputs)
+{
+    // Without pversionBase this is the flush of a memory table to level 0:
+    // a single table, erasures kept.  Compaction output is split at the
+    // level's table size, and erasures that hide nothing deeper are dropped.
+    uint64 nTargetSize = pversionBase ? MaxTableSize(nOutputLevel) : std::numeric_limits<uint64>::max();
+    boost::scoped_ptr<CLSMTableBuilder> pbuilder;
+    unsigned int nNumber = 0;
+    bool fOk = true;
+
+    for (; it.Valid(); it.Next())
+    {
+        if (it.IsErased() && pversionBase && pversionBase->IsBaseLevelForKey(nOutputLevel, it.Key()))
+            continue;
+        if (!pbuilder)
+        {
+            nNumber = NewFileNumber();
+            pbuilder.reset(new CLSMTableBuilder());
+            if (!pbuilder->Open(GetFilePath(nNumber, "sst")))
+            {
+                fOk = error("CLSMStore::BuildTables() : can't create table %u", nNumber);
+                break;
+            }
+        }
+        pbuilder->Add(it.Key(), it.IsErased(), it.Value());
+        if (pbuilder->GetFileSize() >= nTargetSize)
+        {
+            TablePtr ptable(new CLSMTable(GetFilePath(nNumber, "sst"), nNumber));
+            ptable->strSmallest = pbuilder->strSmallest;
+            ptable->strLargest = pbuilder->GetLastKey();
+            if (!pbuilder->Finish() || !ptable->Open())
+            {
+                ptable->fObsolete = true;
+                pbuilder.reset();
+                fOk = error("CLSMStore::BuildTables() : can't write table %u", nNumber);
+                break;
+            }
+            vOutputs.push_back(ptable);
+            pbuilder.reset();
+        }
+    }
+    if (fOk && it.Failed())
+        fOk = error("CLSMStore::BuildTables() : read failed");
+    if (fOk && pbuilder)
+    {
+        TablePtr ptable(new CLSMTable(GetFilePath(nNumber, "sst"), nNumber));
+        ptable->strSmallest = pbuilder->strSmallest;
+        ptable->strLargest = pbuilder->GetLastKey();
+        if (pbuilder->Finish() && ptable->Open())
+            vOutputs.push_back(ptable);
+        else
+        {
+            ptable->fObsolete = true;
+            fOk = error("CLSMStore::BuildTables() : can't write table %u", nNumber);
+        }
+        pbuilder.reset();
+    }
+    if (!fOk)
+    {
+        if (pbuilder)
+            pbuilder->Abandon();
+        BOOST_FOREACH(const TablePtr& ptable, vOutputs)
+            ptable->fObsolete = true;
+        vOutputs.clear();
+    }
+    return fOk;
+}
+
+bool CLSMStore::SwitchMemTable()
+{
+    // Called with the mutex held
+    unsigned int nNewLog = nNextFile++;
+    FILE* fileNew = fopen(GetFilePath(nNewLog, "log").string().c_str(), "ab");
+    if (!fileNew)
+    {
+        strBackgroundError = "can't create a new log";
+        return error("CLSMStore::SwitchMemTable() : can't create log %u", nNewLog);
+    }
+    fclose(fileLog);
+    fileLog = fileNew;
+    pimm = pmem;
+    nImmLogNumber = nLogNumber;
+    nLogNumber = nNewLog;
+    pmem.reset(new CLSMMemTable());
+    condCompact.notify_one();
+    return true;
+}
+
+bool CLSMStore::MakeRoomForWrite(boost::unique_lock<boost::mutex>& lock)
+{
+    while (true)
+    {
+        if (!strBackgroundError.empty())
+            return error("CLSMStore::Write() : %s", strBackgroundError.c_str());
+        if (pmem->nBytes < nWriteBufferSize)
+            return true;
+
+        // The memory table is full.  Wait if the last one is still being
+        // written out, or level 0 has piled up faster than compaction can
+        // take it away; otherwise start a new one.
+        if (pimm || pversion->vLevel[0].size() >= L0_STOP_WRITES)
+        {
+            condCompact.notify_one();
+            condWrite.wait(lock);
+            continue;
+        }
+        return SwitchMemTable();
+    }
+}
+
+bool CLSMStore::NeedsCompaction() const
+{
+    if (pversion->vLevel[0].size() >= L0_COMPACTION_TRIGGER)
+        return true;
+    for (int nLevel = 1; nLevel < NUM_LEVELS - 1; nLevel++)
+        if (pversion->GetLevelBytes(nLevel) > MaxBytesForLevel(nLevel))
+            return true;
+    return false;
+}
+
+void CLSMStore::FlushImmutable(boost::unique_lock<boost::mutex>& lock)
+{
+    boost::shared_ptr<CLSMMemTable> pmemFlush = pimm;
+    vector<TablePtr> vOutputs;
+    lock.unlock();
+    CLSMMemIterator it(pmemFlush, NULL);
+    it.Seek(string());
+    bool fOk = BuildTables(it, NULL, 0, vOutputs);
+    lock.lock();
+
+    boost::shared_ptr<CLSMVersion> pversionNew(new CLSMVersion(*pversion));
+    pversionNew->vLevel[0].insert(pversionNew->vLevel[0].end(), vOutputs.begin(), vOutputs.end());
+    pversionNew->SortLevels();
+    if (!fOk || !WriteManifest(*pversionNew, nLogNumber))
+    {
+        BOOST_FOREACH(const TablePtr& ptable, vOutputs)
+            ptable->fObsolete = true;
+        strBackgroundError = "flush of the memory table failed";
+        condWrite.notify_all();
+        return;
+    }
+    pversion = pversionNew;
+    pimm.reset();
+    remove(GetFilePath(nImmLogNumber, "log").string().c_str());
+    condWrite.notify_all();
+}
+
+void CLSMStore::Compact(boost::unique_lock<boost::mutex>& lock)
+{
+    boost::shared_ptr<const CLSMVersion> pversionBase = pversion;
+    int nLevel;
+    vector<TablePtr> vInputs[2];
+
+    if (pversionBase->vLevel[0].size() >= L0_COMPACTION_TRIGGER)
+    {
+        nLevel = 0;
+        vInputs[0] = pversionBase->vLevel[0];
+    }
+    else
+    {
+        for (nLevel = 1; nLevel < NUM_LEVELS - 1; nLevel++)
+            if (pversionBase->GetLevelBytes(nLevel) > MaxBytesForLevel(nLevel))
+                break;
+        if (nLevel == NUM_LEVELS - 1)
+            return;
+
+        // Take turns through the key range of the level
+        const vector<TablePtr>& vTables = pversionBase->vLevel[nLevel];
+        TablePtr pinput = vTables.front();
+        BOOST_FOREACH(const TablePtr& ptable, vTables)
+        {
+            if (vCompactPointer[nLevel] < ptable->strSmallest)
+            {
+                pinput = ptable;
+                break;
+            }
+        }
+        vInputs[0].push_back(pinput);
+    }
+
+    string strBegin = vInputs[0].front()->strSmallest;
+    string strEnd = vInputs[0].front()->strLargest;
+    BOOST_FOREACH(const TablePtr& ptable, vInputs[0])
+    {
+        strBegin = min(strBegin, ptable->strSmallest);
+        strEnd = max(strEnd, ptable->strLargest);
+    }
+    pversionBase->GetOverlapping(nLevel + 1, strBegin, strEnd, vInputs[1]);
+
+    vector<TablePtr> vOutputs;
+    bool fMoved = (vInputs[0].size() == 1 && vInputs[1].empty());
+    if (fMoved)
+    {
+        // Nothing to merge with, the table moves down as it is
+        vOutputs = vInputs[0];
+    }
+    else
+    {
+        lock.unlock();
+        vector<CLSMIterator*> vIter;
+        BOOST_FOREACH(const TablePtr& ptable, vInputs[0])
+            vIter.push_back(new CLSMTableIterator(ptable));
+        if (!vInputs[1].empty())
+            vIter.push_back(new CLSMLevelIterator(vInputs[1]));
+        CLSMMergingIterator it(vIter);
+        it.Seek(string());
+        bool fOk = BuildTables(it, pversionBase.get(), nLevel + 1, vOutputs);
+        lock.lock();
+        if (!fOk)
+        {
+            strBackgroundError = "compaction failed";
+            condWrite.notify_all();
+            return;
+        }
+    }
+
+    // Only this thread replaces the version, so it is still pversionBase
+    boost::shared_ptr<CLSMVersion> pversionNew(new CLSMVersion(*pversion));
+    for (int i = 0; i < 2; i++)
+    {
+        vector<TablePtr>& vLevel = pversionNew->vLevel[nLevel + i];
+        BOOST_FOREACH(const TablePtr& ptable, vInputs[i])
+            vLevel.erase(std::remove(vLevel.begin(), vLevel.end(), ptable), vLevel.end());
+    }
+    pversionNew->vLevel[nLevel + 1].insert(pversionNew->vLevel[nLevel + 1].end(), vOutputs.begin(), vOutputs.end());
+    pversionNew->SortLevels();
+    if (nLevel > 0)
+        vCompactPointer[nLevel] = vInputs[0].back()->strLargest;
+
+    if (!WriteManifest(*pversionNew, pimm ? nImmLogNumber : nLogNumber))
+    {
+        if (!fMoved)
+        {
+            BOOST_FOREACH(const TablePtr& ptable, vOutputs)
+                ptable->fObsolete = true;
+        }
+        strBackgroundError = "compaction failed";
+        condWrite.notify_all();
+        return;
+    }
+    if (!fMoved)
+    {
+        for (int i = 0; i < 2; i++)
+            BOOST_FOREACH(const TablePtr& ptable, vInputs[i])
+                ptable->fObsolete = true;
+    }
+    pversion = pversionNew;
+
+    if (fDebug)
+        printf("CLSMStore: compacted %"PRIszu"+%"PRIszu" tables of level %d into %"PRIszu" of level %d\n",
+               vInputs[0].size(), vInputs[1].size(), nLevel, vOutputs.size(), nLevel + 1);
+    condWrite.notify_all();
+}
+
+void CLSMStore::ThreadCompact()
+{
+    RenameThread("bitcoin-lsmcompact");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fStopping)
+    {
+        if (!strBackgroundError.empty())
+            condCompact.wait(lock);
+        else if (pimm)
+            FlushImmutable(lock);
+        else if (NeedsCompaction())
+            Compact(lock);
+        else
+        {
+            condWrite.notify_all();
+            condCompact.wait(lock);
+        }
+    }
+}
+
+bool CLSMStore::Open(const boost::filesystem::path& pathDirIn, size_t nWriteBufferSizeIn)
+{
+    pathDir = pathDirIn;
+    nWriteBufferSize = nWriteBufferSizeIn;
+    fStopping = false;
+    strBackgroundError.clear();
+    try {
+        boost::filesystem::create_directories(pathDir);
+    } catch (std::exception& e) {
+        return error("CLSMStore::Open() : can't create %s: %s", pathDir.string().c_str(), e.what());
+    }
+
+    // Tables of the last manifest
+    boost::shared_ptr<CLSMVersion> pversionNew(new CLSMVersion());
+    unsigned int nManifestLog = 0;
+    set<unsigned int> setLive;
+    nNextFile = 1;
+    if (boost::filesystem::exists(pathDir / "MANIFEST"))
+    {
+        vector<CLSMTableInfo> vInfo;
+        if (!ReadManifest(vInfo, nManifestLog))
+            return false;
+        BOOST_FOREACH(const CLSMTableInfo& info, vInfo)
+        {
+            if (info.nLevel < 0 || info.nLevel >= NUM_LEVELS)
+                return error("CLSMStore::Open() : bad level %d in manifest", info.nLevel);
+            TablePtr ptable(new CLSMTable(GetFilePath(info.nNumber, "sst"), info.nNumber));
+            if (!ptable->Open())
+                return error("CLSMStore::Open() : table %u is missing or damaged", info.nNumber);
+            ptable->strSmallest = info.strSmallest;
+            ptable->strLargest = info.strLargest;
+            pversionNew->vLevel[info.nLevel].push_back(ptable);
+            setLive.insert(info.nNumber);
+        }
+        pversionNew->SortLevels();
+    }
+
+    // Logs still to replay, and files a crash left behind
+    vector<unsigned int> vLogs;
+    for (boost::filesystem::directory_iterator it(pathDir); it != boost::filesystem::directory_iterator(); ++it)
+    {
+        string strName = it->path().filename().string();
+        unsigned int nNumber;
+        char szExt[8];
+        if (sscanf(strName.c_str(), "%u.%7s", &nNumber, szExt) != 2)
+            continue;
+        nNextFile = max(nNextFile, nNumber + 1);
+        string strExt(szExt);
+        if (strExt == "log" && nNumber >= nManifestLog)
+            vLogs.push_back(nNumber);
+        else if (strExt == "log" || (strExt == "sst" && !setLive.count(nNumber)))
+            remove(it->path().string().c_str());
+    }
+    sort(vLogs.begin(), vLogs.end());
+
+    CLSMMemTable* pmemReplay = new CLSMMemTable();
+    boost::shared_ptr<CLSMMemTable> pmemReplayed(pmemReplay);
+    BOOST_FOREACH(unsigned int nNumber, vLogs)
+        if (!ReplayLog(nNumber, *pmemReplay))
+            return false;
+
+    nLogNumber = nNextFile++;
+    fileLog = fopen(GetFilePath(nLogNumber, "log").string().c_str(), "ab");
+    if (!fileLog)
+        return error("CLSMStore::Open() : can't create log %u", nLogNumber);
+
+    // Replayed writes go straight to level 0 so the old logs can go
+    if (!pmemReplay->mapEntries.empty())
+    {
+        CLSMMemIterator it(pmemReplayed, NULL);
+        it.Seek(string());
+        vector<TablePtr> vOutputs;
+        if (!BuildTables(it, NULL, 0, vOutputs))
+            return false;
+        pversionNew->vLevel[0].insert(pversionNew->vLevel[0].end(), vOutputs.begin(), vOutputs.end());
+        pversionNew->SortLevels();
+    }
+    if (!WriteManifest(*pversionNew, nLogNumber))
+        return false;
+    BOOST_FOREACH(unsigned int nNumber, vLogs)
+        remove(GetFilePath(nNumber, "log").string().c_str());
+
+    pversion = pversionNew;
+    pmem.reset(new CLSMMemTable());
+    pimm.reset();
+    pthreadCompact = new boost::thread(boost::bind(&CLSMStore::ThreadCompact, this));
+
+    unsigned int nTables = 0;
+    for (int nLevel = 0; nLevel < NUM_LEVELS; nLevel++)
+        nTables += pversion->vLevel[nLevel].size();
+    printf("CLSMStore: opened %s, %u tables, %"PRIszu" records replayed\n", pathDir.string().c_str(), nTables, pmemReplay->mapEntries.size());
+    return true;
+}
+
+void CLSMStore::Close()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        fStopping = true;
+    }
+    condCompact.notify_all();
+    if (pthreadCompact)
+    {
+        pthreadCompact->join();
+        delete pthreadCompact;
+        pthreadCompact = NULL;
+    }
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (fileLog)
+    {
+        fflush(fileLog);
+        FileCommit(fileLog);
+        fclose(fileLog);
+        fileLog = NULL;
+    }
+    pmem.reset();
+    pimm.reset();
+    pversion.reset();
+}
+
+bool CLSMStore::Read(const string& strKey, string& strValueRet)
+{
+    boost::shared_ptr<const CLSMVersion> pversionRead;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (!pversion)
+            return false;
+        const CLSMMemTable* vpmem[2] = { pmem.get(), pimm.get() };
+        for (int i = 0; i < 2; i++)
+        {
+            if (!vpmem[i])
+                continue;
+            CLSMMemTable::MapType::const_iterator it = vpmem[i]->mapEntries.find(strKey);
+            if (it != vpmem[i]->mapEntries.end())
+            {
+                if (it->second.fErased)
+                    return false;
+                strValueRet = it->second.strValue;
+                return true;
+            }
+        }
+        pversionRead = pversion;
+    }
+
+    bool fFound;
+    CLSMValue value;
+    if (!pversionRead->Get(strKey, BloomHash(strKey), fFound, value) || !fFound || value.fErased)
+        return false;
+    strValueRet.swap(value.strValue);
+    return true;
+}
+
+bool CLSMStore::Exists(const string& strKey)
+{
+    string strValue;
+    return Read(strKey, strValue);
+}
+
+bool CLSMStore::Write(const CKeyValueBatch& batch, bool fSync)
+{
+    if (batch.empty())
+        return true;
+    string strRecord(8, 0);
+    strRecord.reserve(8 + batch.GetDataSize() + batch.size() * 8);
+    EncodeBatch(batch, strRecord);
+    string strHeader;
+    PutFixed32(strHeader, CRC32(strRecord.data() + 8, strRecord.size() - 8));
+    PutFixed32(strHeader, strRecord.size() - 8);
+    strRecord.replace(0, 8, strHeader);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!fileLog)
+        return error("CLSMStore::Write() : store is not open");
+    if (!MakeRoomForWrite(lock))
+        return false;
+    if (fwrite(strRecord.data(), 1, strRecord.size(), fileLog) != strRecord.size() || fflush(fileLog) != 0)
+    {
+        // Whatever follows a torn record would be lost on replay
+        strBackgroundError = "write to the log failed";
+        return error("CLSMStore::Write() : write to log %u failed", nLogNumber);
+    }
+    if (fSync)
+        FileCommit(fileLog);
+    pmem->Apply(batch);
+    return true;
+}
+
+CKeyValueCursor* CLSMStore::NewCursor()
+{
+    vector<CLSMIterator*> vIter;
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (pmem)
+        vIter.push_back(new CLSMMemIterator(pmem, &mutex));
+    if (pimm)
+        vIter.push_back(new CLSMMemIterator(pimm, NULL));
+    if (pversion)
+        pversion->AddIterators(vIter);
+    return new CLSMCursor(new CLSMMergingIterator(vIter));
+}
+
+bool CLSMStore::Sync()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!fileLog)
+        return false;
+    if (fflush(fileLog) != 0)
+        return error("CLSMStore::Sync() : flush of log %u failed", nLogNumber);
+    FileCommit(fileLog);
+    return true;
+}
+
+bool CLSMStore::WaitForCompaction(bool fFlushMemTable)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!pmem)
+        return false;
+    if (fFlushMemTable && !pmem->mapEntries.empty())
+    {
+        while (pimm && strBackgroundError.empty())
+        {
+            condCompact.notify_one();
+            condWrite.wait(lock);
+        }
+        if (strBackgroundError.empty() && !SwitchMemTable())
+            return false;
+    }
+    condCompact.notify_one();
+    while (strBackgroundError.empty() && (pimm || NeedsCompaction()))
+        condWrite.wait(lock);
+    return strBackgroundError.empty();
+}
+
+vector<unsigned int> CLSMStore::GetTableCounts()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    vector<unsigned int> vCounts(NUM_LEVELS, 0);
+    if (pversion)
+        for (int nLevel = 0; nLevel < NUM_LEVELS; nLevel++)
+            vCounts[nLevel] = pversion->vLevel[nLevel].size();
+    return vCounts;
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_LSMDB_H
+#define MIRACLECOIN_LSMDB_H
+
+#include "kvstore.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CLSMIterator;
+class CLSMMemTable;
+class CLSMTable;
+class CLSMTableInfo;
+class CLSMVersion;
+
+/** An embedded log-structured merge store, the -txdb=lsm engine.
+ *
+ * Writes are appended to a write-ahead log and applied to a sorted
+ * in-memory table.  When that grows past the write buffer size it is frozen
+ * and a background thread writes it out as an immutable sorted table in
+ * level 0, after which its log is deleted.  Level 0 tables may overlap each
+ * other; once there are L0_COMPACTION_TRIGGER of them they are merged into
+ * level 1, and any deeper level that outgrows its budget (ten times the one
+ * above) has one table at a time merged into the next.  Levels 1 and up
+ * hold tables with disjoint key ranges, so a read looks at the memory
+ * tables, the level 0 tables newest first, and at most one table per deeper
+ * level, skipping most of those with the bloom filter each table carries.
+ *
+ * The MANIFEST file names the live tables and the oldest log still needed.
+ * It is replaced atomically after every flush and compaction, so a crash at
+ * any point leaves a store that opens to the last logged write.
+ */
+class CLSMStore : public CKeyValueStore
+{
+public:
+    enum
+    {
+        NUM_LEVELS = 7,
+        L0_COMPACTION_TRIGGER = 4,
+        L0_STOP_WRITES = 12,
+    };
+
+    static const size_t DEFAULT_WRITE_BUFFER_SIZE = 8 << 20;
+
+    typedef boost::shared_ptr<CLSMTable> TablePtr;
+
+private:
+    boost::filesystem::path pathDir;
+    size_t nWriteBufferSize;
+
+    boost::mutex mutex;
+    boost::condition_variable condCompact;
+    boost::condition_variable condWrite;
+    boost::thread* pthreadCompact;
+    bool fStopping;
+    std::string strBackgroundError;
+
+    boost::shared_ptr<CLSMMemTable> pmem;
+    boost::shared_ptr<CLSMMemTable> pimm;
+    boost::shared_ptr<const CLSMVersion> pversion;
+    FILE* fileLog;
+    unsigned int nLogNumber;
+    unsigned int nImmLogNumber;
+    unsigned int nNextFile;
+    std::string vCompactPointer[NUM_LEVELS];
+
+    CLSMStore(const CLSMStore&);
+    void operator=(const CLSMStore&);
+
+    boost::filesystem::path GetFilePath(unsigned int nNumber, const char* pszExt) const;
+    unsigned int NewFileNumber();
+    bool ReadManifest(std::vector<CLSMTableInfo>& vInfoRet, unsigned int& nLogNumberRet);
+    bool WriteManifest(const CLSMVersion& version, unsigned int nLogNumberIn);
+    bool ReplayLog(unsigned int nNumber, CLSMMemTable& mem);
+    bool BuildTables(CLSMIterator& it, const CLSMVersion* pversionBase, int nOutputLevel, std::vector<TablePtr>& vOutputs);
+    bool SwitchMemTable();
+    bool MakeRoomForWrite(boost::unique_lock<boost::mutex>& lock);
+    bool NeedsCompaction() const;
+    void FlushImmutable(boost::unique_lock<boost::mutex>& lock);
+    void Compact(boost::unique_lock<boost::mutex>& lock);
+    void ThreadCompact();
+
+public:
+    CLSMStore();
+    ~CLSMStore();
+
+    bool Open(const boost::filesystem::path& pathDirIn, size_t nWriteBufferSizeIn = DEFAULT_WRITE_BUFFER_SIZE);
+    void Close();
+
+    bool Read(const std::string& strKey, std::string& strValueRet);
+    bool Exists(const std::string& strKey);
+    bool Write(const CKeyValueBatch& batch, bool fSync);
+    CKeyValueCursor* NewCursor();
+    bool Sync();
+
+    // Block until the background thread has nothing left to do, after
+    // moving the memory table out to level 0 if fFlushMemTable
+    bool WaitForCompaction(bool fFlushMemTable);
+
+    // Number of tables in each level
+    std::vector<unsigned int> GetTableCounts();
+};
+
+#endif // MIRACLECOIN_LSMDB_H
@@ -10,6 +10,7 @@
 #include "init.h"
 #include "ui_interface.h"
 #include "kernel.h"
+#include "checkqueue.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -31,7 +32,7 @@ CCriticalSection cs_main;
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 uint256 hashGenesisBlock = hashGenesisBlockOfficial;
 static CBigNum bnProofOfWorkLimit(~uint256(0) >> 20);
@@ -49,11 +50,13 @@ int64 nChainStartTime = 1408199514;
 int nCoinbaseMaturity = 10;
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
-CBigNum bnBestChainTrust = 0;
-CBigNum bnBestInvalidTrust = 0;
+uint256 nBestChainTrust = 0;
+uint256 nBestInvalidTrust = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
+int nScriptCheckThreads = 0;
+bool fAddrIndex = false;
 
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
 
@@ -347,7 +350,7 @@ bool CTransaction::AreInputsStandard(const MapPrevTx& mapInputs) const
         // be quick, because if there are any operations
         // beside "push data" in the scriptSig the
         // IsStandard() call returns false
-        vector<vector<unsigned char> > stack;
+        CScriptStack stack;
         if (!EvalScript(stack, vin[i].scriptSig, *this, i, 0))
             return false;
 
@@ -434,7 +437,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -715,7 +718,7 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTransaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+    for (uint256_map<CTransaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
         vtxid.push_back((*mi).first);
 }
 
@@ -728,7 +731,7 @@ int CMerkleTx::GetDepthInMainChain(CBlockIndex* &pindexRet) const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -806,6 +809,8 @@ bool CWalletTx::AcceptWalletTransaction()
 }
 
 
+bool CTxIndex::fKeepSpenders = false;
+
 int CTxIndex::GetDepthInMainChain() const
 {
     // Read block header
@@ -813,7 +818,7 @@ int CTxIndex::GetDepthInMainChain() const
     if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -873,6 +878,56 @@ CBlockIndex* FindBlockByHeight(int nHeight)
 }
 
 
+// Number of nodes in the merkle tree of nLeaves transactions
+static unsigned int GetMerkleTreeSize(unsigned int nLeaves)
+{
+    unsigned int nNodes = nLeaves;
+    for (unsigned int nSize = nLeaves; nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += (nSize + 1) / 2;
+    return nNodes;
+}
+
+uint256 CBlock::BuildMerkleTree() const
+{
+    // Levels are stored one after the other, so the pairs of a level are
+    // adjacent 64-byte messages that SHA256D64 hashes as one batch.  The
+    // vector keeps its capacity, so rebuilding a tree doesn't allocate.
+    vMerkleTree.resize(GetMerkleTreeSize(vtx.size()));
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        vMerkleTree[i] = vtx[i].GetHash();
+    int j = 0;
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        int nPairs = nSize / 2;
+        SHA256D64((unsigned char*)&vMerkleTree[j + nSize], (const unsigned char*)&vMerkleTree[j], nPairs);
+        // An odd one out is paired with itself
+        if (nSize & 1)
+        {
+            const uint256& hashLast = vMerkleTree[j + nSize - 1];
+            vMerkleTree[j + nSize + nPairs] = Hash(BEGIN(hashLast), END(hashLast), BEGIN(hashLast), END(hashLast));
+        }
+        j += nSize;
+    }
+    return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
+}
+
+uint256 CBlock::UpdateMerkleTreeCoinbase() const
+{
+    if (vtx.empty() || vMerkleTree.size() != GetMerkleTreeSize(vtx.size()))
+        return BuildMerkleTree();
+
+    // The coinbase is the first node of every level
+    vMerkleTree[0] = vtx[0].GetHash();
+    int j = 0;
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        vMerkleTree[j + nSize] = Hash(BEGIN(vMerkleTree[j]), END(vMerkleTree[j]),
+                                      BEGIN(vMerkleTree[j + 1]), END(vMerkleTree[j + 1]));
+        j += nSize;
+    }
+    return vMerkleTree.back();
+}
+
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
 {
     if (!fReadTransactions)
@@ -1036,6 +1091,45 @@ bool CheckProofOfWork(uint256 hash, unsigned int nBits)
     return true;
 }
 
+static void PrecomputeBlockHashesRange(const std::vector<const CBlock*>* pvpblock, size_t nBegin, size_t nEnd)
+{
+    static const size_t nHeaderSize = 80;
+    std::vector<unsigned char> vchHeaders((nEnd - nBegin) * nHeaderSize);
+    std::vector<unsigned char> vchHashes((nEnd - nBegin) * 64);
+    for (size_t i = nBegin; i < nEnd; i++)
+        memcpy(&vchHeaders[(i - nBegin) * nHeaderSize], BEGIN((*pvpblock)[i]->nVersion), nHeaderSize);
+
+    X11HashBatch(&vchHeaders[0], nHeaderSize, nEnd - nBegin, &vchHashes[0]);
+
+    for (size_t i = nBegin; i < nEnd; i++)
+    {
+        uint256 hash;
+        memcpy(BEGIN(hash), &vchHashes[(i - nBegin) * 64], sizeof(hash));
+        (*pvpblock)[i]->SetCachedHash(hash);
+    }
+}
+
+// Hash many block headers in one go, so later GetHash() calls are cache hits.
+// Large batches are split across the available cores.
+void PrecomputeBlockHashes(const std::vector<const CBlock*>& vpblock)
+{
+    static const size_t nMinPerThread = 256;
+    size_t nThreads = std::max(1, (int)boost::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, vpblock.size() / nMinPerThread);
+    if (nThreads <= 1)
+    {
+        if (!vpblock.empty())
+            PrecomputeBlockHashesRange(&vpblock, 0, vpblock.size());
+        return;
+    }
+
+    boost::thread_group threadGroup;
+    size_t nPerThread = (vpblock.size() + nThreads - 1) / nThreads;
+    for (size_t nBegin = 0; nBegin < vpblock.size(); nBegin += nPerThread)
+        threadGroup.create_thread(boost::bind(&PrecomputeBlockHashesRange, &vpblock, nBegin, std::min(nBegin + nPerThread, vpblock.size())));
+    threadGroup.join_all();
+}
+
 // Return maximum amount of blocks that other nodes claim to have
 int GetNumBlocksOfPeers()
 {
@@ -1059,19 +1153,19 @@ bool IsInitialBlockDownload()
 
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
-    if (pindexNew->bnChainTrust > bnBestInvalidTrust)
+    if (pindexNew->nChainTrust > nBestInvalidTrust)
     {
-        bnBestInvalidTrust = pindexNew->bnChainTrust;
-        CTxDB().WriteBestInvalidTrust(bnBestInvalidTrust);
+        nBestInvalidTrust = pindexNew->nChainTrust;
+        CTxDB().WriteBestInvalidTrust(nBestInvalidTrust);
         uiInterface.NotifyBlocksChanged();
     }
 
     printf("InvalidChainFound: invalid block=%s  height=%d  trust=%s  date=%s\n",
       pindexNew->GetBlockHash().ToString().substr(0,20).c_str(), pindexNew->nHeight,
-      pindexNew->bnChainTrust.ToString().c_str(), DateTimeStrFormat("%x %H:%M:%S",
+      CBigNum(pindexNew->nChainTrust).ToString().c_str(), DateTimeStrFormat("%x %H:%M:%S",
       pindexNew->GetBlockTime()).c_str());
     printf("InvalidChainFound:  current best=%s  height=%d  trust=%s  date=%s\n",
-      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainTrust.ToString().c_str(),
+      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, CBigNum(nBestChainTrust).ToString().c_str(),
       DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()).c_str());
 }
 
@@ -1095,11 +1189,11 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
             if (!txdb.ReadTxIndex(prevout.hash, txindex))
                 return error("DisconnectInputs() : ReadTxIndex failed");
 
-            if (prevout.n >= txindex.vSpent.size())
+            if (prevout.n >= txindex.GetOutputCount())
                 return error("DisconnectInputs() : prevout.n out of range");
 
             // Mark outpoint as not spent
-            txindex.vSpent[prevout.n].SetNull();
+            txindex.MarkUnspent(prevout.n);
 
             // Write back
             if (!txdb.UpdateTxIndex(prevout.hash, txindex))
@@ -1163,7 +1257,7 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
                 txPrev = mempool.lookup(prevout.hash);
             }
             if (!fFound)
-                txindex.vSpent.resize(txPrev.vout.size());
+                txindex.SetOutputCount(txPrev.vout.size());
         }
         else
         {
@@ -1180,12 +1274,12 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
         assert(inputsRet.count(prevout.hash) != 0);
         const CTxIndex& txindex = inputsRet[prevout.hash].first;
         const CTransaction& txPrev = inputsRet[prevout.hash].second;
-        if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
+        if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.GetOutputCount())
         {
             // Revisit this if/when transaction replacement is implemented and allows
             // adding inputs:
             fInvalid = true;
-            return DoS(100, error("FetchInputs() : %s prevout.n out of range %d %"PRIszu" %"PRIszu" prev tx %s\n%s", GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(), txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(), txPrev.ToString().c_str()));
+            return DoS(100, error("FetchInputs() : %s prevout.n out of range %d %"PRIszu" %u prev tx %s\n%s", GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(), txindex.GetOutputCount(), prevout.hash.ToString().substr(0,10).c_str(), txPrev.ToString().c_str()));
         }
     }
 
@@ -1238,9 +1332,25 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
 }
 
 
+bool CScriptCheck::operator()() const
+{
+    const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, fStrictPayToScriptHash, nHashType, pcontext.get()))
+    {
+        // only during transition phase for P2SH: do not invoke anti-DoS code for
+        // potentially old clients relaying bad P2SH transactions
+        bool fP2SHOnly = fStrictPayToScriptHash && VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, false, nHashType, pcontext.get());
+        if (pstatus)
+            pstatus->Failed(!fP2SHOnly);
+        return error("CScriptCheck() : %s %sVerifySignature failed", ptxTo->GetHash().ToString().substr(0,10).c_str(), fP2SHOnly ? "P2SH " : "");
+    }
+    return true;
+}
+
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                                  map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash)
+                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash,
+                                 std::vector<CScriptCheck>* pvChecks, CScriptCheckStatus* pstatus)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1257,8 +1367,8 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             CTxIndex& txindex = inputs[prevout.hash].first;
             CTransaction& txPrev = inputs[prevout.hash].second;
 
-            if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
-                return DoS(100, error("ConnectInputs() : %s prevout.n out of range %d %"PRIszu" %"PRIszu" prev tx %s\n%s", GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(), txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(), txPrev.ToString().c_str()));
+            if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.GetOutputCount())
+                return DoS(100, error("ConnectInputs() : %s prevout.n out of range %d %"PRIszu" %u prev tx %s\n%s", GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(), txindex.GetOutputCount(), prevout.hash.ToString().substr(0,10).c_str(), txPrev.ToString().c_str()));
 
             // If prev is coinbase or coinstake, check that it's matured
             if (txPrev.IsCoinBase() || txPrev.IsCoinStake())
@@ -1279,6 +1389,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+        boost::shared_ptr<const CSignatureHashContext> pcontext;
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1289,20 +1400,32 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             // Check for conflicts (double-spend)
             // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
             // for an attacker to attempt to split the network.
-            if (!txindex.vSpent[prevout.n].IsNull())
-                return fMiner ? false : error("ConnectInputs() : %s prev tx already used at %s", GetHash().ToString().substr(0,10).c_str(), txindex.vSpent[prevout.n].ToString().c_str());
+            if (txindex.IsSpent(prevout.n))
+            {
+                CDiskTxPos posSpender;
+                return fMiner ? false : error("ConnectInputs() : %s prev tx already used at %s", GetHash().ToString().substr(0,10).c_str(), txindex.GetSpender(prevout.n, posSpender) ? posSpender.ToString().c_str() : "unrecorded position");
+            }
 
             // Skip ECDSA signature verification when connecting blocks (fBlock=true)
             // before the last blockchain checkpoint. This is safe because block merkle hashes are
             // still computed and checked, and any change will be caught at the next checkpoint.
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
-                // Verify signature
-                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0))
+                // Signature hashes of several inputs share most of their work
+                if (!pcontext && vin.size() > 1)
+                    pcontext.reset(new CSignatureHashContext(*this));
+
+                // Verify signature, or leave it to the caller's check queue
+                if (pvChecks)
+                {
+                    pvChecks->push_back(CScriptCheck());
+                    CScriptCheck(txPrev, *this, i, fStrictPayToScriptHash, 0, pcontext, pstatus).swap(pvChecks->back());
+                }
+                else if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0, pcontext.get()))
                 {
                     // only during transition phase for P2SH: do not invoke anti-DoS code for
                     // potentially old clients relaying bad P2SH transactions
-                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, 0))
+                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, 0, pcontext.get()))
                         return error("ConnectInputs() : %s P2SH VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
 
                     return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str()));
@@ -1310,7 +1433,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             }
 
             // Mark outpoints as spent
-            txindex.vSpent[prevout.n] = posThisTx;
+            txindex.MarkSpent(prevout.n, posThisTx);
 
             // Write back
             if (fBlock || fMiner)
@@ -1399,12 +1522,169 @@ bool CTransaction::ClientConnectInputs()
 }
 
 
-bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
+// Add the address index entries of a block.  vSpent holds the outputs its
+// inputs spend, in the order of the inputs.  The destinations of those are
+// kept to take the entries out again without reading the transactions.
+static bool ConnectAddrIndex(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, const vector<CTxOut>& vSpent)
+{
+    vector<CAddrIndexDest> vSpentDests;
+    vSpentDests.reserve(vSpent.size());
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        uint256 hashTx = tx.GetHash();
+        if (!tx.IsCoinBase())
+        {
+            for (unsigned int i = 0; i < tx.vin.size(); i++)
+            {
+                if (vSpentDests.size() >= vSpent.size())
+                    return error("ConnectAddrIndex() : spent output missing");
+                const CTxOut& txout = vSpent[vSpentDests.size()];
+                CAddrIndexDest dest(txout.scriptPubKey);
+                if (!txdb.WriteAddrIndex(CAddrIndexKey(dest, pindex->nHeight, hashTx, true, i), CAddrIndexValue(txout.nValue, tx.vin[i].prevout)))
+                    return error("ConnectAddrIndex() : WriteAddrIndex failed");
+                vSpentDests.push_back(dest);
+            }
+        }
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            const CTxOut& txout = tx.vout[i];
+            if (txout.IsEmpty())
+                continue;
+            if (!txdb.WriteAddrIndex(CAddrIndexKey(CAddrIndexDest(txout.scriptPubKey), pindex->nHeight, hashTx, false, i), CAddrIndexValue(txout.nValue)))
+                return error("ConnectAddrIndex() : WriteAddrIndex failed");
+        }
+    }
+    if (!txdb.WriteAddrIndexUndo(pindex->GetBlockHash(), vSpentDests))
+        return error("ConnectAddrIndex() : WriteAddrIndexUndo failed");
+    return true;
+}
+
+static bool DisconnectAddrIndex(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex)
 {
-    // Disconnect in reverse order
-    for (int i = vtx.size()-1; i >= 0; i--)
-        if (!vtx[i].DisconnectInputs(txdb))
+    uint256 hash = pindex->GetBlockHash();
+    vector<CAddrIndexDest> vSpentDests;
+    bool fUndo = txdb.ReadAddrIndexUndo(hash, vSpentDests);
+    if (!fUndo)
+        printf("DisconnectAddrIndex() : no undo record for %s, inputs stay in the address index\n", hash.ToString().substr(0,20).c_str());
+
+    unsigned int nSpent = 0;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        uint256 hashTx = tx.GetHash();
+        if (fUndo && !tx.IsCoinBase())
+        {
+            for (unsigned int i = 0; i < tx.vin.size(); i++)
+            {
+                if (nSpent >= vSpentDests.size())
+                    return error("DisconnectAddrIndex() : undo record too short");
+                if (!txdb.EraseAddrIndex(CAddrIndexKey(vSpentDests[nSpent++], pindex->nHeight, hashTx, true, i)))
+                    return error("DisconnectAddrIndex() : EraseAddrIndex failed");
+            }
+        }
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            const CTxOut& txout = tx.vout[i];
+            if (txout.IsEmpty())
+                continue;
+            if (!txdb.EraseAddrIndex(CAddrIndexKey(CAddrIndexDest(txout.scriptPubKey), pindex->nHeight, hashTx, false, i)))
+                return error("DisconnectAddrIndex() : EraseAddrIndex failed");
+        }
+    }
+    if (fUndo && !txdb.EraseAddrIndexUndo(hash))
+        return error("DisconnectAddrIndex() : EraseAddrIndexUndo failed");
+    return true;
+}
+
+bool BuildAddrIndex()
+{
+    CTxDB txdb("r+");
+    if (txdb.ReadAddrIndexBuilt())
+        return true;
+
+    // Whatever is there was left by an earlier run and may be stale
+    printf("BuildAddrIndex() : building the address index\n");
+    int64 nStart = GetTimeMillis();
+    if (!txdb.ClearAddrIndex())
+        return error("BuildAddrIndex() : ClearAddrIndex failed");
+
+    // The genesis block is never connected, so it has no entries either
+    for (CBlockIndex* pindex = pindexGenesisBlock ? pindexGenesisBlock->pnext : NULL; pindex; pindex = pindex->pnext)
+    {
+        if (fRequestShutdown)
+            return txdb.Flush(true);
+
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return error("BuildAddrIndex() : ReadFromDisk failed");
+        vector<CTxOut> vSpent;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            if (tx.IsCoinBase())
+                continue;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                CTransaction txPrev;
+                if (!txdb.ReadDiskTx(txin.prevout.hash, txPrev) || txin.prevout.n >= txPrev.vout.size())
+                    return error("BuildAddrIndex() : prev tx %s not found", txin.prevout.hash.ToString().substr(0,10).c_str());
+                vSpent.push_back(txPrev.vout[txin.prevout.n]);
+            }
+        }
+
+        if (!txdb.TxnBegin())
+            return error("BuildAddrIndex() : TxnBegin failed");
+        if (!ConnectAddrIndex(txdb, block, pindex, vSpent))
+        {
+            txdb.TxnAbort();
             return false;
+        }
+        // Only the blocks ConnectBlock() would still keep undo records for
+        if (nBestHeight - pindex->nHeight >= BLOCK_UNDO_DEPTH && !txdb.EraseAddrIndexUndo(pindex->GetBlockHash()))
+        {
+            txdb.TxnAbort();
+            return error("BuildAddrIndex() : EraseAddrIndexUndo failed");
+        }
+        if (!txdb.TxnCommit())
+            return error("BuildAddrIndex() : TxnCommit failed");
+        if (pindex->nHeight % 10000 == 0)
+            printf("BuildAddrIndex() : at height %d\n", pindex->nHeight);
+    }
+
+    if (!txdb.WriteAddrIndexBuilt(true) || !txdb.Flush(true))
+        return error("BuildAddrIndex() : write failed");
+    printf("BuildAddrIndex() : done to height %d in %"PRI64d"ms\n", nBestHeight, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    CBlockUndo undo;
+    if (txdb.ReadBlockUndo(hash, undo))
+    {
+        // Remove the transactions the block added, then put back what it
+        // spent from.  Unlike in DisconnectInputs every erase must succeed:
+        // ConnectBlock wrote each of these, a duplicate of an older
+        // transaction included, which vPrev then restores.
+        BOOST_FOREACH(const uint256& hashTx, undo.vCreated)
+            if (!txdb.EraseTxIndex(hashTx))
+                return error("DisconnectBlock() : EraseTxIndex failed");
+        for (unsigned int i = 0; i < undo.vPrev.size(); i++)
+            if (!txdb.UpdateTxIndex(undo.vPrev[i].first, undo.vPrev[i].second))
+                return error("DisconnectBlock() : UpdateTxIndex failed");
+        if (!txdb.EraseBlockUndo(hash))
+            return error("DisconnectBlock() : EraseBlockUndo failed");
+    }
+    else
+    {
+        // Connected before undo records were written, or deeper than
+        // BLOCK_UNDO_DEPTH.  Disconnect in reverse order
+        for (int i = vtx.size()-1; i >= 0; i--)
+            if (!vtx[i].DisconnectInputs(txdb))
+                return false;
+    }
+
+    if (fAddrIndex && !DisconnectAddrIndex(txdb, *this, pindex))
+        return false;
 
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
@@ -1423,6 +1703,21 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
     return true;
 }
 
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+void ThreadScriptCheck(void*)
+{
+    vnThreadsRunning[THREAD_SCRIPTCHECK]++;
+    RenameThread("bitcoin-scriptch");
+    scriptcheckqueue.Thread();
+    vnThreadsRunning[THREAD_SCRIPTCHECK]--;
+}
+
+void ThreadScriptCheckQuit()
+{
+    scriptcheckqueue.Quit();
+}
+
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 {
     // Check it again in case a previous version let a bad block in
@@ -1453,7 +1748,15 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     else
         nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
 
+    // Script checks of the whole block run on the check queue's threads
+    // while the rest of the block is processed; they are joined below,
+    // before anything is written
+    CScriptCheckStatus checkstatus;
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
     map<uint256, CTxIndex> mapQueuedChanges;
+    CBlockUndo undo;
+    vector<CTxOut> vSpent;
     int64 nFees = 0;
     int64 nValueIn = 0;
     int64 nValueOut = 0;
@@ -1464,12 +1767,14 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 
         if (fEnforceBIP30) {
             CTxIndex txindexOld;
-            if (txdb.ReadTxIndex(hashTx, txindexOld)) {
-                BOOST_FOREACH(CDiskTxPos &pos, txindexOld.vSpent)
-                    if (pos.IsNull())
-                        return false;
+            if (txdb.ReadTxIndex(hashTx, txindexOld))
+            {
+                if (!txindexOld.IsFullySpent())
+                    return false;
+                undo.vPrev.push_back(make_pair(hashTx, txindexOld));
             }
         }
+        undo.vCreated.push_back(hashTx);
 
         nSigOps += tx.GetLegacySigOpCount();
         if (nSigOps > MAX_BLOCK_SIGOPS)
@@ -1505,13 +1810,33 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (!tx.IsCoinStake())
                 nFees += nTxValueIn - nTxValueOut;
 
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fStrictPayToScriptHash))
+            // Records not changed earlier in this block are as the txdb has them
+            for (MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
+                if (!mapQueuedChanges.count(mi->first))
+                    undo.vPrev.push_back(make_pair(mi->first, mi->second.first));
+
+            std::vector<CScriptCheck> vChecks;
+            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fStrictPayToScriptHash, nScriptCheckThreads ? &vChecks : NULL, &checkstatus))
                 return false;
+            control.Add(vChecks);
+
+            if (fAddrIndex && !fJustCheck)
+            {
+                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                    vSpent.push_back(mapInputs[txin.prevout.hash].second.vout[txin.prevout.n]);
+            }
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
     }
 
+    if (!control.Wait())
+    {
+        if (!checkstatus.IsDoS())
+            return error("ConnectBlock() : P2SH script verification failed");
+        return DoS(100, error("ConnectBlock() : script verification failed"));
+    }
+
     // ppcoin: track money supply and mint amount info
     pindex->nMint = nValueOut - nValueIn + nFees;
     pindex->nMoneySupply = (pindex->pprev? pindex->pprev->nMoneySupply : 0) + nValueOut - nValueIn;
@@ -1532,6 +1857,23 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         if (!txdb.UpdateTxIndex((*mi).first, (*mi).second))
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
+    if (!txdb.WriteBlockUndo(pindex->GetBlockHash(), undo))
+        return error("ConnectBlock() : WriteBlockUndo failed");
+
+    // The record of the block this one takes out of BLOCK_UNDO_DEPTH is not
+    // needed any more
+    const CBlockIndex* pindexUndo = pindex;
+    for (int i = 0; i < BLOCK_UNDO_DEPTH && pindexUndo; i++)
+        pindexUndo = pindexUndo->pprev;
+    if (pindexUndo && !txdb.EraseBlockUndo(pindexUndo->GetBlockHash()))
+        return error("ConnectBlock() : EraseBlockUndo failed");
+    if (fAddrIndex)
+    {
+        if (!ConnectAddrIndex(txdb, *this, pindex, vSpent))
+            return false;
+        if (pindexUndo && !txdb.EraseAddrIndexUndo(pindexUndo->GetBlockHash()))
+            return error("ConnectBlock() : EraseAddrIndexUndo failed");
+    }
 
 	uint256 prevHash = 0;
 	if(pindex->pprev)
@@ -1712,7 +2054,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 
         // Reorganize is costly in terms of db load, as it works in a single db transaction.
         // Try to limit how much needs to be done inside
-        while (pindexIntermediate->pprev && pindexIntermediate->pprev->bnChainTrust > pindexBest->bnChainTrust)
+        while (pindexIntermediate->pprev && pindexIntermediate->pprev->nChainTrust > pindexBest->nChainTrust)
         {
             vpindexSecondary.push_back(pindexIntermediate);
             pindexIntermediate = pindexIntermediate->pprev;
@@ -1761,13 +2103,20 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     pindexBest = pindexNew;
     pblockindexFBBHLast = NULL;
     nBestHeight = pindexBest->nHeight;
-    bnBestChainTrust = pindexNew->bnChainTrust;
+    nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
     printf("SetBestChain: new best=%s  height=%d  trust=%s  date=%s\n",
-      hashBestChain.ToString().c_str(), nBestHeight, bnBestChainTrust.ToString().c_str(),
+      hashBestChain.ToString().c_str(), nBestHeight, CBigNum(nBestChainTrust).ToString().c_str(),
       DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()).c_str());
 
+    // Near the tip every block is made durable, during initial download
+    // the blocks of a while are written out together
+    if (!txdb.PeriodicFlush(!fIsInitialDownload))
+    {
+        printf("SetBestChain() : flush of the transaction database failed, will retry\n");
+    }
+
 	printf("Stake checkpoint: %x\n", pindexBest->nStakeModifierChecksum);
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
@@ -1879,7 +2228,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     if (!pindexNew)
         return error("AddToBlockIndex() : new CBlockIndex failed");
     pindexNew->phashBlock = &hash;
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -1887,7 +2236,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     }
 
     // ppcoin: compute chain trust score
-    pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
+    pindexNew->nChainTrust = (pindexNew->pprev ? pindexNew->pprev->nChainTrust : 0) + pindexNew->GetBlockTrust();
 
     // ppcoin: compute stake entropy bit for stake modifier
     if (!pindexNew->SetStakeEntropyBit(GetStakeEntropyBit(pindexNew->nHeight)))
@@ -1898,7 +2247,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     {
         if (!mapProofOfStake.count(hash))
             return error("AddToBlockIndex() : hashProofOfStake not found in map");
-        pindexNew->hashProofOfStake = mapProofOfStake[hash];
+        pindexNew->pstake->hashProofOfStake = mapProofOfStake[hash];
     }
 
     // ppcoin: compute stake modifier
@@ -1912,9 +2261,9 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return error("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=0x%016"PRI64x, pindexNew->nHeight, nStakeModifier);
 
     // Add to mapBlockIndex
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     if (pindexNew->IsProofOfStake())
-        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+        setStakeSeen.insert(make_pair(pindexNew->GetPrevoutStake(), pindexNew->GetStakeTime()));
     pindexNew->phashBlock = &((*mi).first);
 
     // Write to disk block index
@@ -1926,7 +2275,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return false;
 
     // New best
-    if (pindexNew->bnChainTrust > bnBestChainTrust)
+    if (pindexNew->nChainTrust > nBestChainTrust)
         if (!SetBestChain(txdb, pindexNew))
             return false;
 
@@ -1949,6 +2298,8 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot) const
 {
     // These are checks that are independent of context
     // that can be verified before saving an orphan block.
+    if (fChecked && fCheckPOW && fCheckMerkleRoot)
+        return true;
 
     // Size limits
     if (vtx.empty() || vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
@@ -2023,7 +2374,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return DoS(10, error("AcceptBlock() : prev block not found"));
     CBlockIndex* pindexPrev = (*mi).second;
@@ -2105,26 +2456,57 @@ bool CBlock::AcceptBlock()
 }
 
 
-CBigNum CBlockIndex::GetBlockTrust() const
+uint256 CBlockIndex::GetBlockTrust() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
-    if (bnTarget <= 0)
+    bool fNegative, fOverflow;
+    uint256 nTarget;
+    nTarget.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || nTarget == 0)
         return 0;
 
     if (IsProofOfStake())
     {
-        // Return trust score as usual
-        return (CBigNum(1)<<256) / (bnTarget+1);
+        // Return trust score as usual, 2**256 / (nTarget+1), which is
+        // ~nTarget / (nTarget+1) + 1 without going past 256 bits
+        return (~nTarget / (nTarget + 1)) + 1;
     }
     else
     {
         // Calculate work amount for block
-        CBigNum bnPoWTrust = (bnProofOfWorkLimit / (bnTarget+1));
-        return bnPoWTrust > 1 ? bnPoWTrust : 1;
+        uint256 nPoWTrust = bnProofOfWorkLimit.getuint256() / (nTarget + 1);
+        return nPoWTrust > 1 ? nPoWTrust : 1;
     }
 }
 
+static CObjectPool<CBlockIndex> poolBlockIndex;
+static CObjectPool<CBlockIndexStake> poolBlockIndexStake;
+
+void* CBlockIndex::operator new(size_t nSize)
+{
+    // Inherited by CDiskBlockIndex, which is larger
+    if (nSize != sizeof(CBlockIndex))
+        return ::operator new(nSize);
+    return poolBlockIndex.Allocate();
+}
+
+void CBlockIndex::operator delete(void* p, size_t nSize)
+{
+    if (nSize != sizeof(CBlockIndex))
+        ::operator delete(p);
+    else
+        poolBlockIndex.Free(p);
+}
+
+void* CBlockIndexStake::operator new(size_t nSize)
+{
+    return poolBlockIndexStake.Allocate();
+}
+
+void CBlockIndexStake::operator delete(void* p, size_t nSize)
+{
+    poolBlockIndexStake.Free(p);
+}
+
 bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned int nRequired, unsigned int nToCheck)
 {
     unsigned int nFound = 0;
@@ -2348,13 +2730,9 @@ bool CBlock::CheckBlockSignature() const
             return false;
         if (whichType == TX_PUBKEY)
         {
-            valtype& vchPubKey = vSolutions[0];
-            CKey key;
-            if (!key.SetPubKey(vchPubKey))
-                return false;
             if (vchBlockSig.empty())
                 return false;
-            return key.Verify(GetHash(), vchBlockSig);
+            return CPubKey(vSolutions[0]).Verify(GetHash(), vchBlockSig);
         }
     }
     else
@@ -2369,13 +2747,9 @@ bool CBlock::CheckBlockSignature() const
             if (whichType == TX_PUBKEY)
             {
                 // Verify
-                valtype& vchPubKey = vSolutions[0];
-                CKey key;
-                if (!key.SetPubKey(vchPubKey))
-                    continue;
                 if (vchBlockSig.empty())
                     continue;
-                if(!key.Verify(GetHash(), vchBlockSig))
+                if (!CPubKey(vSolutions[0]).Verify(GetHash(), vchBlockSig))
                     continue;
 
                 return true;
@@ -2411,6 +2785,8 @@ static filesystem::path BlockFilePath(unsigned int nFile)
     return GetDataDir() / strBlockFn;
 }
 
+CBlockStore blockstore(BlockFilePath);
+
 
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
 {
@@ -2432,6 +2808,25 @@ FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszM
 
 
 static unsigned int nCurrentBlockFile = 1;
+static unsigned int nFirstUncommittedFile = 1;
+static CCriticalSection cs_CommitBlockFiles;
+
+// Commit the block files appended to since the last call.  Runs before the
+// transaction database writes out index records, which may point into them.
+bool CommitBlockFiles()
+{
+    LOCK(cs_CommitBlockFiles);
+    for (unsigned int nFile = nFirstUncommittedFile; nFile <= nCurrentBlockFile; nFile++)
+    {
+        FILE* file = OpenBlockFile(nFile, 0, "ab");
+        if (!file)
+            return error("CommitBlockFiles() : can't open block file %u", nFile);
+        FileCommit(file);
+        fclose(file);
+    }
+    nFirstUncommittedFile = nCurrentBlockFile;
+    return true;
+}
 
 FILE* AppendBlockFile(unsigned int& nFileRet)
 {
@@ -2566,7 +2961,7 @@ void PrintBlockTree()
 {
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -2636,69 +3031,325 @@ void PrintBlockTree()
     }
 }
 
+// Reads a block file front to back without seeking, so it can be a pipe.
+// The file is closed with the reader unless it is stdin.
+class CImportReader
+{
+private:
+    FILE* file;
+    std::vector<char> vchBuf;
+    size_t nBegin;
+    size_t nEnd;
+
+    // Have at least nNeed bytes from the current position in the buffer
+    bool Fill(size_t nNeed)
+    {
+        while (nEnd - nBegin < nNeed)
+        {
+            if (nBegin > 0)
+            {
+                memmove(&vchBuf[0], &vchBuf[nBegin], nEnd - nBegin);
+                nEnd -= nBegin;
+                nBegin = 0;
+            }
+            if (vchBuf.size() < nNeed)
+                vchBuf.resize(nNeed);
+            size_t nRead = fread(&vchBuf[nEnd], 1, vchBuf.size() - nEnd, file);
+            if (nRead == 0)
+                return false;
+            nEnd += nRead;
+        }
+        return true;
+    }
+
+public:
+    CImportReader(FILE* fileIn) : file(fileIn), vchBuf(1 << 20), nBegin(0), nEnd(0) { }
+
+    ~CImportReader()
+    {
+        if (file != stdin)
+            fclose(file);
+    }
+
+    // Move past the next message start, false at the end of the file
+    bool FindMessageStart()
+    {
+        while (Fill(sizeof(pchMessageStart)))
+        {
+            const char* pch = &vchBuf[nBegin];
+            const char* pFind = (const char*)memchr(pch, pchMessageStart[0], nEnd - nBegin - sizeof(pchMessageStart) + 1);
+            if (!pFind)
+            {
+                nBegin = nEnd - sizeof(pchMessageStart) + 1;
+                continue;
+            }
+            nBegin += pFind - pch;
+            if (memcmp(&vchBuf[nBegin], pchMessageStart, sizeof(pchMessageStart)) == 0)
+            {
+                nBegin += sizeof(pchMessageStart);
+                return true;
+            }
+            nBegin++;
+        }
+        return false;
+    }
+
+    bool Read(char* pch, size_t nSize)
+    {
+        if (!Fill(nSize))
+            return false;
+        memcpy(pch, &vchBuf[nBegin], nSize);
+        nBegin += nSize;
+        return true;
+    }
+};
+
+// A block on its way through the import, see LoadExternalBlockFile()
+class CImportItem
+{
+public:
+    CDataStream ssData;
+    unsigned int nSize;
+    CBlock block;
+    bool fParsed;
+    bool fValid;
+
+    CImportItem(unsigned int nSizeIn) : ssData(SER_DISK, CLIENT_VERSION), nSize(nSizeIn), fParsed(false), fValid(false)
+    {
+        ssData.resize(nSize);
+    }
+};
+
+class CImportQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condReader;
+    boost::condition_variable condWorker;
+    boost::condition_variable condConsumer;
+
+    // Every block not yet handed on, in file order, and those still raw
+    std::deque<CImportItem*> queueAll;
+    std::deque<CImportItem*> queueRaw;
+    size_t nBytesQueued;
+    bool fReadDone;
+    bool fStop;
+
+public:
+    // Read no further ahead than this
+    static const size_t nMaxBytesQueued = 64 << 20;
+
+    CImportQueue() : nBytesQueued(0), fReadDone(false), fStop(false) { }
+
+    ~CImportQueue()
+    {
+        BOOST_FOREACH(CImportItem* pitem, queueAll)
+            delete pitem;
+    }
+
+    // Reader: false once the import is stopped
+    bool Push(CImportItem* pitem)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nBytesQueued >= nMaxBytesQueued && !fStop)
+            condReader.wait(lock);
+        if (fStop)
+        {
+            delete pitem;
+            return false;
+        }
+        nBytesQueued += pitem->nSize;
+        queueAll.push_back(pitem);
+        queueRaw.push_back(pitem);
+        condWorker.notify_one();
+        return true;
+    }
+
+    void ReadDone()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReadDone = true;
+        condWorker.notify_all();
+        condConsumer.notify_all();
+    }
+
+    // Worker: the next raw block, NULL when there are no more
+    CImportItem* NextRaw()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queueRaw.empty() && !fReadDone && !fStop)
+            condWorker.wait(lock);
+        if (queueRaw.empty() || fStop)
+            return NULL;
+        CImportItem* pitem = queueRaw.front();
+        queueRaw.pop_front();
+        return pitem;
+    }
+
+    void Parsed(CImportItem* pitem)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pitem->fParsed = true;
+        if (pitem == queueAll.front())
+            condConsumer.notify_one();
+    }
+
+    // Consumer: the next block in file order once it is parsed, NULL at the
+    // end or on shutdown.  The caller deletes it.
+    CImportItem* Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop && !fRequestShutdown && (queueAll.empty() ? !fReadDone : !queueAll.front()->fParsed))
+            condConsumer.timed_wait(lock, boost::posix_time::milliseconds(250));
+        if (fRequestShutdown && !fStop)
+        {
+            fStop = true;
+            condReader.notify_all();
+            condWorker.notify_all();
+        }
+        if (queueAll.empty() || fStop)
+            return NULL;
+        CImportItem* pitem = queueAll.front();
+        queueAll.pop_front();
+        nBytesQueued -= pitem->nSize;
+        condReader.notify_one();
+        return pitem;
+    }
+
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        condReader.notify_all();
+        condWorker.notify_all();
+        condConsumer.notify_all();
+    }
+};
+
+// Owns its share of the queue and the reader, as it may be left blocked on
+// a pipe when the import stops
+static void ThreadImportRead(boost::shared_ptr<CImportQueue> pqueue, boost::shared_ptr<CImportReader> preader)
+{
+    RenameThread("bitcoin-importread");
+    while (preader->FindMessageStart())
+    {
+        unsigned int nSize;
+        if (!preader->Read((char*)&nSize, sizeof(nSize)))
+            break;
+        if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+            continue;
+        CImportItem* pitem = new CImportItem(nSize);
+        if (!preader->Read(&pitem->ssData[0], nSize))
+        {
+            delete pitem;
+            break;
+        }
+        if (!pqueue->Push(pitem))
+            return;
+    }
+    pqueue->ReadDone();
+}
+
+static void ThreadImportParse(CImportQueue* pqueue)
+{
+    RenameThread("bitcoin-importparse");
+    CImportItem* pitem;
+    while ((pitem = pqueue->NextRaw()) != NULL)
+    {
+        try {
+            pitem->ssData >> pitem->block;
+            pitem->fValid = true;
+        }
+        catch (std::exception &e) {
+            printf("%s() : deserialize error\n", BOOST_CURRENT_FUNCTION);
+        }
+        pitem->ssData.clear();
+
+        // The hashing and the context-free checks, done here in parallel
+        // rather than under cs_main
+        if (pitem->fValid && pitem->block.CheckBlock())
+            pitem->block.fChecked = true;
+        pqueue->Parsed(pitem);
+    }
+}
+
+// Stop the import threads and wait for them.  A reader still blocked on
+// stdin is left behind; it ends once its read returns.
+static void StopImport(CImportQueue& queue, boost::thread_group& threadGroup, boost::thread& threadRead, bool fStdin)
+{
+    queue.Stop();
+    threadGroup.join_all();
+    if (!fStdin)
+        threadRead.join();
+    else if (!threadRead.timed_join(boost::posix_time::seconds(1)))
+    {
+        printf("LoadExternalBlockFile() : stopped while waiting for standard input\n");
+        threadRead.detach();
+    }
+}
+
+// Imports the blocks in a file (or a pipe) in three stages: one thread reads
+// ahead, several deserialize the blocks and run CheckBlock(), and the
+// calling thread passes them to ProcessBlock() in file order.  The file is
+// closed at the end, unless it is stdin.
 bool LoadExternalBlockFile(FILE* fileIn)
 {
     int64 nStart = GetTimeMillis();
-
-    int nLoaded = 0;
+    int nLoaded = 0, nRead = 0;
+    uint64 nBytesRead = 0;
     {
-        LOCK(cs_main);
+        bool fStdin = (fileIn == stdin);
+        boost::shared_ptr<CImportReader> preader(new CImportReader(fileIn));
+        boost::shared_ptr<CImportQueue> pqueue(new CImportQueue());
+        CImportQueue& queue = *pqueue;
+
+        int nWorkers = std::min(std::max((int)boost::thread::hardware_concurrency() - 1, 1), 16);
+        boost::thread threadRead(boost::bind(&ThreadImportRead, pqueue, preader));
+        preader.reset();
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nWorkers; i++)
+            threadGroup.create_thread(boost::bind(&ThreadImportParse, pqueue.get()));
+
+        int64 nLastReport = nStart;
         try {
-            CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-            while (nPos != (unsigned int)-1 && blkdat.good() && !fRequestShutdown)
+            CImportItem* pitem;
+            while ((pitem = queue.Next()) != NULL)
             {
-                unsigned char pchData[65536];
-                do {
-                    fseek(blkdat, nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-                    if (nRead <= 8)
-                    {
-                        nPos = (unsigned int)-1;
-                        break;
-                    }
-                    void* nFind = memchr(pchData, pchMessageStart[0], nRead+1-sizeof(pchMessageStart));
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart))==0)
-                        {
-                            nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
-                            break;
-                        }
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    }
-                    else
-                        nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
-                } while(!fRequestShutdown);
-                if (nPos == (unsigned int)-1)
-                    break;
-                fseek(blkdat, nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
+                nRead++;
+                nBytesRead += pitem->nSize;
+                if (pitem->fValid)
                 {
-                    CBlock block;
-                    blkdat >> block;
-                    if (ProcessBlock(NULL,&block))
-                    {
+                    LOCK(cs_main);
+                    if (ProcessBlock(NULL, &pitem->block))
                         nLoaded++;
-                        nPos += 4 + nSize;
-                    }
+                }
+                delete pitem;
+
+                if (GetTimeMillis() - nLastReport >= 10000)
+                {
+                    nLastReport = GetTimeMillis();
+                    double dSeconds = (nLastReport - nStart) / 1000.0;
+                    printf("LoadExternalBlockFile() : %i blocks read, %i loaded, %.1f blocks/s, %.2f MB/s\n",
+                           nRead, nLoaded, nRead / dSeconds, nBytesRead / 1048576.0 / dSeconds);
                 }
             }
         }
-        catch (std::exception &e) {
-            printf("%s() : Deserialize or I/O error caught during load\n",
-                   BOOST_CURRENT_FUNCTION);
+        catch (...) {
+            // The other stages use the queue, which is about to go
+            StopImport(queue, threadGroup, threadRead, fStdin);
+            throw;
         }
+        StopImport(queue, threadGroup, threadRead, fStdin);
     }
-    printf("Loaded %i blocks from external file in %"PRI64d"ms\n", nLoaded, GetTimeMillis() - nStart);
+
+    double dSeconds = max(GetTimeMillis() - nStart, (int64)1) / 1000.0;
+    printf("Loaded %i blocks from external file in %"PRI64d"ms (%.1f blocks/s, %.2f MB/s)\n",
+           nLoaded, GetTimeMillis() - nStart, nRead / dSeconds, nBytesRead / 1048576.0 / dSeconds);
     return nLoaded > 0;
 }
 
 
 
-
 //////////////////////////////////////////////////////////////////////////////
 //
 // CAlert
@@ -3098,7 +3749,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (inv.type == MSG_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -3209,7 +3860,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -3772,20 +4423,18 @@ static const unsigned int pSHA256InitState[8] =
 
 void SHA256Transform(void* pstate, void* pinput, const void* pinit)
 {
-    SHA256_CTX ctx;
+    uint32_t state[8];
     unsigned char data[64];
 
-    SHA256_Init(&ctx);
-
     for (int i = 0; i < 16; i++)
         ((uint32_t*)data)[i] = ByteReverse(((uint32_t*)pinput)[i]);
 
     for (int i = 0; i < 8; i++)
-        ctx.h[i] = ((uint32_t*)pinit)[i];
+        state[i] = ((uint32_t*)pinit)[i];
 
-    SHA256_Update(&ctx, data, sizeof(data));
+    SHA256TransformBlocks(state, data, 1);
     for (int i = 0; i < 8; i++)
-        ((uint32_t*)pstate)[i] = ctx.h[i];
+        ((uint32_t*)pstate)[i] = state[i];
 }
 
 // Some explaining would be appreciated
@@ -3905,6 +4554,7 @@ CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake)
                     // as it would be the same as the block timestamp
                     pblock->vtx[0].vout[0].SetEmpty();
                     pblock->vtx[0].nTime = txCoinStake.nTime;
+                    pblock->vtx[0].InvalidateHash();
                     pblock->vtx.push_back(txCoinStake);
                 }
             }
@@ -3929,7 +4579,7 @@ CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake)
         // This vector will be sorted into a priority queue:
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        for (uint256_map<CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
         {
             CTransaction& tx = (*mi).second;
             if (tx.IsCoinBase() || tx.IsCoinStake() || !tx.IsFinal())
@@ -4108,7 +4758,10 @@ CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake)
             printf("CreateNewBlock(): total size %"PRI64u"\n", nBlockSize);
 
         if (pblock->IsProofOfWork())
+        {
             pblock->vtx[0].vout[0].nValue = GetProofOfWorkReward(pindexPrev->nHeight+1, nFees, pindexPrev->GetBlockHash());
+            pblock->vtx[0].InvalidateHash();
+        }
 
         // Fill in header
         pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
@@ -4135,11 +4788,18 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+}
+
+
+void SetExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int nExtraNonce)
+{
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
+    pblock->vtx[0].InvalidateHash();
     assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
 
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    pblock->hashMerkleRoot = pblock->UpdateMerkleTreeCoinbase();
 }
 
 
@@ -4232,6 +4892,105 @@ static bool fGenerateBitcoins = false;
 static bool fLimitProcessors = false;
 static int nLimitProcessors = -1;
 
+// Each proof-of-work thread owns a worker slot. The slot fixes which extra
+// nonces the thread puts in its coinbase, so no two threads ever hash the
+// same header, and holds the thread's hash rate for gethashespersec.
+static const int MAX_MINER_THREADS = 256;
+
+static CCriticalSection cs_miner;
+static std::vector<bool> vMinerSlotUsed(MAX_MINER_THREADS, false);
+static std::vector<double> vMinerHashesPerSec(MAX_MINER_THREADS, 0);
+
+class CMinerSlot
+{
+public:
+    int nWorker;
+
+    CMinerSlot()
+    {
+        LOCK(cs_miner);
+        nWorker = std::find(vMinerSlotUsed.begin(), vMinerSlotUsed.end(), false) - vMinerSlotUsed.begin();
+        if (nWorker < MAX_MINER_THREADS)
+            vMinerSlotUsed[nWorker] = true;
+    }
+
+    ~CMinerSlot()
+    {
+        if (nWorker < MAX_MINER_THREADS)
+            SetHashesPerSec(0);
+        LOCK(cs_miner);
+        if (nWorker < MAX_MINER_THREADS)
+            vMinerSlotUsed[nWorker] = false;
+    }
+
+    bool IsValid() const { return nWorker < MAX_MINER_THREADS; }
+
+    void SetHashesPerSec(double dRate)
+    {
+        LOCK(cs_miner);
+        vMinerHashesPerSec[nWorker] = dRate;
+        dHashesPerSec = 0;
+        for (int i = 0; i < MAX_MINER_THREADS; i++)
+            dHashesPerSec += vMinerHashesPerSec[i];
+    }
+};
+
+void GetMinerHashesPerSec(std::vector<double>& vHashesPerSec)
+{
+    LOCK(cs_miner);
+    vHashesPerSec.clear();
+    for (int i = 0; i < MAX_MINER_THREADS; i++)
+        if (vMinerSlotUsed[i])
+            vHashesPerSec.push_back(vMinerHashesPerSec[i]);
+}
+
+// The block template is shared by all proof-of-work threads: one of them
+// builds it with CreateNewBlock, the others copy it. It is rebuilt when the
+// best block changes, when the memory pool has changed and the template is
+// a minute old, or when its coinbase timestamp is about to go stale.
+static CCriticalSection cs_minerTemplate;
+static auto_ptr<CBlock> pblockMinerTemplate;
+static CBlockIndex* pindexMinerTemplatePrev = NULL;
+static unsigned int nMinerTemplateTransactionsUpdated = 0;
+static int64 nMinerTemplateTime = 0;
+static unsigned int nMinerTemplateId = 0;
+
+static bool IsMinerTemplateStale(const CBlock& block, CBlockIndex* pindexPrev, unsigned int nTransactionsUpdatedLast, int64 nTimeCreated)
+{
+    if (pindexPrev != pindexBest)
+        return true;
+    if (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nTimeCreated > 60)
+        return true;
+    if (GetAdjustedTime() >= (int64)block.vtx[0].nTime + nMaxClockDrift)
+        return true;
+    return false;
+}
+
+static bool GetMinerTemplate(CWallet* pwallet, CBlock& block, CBlockIndex*& pindexPrev, unsigned int& nTransactionsUpdatedLast, int64& nTimeCreated, unsigned int& nTemplateId)
+{
+    LOCK(cs_minerTemplate);
+    if (!pblockMinerTemplate.get() ||
+        IsMinerTemplateStale(*pblockMinerTemplate, pindexMinerTemplatePrev, nMinerTemplateTransactionsUpdated, nMinerTemplateTime))
+    {
+        nMinerTemplateTransactionsUpdated = nTransactionsUpdated;
+        pindexMinerTemplatePrev = pindexBest;
+        nMinerTemplateTime = GetTime();
+        pblockMinerTemplate.reset(CreateNewBlock(pwallet, false));
+        if (!pblockMinerTemplate.get())
+            return false;
+        // Built once here, the workers only update their coinbase path
+        pblockMinerTemplate->BuildMerkleTree();
+        nMinerTemplateId++;
+    }
+
+    block = *pblockMinerTemplate;
+    pindexPrev = pindexMinerTemplatePrev;
+    nTransactionsUpdatedLast = nMinerTemplateTransactionsUpdated;
+    nTimeCreated = nMinerTemplateTime;
+    nTemplateId = nMinerTemplateId;
+    return true;
+}
+
 void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
 {
     printf("CPUMiner started for proof-of-%s\n", fProofOfStake? "stake" : "work");
@@ -4244,6 +5003,17 @@ void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    // Proof-of-work threads use extra nonces nWorker + 1 + k * MAX_MINER_THREADS
+    auto_ptr<CMinerSlot> pslot;
+    unsigned int nTemplateIdLast = 0;
+    unsigned int nRound = 0;
+    if (!fProofOfStake)
+    {
+        pslot.reset(new CMinerSlot());
+        if (!pslot->IsValid())
+            return;
+    }
+
     while (fGenerateBitcoins || fProofOfStake)
     {
         if (fShutdown)
@@ -4259,19 +5029,18 @@ void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
                 return;
         }
 
-        //
-        // Create new block
-        //
-        unsigned int nTransactionsUpdatedLast = nTransactionsUpdated;
-        CBlockIndex* pindexPrev = pindexBest;
-
-        auto_ptr<CBlock> pblock(CreateNewBlock(pwallet, fProofOfStake));
-        if (!pblock.get())
-            return;
-        IncrementExtraNonce(pblock.get(), pindexPrev, nExtraNonce);
-
         if (fProofOfStake)
         {
+            //
+            // Create new block
+            //
+            CBlockIndex* pindexPrev = pindexBest;
+
+            auto_ptr<CBlock> pblock(CreateNewBlock(pwallet, fProofOfStake));
+            if (!pblock.get())
+                return;
+            IncrementExtraNonce(pblock.get(), pindexPrev, nExtraNonce);
+
             // ppcoin: if proof-of-stake block found then process block
             if (pblock->IsProofOfStake())
             {
@@ -4286,34 +5055,69 @@ void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
             continue;
         }
 
-        printf("Running BitcoinMiner with %"PRIszu" transactions in block (%u bytes)\n", pblock->vtx.size(),
-               ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
-
         //
-        // Pre-build hash buffers
+        // Take a copy of the shared template and give it our own coinbase
         //
-        //char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
-        //char pdatabuf[128+16];    char* pdata     = alignup<16>(pdatabuf);
-        //char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
-
-        //FormatHashBuffers(pblock.get(), pmidstate, pdata, phash1);
-
-        //unsigned int& nBlockTime = *(unsigned int*)(pdata + 64 + 4);
-        //unsigned int& nBlockNonce = *(unsigned int*)(pdata + 64 + 12);
+        CBlockIndex* pindexPrev;
+        unsigned int nTransactionsUpdatedLast;
+        int64 nStart;
+        unsigned int nTemplateId;
+        auto_ptr<CBlock> pblock(new CBlock());
+        if (!GetMinerTemplate(pwallet, *pblock, pindexPrev, nTransactionsUpdatedLast, nStart, nTemplateId))
+            return;
+        if (nTemplateId != nTemplateIdLast)
+        {
+            nTemplateIdLast = nTemplateId;
+            nRound = 0;
+        }
+        SetExtraNonce(pblock.get(), pindexPrev, pslot->nWorker + 1 + nRound * MAX_MINER_THREADS);
+        nRound++;
 
+        printf("Running BitcoinMiner with %"PRIszu" transactions in block (%u bytes)\n", pblock->vtx.size(),
+               ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
 
         //
         // Search
         //
-        int64 nStart = GetTime();
+        // Headers are hashed a batch of nonces at a time, so the multi-lane
+        // X11 kernels can work on several of them at once
+        static const unsigned int nBatch = 64;
+        static const unsigned int nHeaderSize = 80;
+        const unsigned int nNonceOffset = BEGIN(pblock->nNonce) - BEGIN(pblock->nVersion);
+        unsigned char pchHeaders[nBatch * nHeaderSize];
+        unsigned char pchHashes[nBatch * 64];
+
         uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
-	uint256 hash;
+        int64 nHashCounter = 0;
+        int64 nMeterStart = GetTimeMillis();
 
         INFINITE_LOOP
         {
-	    hash = pblock->GetHash();
-            if (hash <= hashTarget){
-                // nHashesDone += pblock->nNonce;
+            unsigned int nNonceFirst = pblock->nNonce;
+            for (unsigned int i = 0; i < nBatch; i++)
+            {
+                unsigned int nNonce = nNonceFirst + i;
+                memcpy(&pchHeaders[i * nHeaderSize], BEGIN(pblock->nVersion), nHeaderSize);
+                memcpy(&pchHeaders[i * nHeaderSize + nNonceOffset], &nNonce, sizeof(nNonce));
+            }
+            X11HashBatch(pchHeaders, nHeaderSize, nBatch, pchHashes);
+            nHashCounter += nBatch;
+
+            bool fFound = false;
+            for (unsigned int i = 0; i < nBatch && !fFound; i++)
+            {
+                uint256 hash;
+                memcpy(BEGIN(hash), &pchHashes[i * 64], sizeof(hash));
+                if (hash <= hashTarget)
+                {
+                    pblock->nNonce = nNonceFirst + i;
+                    fFound = true;
+                }
+            }
+
+            if (fFound)
+            {
+                uint256 hash = pblock->GetHash();
                 if (!pblock->SignBlock(*pwalletMain))
                     break;
 
@@ -4326,33 +5130,21 @@ void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
                 SetThreadPriority(THREAD_PRIORITY_LOWEST);
                 break;
             }
-            ++pblock->nNonce;
-
+            pblock->nNonce += nBatch;
 
             // Meter hashes/sec
-            static int64 nHashCounter;
-            if (nHPSTimerStart == 0)
+            int64 nNow = GetTimeMillis();
+            if (nNow - nMeterStart > 4000)
             {
-                nHPSTimerStart = GetTimeMillis();
+                pslot->SetHashesPerSec(1000.0 * nHashCounter / (nNow - nMeterStart));
+                nMeterStart = nNow;
                 nHashCounter = 0;
-            }
-            else
-                nHashCounter += 1;
 
-            if (GetTimeMillis() - nHPSTimerStart > 4000)
-            {
-                static CCriticalSection cs;
+                LOCK(cs_miner);
+                if (nNow - nHPSTimerStart > 4000)
                 {
-                    LOCK(cs);
-                    if (GetTimeMillis() - nHPSTimerStart > 4000)
-                    {
-                        dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-                        nHPSTimerStart = GetTimeMillis();
-                        nHashCounter = 0;
-
-                            printf("hashmeter %3d CPUs %6.0f khash/s\n", vnThreadsRunning[THREAD_MINER], dHashesPerSec/1000.0);
-
-                    }
+                    nHPSTimerStart = nNow;
+                    printf("hashmeter %3d CPUs %6.0f khash/s\n", vnThreadsRunning[THREAD_MINER], dHashesPerSec/1000.0);
                 }
             }
 
@@ -4365,20 +5157,15 @@ void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
                 return;
             if (vNodes.empty())
                 break;
-            if (++pblock->nNonce >= 0xffff0000)
+            if (pblock->nNonce >= 0xffff0000)
                 break;
-            if (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                break;
-            if (pindexPrev != pindexBest)
+            if (IsMinerTemplateStale(*pblock, pindexPrev, nTransactionsUpdatedLast, nStart))
                 break;
 
             // Update nTime every few seconds
             pblock->nTime = max(pindexPrev->GetMedianTimePast()+1, pblock->GetMaxTransactionTime());
             pblock->nTime = max(pblock->GetBlockTime(), pindexPrev->GetBlockTime() - nMaxClockDrift);
             pblock->UpdateTime(pindexPrev);
-
-            if (pblock->GetBlockTime() >= (int64)pblock->vtx[0].nTime + nMaxClockDrift)
-                break;  // need to update coinbase timestamp
         }
     }
 }
@@ -4422,6 +5209,7 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet)
             nProcessors = 1;
         if (fLimitProcessors && nProcessors > nLimitProcessors)
             nProcessors = nLimitProcessors;
+        nProcessors = std::min(nProcessors, MAX_MINER_THREADS);
         int nAddThreads = nProcessors - vnThreadsRunning[THREAD_MINER];
         printf("Starting %d BitcoinMiner threads\n", nAddThreads);
         for (int i = 0; i < nAddThreads; i++)
@@ -6,14 +6,18 @@
 #define BITCOIN_MAIN_H
 
 #include "bignum.h"
+#include "blockstore.h"
 #include "sync.h"
 #include "net.h"
 #include "script.h"
 #include "scrypt.h"
 #include "hashblock.h"
+#include "uint256map.h"
 
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+
 class CWallet;
 class CBlock;
 class CBlockIndex;
@@ -26,11 +30,17 @@ class CInv;
 class CRequestTracker;
 class CNode;
 
+typedef uint256_map<CBlockIndex*> BlockMap;
+
 static const unsigned int MAX_BLOCK_SIZE = 1000000;
 static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
 static const unsigned int MAX_INV_SZ = 50000;
+/** Maximum number of script-checking threads allowed */
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Blocks are disconnected from their undo records up to this deep */
+static const int BLOCK_UNDO_DEPTH = 500;
 static const int64 MIN_TX_FEE = 1 * CENT / 100; // 0.0001
 static const int64 MIN_RELAY_TX_FEE = 1 * CENT / 100; // 0.0001
 static const int64 MAX_MONEY = 100000000 * COIN;
@@ -66,15 +76,18 @@ extern CScript COINBASE_FLAGS;
 
 
 extern CCriticalSection cs_main;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+extern CBlockStore blockstore;
+extern BlockMap mapBlockIndex;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 extern uint256 hashGenesisBlock;
 extern CBlockIndex* pindexGenesisBlock;
 extern unsigned int nStakeMinAge;
+extern int nScriptCheckThreads;
+extern bool fAddrIndex;
 extern int nCoinbaseMaturity;
 extern int nBestHeight;
-extern CBigNum bnBestChainTrust;
-extern CBigNum bnBestInvalidTrust;
+extern uint256 nBestChainTrust;
+extern uint256 nBestInvalidTrust;
 extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
 extern unsigned int nTransactionsUpdated;
@@ -100,6 +113,8 @@ static const uint64 nMinDiskSpace = 52428800;
 class CReserveKey;
 class CTxDB;
 class CTxIndex;
+class CScriptCheck;
+class CScriptCheckStatus;
 
 void RegisterWallet(CWallet* pwalletIn);
 void UnregisterWallet(CWallet* pwalletIn);
@@ -108,15 +123,20 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64 nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
+bool CommitBlockFiles();
+bool BuildAddrIndex();
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 bool LoadExternalBlockFile(FILE* fileIn);
+void PrecomputeBlockHashes(const std::vector<const CBlock*>& vpblock);
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
+void GetMinerHashesPerSec(std::vector<double>& vHashesPerSec);
 CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake=false);
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+void SetExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int nExtraNonce);
 void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash1);
 bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
@@ -131,6 +151,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 uint256 WantedByOrphan(const CBlock* pblockOrphan);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
 void BitcoinMiner(CWallet *pwallet, bool fProofOfStake);
+void ThreadScriptCheck(void* parg);
+void ThreadScriptCheckQuit();
 void ResendWalletTransactions();
 
 
@@ -450,6 +472,10 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+    // memory only: hash cache, see GetHash()
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
     CTransaction()
     {
         SetNull();
@@ -463,6 +489,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            InvalidateHash();
 	)
 
     void SetNull()
@@ -473,6 +501,7 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  // Denial-of-service prevention
+        InvalidateHash();
     }
 
     bool IsNull() const
@@ -480,9 +509,23 @@ public:
         return (vin.empty() && vout.empty());
     }
 
+    // The hash is computed on first use and remembered until the transaction
+    // is deserialized again or SetNull() is called.  Code that modifies the
+    // fields of a transaction whose hash may already have been taken must
+    // call InvalidateHash() afterwards.
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        if (!fHashCached)
+        {
+            hashCached = SerializeHash(*this);
+            fHashCached = true;
+        }
+        return hashCached;
+    }
+
+    void InvalidateHash() const
+    {
+        fHashCached = false;
     }
 
     bool IsFinal(int nBlockHeight=0, int64 nBlockTime=0) const
@@ -610,6 +653,19 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        // Read transaction from the mapped block file
+        CBlockFileView view(SER_DISK, CLIENT_VERSION);
+        if (!pfileRet && blockstore.GetView(pos.nFile, pos.nTxPos, view))
+        {
+            try {
+                view >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize error", BOOST_CURRENT_FUNCTION);
+            }
+            return true;
+        }
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -710,11 +766,14 @@ public:
         @param[in] fBlock	true if called from ConnectBlock
         @param[in] fMiner	true if called from CreateNewBlock
         @param[in] fStrictPayToScriptHash	true if fully validating p2sh transactions
+        @param[out] pvChecks	if not NULL, script checks are appended here instead of being run
+        @param[out] pstatus	where the appended checks report how they failed
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash=true);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash=true,
+                       std::vector<CScriptCheck>* pvChecks=NULL, CScriptCheckStatus* pstatus=NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
@@ -728,6 +787,72 @@ protected:
 
 
 
+/** How the script checks of a block failed, written by the threads running
+ * them.  A check that fails only under the strict P2SH rules is not counted
+ * against the peer, the same as when ConnectInputs() verifies inline.
+ */
+class CScriptCheckStatus
+{
+private:
+    mutable boost::mutex mutex;
+    bool fDoS;
+
+public:
+    CScriptCheckStatus() : fDoS(false) {}
+
+    void Failed(bool fDoSIn)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDoS |= fDoSIn;
+    }
+
+    bool IsDoS() const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return fDoS;
+    }
+};
+
+/** Closure representing one script verification.
+ * Note that this stores a reference to the spending transaction, which
+ * must outlive the check.
+ */
+class CScriptCheck
+{
+private:
+    CScript scriptPubKey;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    bool fStrictPayToScriptHash;
+    int nHashType;
+    // Shared by the checks of all inputs of ptxTo, if it has several
+    boost::shared_ptr<const CSignatureHashContext> pcontext;
+    CScriptCheckStatus* pstatus;
+
+public:
+    CScriptCheck() : ptxTo(NULL), nIn(0), fStrictPayToScriptHash(false), nHashType(0), pstatus(NULL) {}
+    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, bool fStrictPayToScriptHashIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSignatureHashContext>& pcontextIn, CScriptCheckStatus* pstatusIn) :
+        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+        ptxTo(&txToIn), nIn(nInIn), fStrictPayToScriptHash(fStrictPayToScriptHashIn), nHashType(nHashTypeIn), pcontext(pcontextIn), pstatus(pstatusIn) {}
+
+    bool operator()() const;
+
+    void swap(CScriptCheck& check)
+    {
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(fStrictPayToScriptHash, check.fStrictPayToScriptHash);
+        std::swap(nHashType, check.nHashType);
+        pcontext.swap(check.pcontext);
+        std::swap(pstatus, check.pstatus);
+    }
+};
+
+
+
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -780,39 +905,79 @@ public:
 
 
 
-/**  A txdb record that contains the disk location of a transaction and the
- * locations of transactions that spend its outputs.  vSpent is really only
- * used as a flag, but having the location is very helpful for debugging.
+/** Set in the version field of CTxIndex records written in the compact format */
+static const int TXINDEX_COMPACT = 0x40000000;
+
+/**  A txdb record that contains the disk location of a transaction and which
+ * of its outputs are spent.  The spent flags are kept as a bitmap.  The
+ * locations of the spending transactions are only kept with -txindexspenders,
+ * they are helpful for debugging but nothing depends on them.
+ *
+ * Records written before the bitmap have a position for every output instead,
+ * and are converted as they are read (see CTxDB::UpgradeTxIndex).
  */
 class CTxIndex
 {
 public:
+    /** Keep the positions of spending transactions (-txindexspenders) */
+    static bool fKeepSpenders;
+
     CDiskTxPos pos;
-    std::vector<CDiskTxPos> vSpent;
 
+private:
+    unsigned int nOutputs;
+    std::vector<unsigned char> vSpentBits;
+    std::vector<std::pair<unsigned int, CDiskTxPos> > vSpenders;
+
+public:
     CTxIndex()
     {
         SetNull();
     }
 
-    CTxIndex(const CDiskTxPos& posIn, unsigned int nOutputs)
+    CTxIndex(const CDiskTxPos& posIn, unsigned int nOutputsIn)
     {
         pos = posIn;
-        vSpent.resize(nOutputs);
+        SetOutputCount(nOutputsIn);
     }
 
     IMPLEMENT_SERIALIZE
     (
+        CTxIndex* pthis = const_cast<CTxIndex*>(this);
+        int nFormat = nVersion | TXINDEX_COMPACT;
         if (!(nType & SER_GETHASH))
-            READWRITE(nVersion);
+            READWRITE(nFormat);
         READWRITE(pos);
-        READWRITE(vSpent);
+        if (nFormat & TXINDEX_COMPACT)
+        {
+            unsigned char nPadBits = vSpentBits.size() * 8 - nOutputs;
+            READWRITE(nPadBits);
+            READWRITE(vSpentBits);
+            READWRITE(vSpenders);
+            if (fRead)
+            {
+                if (nPadBits > 7 || (vSpentBits.empty() && nPadBits > 0))
+                    throw std::ios_base::failure("CTxIndex::Unserialize() : invalid spent bitmap");
+                pthis->nOutputs = vSpentBits.size() * 8 - nPadBits;
+                if (!fKeepSpenders)
+                    pthis->vSpenders.clear();
+            }
+        }
+        else
+        {
+            std::vector<CDiskTxPos> vSpent;
+            READWRITE(vSpent);
+            pthis->SetOutputCount(vSpent.size());
+            for (unsigned int n = 0; n < vSpent.size(); n++)
+                if (!vSpent[n].IsNull())
+                    pthis->MarkSpent(n, vSpent[n]);
+        }
     )
 
     void SetNull()
     {
         pos.SetNull();
-        vSpent.clear();
+        SetOutputCount(0);
     }
 
     bool IsNull()
@@ -820,10 +985,77 @@ public:
         return pos.IsNull();
     }
 
+    unsigned int GetOutputCount() const
+    {
+        return nOutputs;
+    }
+
+    /** Resize to nOutputsIn outputs, all of them unspent */
+    void SetOutputCount(unsigned int nOutputsIn)
+    {
+        nOutputs = nOutputsIn;
+        vSpentBits.assign((nOutputsIn + 7) / 8, 0);
+        vSpenders.clear();
+    }
+
+    bool IsSpent(unsigned int n) const
+    {
+        if (n >= nOutputs)
+            return false;
+        return (vSpentBits[n / 8] >> (n % 8)) & 1;
+    }
+
+    bool IsFullySpent() const
+    {
+        for (unsigned int n = 0; n < nOutputs; n++)
+            if (!IsSpent(n))
+                return false;
+        return true;
+    }
+
+    void MarkSpent(unsigned int n, const CDiskTxPos& posSpender)
+    {
+        if (n >= nOutputs)
+            return;
+        vSpentBits[n / 8] |= (1 << (n % 8));
+        if (fKeepSpenders && !posSpender.IsNull())
+        {
+            std::vector<std::pair<unsigned int, CDiskTxPos> >::iterator it = LowerBound(n);
+            if (it != vSpenders.end() && it->first == n)
+                it->second = posSpender;
+            else
+                vSpenders.insert(it, std::make_pair(n, posSpender));
+        }
+    }
+
+    void MarkUnspent(unsigned int n)
+    {
+        if (n >= nOutputs)
+            return;
+        vSpentBits[n / 8] &= ~(1 << (n % 8));
+        std::vector<std::pair<unsigned int, CDiskTxPos> >::iterator it = LowerBound(n);
+        if (it != vSpenders.end() && it->first == n)
+            vSpenders.erase(it);
+    }
+
+    /** Position of the transaction spending output n, if it was recorded */
+    bool GetSpender(unsigned int n, CDiskTxPos& posRet) const
+    {
+        std::vector<std::pair<unsigned int, CDiskTxPos> >::const_iterator it = vSpenders.begin();
+        while (it != vSpenders.end() && it->first < n)
+            ++it;
+        if (it == vSpenders.end() || it->first != n)
+            return false;
+        posRet = it->second;
+        return true;
+    }
+
     friend bool operator==(const CTxIndex& a, const CTxIndex& b)
     {
-        return (a.pos    == b.pos &&
-                a.vSpent == b.vSpent);
+        return (a.pos        == b.pos &&
+                a.nOutputs   == b.nOutputs &&
+                a.vSpentBits == b.vSpentBits &&
+                a.vSpenders  == b.vSpenders);
     }
 
     friend bool operator!=(const CTxIndex& a, const CTxIndex& b)
@@ -832,6 +1064,226 @@ public:
     }
     int GetDepthInMainChain() const;
 
+private:
+    std::vector<std::pair<unsigned int, CDiskTxPos> >::iterator LowerBound(unsigned int n)
+    {
+        std::vector<std::pair<unsigned int, CDiskTxPos> >::iterator it = vSpenders.begin();
+        while (it != vSpenders.end() && it->first < n)
+            ++it;
+        return it;
+    }
+};
+
+
+
+/** Undo record of a block, written to the txdb in the same transaction as the
+ * index changes of ConnectBlock.  It holds the txdb records of the
+ * transactions the block spent from as they were before the block, and the
+ * transactions the block added, so DisconnectBlock puts the txdb back without
+ * reading any of them or looking at the block's inputs.
+ */
+class CBlockUndo
+{
+public:
+    std::vector<uint256> vCreated;
+    std::vector<std::pair<uint256, CTxIndex> > vPrev;
+
+    CBlockUndo()
+    {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        if (!(nType & SER_GETHASH))
+            READWRITE(nVersion);
+        READWRITE(vCreated);
+        READWRITE(vPrev);
+    )
+
+    void SetNull()
+    {
+        vCreated.clear();
+        vPrev.clear();
+    }
+
+    bool IsNull() const
+    {
+        return vCreated.empty();
+    }
+};
+
+
+
+/** What the address index (-addrindex) files an output under: the key or
+ * script hash its script pays to, so the pay-to-pubkey outputs of coinbases
+ * and coinstakes are found with the pay-to-pubkey-hash ones of the same key.
+ * Scripts without an address are filed under their own hash.  The type keeps
+ * the three kinds of hash apart.
+ */
+class CAddrIndexDest
+{
+public:
+    enum
+    {
+        DEST_NONE = 0,
+        DEST_KEY = 1,
+        DEST_SCRIPTHASH = 2,
+        DEST_SCRIPT = 3,
+    };
+
+    unsigned char nDestType;
+    uint160 hash;
+
+    CAddrIndexDest()
+    {
+        SetNull();
+    }
+
+    CAddrIndexDest(unsigned char nDestTypeIn, const uint160& hashIn)
+    {
+        nDestType = nDestTypeIn;
+        hash = hashIn;
+    }
+
+    // Where an output paying to scriptPubKey is filed
+    explicit CAddrIndexDest(const CScript& scriptPubKey)
+    {
+        CTxDestination dest;
+        if (!ExtractDestination(scriptPubKey, dest) || !SetDestination(dest))
+        {
+            nDestType = DEST_SCRIPT;
+            hash = Hash160(scriptPubKey);
+        }
+    }
+
+    // Where the outputs paying to an address are filed
+    explicit CAddrIndexDest(const CTxDestination& dest)
+    {
+        SetDestination(dest);
+    }
+
+    bool SetDestination(const CTxDestination& dest)
+    {
+        if (const CKeyID* pkeyID = boost::get<CKeyID>(&dest))
+        {
+            nDestType = DEST_KEY;
+            hash = *pkeyID;
+            return true;
+        }
+        if (const CScriptID* pscriptID = boost::get<CScriptID>(&dest))
+        {
+            nDestType = DEST_SCRIPTHASH;
+            hash = *pscriptID;
+            return true;
+        }
+        SetNull();
+        return false;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nDestType);
+        READWRITE(hash);
+    )
+
+    void SetNull()
+    {
+        nDestType = DEST_NONE;
+        hash = 0;
+    }
+
+    bool IsNull() const
+    {
+        return nDestType == DEST_NONE;
+    }
+
+    friend bool operator==(const CAddrIndexDest& a, const CAddrIndexDest& b)
+    {
+        return a.nDestType == b.nDestType && a.hash == b.hash;
+    }
+
+    friend bool operator!=(const CAddrIndexDest& a, const CAddrIndexDest& b)
+    {
+        return !(a == b);
+    }
+};
+
+/** Key of an address index entry.  An entry is either an output filed under
+ * the destination, or an input spending such an output.  The height is
+ * written big endian so the entries of a destination are in height order,
+ * and one range scan from the destination finds all of them.
+ */
+class CAddrIndexKey
+{
+public:
+    CAddrIndexDest dest;
+    int nHeight;
+    uint256 hashTx;
+    bool fSpend;
+    unsigned int nIndex; // of the output, or of the input if fSpend
+
+    CAddrIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddrIndexKey(const CAddrIndexDest& destIn, int nHeightIn, const uint256& hashTxIn, bool fSpendIn, unsigned int nIndexIn)
+    {
+        dest = destIn;
+        nHeight = nHeightIn;
+        hashTx = hashTxIn;
+        fSpend = fSpendIn;
+        nIndex = nIndexIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        CAddrIndexKey* pthis = const_cast<CAddrIndexKey*>(this);
+        READWRITE(dest);
+        unsigned int nHeightBE = ByteReverse((uint32_t)nHeight);
+        READWRITE(nHeightBE);
+        if (fRead)
+            pthis->nHeight = ByteReverse(nHeightBE);
+        READWRITE(hashTx);
+        READWRITE(fSpend);
+        READWRITE(nIndex);
+    )
+
+    void SetNull()
+    {
+        dest.SetNull();
+        nHeight = 0;
+        hashTx = 0;
+        fSpend = false;
+        nIndex = 0;
+    }
+};
+
+/** Value of an address index entry: the amount, and for an input the output
+ * it spends */
+class CAddrIndexValue
+{
+public:
+    int64 nValue;
+    COutPoint prevout;
+
+    CAddrIndexValue()
+    {
+        nValue = 0;
+    }
+
+    CAddrIndexValue(int64 nValueIn, const COutPoint& prevoutIn = COutPoint())
+    {
+        nValue = nValueIn;
+        prevout = prevoutIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(prevout);
+    )
 };
 
 
@@ -869,6 +1321,15 @@ public:
     // memory only
     mutable std::vector<uint256> vMerkleTree;
 
+    // memory only: X11 hash of the header bytes in pchHeaderCached
+    mutable uint256 hashCached;
+    mutable unsigned char pchHeaderCached[80];
+    mutable bool fHashCached;
+
+    // memory only: CheckBlock() already passed.  Only set by code that won't
+    // change the block any more, see LoadExternalBlockFile()
+    bool fChecked;
+
     // Denial-of-service detection:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
@@ -912,6 +1373,8 @@ public:
         vtx.clear();
         vchBlockSig.clear();
         vMerkleTree.clear();
+        fHashCached = false;
+        fChecked = false;
         nDoS = 0;
     }
 
@@ -920,9 +1383,26 @@ public:
         return (nBits == 0);
     }
 
+    // Header fields are public and get changed in place (the miner bumps
+    // nNonce, getwork sets nTime), so the cached hash is only reused while
+    // the 80 header bytes still match the ones it was computed from.
     uint256 GetHash() const
     {
-        return Hash9(BEGIN(nVersion), END(nNonce));
+        if (!fHashCached || memcmp(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached)) != 0)
+        {
+            memcpy(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached));
+            hashCached = Hash9(BEGIN(nVersion), END(nNonce));
+            fHashCached = true;
+        }
+        return hashCached;
+    }
+
+    // Prime the hash cache with a hash computed elsewhere, see PrecomputeBlockHashes()
+    void SetCachedHash(const uint256& hash) const
+    {
+        memcpy(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached));
+        hashCached = hash;
+        fHashCached = true;
     }
 
     int64 GetBlockTime() const
@@ -967,24 +1447,11 @@ public:
         return maxTransactionTime;
     }
 
-    uint256 BuildMerkleTree() const
-    {
-        vMerkleTree.clear();
-        BOOST_FOREACH(const CTransaction& tx, vtx)
-            vMerkleTree.push_back(tx.GetHash());
-        int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
-        {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
-            j += nSize;
-        }
-        return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
-    }
+    uint256 BuildMerkleTree() const;
+
+    // Recompute only the path from the coinbase to the root, for when
+    // nothing but the coinbase changed since the tree was built
+    uint256 UpdateMerkleTreeCoinbase() const;
 
     std::vector<uint256> GetMerkleBranch(int nIndex) const
     {
@@ -1036,10 +1503,10 @@ public:
         nBlockPosRet = fileOutPos;
         fileout << *this;
 
-        // Flush stdio buffers and commit to disk before returning
+        // Flush stdio buffers.  The file is committed to disk before the
+        // index records pointing into it are, see CommitBlockFiles()
         fflush(fileout);
-        if (!IsInitialBlockDownload() || (nBestHeight+1) % 500 == 0)
-            FileCommit(fileout);
+        blockstore.Appended(nFileRet, ftell(fileout));
 
         return true;
     }
@@ -1048,19 +1515,33 @@ public:
     {
         SetNull();
 
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
-        if (!fReadTransactions)
-            filein.nType |= SER_BLOCKHEADERONLY;
-
-        // Read block
-        try {
-            filein >> *this;
+        // Read block from the mapped file, or with stdio if it can't be mapped
+        CBlockFileView view(SER_DISK, CLIENT_VERSION);
+        if (blockstore.GetView(nFile, nBlockPos, view))
+        {
+            if (!fReadTransactions)
+                view.nType |= SER_BLOCKHEADERONLY;
+            try {
+                view >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize error", BOOST_CURRENT_FUNCTION);
+            }
         }
-        catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error", BOOST_CURRENT_FUNCTION);
+        else
+        {
+            CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+            if (!fReadTransactions)
+                filein.nType |= SER_BLOCKHEADERONLY;
+
+            try {
+                filein >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", BOOST_CURRENT_FUNCTION);
+            }
         }
 
         // Check the header
@@ -1114,12 +1595,39 @@ private:
 
 
 
+/** The proof-of-stake fields of a block index entry.  They are seldom
+ * looked at, so they are kept out of CBlockIndex, and only proof-of-stake
+ * blocks have them.  Allocated from a pool like CBlockIndex.
+ */
+class CBlockIndexStake
+{
+public:
+    COutPoint prevoutStake;
+    unsigned int nStakeTime;
+    uint256 hashProofOfStake;
+
+    CBlockIndexStake()
+    {
+        nStakeTime = 0;
+        hashProofOfStake = 0;
+    }
+
+    static void* operator new(size_t nSize);
+    static void operator delete(void* p, size_t nSize);
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block.  pprev and pnext link a path through the
  * main/longest chain.  A blockindex may have multiple pprev pointing back
  * to it, but pnext will only point forward to the longest branch, or will
  * be null if the block is not part of the longest chain.
+ *
+ * There is an entry for every block, walked all the time, so they are kept
+ * small: the chain trust is a plain 256-bit number, the proof-of-stake
+ * fields are in a CBlockIndexStake of their own, and entries are allocated
+ * from a pool.  Entries and their CBlockIndexStake live as long as the
+ * process; copies, like CDiskBlockIndex, share the CBlockIndexStake.
  */
 class CBlockIndex
 {
@@ -1127,13 +1635,16 @@ public:
     const uint256* phashBlock;
     CBlockIndex* pprev;
     CBlockIndex* pnext;
-    unsigned int nFile;
-    unsigned int nBlockPos;
-    CBigNum bnChainTrust; // ppcoin: trust score of block chain
-    int nHeight;
+    CBlockIndexStake* pstake; // ppcoin: proof-of-stake fields, NULL for proof-of-work
+    uint256 nChainTrust; // ppcoin: trust score of block chain
 
     int64 nMint;
     int64 nMoneySupply;
+    uint64 nStakeModifier; // hash modifier for proof-of-stake
+
+    unsigned int nFile;
+    unsigned int nBlockPos;
+    int nHeight;
 
     unsigned int nFlags;  // ppcoin: block index flags
     enum
@@ -1143,14 +1654,8 @@ public:
         BLOCK_STAKE_MODIFIER = (1 << 2), // regenerated stake modifier
     };
 
-    uint64 nStakeModifier; // hash modifier for proof-of-stake
     unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
 
-    // proof-of-stake specific fields
-    COutPoint prevoutStake;
-    unsigned int nStakeTime;
-    uint256 hashProofOfStake;
-
     // block header
     int nVersion;
     uint256 hashMerkleRoot;
@@ -1163,18 +1668,16 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pstake = NULL;
         nFile = 0;
         nBlockPos = 0;
         nHeight = 0;
-        bnChainTrust = 0;
+        nChainTrust = 0;
         nMint = 0;
         nMoneySupply = 0;
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
-        hashProofOfStake = 0;
-        prevoutStake.SetNull();
-        nStakeTime = 0;
 
         nVersion       = 0;
         hashMerkleRoot = 0;
@@ -1188,26 +1691,20 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pstake = NULL;
         nFile = nFileIn;
         nBlockPos = nBlockPosIn;
         nHeight = 0;
-        bnChainTrust = 0;
+        nChainTrust = 0;
         nMint = 0;
         nMoneySupply = 0;
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
-        hashProofOfStake = 0;
         if (block.IsProofOfStake())
         {
             SetProofOfStake();
-            prevoutStake = block.vtx[1].vin[0].prevout;
-            nStakeTime = block.vtx[1].nTime;
-        }
-        else
-        {
-            prevoutStake.SetNull();
-            nStakeTime = 0;
+            SetStake(block.vtx[1].vin[0].prevout, block.vtx[1].nTime, 0);
         }
 
         nVersion       = block.nVersion;
@@ -1240,7 +1737,7 @@ public:
         return (int64)nTime;
     }
 
-    CBigNum GetBlockTrust() const;
+    uint256 GetBlockTrust() const;
 
     bool IsInMainChain() const
     {
@@ -1328,6 +1825,33 @@ public:
             nFlags |= BLOCK_STAKE_MODIFIER;
     }
 
+    COutPoint GetPrevoutStake() const
+    {
+        return pstake ? pstake->prevoutStake : COutPoint();
+    }
+
+    unsigned int GetStakeTime() const
+    {
+        return pstake ? pstake->nStakeTime : 0;
+    }
+
+    uint256 GetProofOfStakeHash() const
+    {
+        return pstake ? pstake->hashProofOfStake : 0;
+    }
+
+    void SetStake(const COutPoint& prevoutStake, unsigned int nStakeTime, const uint256& hashProofOfStake)
+    {
+        if (!pstake)
+            pstake = new CBlockIndexStake();
+        pstake->prevoutStake = prevoutStake;
+        pstake->nStakeTime = nStakeTime;
+        pstake->hashProofOfStake = hashProofOfStake;
+    }
+
+    static void* operator new(size_t nSize);
+    static void operator delete(void* p, size_t nSize);
+
     std::string ToString() const
     {
         return strprintf("CBlockIndex(nprev=%p, pnext=%p, nFile=%u, nBlockPos=%-6d nHeight=%d, nMint=%s, nMoneySupply=%s, nFlags=(%s)(%d)(%s), nStakeModifier=%016"PRI64x", nStakeModifierChecksum=%08x, hashProofOfStake=%s, prevoutStake=(%s), nStakeTime=%d merkle=%s, hashBlock=%s)",
@@ -1335,8 +1859,8 @@ public:
             FormatMoney(nMint).c_str(), FormatMoney(nMoneySupply).c_str(),
             GeneratedStakeModifier() ? "MOD" : "-", GetStakeEntropyBit(), IsProofOfStake()? "PoS" : "PoW",
             nStakeModifier, nStakeModifierChecksum,
-            hashProofOfStake.ToString().c_str(),
-            prevoutStake.ToString().c_str(), nStakeTime,
+            GetProofOfStakeHash().ToString().c_str(),
+            GetPrevoutStake().ToString().c_str(), GetStakeTime(),
             hashMerkleRoot.ToString().c_str(),
             GetBlockHash().ToString().c_str());
     }
@@ -1356,16 +1880,26 @@ public:
     uint256 hashPrev;
     uint256 hashNext;
 
+    // proof-of-stake specific fields
+    COutPoint prevoutStake;
+    unsigned int nStakeTime;
+    uint256 hashProofOfStake;
+
     CDiskBlockIndex()
     {
         hashPrev = 0;
         hashNext = 0;
+        nStakeTime = 0;
+        hashProofOfStake = 0;
     }
 
     explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex)
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : 0);
         hashNext = (pnext ? pnext->GetBlockHash() : 0);
+        prevoutStake = pindex->GetPrevoutStake();
+        nStakeTime = pindex->GetStakeTime();
+        hashProofOfStake = pindex->GetProofOfStakeHash();
     }
 
     IMPLEMENT_SERIALIZE
@@ -1403,7 +1937,7 @@ public:
         READWRITE(nNonce);
     )
 
-    uint256 GetBlockHash() const
+    CBlock GetBlockHeader() const
     {
         CBlock block;
         block.nVersion        = nVersion;
@@ -1412,7 +1946,12 @@ public:
         block.nTime           = nTime;
         block.nBits           = nBits;
         block.nNonce          = nNonce;
-        return block.GetHash();
+        return block;
+    }
+
+    uint256 GetBlockHash() const
+    {
+        return GetBlockHeader().GetHash();
     }
 
 
@@ -1461,7 +2000,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1512,7 +2051,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1531,7 +2070,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1547,7 +2086,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1578,7 +2117,7 @@ class CTxMemPool
 {
 public:
     mutable CCriticalSection cs;
-    std::map<uint256, CTransaction> mapTx;
+    uint256_map<CTransaction> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
 
     bool accept(CTxDB& txdb, CTransaction &tx,
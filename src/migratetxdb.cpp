@@ -0,0 +1,183 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Copies the transaction index of a data directory from blkindex.dat into
+// the txdb directory that -txdb=lsm uses.  Run it with the client stopped.
+
+#include "db.h"
+#include "lsmdb.h"
+#include "main.h"
+#include "wallet.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/scoped_ptr.hpp>
+
+using namespace std;
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+
+void Shutdown(void* parg)
+{
+    exit(0);
+}
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+static bool Fail(const char* pszMessage)
+{
+    fprintf(stderr, "Error: %s\n", pszMessage);
+    return false;
+}
+
+static bool CopyRecords(CKeyValueStore& storeFrom, CLSMStore& storeTo, uint64& nRecordsRet, uint64& nBytesRet)
+{
+    static const size_t nBatchSize = 8 << 20;
+    boost::scoped_ptr<CKeyValueCursor> pcursor(storeFrom.NewCursor());
+    CKeyValueBatch batch;
+    for (pcursor->Seek(string()); pcursor->Valid(); pcursor->Next())
+    {
+        batch.Write(pcursor->GetKey(), pcursor->GetValue());
+        nRecordsRet++;
+        nBytesRet += pcursor->GetKey().size() + pcursor->GetValue().size();
+        if (batch.GetDataSize() >= nBatchSize)
+        {
+            if (!storeTo.Write(batch, false))
+                return Fail("write to the new store failed");
+            batch.clear();
+            fprintf(stdout, "\r%"PRI64u" records, %.1f MB", nRecordsRet, nBytesRet / 1048576.0);
+            fflush(stdout);
+        }
+    }
+    if (pcursor->Failed())
+        return Fail("read of blkindex.dat failed");
+    if (!storeTo.Write(batch, true))
+        return Fail("write to the new store failed");
+    fprintf(stdout, "\r%"PRI64u" records, %.1f MB\n", nRecordsRet, nBytesRet / 1048576.0);
+    return true;
+}
+
+static bool VerifyRecords(CKeyValueStore& storeFrom, CLSMStore& storeTo, uint64 nRecords)
+{
+    boost::scoped_ptr<CKeyValueCursor> pcursorFrom(storeFrom.NewCursor());
+    boost::scoped_ptr<CKeyValueCursor> pcursorTo(storeTo.NewCursor());
+    uint64 nCompared = 0;
+    pcursorFrom->Seek(string());
+    pcursorTo->Seek(string());
+    while (pcursorFrom->Valid() && pcursorTo->Valid())
+    {
+        if (pcursorFrom->GetKey() != pcursorTo->GetKey() || pcursorFrom->GetValue() != pcursorTo->GetValue())
+            return Fail("the new store differs from blkindex.dat");
+        nCompared++;
+        pcursorFrom->Next();
+        pcursorTo->Next();
+    }
+    if (pcursorFrom->Failed() || pcursorTo->Failed())
+        return Fail("read failed while verifying");
+    if (pcursorFrom->Valid() || pcursorTo->Valid() || nCompared != nRecords)
+        return Fail("the new store has a different number of records");
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("--help"))
+    {
+        fprintf(stdout, "Usage: migratetxdb_miraclecoin [options]\n\n"
+            "Copies the transaction index in blkindex.dat to the txdb directory used by\n"
+            "-txdb=lsm.  blkindex.dat is left as it is.  The client must not be running.\n\n"
+            "  -datadir=<dir>    Specify data directory\n"
+            "  -conf=<file>      Specify configuration file (default: MiracleCoin.conf)\n"
+            "  -testnet          Use the test network\n"
+            "  -force            Replace an existing txdb directory\n");
+        return 0;
+    }
+    if (!boost::filesystem::is_directory(GetDataDir(false)))
+    {
+        fprintf(stderr, "Error: Specified directory does not exist\n");
+        return 1;
+    }
+    ReadConfigFile(mapArgs, mapMultiArgs);
+    fTestNet = GetBoolArg("-testnet");
+
+    // Nothing but this tool may use the data directory meanwhile
+    boost::filesystem::path pathLockFile = GetDataDir() / ".lock";
+    FILE* file = fopen(pathLockFile.string().c_str(), "a");
+    if (file) fclose(file);
+    boost::interprocess::file_lock lock(pathLockFile.string().c_str());
+    if (!lock.try_lock())
+    {
+        fprintf(stderr, "Error: Cannot obtain a lock on data directory %s.  MiracleCoin is probably running.\n", GetDataDir().string().c_str());
+        return 1;
+    }
+
+    boost::filesystem::path pathTxDB = GetDataDir() / "txdb";
+    boost::filesystem::path pathNew = GetDataDir() / "txdb.migrate";
+    if (!boost::filesystem::exists(GetDataDir() / "blkindex.dat"))
+    {
+        fprintf(stderr, "Error: There is no blkindex.dat in %s\n", GetDataDir().string().c_str());
+        return 1;
+    }
+    if (boost::filesystem::exists(pathTxDB) && !GetBoolArg("-force"))
+    {
+        fprintf(stderr, "Error: %s already exists, use -force to replace it\n", pathTxDB.string().c_str());
+        return 1;
+    }
+    if (!bitdb.Open(GetDataDir()))
+    {
+        fprintf(stderr, "Error: Error initializing database environment %s\n", GetDataDir().string().c_str());
+        return 1;
+    }
+
+    int64 nStart = GetTimeMillis();
+    uint64 nRecords = 0, nBytes = 0;
+    bool fOk;
+    try {
+        boost::filesystem::remove_all(pathNew);
+        CBDBKeyValueStore storeFrom("blkindex.dat", "r");
+        CLSMStore storeTo;
+
+        // Written in key order, the tables come out with no overlap to merge
+        fOk = storeTo.Open(pathNew, 64 << 20) &&
+              CopyRecords(storeFrom, storeTo, nRecords, nBytes) &&
+              storeTo.WaitForCompaction(true);
+        if (fOk)
+        {
+            fprintf(stdout, "Verifying...\n");
+            fOk = VerifyRecords(storeFrom, storeTo, nRecords);
+        }
+        storeTo.Close();
+    }
+    catch (std::exception& e) {
+        fOk = Fail(e.what());
+    }
+    bitdb.Flush(true);
+    if (!fOk)
+    {
+        fprintf(stderr, "Migration failed, %s is left unchanged\n", pathTxDB.string().c_str());
+        return 1;
+    }
+
+    try {
+        boost::filesystem::remove_all(pathTxDB);
+        boost::filesystem::rename(pathNew, pathTxDB);
+    }
+    catch (std::exception& e) {
+        fprintf(stderr, "Error: Can't move %s into place: %s\n", pathNew.string().c_str(), e.what());
+        return 1;
+    }
+
+    double dSeconds = max(GetTimeMillis() - nStart, (int64)1) / 1000.0;
+    fprintf(stdout, "Copied %"PRI64u" records, %.1f MB in %.1f s (%.1f MB/s) to %s\n"
+        "Start the client with -txdb=lsm to use it.\n",
+        nRecords, nBytes / 1048576.0, dSeconds, nBytes / 1048576.0 / dSeconds, pathTxDB.string().c_str());
+    return 0;
+}
@@ -112,6 +112,7 @@ enum threadId
     THREAD_DUMPADDRESS,
     THREAD_RPCHANDLER,
     THREAD_STAKEMINTER,
+    THREAD_SCRIPTCHECK,
 
     THREAD_MAX
 };
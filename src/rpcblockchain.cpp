@@ -4,7 +4,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "base58.h"
 #include "bitcoinrpc.h"
+#include "db.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -90,7 +92,7 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
         result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
 
     result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
-    result.push_back(Pair("proofhash", blockindex->IsProofOfStake()? blockindex->hashProofOfStake.GetHex() : blockindex->GetBlockHash().GetHex()));
+    result.push_back(Pair("proofhash", blockindex->IsProofOfStake()? blockindex->GetProofOfStakeHash().GetHex() : blockindex->GetBlockHash().GetHex()));
     result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
     result.push_back(Pair("modifier", strprintf("%016"PRI64x, blockindex->nStakeModifier)));
     result.push_back(Pair("modifierchecksum", strprintf("%08x", blockindex->nStakeModifierChecksum)));
@@ -254,3 +256,185 @@ Value getcheckpoint(const Array& params, bool fHelp)
 
     return result;
 }
+
+// Address index lookups (-addrindex)
+static void ReadAddrIndexParam(const Value& param, CAddrIndexVisitor& visitor)
+{
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, start with -addrindex");
+    CBitcoinAddress address(param.get_str());
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid MiracleCoin address");
+
+    CTxDB txdb("r");
+    if (!txdb.ReadAddrIndex(CAddrIndexDest(address.Get()), visitor))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Error reading the address index");
+}
+
+// A page of the history, the entries after the first nSkip
+class CAddrHistoryVisitor : public CAddrIndexVisitor
+{
+public:
+    unsigned int nSkip;
+    unsigned int nMax;
+    Array result;
+
+    CAddrHistoryVisitor(unsigned int nSkipIn, unsigned int nMaxIn) : nSkip(nSkipIn), nMax(nMaxIn) { }
+
+    bool Visit(const CAddrIndexKey& key, const CAddrIndexValue& value)
+    {
+        if (result.size() >= nMax)
+            return false;
+        if (nSkip > 0)
+        {
+            nSkip--;
+            return true;
+        }
+        Object entry;
+        entry.push_back(Pair("txid", key.hashTx.GetHex()));
+        entry.push_back(Pair("height", key.nHeight));
+        entry.push_back(Pair("confirmations", nBestHeight - key.nHeight + 1));
+        if (key.fSpend)
+        {
+            entry.push_back(Pair("category", "spend"));
+            entry.push_back(Pair("vin", (int)key.nIndex));
+            entry.push_back(Pair("prevtxid", value.prevout.hash.GetHex()));
+            entry.push_back(Pair("prevvout", (int)value.prevout.n));
+            entry.push_back(Pair("amount", ValueFromAmount(-value.nValue)));
+        }
+        else
+        {
+            entry.push_back(Pair("category", "receive"));
+            entry.push_back(Pair("vout", (int)key.nIndex));
+            entry.push_back(Pair("amount", ValueFromAmount(value.nValue)));
+        }
+        result.push_back(entry);
+        return true;
+    }
+};
+
+Value getaddresshistory(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory <MiracleCoinaddress> [count=100] [from=0]\n"
+            "Returns up to [count] transaction outputs paying to <MiracleCoinaddress>\n"
+            "and inputs spending them, skipping the first [from], oldest first.\n"
+            "Requires -addrindex.");
+
+    int nCount = 100;
+    if (params.size() > 1)
+        nCount = params[1].get_int();
+    int nFrom = 0;
+    if (params.size() > 2)
+        nFrom = params[2].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    if (nFrom < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
+
+    CAddrHistoryVisitor visitor(nFrom, nCount);
+    ReadAddrIndexParam(params[0], visitor);
+    return visitor.result;
+}
+
+// The outputs not spent by one of the inputs, which come later in the scan
+// except in the same block, where the keys are in txid order
+class CAddrUnspentVisitor : public CAddrIndexVisitor
+{
+public:
+    // Unspent outputs by height, with their amounts, and the height of each
+    map<pair<int, COutPoint>, int64> mapUnspent;
+    map<COutPoint, int> mapHeight;
+    set<COutPoint> setSpentFirst;
+
+    bool Visit(const CAddrIndexKey& key, const CAddrIndexValue& value)
+    {
+        if (key.fSpend)
+        {
+            map<COutPoint, int>::iterator mi = mapHeight.find(value.prevout);
+            if (mi == mapHeight.end())
+                setSpentFirst.insert(value.prevout);
+            else
+            {
+                mapUnspent.erase(make_pair(mi->second, mi->first));
+                mapHeight.erase(mi);
+            }
+        }
+        else
+        {
+            COutPoint outpoint(key.hashTx, key.nIndex);
+            if (!setSpentFirst.erase(outpoint))
+            {
+                mapUnspent.insert(make_pair(make_pair(key.nHeight, outpoint), value.nValue));
+                mapHeight.insert(make_pair(outpoint, key.nHeight));
+            }
+        }
+        return true;
+    }
+};
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos <MiracleCoinaddress>\n"
+            "Returns the unspent transaction outputs paying to <MiracleCoinaddress>\n"
+            "in the main chain, oldest first.\n"
+            "Requires -addrindex.");
+
+    CAddrUnspentVisitor visitor;
+    ReadAddrIndexParam(params[0], visitor);
+
+    Array result;
+    for (map<pair<int, COutPoint>, int64>::const_iterator mi = visitor.mapUnspent.begin(); mi != visitor.mapUnspent.end(); ++mi)
+    {
+        int nHeight = mi->first.first;
+        const COutPoint& outpoint = mi->first.second;
+        Object entry;
+        entry.push_back(Pair("txid", outpoint.hash.GetHex()));
+        entry.push_back(Pair("vout", (int)outpoint.n));
+        entry.push_back(Pair("amount", ValueFromAmount(mi->second)));
+        entry.push_back(Pair("height", nHeight));
+        entry.push_back(Pair("confirmations", nBestHeight - nHeight + 1));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+class CAddrBalanceVisitor : public CAddrIndexVisitor
+{
+public:
+    int64 nReceived;
+    int64 nSent;
+
+    CAddrBalanceVisitor() : nReceived(0), nSent(0) { }
+
+    bool Visit(const CAddrIndexKey& key, const CAddrIndexValue& value)
+    {
+        if (key.fSpend)
+            nSent += value.nValue;
+        else
+            nReceived += value.nValue;
+        return true;
+    }
+};
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance <MiracleCoinaddress>\n"
+            "Returns the amounts received by and sent from <MiracleCoinaddress>\n"
+            "in the main chain, and its balance.\n"
+            "Requires -addrindex.");
+
+    CAddrBalanceVisitor visitor;
+    ReadAddrIndexParam(params[0], visitor);
+
+    Object result;
+    result.push_back(Pair("received", ValueFromAmount(visitor.nReceived)));
+    result.push_back(Pair("sent", ValueFromAmount(visitor.nSent)));
+    result.push_back(Pair("balance", ValueFromAmount(visitor.nReceived - visitor.nSent)));
+    return result;
+}
@@ -50,10 +50,26 @@ Value setgenerate(const Array& params, bool fHelp)
 
 Value gethashespersec(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gethashespersec\n"
-            "Returns a recent hashes per second performance measurement while generating.");
+            "gethashespersec [perthread=false]\n"
+            "Returns a recent hashes per second performance measurement while generating.\n"
+            "If [perthread] is true, returns an array with the rate of each miner thread.");
+
+    bool fPerThread = false;
+    if (params.size() > 0)
+        fPerThread = params[0].get_bool();
+
+    if (fPerThread)
+    {
+        vector<double> vHashesPerSec;
+        GetMinerHashesPerSec(vHashesPerSec);
+        bool fStale = (GetTimeMillis() - nHPSTimerStart > 8000);
+        Array ret;
+        BOOST_FOREACH(double dRate, vHashesPerSec)
+            ret.push_back(fStale ? (boost::int64_t)0 : (boost::int64_t)dRate);
+        return ret;
+    }
 
     if (GetTimeMillis() - nHPSTimerStart > 8000)
         return (boost::int64_t)0;
@@ -77,6 +93,9 @@ Value getmininginfo(const Array& params, bool fHelp)
     obj.push_back(Pair("generate",      GetBoolArg("-gen")));
     obj.push_back(Pair("genproclimit",  (int)GetArg("-genproclimit", -1)));
     obj.push_back(Pair("hashespersec",  gethashespersec(params, false)));
+    Array paramsPerThread;
+    paramsPerThread.push_back(true);
+    obj.push_back(Pair("threadhashespersec", gethashespersec(paramsPerThread, false)));
 	obj.push_back(Pair("networkhashps", getnetworkhashps(params, false)));
     obj.push_back(Pair("pooledtx",      (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet",       fTestNet));
@@ -234,11 +253,14 @@ Value getworkex(const Array& params, bool fHelp)
         pblock->nNonce = pdata->nNonce;
 
         if(coinbase.size() == 0)
+        {
             pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+            pblock->vtx[0].InvalidateHash();
+        }
         else
             CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0]; // FIXME - HACK!
 
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->hashMerkleRoot = pblock->UpdateMerkleTreeCoinbase();
 
         if (!pblock->SignBlock(*pwalletMain))
             throw JSONRPCError(-100, "Unable to sign block, wallet locked?");
@@ -354,7 +376,8 @@ Value getwork(const Array& params, bool fHelp)
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
         pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->vtx[0].InvalidateHash();
+        pblock->hashMerkleRoot = pblock->UpdateMerkleTreeCoinbase();
 
         if (!pblock->SignBlock(*pwalletMain))
             throw JSONRPCError(-100, "Unable to sign block, wallet locked?");
@@ -3,7 +3,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_set.hpp>
 
 using namespace std;
 using namespace boost;
@@ -16,27 +18,19 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              const CSignatureHashContext* pcontext = NULL);
 
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
-static const size_t nMaxNumSize = 4;
+static const CScriptValue vchFalse;
+static const CScriptValue vchZero;
+static const CScriptValue vchTrue(valtype(1, 1));
+static const CScriptNum bnZero(0);
+static const CScriptNum bnOne(1);
+static const CScriptNum bnFalse(0);
+static const CScriptNum bnTrue(1);
 
 
-CBigNum CastToBigNum(const valtype& vch)
-{
-    if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    // Get rid of extra leading zeros
-    return CBigNum(CBigNum(vch).getvch());
-}
-
-bool CastToBool(const valtype& vch)
+bool CastToBool(const CScriptValue& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -51,32 +45,6 @@ bool CastToBool(const valtype& vch)
     return false;
 }
 
-//
-// WARNING: This does not work as expected for signed integers; the sign-bit
-// is left in place as the integer is zero-extended. The correct behavior
-// would be to move the most significant bit of the last byte during the
-// resize process. MakeSameSize() is currently only used by the disabled
-// opcodes OP_AND, OP_OR, and OP_XOR.
-//
-void MakeSameSize(valtype& vch1, valtype& vch2)
-{
-    // Lengthen the shorter one
-    if (vch1.size() < vch2.size())
-        // PATCH:
-        // +unsigned char msb = vch1[vch1.size()-1];
-        // +vch1[vch1.size()-1] &= 0x7f;
-        //  vch1.resize(vch2.size(), 0);
-        // +vch1[vch1.size()-1] = msb;
-        vch1.resize(vch2.size(), 0);
-    if (vch2.size() < vch1.size())
-        // PATCH:
-        // +unsigned char msb = vch2[vch2.size()-1];
-        // +vch2[vch2.size()-1] &= 0x7f;
-        //  vch2.resize(vch1.size(), 0);
-        // +vch2[vch2.size()-1] = msb;
-        vch2.resize(vch1.size(), 0);
-}
-
 
 
 //
@@ -85,7 +53,7 @@ void MakeSameSize(valtype& vch1, valtype& vch2)
 //
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(CScriptStack& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
@@ -250,16 +218,15 @@ const char* GetOpName(opcodetype opcode)
     }
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* pcontext)
 {
-    CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
     vector<bool> vfExec;
-    vector<valtype> altstack;
+    CScriptStack altstack;
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -272,11 +239,12 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
             bool fExec = !count(vfExec.begin(), vfExec.end(), false);
 
             //
-            // Read instruction
+            // Read instruction; pushed data is copied straight from the script
             //
-            if (!script.GetOp(pc, opcode, vchPushValue))
+            CScriptPush push;
+            if (!script.GetOp(pc, opcode, push))
                 return false;
-            if (vchPushValue.size() > 520)
+            if (push.nSize > 520)
                 return false;
             if (opcode > OP_16 && ++nOpCount > 201)
                 return false;
@@ -299,7 +267,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 return false;
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4)
-                stack.push_back(vchPushValue);
+                stack.push_back(push.pch, push.pch + push.nSize);
             else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -325,7 +293,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_16:
                 {
                     // ( -- value)
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
+                    CScriptNum bn((int)opcode - (int)(OP_1 - 1));
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -348,7 +316,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
+                        CScriptValue& vch = stacktop(-1);
                         fValue = CastToBool(vch);
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
@@ -431,8 +399,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-2);
+                    CScriptValue vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -443,9 +411,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-3);
+                    CScriptValue vch2 = stacktop(-2);
+                    CScriptValue vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -457,8 +425,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CScriptValue vch1 = stacktop(-4);
+                    CScriptValue vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -469,9 +437,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
-                    stack.erase(stack.end()-6, stack.end()-4);
+                    CScriptValue vch1 = stacktop(-6);
+                    CScriptValue vch2 = stacktop(-5);
+                    stack.erase(stack.size()-6, 2);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -492,7 +460,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -501,7 +469,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_DEPTH:
                 {
                     // -- stacksize
-                    CBigNum bn(stack.size());
+                    CScriptNum bn(stack.size());
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -520,7 +488,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x -- x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -530,7 +498,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2)
                     if (stack.size() < 2)
                         return false;
-                    stack.erase(stack.end() - 2);
+                    stack.erase(stack.size() - 2);
                 }
                 break;
 
@@ -539,7 +507,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    CScriptValue vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -551,13 +519,13 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint();
+                    int n = CScriptNum(stacktop(-1)).getint();
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    CScriptValue vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
-                        stack.erase(stack.end()-n-1);
+                        stack.erase(stack.size()-n-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -588,8 +556,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
-                    stack.insert(stack.end()-2, vch);
+                    CScriptValue vch = stacktop(-1);
+                    stack.insert(stack.size()-2, vch);
                 }
                 break;
 
@@ -597,67 +565,12 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 //
                 // Splice ops
                 //
-                case OP_CAT:
-                {
-                    // (x1 x2 -- out)
-                    if (stack.size() < 2)
-                        return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
-                    vch1.insert(vch1.end(), vch2.begin(), vch2.end());
-                    popstack(stack);
-                    if (stacktop(-1).size() > 520)
-                        return false;
-                }
-                break;
-
-                case OP_SUBSTR:
-                {
-                    // (in begin size -- out)
-                    if (stack.size() < 3)
-                        return false;
-                    valtype& vch = stacktop(-3);
-                    int nBegin = CastToBigNum(stacktop(-2)).getint();
-                    int nEnd = nBegin + CastToBigNum(stacktop(-1)).getint();
-                    if (nBegin < 0 || nEnd < nBegin)
-                        return false;
-                    if (nBegin > (int)vch.size())
-                        nBegin = vch.size();
-                    if (nEnd > (int)vch.size())
-                        nEnd = vch.size();
-                    vch.erase(vch.begin() + nEnd, vch.end());
-                    vch.erase(vch.begin(), vch.begin() + nBegin);
-                    popstack(stack);
-                    popstack(stack);
-                }
-                break;
-
-                case OP_LEFT:
-                case OP_RIGHT:
-                {
-                    // (in size -- out)
-                    if (stack.size() < 2)
-                        return false;
-                    valtype& vch = stacktop(-2);
-                    int nSize = CastToBigNum(stacktop(-1)).getint();
-                    if (nSize < 0)
-                        return false;
-                    if (nSize > (int)vch.size())
-                        nSize = vch.size();
-                    if (opcode == OP_LEFT)
-                        vch.erase(vch.begin() + nSize, vch.end());
-                    else
-                        vch.erase(vch.begin(), vch.end() - nSize);
-                    popstack(stack);
-                }
-                break;
-
                 case OP_SIZE:
                 {
                     // (in -- in size)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn(stacktop(-1).size());
+                    CScriptNum bn(stacktop(-1).size());
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -666,51 +579,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 //
                 // Bitwise logic
                 //
-                case OP_INVERT:
-                {
-                    // (in - out)
-                    if (stack.size() < 1)
-                        return false;
-                    valtype& vch = stacktop(-1);
-                    for (unsigned int i = 0; i < vch.size(); i++)
-                        vch[i] = ~vch[i];
-                }
-                break;
-
-                //
-                // WARNING: These disabled opcodes exhibit unexpected behavior
-                // when used on signed integers due to a bug in MakeSameSize()
-                // [see definition of MakeSameSize() above].
-                //
-                case OP_AND:
-                case OP_OR:
-                case OP_XOR:
-                {
-                    // (x1 x2 - out)
-                    if (stack.size() < 2)
-                        return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
-                    MakeSameSize(vch1, vch2); // <-- NOT SAFE FOR SIGNED VALUES
-                    if (opcode == OP_AND)
-                    {
-                        for (unsigned int i = 0; i < vch1.size(); i++)
-                            vch1[i] &= vch2[i];
-                    }
-                    else if (opcode == OP_OR)
-                    {
-                        for (unsigned int i = 0; i < vch1.size(); i++)
-                            vch1[i] |= vch2[i];
-                    }
-                    else if (opcode == OP_XOR)
-                    {
-                        for (unsigned int i = 0; i < vch1.size(); i++)
-                            vch1[i] ^= vch2[i];
-                    }
-                    popstack(stack);
-                }
-                break;
-
                 case OP_EQUAL:
                 case OP_EQUALVERIFY:
                 //case OP_NOTEQUAL: // use OP_NUMNOTEQUAL
@@ -718,8 +586,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -745,8 +613,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 //
                 case OP_1ADD:
                 case OP_1SUB:
-                case OP_2MUL:
-                case OP_2DIV:
                 case OP_NEGATE:
                 case OP_ABS:
                 case OP_NOT:
@@ -755,17 +621,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- out)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    CScriptNum bn(stacktop(-1));
                     switch (opcode)
                     {
-                    case OP_1ADD:       bn += bnOne; break;
-                    case OP_1SUB:       bn -= bnOne; break;
-                    case OP_2MUL:       bn <<= 1; break;
-                    case OP_2DIV:       bn >>= 1; break;
+                    case OP_1ADD:       bn = bn + bnOne; break;
+                    case OP_1SUB:       bn = bn - bnOne; break;
                     case OP_NEGATE:     bn = -bn; break;
                     case OP_ABS:        if (bn < bnZero) bn = -bn; break;
-                    case OP_NOT:        bn = (bn == bnZero); break;
-                    case OP_0NOTEQUAL:  bn = (bn != bnZero); break;
+                    case OP_NOT:        bn = CScriptNum(bn == bnZero); break;
+                    case OP_0NOTEQUAL:  bn = CScriptNum(bn != bnZero); break;
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
@@ -775,11 +639,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                 case OP_ADD:
                 case OP_SUB:
-                case OP_MUL:
-                case OP_DIV:
-                case OP_MOD:
-                case OP_LSHIFT:
-                case OP_RSHIFT:
                 case OP_BOOLAND:
                 case OP_BOOLOR:
                 case OP_NUMEQUAL:
@@ -795,9 +654,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    CScriptNum bn1(stacktop(-2));
+                    CScriptNum bn2(stacktop(-1));
+                    CScriptNum bn(0);
                     switch (opcode)
                     {
                     case OP_ADD:
@@ -808,42 +667,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         bn = bn1 - bn2;
                         break;
 
-                    case OP_MUL:
-                        if (!BN_mul(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_DIV:
-                        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_MOD:
-                        if (!BN_mod(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_LSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 << bn2.getulong();
-                        break;
-
-                    case OP_RSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 >> bn2.getulong();
-                        break;
-
-                    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
-                    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
-                    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
-                    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
-                    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
-                    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
-                    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
-                    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
-                    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
+                    case OP_BOOLAND:             bn = CScriptNum(bn1 != bnZero && bn2 != bnZero); break;
+                    case OP_BOOLOR:              bn = CScriptNum(bn1 != bnZero || bn2 != bnZero); break;
+                    case OP_NUMEQUAL:            bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMEQUALVERIFY:      bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMNOTEQUAL:         bn = CScriptNum(bn1 != bn2); break;
+                    case OP_LESSTHAN:            bn = CScriptNum(bn1 < bn2); break;
+                    case OP_GREATERTHAN:         bn = CScriptNum(bn1 > bn2); break;
+                    case OP_LESSTHANOREQUAL:     bn = CScriptNum(bn1 <= bn2); break;
+                    case OP_GREATERTHANOREQUAL:  bn = CScriptNum(bn1 >= bn2); break;
                     case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
                     case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
                     default:                     assert(!"invalid opcode"); break;
@@ -867,9 +699,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x min max -- out)
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
+                    CScriptNum bn1(stacktop(-3));
+                    CScriptNum bn2(stacktop(-2));
+                    CScriptNum bn3(stacktop(-1));
                     bool fValue = (bn2 <= bn1 && bn1 < bn3);
                     popstack(stack);
                     popstack(stack);
@@ -891,26 +723,26 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- hash)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CScriptValue& vch = stacktop(-1);
+                    unsigned char pchHash[32];
+                    unsigned int nHashSize = (opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32;
                     if (opcode == OP_RIPEMD160)
-                        RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
+                        RIPEMD160(vch.begin(), vch.size(), pchHash);
                     else if (opcode == OP_SHA1)
-                        SHA1(&vch[0], vch.size(), &vchHash[0]);
+                        SHA1(vch.begin(), vch.size(), pchHash);
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        CSHA256().Write(vch.begin(), vch.size()).Finalize(pchHash);
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
-                        memcpy(&vchHash[0], &hash160, sizeof(hash160));
+                        uint160 hash160 = Hash160(vch.begin(), vch.end());
+                        memcpy(pchHash, &hash160, sizeof(hash160));
                     }
                     else if (opcode == OP_HASH256)
                     {
                         uint256 hash = Hash(vch.begin(), vch.end());
-                        memcpy(&vchHash[0], &hash, sizeof(hash));
+                        memcpy(pchHash, &hash, sizeof(hash));
                     }
-                    popstack(stack);
-                    stack.push_back(vchHash);
+                    vch.assign(pchHash, pchHash + nHashSize);
                 }
                 break;
 
@@ -928,8 +760,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    CScriptValue& vchSig    = stacktop(-2);
+                    CScriptValue& vchPubKey = stacktop(-1);
 
                     ////// debug print
                     //PrintHex(vchSig.begin(), vchSig.end(), "sig: %s\n");
@@ -939,9 +771,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     CScript scriptCode(pbegincodehash, pend);
 
                     // Drop the signature, since there's no way for a signature to sign itself
-                    scriptCode.FindAndDelete(CScript(vchSig));
+                    scriptCode.FindAndDelete(CScript(valtype(vchSig.begin(), vchSig.end())));
 
-                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                    bool fSuccess = CheckSig(valtype(vchSig.begin(), vchSig.end()), valtype(vchPubKey.begin(), vchPubKey.end()),
+                                             scriptCode, txTo, nIn, nHashType, pcontext);
 
                     popstack(stack);
                     popstack(stack);
@@ -965,7 +798,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint();
+                    int nKeysCount = CScriptNum(stacktop(-i)).getint();
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -976,7 +809,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint();
+                    int nSigsCount = CScriptNum(stacktop(-i)).getint();
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -990,18 +823,19 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // Drop the signatures, since there's no way for a signature to sign itself
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        CScriptValue& vchSig = stacktop(-isig-k);
+                        scriptCode.FindAndDelete(CScript(valtype(vchSig.begin(), vchSig.end())));
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        CScriptValue& vchSig    = stacktop(-isig);
+                        CScriptValue& vchPubKey = stacktop(-ikey);
 
                         // Check signature
-                        if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType))
+                        if (CheckSig(valtype(vchSig.begin(), vchSig.end()), valtype(vchPubKey.begin(), vchPubKey.end()),
+                                     scriptCode, txTo, nIn, nHashType, pcontext))
                         {
                             isig++;
                             nSigsCount--;
@@ -1050,6 +884,14 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
     return true;
 }
 
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    CScriptStack stackEval(stack);
+    bool fResult = EvalScript(stackEval, script, txTo, nIn, nHashType);
+    stackEval.GetVector(stack);
+    return fResult;
+}
+
 
 
 
@@ -1120,42 +962,118 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     return Hash(ss.begin(), ss.end());
 }
 
+// Serialized size of an input with its scriptSig blanked:
+// outpoint, empty script, sequence
+static const unsigned int BLANK_TXIN_SIZE = 36 + 1 + 4;
+
+CSignatureHashContext::CSignatureHashContext(const CTransaction& txTo) : ptxTo(&txTo)
+{
+    CDataStream ssInputs(SER_GETHASH, 0);
+    ssInputs.reserve(txTo.vin.size() * BLANK_TXIN_SIZE);
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+    assert(vchInputs.size() == txTo.vin.size() * BLANK_TXIN_SIZE);
+
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    ssOutputs << txTo.vout << txTo.nLockTime;
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+
+    // Header, then the state before each input in turn
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(ss, txTo.vin.size());
+    vMidstate.reserve(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        vMidstate.push_back(ss);
+        ss.write((const char*)&vchInputs[i * BLANK_TXIN_SIZE], BLANK_TXIN_SIZE);
+    }
+}
+
+uint256 CSignatureHashContext::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const
+{
+    // Anything but SIGHASH_ALL changes the inputs or outputs that are hashed
+    if (nIn >= vMidstate.size() || (nHashType & SIGHASH_ANYONECANPAY) ||
+        (nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE)
+        return ::SignatureHash(scriptCode, *ptxTo, nIn, nHashType);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    const CTxIn& txin = ptxTo->vin[nIn];
+    CHashWriter ss(vMidstate[nIn]);
+    ss << txin.prevout << scriptCode << txin.nSequence;
+    unsigned int nAfter = (nIn + 1) * BLANK_TXIN_SIZE;
+    if (nAfter < vchInputs.size())
+        ss.write((const char*)&vchInputs[nAfter], vchInputs.size() - nAfter);
+    ss.write((const char*)&vchOutputs[0], vchOutputs.size());
+    ss << nHashType;
+    return ss.GetHash();
+}
+
 
 // Valid signature cache, to avoid doing expensive ECDSA signature checking
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
+//
+// An entry is a salted hash of (signature hash, signature, public key), so
+// it takes 32 bytes instead of a few hundred and is found in constant time.
+// The salt is chosen at random when the cache is created, which keeps
+// anyone from lining up entries that collide.
+
+class CSignatureCacheHasher
+{
+public:
+    // Entries are already uniformly distributed hashes
+    size_t operator()(const uint256& key) const
+    {
+        return key.Get64();
+    }
+};
 
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, std::vector<unsigned char> > sigdata_type;
-    std::set< sigdata_type> setValid;
-    CCriticalSection cs_sigcache;
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
+    map_type setValid;
+    int64 nMaxCacheSize;
+    boost::shared_mutex cs_sigcache;
+
+    uint256 ComputeEntry(const uint256& hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << hash << vchSig << pubKey;
+        return ss.GetHash();
+    }
 
 public:
+    CSignatureCache()
+    {
+        // DoS prevention: limit cache size to less than 10MB
+        // (~100 bytes per cache entry times 50,000 entries)
+        // Since there are a maximum of 20,000 signature operations per block
+        // 50,000 is a reasonable default.
+        nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
+        nonce = GetRandHash();
+    }
+
     bool
     Get(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
     {
-        LOCK(cs_sigcache);
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.count(entry) != 0;
     }
 
     void Set(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
         if (nMaxCacheSize <= 0) return;
 
-        LOCK(cs_sigcache);
+        uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
 
         while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
         {
@@ -1163,22 +1081,21 @@ public:
             // foil would-be DoS attackers who might try to pre-generate
             // and re-use a set of valid signatures just-slightly-greater
             // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s))
+            {
+                uint256 evict = *it;
+                setValid.erase(evict);
+            }
         }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        setValid.insert(entry);
     }
 };
 
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* pcontext)
 {
     static CSignatureCache signatureCache;
 
@@ -1191,16 +1108,13 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    assert(!pcontext || &pcontext->GetTransaction() == &txTo);
+    uint256 sighash = (pcontext ? pcontext->SignatureHash(scriptCode, nIn, nHashType) : SignatureHash(scriptCode, txTo, nIn, nHashType));
 
     if (signatureCache.Get(sighash, vchSig, vchPubKey))
         return true;
 
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
-
-    if (!key.Verify(sighash, vchSig))
+    if (!CPubKey(vchPubKey).Verify(sighash, vchSig))
         return false;
 
     signatureCache.Set(sighash, vchSig, vchPubKey);
@@ -1218,117 +1132,137 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
 //
 // Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
 //
-bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
+uint160 CScriptSolution::GetID(unsigned int i) const
 {
-    // Templates
-    static map<txnouttype, CScript> mTemplates;
-    if (mTemplates.empty())
+    if (type == TX_PUBKEYHASH || type == TX_SCRIPTHASH)
     {
-        // Standard tx, sender provides pubkey, receiver adds signature
-        mTemplates.insert(make_pair(TX_PUBKEY, CScript() << OP_PUBKEY << OP_CHECKSIG));
+        uint160 hash;
+        memcpy(&hash, vData[i].pch, sizeof(hash));
+        return hash;
+    }
+    return Hash160(vData[i].pch, vData[i].pch + vData[i].nSize);
+}
+
+void CScriptSolution::GetSolutions(vector<valtype>& vSolutionsRet) const
+{
+    vSolutionsRet.clear();
+    if (type == TX_MULTISIG)
+        vSolutionsRet.push_back(valtype(1, (char)nRequired));
+    for (unsigned int i = 0; i < nData; i++)
+        vSolutionsRet.push_back(vData[i].GetValue());
+    if (type == TX_MULTISIG)
+        vSolutionsRet.push_back(valtype(1, (char)nData));
+}
 
-        // Bitcoin address tx, sender provides hash of pubkey, receiver provides signature and pubkey
-        mTemplates.insert(make_pair(TX_PUBKEYHASH, CScript() << OP_DUP << OP_HASH160 << OP_PUBKEYHASH << OP_EQUALVERIFY << OP_CHECKSIG));
+static inline bool IsSmallInteger(opcodetype opcode)
+{
+    return opcode == OP_0 || (opcode >= OP_1 && opcode <= OP_16);
+}
 
-        // Sender provides N pubkeys, receivers provides M signatures
-        mTemplates.insert(make_pair(TX_MULTISIG, CScript() << OP_SMALLINTEGER << OP_PUBKEYS << OP_SMALLINTEGER << OP_CHECKMULTISIG));
-    }
+static inline bool IsPubKeySize(unsigned int nSize)
+{
+    return nSize >= 33 && nSize <= 120;
+}
+
+//
+// Recognizes the standard templates in a single pass over the script:
+//   <pubkey> OP_CHECKSIG
+//   OP_DUP OP_HASH160 <pubkey hash> OP_EQUALVERIFY OP_CHECKSIG
+//   <m> <pubkey>... <n> OP_CHECKMULTISIG
+//   OP_HASH160 <script hash> OP_EQUAL
+// Pubkeys are any push of 33 to 120 bytes, in any push encoding.
+//
+bool Solver(const CScript& scriptPubKey, CScriptSolution& solutionRet)
+{
+    solutionRet.type = TX_NONSTANDARD;
+    solutionRet.nData = 0;
+    solutionRet.nRequired = 0;
 
     // Shortcut for pay-to-script-hash, which are more constrained than the other types:
     // it is always OP_HASH160 20 [20 byte hash] OP_EQUAL
     if (scriptPubKey.IsPayToScriptHash())
     {
-        typeRet = TX_SCRIPTHASH;
-        vector<unsigned char> hashBytes(scriptPubKey.begin()+2, scriptPubKey.begin()+22);
-        vSolutionsRet.push_back(hashBytes);
+        solutionRet.type = TX_SCRIPTHASH;
+        solutionRet.vData[0].pch = &scriptPubKey[2];
+        solutionRet.vData[0].nSize = 20;
+        solutionRet.nData = 1;
         return true;
     }
 
-    // Scan templates
-    const CScript& script1 = scriptPubKey;
-    BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
+    CScript::const_iterator pc = scriptPubKey.begin();
+    CScript::const_iterator pend = scriptPubKey.end();
+    opcodetype opcode;
+    CScriptPush push, pushData;
+    if (!scriptPubKey.GetOp(pc, opcode, push))
+        return false;
+
+    if (IsPubKeySize(push.nSize))
     {
-        const CScript& script2 = tplate.second;
-        vSolutionsRet.clear();
+        if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_CHECKSIG || pc != pend)
+            return false;
+        solutionRet.type = TX_PUBKEY;
+        solutionRet.vData[solutionRet.nData++] = push;
+        return true;
+    }
 
-        opcodetype opcode1, opcode2;
-        vector<unsigned char> vch1, vch2;
+    if (opcode == OP_DUP)
+    {
+        if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_HASH160 ||
+            !scriptPubKey.GetOp(pc, opcode, pushData) || pushData.nSize != sizeof(uint160) ||
+            !scriptPubKey.GetOp(pc, opcode) || opcode != OP_EQUALVERIFY ||
+            !scriptPubKey.GetOp(pc, opcode) || opcode != OP_CHECKSIG || pc != pend)
+            return false;
+        solutionRet.type = TX_PUBKEYHASH;
+        solutionRet.vData[solutionRet.nData++] = pushData;
+        return true;
+    }
 
-        // Compare
-        CScript::const_iterator pc1 = script1.begin();
-        CScript::const_iterator pc2 = script2.begin();
-        INFINITE_LOOP
+    if (IsSmallInteger(opcode))
+    {
+        int nRequired = CScript::DecodeOP_N(opcode);
+        unsigned int nKeys = 0;
+        bool fHaveOp;
+        while ((fHaveOp = scriptPubKey.GetOp(pc, opcode, push)) && IsPubKeySize(push.nSize))
         {
-            if (pc1 == script1.end() && pc2 == script2.end())
-            {
-                // Found a match
-                typeRet = tplate.first;
-                if (typeRet == TX_MULTISIG)
-                {
-                    // Additional checks for TX_MULTISIG:
-                    unsigned char m = vSolutionsRet.front()[0];
-                    unsigned char n = vSolutionsRet.back()[0];
-                    if (m < 1 || n < 1 || m > n || vSolutionsRet.size()-2 != n)
-                        return false;
-                }
-                return true;
-            }
-            if (!script1.GetOp(pc1, opcode1, vch1))
-                break;
-            if (!script2.GetOp(pc2, opcode2, vch2))
-                break;
-
-            // Template matching opcodes:
-            if (opcode2 == OP_PUBKEYS)
-            {
-                while (vch1.size() >= 33 && vch1.size() <= 120)
-                {
-                    vSolutionsRet.push_back(vch1);
-                    if (!script1.GetOp(pc1, opcode1, vch1))
-                        break;
-                }
-                if (!script2.GetOp(pc2, opcode2, vch2))
-                    break;
-                // Normal situation is to fall through
-                // to other if/else statements
-            }
-
-            if (opcode2 == OP_PUBKEY)
-            {
-                if (vch1.size() < 33 || vch1.size() > 120)
-                    break;
-                vSolutionsRet.push_back(vch1);
-            }
-            else if (opcode2 == OP_PUBKEYHASH)
-            {
-                if (vch1.size() != sizeof(uint160))
-                    break;
-                vSolutionsRet.push_back(vch1);
-            }
-            else if (opcode2 == OP_SMALLINTEGER)
-            {   // Single-byte small integer pushed onto vSolutions
-                if (opcode1 == OP_0 ||
-                    (opcode1 >= OP_1 && opcode1 <= OP_16))
-                {
-                    char n = (char)CScript::DecodeOP_N(opcode1);
-                    vSolutionsRet.push_back(valtype(1, n));
-                }
-                else
-                    break;
-            }
-            else if (opcode1 != opcode2 || vch1 != vch2)
-            {
-                // Others must match exactly
-                break;
-            }
+            if (nKeys < CScriptSolution::MAX_MULTISIG_KEYS)
+                solutionRet.vData[solutionRet.nData++] = push;
+            nKeys++;
         }
+        if (!fHaveOp || !IsSmallInteger(opcode))
+        {
+            solutionRet.nData = 0;
+            return false;
+        }
+        unsigned int nKeysCount = CScript::DecodeOP_N(opcode);
+        if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_CHECKMULTISIG || pc != pend)
+        {
+            solutionRet.nData = 0;
+            return false;
+        }
+
+        // It has the form, but the counts must agree as well
+        solutionRet.type = TX_MULTISIG;
+        solutionRet.nRequired = nRequired;
+        if (nRequired < 1 || nKeysCount < 1 || (unsigned int)nRequired > nKeysCount || nKeys != nKeysCount)
+            return false;
+        return true;
     }
 
-    vSolutionsRet.clear();
-    typeRet = TX_NONSTANDARD;
     return false;
 }
 
+bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
+{
+    CScriptSolution solution;
+    bool fSolved = Solver(scriptPubKey, solution);
+    typeRet = solution.type;
+    if (fSolved)
+        solution.GetSolutions(vSolutionsRet);
+    else
+        vSolutionsRet.clear();
+    return fSolved;
+}
+
 
 bool Sign1(const CKeyID& address, const CKeyStore& keystore, uint256 hash, int nHashType, CScript& scriptSigRet)
 {
@@ -1425,36 +1359,20 @@ int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned c
 
 bool IsStandard(const CScript& scriptPubKey)
 {
-    vector<valtype> vSolutions;
-    txnouttype whichType;
-    if (!Solver(scriptPubKey, whichType, vSolutions))
+    CScriptSolution solution;
+    if (!Solver(scriptPubKey, solution))
         return false;
 
-    if (whichType == TX_MULTISIG)
+    if (solution.type == TX_MULTISIG)
     {
-        unsigned char m = vSolutions.front()[0];
-        unsigned char n = vSolutions.back()[0];
         // Support up to x-of-3 multisig txns as standard
-        if (n < 1 || n > 3)
+        if (solution.nData < 1 || solution.nData > 3)
             return false;
-        if (m < 1 || m > n)
+        if (solution.nRequired < 1 || (unsigned int)solution.nRequired > solution.nData)
             return false;
     }
 
-    return whichType != TX_NONSTANDARD;
-}
-
-
-unsigned int HaveKeys(const vector<valtype>& pubkeys, const CKeyStore& keystore)
-{
-    unsigned int nResult = 0;
-    BOOST_FOREACH(const valtype& pubkey, pubkeys)
-    {
-        CKeyID keyID = CPubKey(pubkey).GetID();
-        if (keystore.HaveKey(keyID))
-            ++nResult;
-    }
-    return nResult;
+    return solution.type != TX_NONSTANDARD;
 }
 
 
@@ -1476,26 +1394,21 @@ bool IsMine(const CKeyStore &keystore, const CTxDestination &dest)
 
 bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 {
-    vector<valtype> vSolutions;
-    txnouttype whichType;
-    if (!Solver(scriptPubKey, whichType, vSolutions))
+    CScriptSolution solution;
+    if (!Solver(scriptPubKey, solution))
         return false;
 
-    CKeyID keyID;
-    switch (whichType)
+    switch (solution.type)
     {
     case TX_NONSTANDARD:
         return false;
     case TX_PUBKEY:
-        keyID = CPubKey(vSolutions[0]).GetID();
-        return keystore.HaveKey(keyID);
     case TX_PUBKEYHASH:
-        keyID = CKeyID(uint160(vSolutions[0]));
-        return keystore.HaveKey(keyID);
+        return keystore.HaveKey(CKeyID(solution.GetID()));
     case TX_SCRIPTHASH:
     {
         CScript subscript;
-        if (!keystore.GetCScript(CScriptID(uint160(vSolutions[0])), subscript))
+        if (!keystore.GetCScript(CScriptID(solution.GetID()), subscript))
             return false;
         return IsMine(keystore, subscript);
     }
@@ -1506,8 +1419,10 @@ bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
         // partially owned (somebody else has a key that can spend
         // them) enable spend-out-from-under-you attacks, especially
         // in shared-wallet situations.
-        vector<valtype> keys(vSolutions.begin()+1, vSolutions.begin()+vSolutions.size()-1);
-        return HaveKeys(keys, keystore) == keys.size();
+        for (unsigned int i = 0; i < solution.nData; i++)
+            if (!keystore.HaveKey(CKeyID(solution.GetID(i))))
+                return false;
+        return true;
     }
     }
     return false;
@@ -1515,24 +1430,18 @@ bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 {
-    vector<valtype> vSolutions;
-    txnouttype whichType;
-    if (!Solver(scriptPubKey, whichType, vSolutions))
+    CScriptSolution solution;
+    if (!Solver(scriptPubKey, solution))
         return false;
 
-    if (whichType == TX_PUBKEY)
-    {
-        addressRet = CPubKey(vSolutions[0]).GetID();
-        return true;
-    }
-    else if (whichType == TX_PUBKEYHASH)
+    if (solution.type == TX_PUBKEY || solution.type == TX_PUBKEYHASH)
     {
-        addressRet = CKeyID(uint160(vSolutions[0]));
+        addressRet = CKeyID(solution.GetID());
         return true;
     }
-    else if (whichType == TX_SCRIPTHASH)
+    else if (solution.type == TX_SCRIPTHASH)
     {
-        addressRet = CScriptID(uint160(vSolutions[0]));
+        addressRet = CScriptID(solution.GetID());
         return true;
     }
     // Multisig txns have more than one address...
@@ -1568,15 +1477,171 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
     return true;
 }
 
+// Splits a script made only of data pushes (no OP_1..OP_16) the way EvalScript
+// would push them; false if it isn't one or has more than nMaxPushes.
+static bool GetScriptPushes(const CScript& script, CScriptPush* vPush, unsigned int nMaxPushes, unsigned int& nPushesRet)
+{
+    nPushesRet = 0;
+    if (script.size() > 10000)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    while (pc < script.end())
+    {
+        opcodetype opcode;
+        if (nPushesRet == nMaxPushes || !script.GetOp(pc, opcode, vPush[nPushesRet]) || opcode > OP_PUSHDATA4)
+            return false;
+        if (vPush[nPushesRet++].nSize > 520)
+            return false;
+    }
+    return true;
+}
+
+static bool CheckPushSig(const CScriptPush& sig, const valtype& vchPubKey, const CScript& script,
+                         const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* pcontext)
+{
+    CScript scriptCode(script);
+    valtype vchSig = sig.GetValue();
+    scriptCode.FindAndDelete(CScript(vchSig));
+    return CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, pcontext);
+}
+
+// The CHECKMULTISIG of "m <pubkey>... n CHECKMULTISIG" run on the
+// stack vSig[0..nStack), with the same order of FindAndDelete and signature
+// checks as EvalScript.  False if the redeem script isn't of that form.
+static bool VerifyMultisigRedeem(const CScript& scriptRedeem, const CScriptPush* vSig, unsigned int nStack,
+                                 const CTransaction& txTo, unsigned int nIn, int nHashType, bool& fValidRet,
+                                 const CSignatureHashContext* pcontext)
+{
+    CScriptPush vKey[16];
+    unsigned int nKeys = 0;
+    CScript::const_iterator pc = scriptRedeem.begin();
+    CScript::const_iterator pend = scriptRedeem.end();
+    if (pend - pc < 3 || pend[-1] != OP_CHECKMULTISIG || pc[0] < OP_1 || pc[0] > OP_16 || pend[-2] < OP_1 || pend[-2] > OP_16)
+        return false;
+    unsigned int nSigsCount = CScript::DecodeOP_N((opcodetype)pc[0]);
+    unsigned int nKeysCount = CScript::DecodeOP_N((opcodetype)pend[-2]);
+    for (pc++; pc < pend - 2; nKeys++)
+    {
+        if (nKeys == nKeysCount || *pc >= OP_PUSHDATA1 || pend - 2 - pc < 1 + *pc)
+            return false;
+        vKey[nKeys].pch = &*pc + 1;
+        vKey[nKeys].nSize = *pc;
+        pc += 1 + *pc;
+    }
+    if (nKeys != nKeysCount || nSigsCount > nKeysCount)
+        return false;
+
+    // Signatures plus the extra element CHECKMULTISIG pops
+    if (nStack < nSigsCount + 1)
+    {
+        fValidRet = false;
+        return true;
+    }
+
+    CScript scriptCode(scriptRedeem);
+    for (unsigned int k = 0; k < nSigsCount; k++)
+        scriptCode.FindAndDelete(CScript(vSig[nStack - 1 - k].GetValue()));
+
+    // Topmost signature against topmost key, working down
+    int isig = nStack - 1;
+    int ikey = nKeys - 1;
+    bool fSuccess = true;
+    while (fSuccess && nSigsCount > 0)
+    {
+        if (CheckSig(vSig[isig].GetValue(), vKey[ikey].GetValue(), scriptCode, txTo, nIn, nHashType, pcontext))
+        {
+            isig--;
+            nSigsCount--;
+        }
+        ikey--;
+        nKeysCount--;
+        if (nSigsCount > nKeysCount)
+            fSuccess = false;
+    }
+    fValidRet = fSuccess;
+    return true;
+}
+
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                          bool fValidatePayToScriptHash, int nHashType, bool& fValidRet,
+                          const CSignatureHashContext* pcontext)
+{
+    // Room for a 16-of-16 P2SH spend: dummy, signatures and redeem script
+    CScriptPush vPush[18];
+    unsigned int nPushes;
+    if (scriptPubKey.size() > 10000 || !GetScriptPushes(scriptSig, vPush, 18, nPushes) || nPushes == 0)
+        return false;
+    const CScriptPush& pushTop = vPush[nPushes - 1];
+
+    // <sig> <pubkey> | OP_DUP OP_HASH160 <pubkey hash> OP_EQUALVERIFY OP_CHECKSIG
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        if (nPushes < 2)
+            return false;
+        valtype vchPubKey = pushTop.GetValue();
+        uint160 hash160 = Hash160(vchPubKey);
+        if (memcmp(&hash160, &scriptPubKey[3], 20) != 0)
+            fValidRet = false;
+        else
+            fValidRet = CheckPushSig(vPush[nPushes - 2], vchPubKey, scriptPubKey, txTo, nIn, nHashType, pcontext);
+        return true;
+    }
+
+    // <sig> | <pubkey> OP_CHECKSIG
+    if (scriptPubKey.size() >= 2 && scriptPubKey[0] < OP_PUSHDATA1 && scriptPubKey.size() == scriptPubKey[0] + 2u &&
+        scriptPubKey.back() == OP_CHECKSIG)
+    {
+        valtype vchPubKey(scriptPubKey.begin() + 1, scriptPubKey.end() - 1);
+        fValidRet = CheckPushSig(pushTop, vchPubKey, scriptPubKey, txTo, nIn, nHashType, pcontext);
+        return true;
+    }
+
+    // OP_0 <sig>... <redeem script> | OP_HASH160 <script hash> OP_EQUAL
+    if (scriptPubKey.IsPayToScriptHash())
+    {
+        CScript scriptRedeem(pushTop.pch, pushTop.pch + pushTop.nSize);
+        uint160 hash160 = Hash160(scriptRedeem);
+        if (memcmp(&hash160, &scriptPubKey[2], 20) != 0)
+        {
+            fValidRet = false;
+            return true;
+        }
+        if (!fValidatePayToScriptHash)
+        {
+            fValidRet = true;
+            return true;
+        }
+        return VerifyMultisigRedeem(scriptRedeem, vPush, nPushes - 1, txTo, nIn, nHashType, fValidRet, pcontext);
+    }
+
+    return false;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType)
 {
-    vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType))
+    return VerifyScript(scriptSig, scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, NULL);
+}
+
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                  bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* pcontext)
+{
+    bool fValid;
+    if (VerifyStandardScript(scriptSig, scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, fValid, pcontext))
+        return fValid;
+    return VerifyScriptInterpreted(scriptSig, scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, pcontext);
+}
+
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                             bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* pcontext)
+{
+    CScriptStack stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType, pcontext))
         return false;
     if (fValidatePayToScriptHash)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType, pcontext))
         return false;
     if (stack.empty())
         return false;
@@ -1590,11 +1655,11 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         if (!scriptSig.IsPushOnly()) // scriptSig must be literals-only
             return false;            // or validation fails
 
-        const valtype& pubKeySerialized = stackCopy.back();
+        const CScriptValue& pubKeySerialized = stackCopy.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType, pcontext))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1605,14 +1670,19 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType,
+                   const CSignatureHashContext* pcontext)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    assert(!pcontext || &pcontext->GetTransaction() == &txTo);
+    uint256 hash = (pcontext ? pcontext->SignatureHash(fromPubKey, nIn, nHashType) : SignatureHash(fromPubKey, txTo, nIn, nHashType));
+
+    // txin.scriptSig is rewritten below
+    txTo.InvalidateHash();
 
     txnouttype whichType;
     if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
@@ -1626,7 +1696,7 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         CScript subscript = txin.scriptSig;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = (pcontext ? pcontext->SignatureHash(subscript, nIn, nHashType) : SignatureHash(subscript, txTo, nIn, nHashType));
 
         txnouttype subType;
         bool fSolved =
@@ -1637,10 +1707,11 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
     }
 
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, 0);
+    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, 0, pcontext);
 }
 
-bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType,
+                   const CSignatureHashContext* pcontext)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
@@ -1648,10 +1719,11 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTrans
     assert(txin.prevout.hash == txFrom.GetHash());
     const CTxOut& txout = txFrom.vout[txin.prevout.n];
 
-    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
+    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType, pcontext);
 }
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType)
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType,
+                     const CSignatureHashContext* pcontext)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1662,7 +1734,7 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType);
+    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, pcontext);
 }
 
 static CScript PushAll(const vector<valtype>& values)
@@ -1675,7 +1747,7 @@ static CScript PushAll(const vector<valtype>& values)
 
 static CScript CombineMultisig(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                                const vector<valtype>& vSolutions,
-                               vector<valtype>& sigs1, vector<valtype>& sigs2)
+                               vector<valtype>& sigs1, vector<valtype>& sigs2, const CSignatureHashContext* pcontext)
 {
     // Combine all the signatures we've got:
     set<valtype> allsigs;
@@ -1703,7 +1775,7 @@ static CScript CombineMultisig(CScript scriptPubKey, const CTransaction& txTo, u
             if (sigs.count(pubkey))
                 continue; // Already got a sig for this pubkey
 
-            if (CheckSig(sig, pubkey, scriptPubKey, txTo, nIn, 0))
+            if (CheckSig(sig, pubkey, scriptPubKey, txTo, nIn, 0, pcontext))
             {
                 sigs[pubkey] = sig;
                 break;
@@ -1730,7 +1802,7 @@ static CScript CombineMultisig(CScript scriptPubKey, const CTransaction& txTo, u
 
 static CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                                  const txnouttype txType, const vector<valtype>& vSolutions,
-                                 vector<valtype>& sigs1, vector<valtype>& sigs2)
+                                 vector<valtype>& sigs1, vector<valtype>& sigs2, const CSignatureHashContext* pcontext)
 {
     switch (txType)
     {
@@ -1761,19 +1833,19 @@ static CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo,
             Solver(pubKey2, txType2, vSolutions2);
             sigs1.pop_back();
             sigs2.pop_back();
-            CScript result = CombineSignatures(pubKey2, txTo, nIn, txType2, vSolutions2, sigs1, sigs2);
+            CScript result = CombineSignatures(pubKey2, txTo, nIn, txType2, vSolutions2, sigs1, sigs2, pcontext);
             result << spk;
             return result;
         }
     case TX_MULTISIG:
-        return CombineMultisig(scriptPubKey, txTo, nIn, vSolutions, sigs1, sigs2);
+        return CombineMultisig(scriptPubKey, txTo, nIn, vSolutions, sigs1, sigs2, pcontext);
     }
 
     return CScript();
 }
 
 CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                          const CScript& scriptSig1, const CScript& scriptSig2)
+                          const CScript& scriptSig1, const CScript& scriptSig2, const CSignatureHashContext* pcontext)
 {
     txnouttype txType;
     vector<vector<unsigned char> > vSolutions;
@@ -1784,7 +1856,7 @@ CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsign
     vector<valtype> stack2;
     EvalScript(stack2, scriptSig2, CTransaction(), 0, 0);
 
-    return CombineSignatures(scriptPubKey, txTo, nIn, txType, vSolutions, stack1, stack2);
+    return CombineSignatures(scriptPubKey, txTo, nIn, txType, vSolutions, stack1, stack2, pcontext);
 }
 
 unsigned int CScript::GetSigOpCount(bool fAccurate) const
@@ -13,6 +13,7 @@
 
 #include "keystore.h"
 #include "bignum.h"
+#include "scriptstack.h"
 
 typedef std::vector<unsigned char> valtype;
 
@@ -231,6 +232,15 @@ inline std::string StackString(const std::vector<std::vector<unsigned char> >& v
 
 
 
+/** The data of a push, pointing into the script it came from */
+struct CScriptPush
+{
+    const unsigned char* pch;
+    unsigned int nSize;
+
+    valtype GetValue() const { return valtype(pch, pch + nSize); }
+};
+
 /** Serialized script, used inside transaction inputs and outputs */
 class CScript : public std::vector<unsigned char>
 {
@@ -412,6 +422,23 @@ public:
         return GetOp2(pc, opcodeRet, NULL);
     }
 
+    // Points pushRet at the data of a push instead of copying it out
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, CScriptPush& pushRet) const
+    {
+        const_iterator pcOp = pc;
+        pushRet.pch = NULL;
+        pushRet.nSize = 0;
+        if (!GetOp2(pc, opcodeRet, NULL))
+            return false;
+        if (opcodeRet <= OP_PUSHDATA4)
+        {
+            unsigned int nHeaderSize = (opcodeRet < OP_PUSHDATA1 ? 1 : opcodeRet == OP_PUSHDATA1 ? 2 : opcodeRet == OP_PUSHDATA2 ? 3 : 5);
+            pushRet.pch = &*pcOp + nHeaderSize;
+            pushRet.nSize = (pc - pcOp) - nHeaderSize;
+        }
+        return true;
+    }
+
     bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, std::vector<unsigned char>* pvchRet) const
     {
         opcodeRet = OP_INVALIDOPCODE;
@@ -585,7 +612,60 @@ public:
 
 
 
+/** The parts of a transaction's signature hash serialization that are the
+ * same for every input, prepared once so that signing or checking all N
+ * inputs doesn't copy and re-serialize the whole transaction N times.  For
+ * SIGHASH_ALL each input hashes on from the SHA256 midstate saved just
+ * before it, then the blanked inputs after it and the outputs, which are
+ * kept serialized; the other hash types fall back to SignatureHash.
+ *
+ * Only the scriptSigs of the transaction may change while a context is in
+ * use (as they do while signing).  The context is read-only once built, so
+ * the script check threads can share one.
+ */
+class CSignatureHashContext
+{
+private:
+    const CTransaction* ptxTo;
+    std::vector<CHashWriter> vMidstate;
+    std::vector<unsigned char> vchInputs;
+    std::vector<unsigned char> vchOutputs;
+
+public:
+    explicit CSignatureHashContext(const CTransaction& txTo);
+
+    const CTransaction& GetTransaction() const { return *ptxTo; }
+
+    // Same result as SignatureHash(scriptCode, GetTransaction(), nIn, nHashType)
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* pcontext = NULL);
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/** A standard scriptPubKey taken apart in place by Solver: the pubkey of
+ * TX_PUBKEY, the hash of TX_PUBKEYHASH and TX_SCRIPTHASH, or the keys of
+ * TX_MULTISIG, as pointers into the script.
+ */
+class CScriptSolution
+{
+public:
+    enum { MAX_MULTISIG_KEYS = 16 };
+
+    txnouttype type;
+    CScriptPush vData[MAX_MULTISIG_KEYS];
+    unsigned int nData;
+    int nRequired;
+
+    // Key or script ID of vData[i]: the hash itself, or the hash of the pubkey
+    uint160 GetID(unsigned int i = 0) const;
+
+    // In the layout of Solver's vSolutions
+    void GetSolutions(std::vector<std::vector<unsigned char> >& vSolutionsRet) const;
+};
+
+bool Solver(const CScript& scriptPubKey, CScriptSolution& solutionRet);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -593,14 +673,30 @@ bool IsMine(const CKeyStore& keystore, const CScript& scriptPubKey);
 bool IsMine(const CKeyStore& keystore, const CTxDestination &dest);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+// Callers that sign or verify several inputs of txTo can pass a context
+// built for it to all of them
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+                   const CSignatureHashContext* pcontext = NULL);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+                   const CSignatureHashContext* pcontext = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                  bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* pcontext);
+// The two halves of VerifyScript: the shortcut for pay-to-pubkey(-hash) and
+// P2SH multisig, which returns false without touching fValidRet for any other
+// form, and the general interpreter
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                          bool fValidatePayToScriptHash, int nHashType, bool& fValidRet,
+                          const CSignatureHashContext* pcontext = NULL);
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                             bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* pcontext = NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType,
+                     const CSignatureHashContext* pcontext = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
-CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2);
+CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2,
+                          const CSignatureHashContext* pcontext = NULL);
 
 #endif
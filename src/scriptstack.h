@@ -0,0 +1,345 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_SCRIPTSTACK_H
+#define MIRACLECOIN_SCRIPTSTACK_H
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string.h>
+#include <vector>
+
+typedef long long  int64;
+typedef unsigned long long  uint64;
+
+/** One element of the script interpreter's stacks.  Everything standard
+ * scripts put on the stack (signatures, public keys, hashes, numbers) fits
+ * in the inline buffer; only bigger pushes such as P2SH redeem scripts go to
+ * the heap, and then straight to the largest size a push can have so the
+ * buffer never has to grow again.
+ */
+class CScriptValue
+{
+public:
+    enum
+    {
+        INLINE_SIZE = 80,
+        MAX_PUSH_SIZE = 520,
+    };
+
+private:
+    unsigned int nSize;
+    unsigned int nCapacity;
+    union
+    {
+        unsigned char buf[INLINE_SIZE];
+        unsigned char* pchHeap;
+    } u;
+
+    bool IsInline() const { return nCapacity <= INLINE_SIZE; }
+
+public:
+    CScriptValue() : nSize(0), nCapacity(INLINE_SIZE) { }
+
+    CScriptValue(const unsigned char* pbegin, const unsigned char* pend) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        assign(pbegin, pend);
+    }
+
+    explicit CScriptValue(const std::vector<unsigned char>& vch) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        assign(vch.empty() ? NULL : &vch[0], vch.empty() ? NULL : &vch[0] + vch.size());
+    }
+
+    CScriptValue(const CScriptValue& b) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        assign(b.begin(), b.end());
+    }
+
+    ~CScriptValue()
+    {
+        if (!IsInline())
+            delete[] u.pchHeap;
+    }
+
+    CScriptValue& operator=(const CScriptValue& b)
+    {
+        if (this != &b)
+            assign(b.begin(), b.end());
+        return *this;
+    }
+
+    unsigned char* begin()             { return IsInline() ? u.buf : u.pchHeap; }
+    const unsigned char* begin() const { return IsInline() ? u.buf : u.pchHeap; }
+    unsigned char* end()               { return begin() + nSize; }
+    const unsigned char* end() const   { return begin() + nSize; }
+    unsigned int size() const          { return nSize; }
+    bool empty() const                 { return nSize == 0; }
+    unsigned char& operator[](unsigned int i)             { return begin()[i]; }
+    const unsigned char& operator[](unsigned int i) const { return begin()[i]; }
+
+    void reserve(unsigned int n)
+    {
+        if (n <= nCapacity)
+            return;
+        unsigned int nNewCapacity = std::max(n, (unsigned int)MAX_PUSH_SIZE);
+        unsigned char* pchNew = new unsigned char[nNewCapacity];
+        memcpy(pchNew, begin(), nSize);
+        if (!IsInline())
+            delete[] u.pchHeap;
+        u.pchHeap = pchNew;
+        nCapacity = nNewCapacity;
+    }
+
+    void resize(unsigned int n)
+    {
+        reserve(n);
+        if (n > nSize)
+            memset(begin() + nSize, 0, n - nSize);
+        nSize = n;
+    }
+
+    void assign(const unsigned char* pbegin, const unsigned char* pend)
+    {
+        unsigned int n = pend - pbegin;
+        reserve(n);
+        if (n)
+            memmove(begin(), pbegin, n);
+        nSize = n;
+    }
+
+    // Keeps the buffer for the next value stored here
+    void clear() { nSize = 0; }
+
+    friend bool operator==(const CScriptValue& a, const CScriptValue& b)
+    {
+        return a.nSize == b.nSize && (a.nSize == 0 || memcmp(a.begin(), b.begin(), a.nSize) == 0);
+    }
+
+    friend bool operator!=(const CScriptValue& a, const CScriptValue& b)
+    {
+        return !(a == b);
+    }
+
+    // Heap buffers change hands, inline contents are exchanged
+    friend void swap(CScriptValue& a, CScriptValue& b)
+    {
+        std::swap(a.nSize, b.nSize);
+        std::swap(a.nCapacity, b.nCapacity);
+        std::swap(a.u, b.u);
+    }
+};
+
+
+/** The main and alt stacks of the script interpreter.  The first
+ * INLINE_ELEMENTS slots are part of the object; deeper stacks move to a heap
+ * array that doubles as needed, up to the 1000 elements EvalScript allows.
+ * Popped slots keep their buffers, so pushing into them again is a copy
+ * into memory that is already there.
+ */
+class CScriptStack
+{
+public:
+    enum
+    {
+        INLINE_ELEMENTS = 16,
+    };
+
+private:
+    CScriptValue vInline[INLINE_ELEMENTS];
+    CScriptValue* pelem;
+    unsigned int nSize;
+    unsigned int nCapacity;
+
+    void Grow()
+    {
+        unsigned int nNewCapacity = nCapacity * 2;
+        CScriptValue* pelemNew = new CScriptValue[nNewCapacity];
+        for (unsigned int i = 0; i < nSize; i++)
+            swap(pelemNew[i], pelem[i]);
+        if (pelem != vInline)
+            delete[] pelem;
+        pelem = pelemNew;
+        nCapacity = nNewCapacity;
+    }
+
+public:
+    CScriptStack() : pelem(vInline), nSize(0), nCapacity(INLINE_ELEMENTS) { }
+
+    CScriptStack(const CScriptStack& b) : pelem(vInline), nSize(0), nCapacity(INLINE_ELEMENTS)
+    {
+        *this = b;
+    }
+
+    explicit CScriptStack(const std::vector<std::vector<unsigned char> >& vStack) : pelem(vInline), nSize(0), nCapacity(INLINE_ELEMENTS)
+    {
+        for (unsigned int i = 0; i < vStack.size(); i++)
+            push_back(vStack[i]);
+    }
+
+    ~CScriptStack()
+    {
+        if (pelem != vInline)
+            delete[] pelem;
+    }
+
+    CScriptStack& operator=(const CScriptStack& b)
+    {
+        if (this == &b)
+            return *this;
+        nSize = 0;
+        for (unsigned int i = 0; i < b.nSize; i++)
+            push_back(b.pelem[i]);
+        return *this;
+    }
+
+    unsigned int size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    void clear() { nSize = 0; }
+
+    CScriptValue& operator[](unsigned int i)             { return pelem[i]; }
+    const CScriptValue& operator[](unsigned int i) const { return pelem[i]; }
+
+    CScriptValue& at(unsigned int i)
+    {
+        if (i >= nSize)
+            throw std::out_of_range("CScriptStack::at() : out of range");
+        return pelem[i];
+    }
+
+    CScriptValue& back() { return pelem[nSize - 1]; }
+    const CScriptValue& back() const { return pelem[nSize - 1]; }
+
+    void push_back(const unsigned char* pbegin, const unsigned char* pend)
+    {
+        if (nSize == nCapacity)
+        {
+            // The source may be one of our own elements
+            CScriptValue vch(pbegin, pend);
+            Grow();
+            swap(pelem[nSize++], vch);
+            return;
+        }
+        pelem[nSize++].assign(pbegin, pend);
+    }
+
+    void push_back(const CScriptValue& vch)
+    {
+        push_back(vch.begin(), vch.end());
+    }
+
+    void push_back(const std::vector<unsigned char>& vch)
+    {
+        push_back(vch.empty() ? NULL : &vch[0], vch.empty() ? NULL : &vch[0] + vch.size());
+    }
+
+    void pop_back()
+    {
+        pelem[--nSize].clear();
+    }
+
+    // Remove nCount elements starting at nPos, keeping their buffers above the top
+    void erase(unsigned int nPos, unsigned int nCount = 1)
+    {
+        for (unsigned int i = nPos; i + nCount < nSize; i++)
+            swap(pelem[i], pelem[i + nCount]);
+        nSize -= nCount;
+    }
+
+    void insert(unsigned int nPos, const CScriptValue& vch)
+    {
+        push_back(vch);
+        for (unsigned int i = nSize - 1; i > nPos; i--)
+            swap(pelem[i], pelem[i - 1]);
+    }
+
+    void GetVector(std::vector<std::vector<unsigned char> >& vStackRet) const
+    {
+        vStackRet.resize(nSize);
+        for (unsigned int i = 0; i < nSize; i++)
+            vStackRet[i].assign(pelem[i].begin(), pelem[i].end());
+    }
+};
+
+
+/** Numeric operand of the script interpreter.  Operands are at most four
+ * bytes, so every result of the enabled arithmetic opcodes fits in 64 bits
+ * and no bignum is needed.  The encoding is the one CBigNum::setvch and
+ * getvch use: little-endian magnitude with the sign in the top bit of the
+ * last byte, written back in its shortest form.
+ */
+class CScriptNum
+{
+private:
+    int64 n;
+
+public:
+    static const unsigned int MAX_NUM_SIZE = 4;
+
+    explicit CScriptNum(int64 nIn) : n(nIn) { }
+
+    explicit CScriptNum(const CScriptValue& vch)
+    {
+        if (vch.size() > MAX_NUM_SIZE)
+            throw std::runtime_error("CScriptNum() : overflow");
+        n = Decode(vch.begin(), vch.size());
+    }
+
+    static int64 Decode(const unsigned char* pch, unsigned int nLen)
+    {
+        if (nLen == 0)
+            return 0;
+        uint64 nMagnitude = 0;
+        for (unsigned int i = 0; i < nLen; i++)
+            nMagnitude |= (uint64)pch[i] << (8 * i);
+        if (pch[nLen - 1] & 0x80)
+            return -(int64)(nMagnitude & ~((uint64)0x80 << (8 * (nLen - 1))));
+        return (int64)nMagnitude;
+    }
+
+    CScriptValue getvch() const
+    {
+        unsigned char pch[9];
+        unsigned int nLen = 0;
+        uint64 nMagnitude = (n < 0 ? -(uint64)n : (uint64)n);
+        while (nMagnitude)
+        {
+            pch[nLen++] = nMagnitude & 0xff;
+            nMagnitude >>= 8;
+        }
+        if (nLen > 0)
+        {
+            // The top bit is the sign: add a byte for it if the magnitude needs that bit
+            if (pch[nLen - 1] & 0x80)
+                pch[nLen++] = (n < 0 ? 0x80 : 0);
+            else if (n < 0)
+                pch[nLen - 1] |= 0x80;
+        }
+        return CScriptValue(pch, pch + nLen);
+    }
+
+    int getint() const
+    {
+        if (n > std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        if (n < std::numeric_limits<int>::min())
+            return std::numeric_limits<int>::min();
+        return (int)n;
+    }
+
+    int64 getint64() const { return n; }
+
+    CScriptNum operator-() const { return CScriptNum(-n); }
+
+    friend CScriptNum operator+(const CScriptNum& a, const CScriptNum& b) { return CScriptNum(a.n + b.n); }
+    friend CScriptNum operator-(const CScriptNum& a, const CScriptNum& b) { return CScriptNum(a.n - b.n); }
+    friend bool operator==(const CScriptNum& a, const CScriptNum& b) { return a.n == b.n; }
+    friend bool operator!=(const CScriptNum& a, const CScriptNum& b) { return a.n != b.n; }
+    friend bool operator<(const CScriptNum& a, const CScriptNum& b)  { return a.n < b.n; }
+    friend bool operator<=(const CScriptNum& a, const CScriptNum& b) { return a.n <= b.n; }
+    friend bool operator>(const CScriptNum& a, const CScriptNum& b)  { return a.n > b.n; }
+    friend bool operator>=(const CScriptNum& a, const CScriptNum& b) { return a.n >= b.n; }
+};
+
+#endif // MIRACLECOIN_SCRIPTSTACK_H
@@ -0,0 +1,821 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "secp256k1_verify.h"
+
+#ifdef HAVE_SECP256K1_VERIFY
+
+#include <stdint.h>
+#include <string.h>
+
+// Everything here only ever handles public data (keys, signatures, hashes),
+// so none of it needs to run in constant time.
+
+namespace {
+
+typedef unsigned __int128 uint128;
+
+//
+// 256-bit integers: four 64-bit limbs, least significant first
+//
+
+inline bool IsZero4(const uint64_t a[4])
+{
+    return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+inline bool IsOne4(const uint64_t a[4])
+{
+    return a[0] == 1 && (a[1] | a[2] | a[3]) == 0;
+}
+
+// a >= b
+inline bool GreaterOrEqual4(const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 3; i >= 0; i--)
+        if (a[i] != b[i])
+            return a[i] > b[i];
+    return true;
+}
+
+// r = a + b, returns the carry out
+inline uint64_t Add4(uint64_t r[4], const uint64_t a[4], const uint64_t b[4])
+{
+    uint128 t = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        t += (uint128)a[i] + b[i];
+        r[i] = (uint64_t)t;
+        t >>= 64;
+    }
+    return (uint64_t)t;
+}
+
+// r = a - b, returns the borrow out
+inline uint64_t Sub4(uint64_t r[4], const uint64_t a[4], const uint64_t b[4])
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t d = a[i] - b[i];
+        uint64_t borrow2 = (a[i] < b[i]) | (d < borrow);
+        r[i] = d - borrow;
+        borrow = borrow2;
+    }
+    return borrow;
+}
+
+// a >>= 1, shifting nTop into the most significant bit
+inline void Shr1(uint64_t a[4], uint64_t nTop)
+{
+    for (int i = 0; i < 3; i++)
+        a[i] = (a[i] >> 1) | (a[i + 1] << 63);
+    a[3] = (a[3] >> 1) | (nTop << 63);
+}
+
+// t = a * b
+void Mul4(uint64_t t[8], const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 0; i < 8; i++)
+        t[i] = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t carry = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            uint128 x = (uint128)a[i] * b[j] + t[i + j] + carry;
+            t[i + j] = (uint64_t)x;
+            carry = (uint64_t)(x >> 64);
+        }
+        t[i + 4] = carry;
+    }
+}
+
+// r = a^-1 mod m, for odd m and 0 < a < m (binary extended Euclid)
+void ModInverse(uint64_t r[4], const uint64_t a[4], const uint64_t m[4])
+{
+    uint64_t u[4], v[4];
+    uint64_t x1[4] = { 1, 0, 0, 0 };
+    uint64_t x2[4] = { 0, 0, 0, 0 };
+    memcpy(u, a, sizeof(u));
+    memcpy(v, m, sizeof(v));
+
+    // Invariant: x1 * a = u and x2 * a = v (mod m)
+    while (!IsOne4(u) && !IsOne4(v))
+    {
+        while (!(u[0] & 1))
+        {
+            Shr1(u, 0);
+            if (x1[0] & 1)
+                Shr1(x1, Add4(x1, x1, m));
+            else
+                Shr1(x1, 0);
+        }
+        while (!(v[0] & 1))
+        {
+            Shr1(v, 0);
+            if (x2[0] & 1)
+                Shr1(x2, Add4(x2, x2, m));
+            else
+                Shr1(x2, 0);
+        }
+        if (GreaterOrEqual4(u, v))
+        {
+            Sub4(u, u, v);
+            if (Sub4(x1, x1, x2))
+                Add4(x1, x1, m);
+        }
+        else
+        {
+            Sub4(v, v, u);
+            if (Sub4(x2, x2, x1))
+                Add4(x2, x2, m);
+        }
+    }
+    memcpy(r, IsOne4(u) ? x1 : x2, sizeof(x1));
+}
+
+void Load32(uint64_t r[4], const unsigned char* pch)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t n = 0;
+        for (int j = 0; j < 8; j++)
+            n = (n << 8) | pch[(3 - i) * 8 + j];
+        r[i] = n;
+    }
+}
+
+//
+// Field elements: integers modulo p = 2^256 - 2^32 - 977, kept fully reduced
+//
+
+const uint64_t P[4] = { 0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL };
+
+// 2^256 mod p
+const uint64_t PC = 0x1000003D1ULL;
+
+struct CFieldElem
+{
+    uint64_t n[4];
+};
+
+inline void FeSetInt(CFieldElem& r, uint64_t n)
+{
+    r.n[0] = n;
+    r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+inline bool FeIsZero(const CFieldElem& a)
+{
+    return IsZero4(a.n);
+}
+
+inline bool FeEqual(const CFieldElem& a, const CFieldElem& b)
+{
+    return memcmp(a.n, b.n, sizeof(a.n)) == 0;
+}
+
+inline bool FeIsOdd(const CFieldElem& a)
+{
+    return a.n[0] & 1;
+}
+
+// Returns false if the 32 bytes encode a number >= p
+inline bool FeSetB32(CFieldElem& r, const unsigned char* pch)
+{
+    Load32(r.n, pch);
+    return !GreaterOrEqual4(r.n, P);
+}
+
+inline void FeAdd(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    if (Add4(r.n, a.n, b.n))
+    {
+        // Wrapped past 2^256, which is PC mod p; can't carry again
+        uint128 t = (uint128)r.n[0] + PC;
+        r.n[0] = (uint64_t)t;
+        for (int i = 1; i < 4 && (t >>= 64); i++)
+        {
+            t += r.n[i];
+            r.n[i] = (uint64_t)t;
+        }
+    }
+    if (GreaterOrEqual4(r.n, P))
+        Sub4(r.n, r.n, P);
+}
+
+inline void FeSub(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    if (Sub4(r.n, a.n, b.n))
+    {
+        // Wrapped below zero: add p, i.e. subtract PC modulo 2^256
+        const uint64_t pc[4] = { PC, 0, 0, 0 };
+        Sub4(r.n, r.n, pc);
+    }
+}
+
+inline void FeNegate(CFieldElem& r, const CFieldElem& a)
+{
+    if (FeIsZero(a))
+        r = a;
+    else
+        Sub4(r.n, P, a.n);
+}
+
+// Reduce a 512-bit product modulo p
+void FeReduce(CFieldElem& r, const uint64_t t[8])
+{
+    // t = lo + hi * 2^256 = lo + hi * PC (mod p)
+    uint64_t carry = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint128 x = (uint128)t[i + 4] * PC + t[i] + carry;
+        r.n[i] = (uint64_t)x;
+        carry = (uint64_t)(x >> 64);
+    }
+
+    // Fold the (at most 34-bit) carry the same way
+    uint128 x = (uint128)carry * PC + r.n[0];
+    r.n[0] = (uint64_t)x;
+    uint64_t c = (uint64_t)(x >> 64);
+    for (int i = 1; i < 4; i++)
+    {
+        uint64_t s = r.n[i] + c;
+        c = (s < c);
+        r.n[i] = s;
+    }
+    if (c)
+    {
+        // Wrapped again; what is left is tiny, so this can't carry far
+        x = (uint128)r.n[0] + PC;
+        r.n[0] = (uint64_t)x;
+        r.n[1] += (uint64_t)(x >> 64);
+    }
+
+    if (GreaterOrEqual4(r.n, P))
+        Sub4(r.n, r.n, P);
+}
+
+inline void FeMul(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint64_t t[8];
+    Mul4(t, a.n, b.n);
+    FeReduce(r, t);
+}
+
+inline void FeSqr(CFieldElem& r, const CFieldElem& a)
+{
+    FeMul(r, a, a);
+}
+
+inline void FeMulInt(CFieldElem& r, const CFieldElem& a, uint64_t n)
+{
+    uint64_t t[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint128 x = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        x += (uint128)a.n[i] * n;
+        t[i] = (uint64_t)x;
+        x >>= 64;
+    }
+    t[4] = (uint64_t)x;
+    FeReduce(r, t);
+}
+
+inline void FeInv(CFieldElem& r, const CFieldElem& a)
+{
+    ModInverse(r.n, a.n, P);
+}
+
+void FeSqrN(CFieldElem& r, const CFieldElem& a, int n)
+{
+    r = a;
+    for (int i = 0; i < n; i++)
+        FeSqr(r, r);
+}
+
+// r = a^((p+1)/4), a square root of a if a is a square.  The exponent in
+// binary is 223 ones, 0, 22 ones, 0000, 11, 00.
+bool FeSqrt(CFieldElem& r, const CFieldElem& a)
+{
+    CFieldElem x2, x3, x6, x9, x11, x22, x44, x88, x176, x220, x223, t;
+
+    FeSqr(x2, a);
+    FeMul(x2, x2, a);
+    FeSqr(x3, x2);
+    FeMul(x3, x3, a);
+    FeSqrN(x6, x3, 3);
+    FeMul(x6, x6, x3);
+    FeSqrN(x9, x6, 3);
+    FeMul(x9, x9, x3);
+    FeSqrN(x11, x9, 2);
+    FeMul(x11, x11, x2);
+    FeSqrN(x22, x11, 11);
+    FeMul(x22, x22, x11);
+    FeSqrN(x44, x22, 22);
+    FeMul(x44, x44, x22);
+    FeSqrN(x88, x44, 44);
+    FeMul(x88, x88, x44);
+    FeSqrN(x176, x88, 88);
+    FeMul(x176, x176, x88);
+    FeSqrN(x220, x176, 44);
+    FeMul(x220, x220, x44);
+    FeSqrN(x223, x220, 3);
+    FeMul(x223, x223, x3);
+
+    FeSqrN(t, x223, 23);
+    FeMul(t, t, x22);
+    FeSqrN(t, t, 6);
+    FeMul(t, t, x2);
+    FeSqrN(r, t, 2);
+
+    FeSqr(t, r);
+    return FeEqual(t, a);
+}
+
+//
+// Scalars: integers modulo the group order n
+//
+
+const uint64_t N[4] = { 0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL };
+
+// 2^256 mod n
+const uint64_t NC[3] = { 0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 0x1ULL };
+
+// p - n
+const uint64_t PMINUSN[4] = { 0x402DA1722FC9BAEEULL, 0x4551231950B75FC4ULL, 0x1ULL, 0 };
+
+struct CScalar
+{
+    uint64_t n[4];
+};
+
+// Reduce a 512-bit product modulo n
+void ScalarReduce(CScalar& r, const uint64_t tIn[8])
+{
+    uint64_t t[8];
+    memcpy(t, tIn, sizeof(t));
+
+    // Fold the high half down with 2^256 = NC (mod n) until it is gone:
+    // 512 bits become at most 386, then 259, then 257
+    while (t[4] | t[5] | t[6] | t[7])
+    {
+        uint64_t hi[4] = { t[4], t[5], t[6], t[7] };
+        t[4] = t[5] = t[6] = t[7] = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            uint64_t carry = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                uint128 x = (uint128)hi[i] * NC[j] + t[i + j] + carry;
+                t[i + j] = (uint64_t)x;
+                carry = (uint64_t)(x >> 64);
+            }
+            for (int k = i + 3; carry && k < 8; k++)
+            {
+                uint128 x = (uint128)t[k] + carry;
+                t[k] = (uint64_t)x;
+                carry = (uint64_t)(x >> 64);
+            }
+        }
+    }
+
+    memcpy(r.n, t, sizeof(r.n));
+    while (GreaterOrEqual4(r.n, N))
+        Sub4(r.n, r.n, N);
+}
+
+inline void ScalarMul(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    uint64_t t[8];
+    Mul4(t, a.n, b.n);
+    ScalarReduce(r, t);
+}
+
+inline void ScalarInv(CScalar& r, const CScalar& a)
+{
+    ModInverse(r.n, a.n, N);
+}
+
+// Four-bit window i of a scalar, least significant first
+inline unsigned int ScalarNibble(const CScalar& a, int i)
+{
+    return (a.n[i >> 4] >> ((i & 15) * 4)) & 15;
+}
+
+//
+// Points on y^2 = x^3 + 7
+//
+
+struct CGroupElem
+{
+    CFieldElem x, y;
+    bool fInfinity;
+};
+
+// Jacobian coordinates: (x, y) = (X / Z^2, Y / Z^3)
+struct CGroupElemJ
+{
+    CFieldElem x, y, z;
+    bool fInfinity;
+};
+
+void GeSetInfinity(CGroupElemJ& r)
+{
+    r.fInfinity = true;
+}
+
+void GeSetAffine(CGroupElemJ& r, const CGroupElem& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    FeSetInt(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+bool GeIsOnCurve(const CGroupElem& a)
+{
+    CFieldElem y2, x3, seven;
+    FeSqr(y2, a.y);
+    FeSqr(x3, a.x);
+    FeMul(x3, x3, a.x);
+    FeSetInt(seven, 7);
+    FeAdd(x3, x3, seven);
+    return FeEqual(y2, x3);
+}
+
+void GeDouble(CGroupElemJ& r, const CGroupElemJ& a)
+{
+    // dbl-2009-l; a point with y = 0 would have order two, which this
+    // curve doesn't have, but stay safe
+    if (a.fInfinity || FeIsZero(a.y))
+    {
+        GeSetInfinity(r);
+        return;
+    }
+
+    CFieldElem A, B, C, D, E, F, t;
+    FeSqr(A, a.x);
+    FeSqr(B, a.y);
+    FeSqr(C, B);
+    FeAdd(D, a.x, B);
+    FeSqr(D, D);
+    FeSub(D, D, A);
+    FeSub(D, D, C);
+    FeAdd(D, D, D);
+    FeMulInt(E, A, 3);
+    FeSqr(F, E);
+
+    FeMul(r.z, a.y, a.z);
+    FeAdd(r.z, r.z, r.z);
+    FeAdd(t, D, D);
+    FeSub(r.x, F, t);
+    FeSub(t, D, r.x);
+    FeMul(r.y, E, t);
+    FeMulInt(t, C, 8);
+    FeSub(r.y, r.y, t);
+    r.fInfinity = false;
+}
+
+// r = a + b, b in affine coordinates
+void GeAddMixed(CGroupElemJ& r, const CGroupElemJ& a, const CGroupElem& b)
+{
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    if (a.fInfinity)
+    {
+        GeSetAffine(r, b);
+        return;
+    }
+
+    CFieldElem z1z1, u2, s2, h, rr, hh, hhh, v, t;
+    FeSqr(z1z1, a.z);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    FeSub(h, u2, a.x);
+    FeSub(rr, s2, a.y);
+    if (FeIsZero(h))
+    {
+        if (FeIsZero(rr))
+            GeDouble(r, a);
+        else
+            GeSetInfinity(r);
+        return;
+    }
+
+    FeSqr(hh, h);
+    FeMul(hhh, h, hh);
+    FeMul(v, a.x, hh);
+
+    FeMul(r.z, a.z, h);
+    FeSqr(r.x, rr);
+    FeSub(r.x, r.x, hhh);
+    FeSub(r.x, r.x, v);
+    FeSub(r.x, r.x, v);
+    FeSub(t, v, r.x);
+    FeMul(t, rr, t);
+    FeMul(hhh, a.y, hhh);
+    FeSub(r.y, t, hhh);
+    r.fInfinity = false;
+}
+
+// r = a + b
+void GeAdd(CGroupElemJ& r, const CGroupElemJ& a, const CGroupElemJ& b)
+{
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+
+    CFieldElem z1z1, z2z2, u1, u2, s1, s2, h, rr, hh, hhh, v, t;
+    FeSqr(z1z1, a.z);
+    FeSqr(z2z2, b.z);
+    FeMul(u1, a.x, z2z2);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s1, a.y, b.z);
+    FeMul(s1, s1, z2z2);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    FeSub(h, u2, u1);
+    FeSub(rr, s2, s1);
+    if (FeIsZero(h))
+    {
+        if (FeIsZero(rr))
+            GeDouble(r, a);
+        else
+            GeSetInfinity(r);
+        return;
+    }
+
+    FeSqr(hh, h);
+    FeMul(hhh, h, hh);
+    FeMul(v, u1, hh);
+
+    FeMul(r.z, a.z, b.z);
+    FeMul(r.z, r.z, h);
+    FeSqr(r.x, rr);
+    FeSub(r.x, r.x, hhh);
+    FeSub(r.x, r.x, v);
+    FeSub(r.x, r.x, v);
+    FeSub(t, v, r.x);
+    FeMul(t, rr, t);
+    FeMul(hhh, s1, hhh);
+    FeSub(r.y, t, hhh);
+    r.fInfinity = false;
+}
+
+// Convert n points to affine coordinates with a single inversion
+void GeBatchToAffine(CGroupElem* r, const CGroupElemJ* a, int n, CFieldElem* scratch)
+{
+    // scratch[i] = product of the z of every finite point before i
+    CFieldElem acc;
+    FeSetInt(acc, 1);
+    for (int i = 0; i < n; i++)
+    {
+        scratch[i] = acc;
+        if (!a[i].fInfinity)
+            FeMul(acc, acc, a[i].z);
+    }
+
+    CFieldElem inv;
+    FeInv(inv, acc);
+    for (int i = n - 1; i >= 0; i--)
+    {
+        r[i].fInfinity = a[i].fInfinity;
+        if (a[i].fInfinity)
+            continue;
+        CFieldElem zinv, zinv2;
+        FeMul(zinv, inv, scratch[i]);
+        FeMul(inv, inv, a[i].z);
+        FeSqr(zinv2, zinv);
+        FeMul(r[i].x, a[i].x, zinv2);
+        FeMul(zinv2, zinv2, zinv);
+        FeMul(r[i].y, a[i].y, zinv2);
+    }
+}
+
+//
+// Multiples of the generator: for every four-bit window i and digit
+// j = 1..15, the affine point j * 16^i * G.  u * G is then 64 additions.
+//
+
+const int WINDOWS = 64;
+
+CGroupElem tableG[WINDOWS][15];
+
+struct CGeneratorTableInit
+{
+    CGeneratorTableInit()
+    {
+        static const unsigned char pchGx[32] = {
+            0x79, 0xBE, 0x66, 0x7E, 0xF9, 0xDC, 0xBB, 0xAC, 0x55, 0xA0, 0x62, 0x95, 0xCE, 0x87, 0x0B, 0x07,
+            0x02, 0x9B, 0xFC, 0xDB, 0x2D, 0xCE, 0x28, 0xD9, 0x59, 0xF2, 0x81, 0x5B, 0x16, 0xF8, 0x17, 0x98
+        };
+        static const unsigned char pchGy[32] = {
+            0x48, 0x3A, 0xDA, 0x77, 0x26, 0xA3, 0xC4, 0x65, 0x5D, 0xA4, 0xFB, 0xFC, 0x0E, 0x11, 0x08, 0xA8,
+            0xFD, 0x17, 0xB4, 0x48, 0xA6, 0x85, 0x54, 0x19, 0x9C, 0x47, 0xD0, 0x8F, 0xFB, 0x10, 0xD4, 0xB8
+        };
+        CGroupElem g;
+        FeSetB32(g.x, pchGx);
+        FeSetB32(g.y, pchGy);
+        g.fInfinity = false;
+
+        static CGroupElemJ tableJ[WINDOWS * 15];
+        static CFieldElem scratch[WINDOWS * 15];
+        CGroupElemJ base;
+        GeSetAffine(base, g);
+        for (int i = 0; i < WINDOWS; i++)
+        {
+            tableJ[i * 15] = base;
+            for (int j = 1; j < 15; j++)
+                GeAdd(tableJ[i * 15 + j], tableJ[i * 15 + j - 1], base);
+            for (int k = 0; k < 4; k++)
+                GeDouble(base, base);
+        }
+        GeBatchToAffine(&tableG[0][0], tableJ, WINDOWS * 15, scratch);
+    }
+} instance_of_cgeneratortableinit;
+
+//
+// Encodings
+//
+
+// One DER INTEGER of a signature, as a positive number below 2^256.
+// Anything OpenSSL would not re-encode to the same bytes is rejected, as
+// are negative numbers, which OpenSSL rejects when verifying.
+bool ParseDERInteger(const unsigned char*& pch, const unsigned char* pend, unsigned char pchOut[32])
+{
+    if (pend - pch < 2 || pch[0] != 0x02)
+        return false;
+    size_t nLen = pch[1];
+    if (nLen == 0 || nLen >= 0x80 || nLen > (size_t)(pend - pch - 2))
+        return false;
+    const unsigned char* pint = pch + 2;
+    pch += 2 + nLen;
+
+    if (pint[0] & 0x80)
+        return false;
+    if (pint[0] == 0 && nLen > 1 && !(pint[1] & 0x80))
+        return false;
+    if (pint[0] == 0)
+    {
+        pint++;
+        nLen--;
+    }
+    if (nLen > 32)
+        return false;
+    memset(pchOut, 0, 32);
+    memcpy(pchOut + 32 - nLen, pint, nLen);
+    return true;
+}
+
+bool ParseSignature(CScalar& r, CScalar& s, const unsigned char* pchSig, size_t nSigLen)
+{
+    // SEQUENCE { INTEGER r, INTEGER s }, with a short-form length that
+    // covers exactly the rest of the input
+    if (nSigLen < 2 || pchSig[0] != 0x30 || pchSig[1] >= 0x80 || pchSig[1] != nSigLen - 2)
+        return false;
+    const unsigned char* pch = pchSig + 2;
+    const unsigned char* pend = pchSig + nSigLen;
+    unsigned char pchR[32], pchS[32];
+    if (!ParseDERInteger(pch, pend, pchR) || !ParseDERInteger(pch, pend, pchS) || pch != pend)
+        return false;
+
+    Load32(r.n, pchR);
+    Load32(s.n, pchS);
+    if (IsZero4(r.n) || GreaterOrEqual4(r.n, N))
+        return false;
+    if (IsZero4(s.n) || GreaterOrEqual4(s.n, N))
+        return false;
+    return true;
+}
+
+// The encodings o2i_ECPublicKey accepts: the point at infinity as a single
+// zero byte, and compressed, uncompressed and hybrid points
+bool ParsePubKey(CGroupElem& q, const unsigned char* pch, size_t nLen)
+{
+    if (nLen == 1 && pch[0] == 0x00)
+    {
+        q.fInfinity = true;
+        return true;
+    }
+    q.fInfinity = false;
+
+    if (nLen == 33 && (pch[0] == 0x02 || pch[0] == 0x03))
+    {
+        if (!FeSetB32(q.x, pch + 1))
+            return false;
+        CFieldElem x3, seven;
+        FeSqr(x3, q.x);
+        FeMul(x3, x3, q.x);
+        FeSetInt(seven, 7);
+        FeAdd(x3, x3, seven);
+        if (!FeSqrt(q.y, x3))
+            return false;
+        if (FeIsOdd(q.y) != (pch[0] == 0x03))
+            FeNegate(q.y, q.y);
+        return true;
+    }
+
+    if (nLen == 65 && (pch[0] == 0x04 || pch[0] == 0x06 || pch[0] == 0x07))
+    {
+        if (!FeSetB32(q.x, pch + 1) || !FeSetB32(q.y, pch + 33))
+            return false;
+        if (pch[0] != 0x04 && FeIsOdd(q.y) != (pch[0] == 0x07))
+            return false;
+        return GeIsOnCurve(q);
+    }
+
+    return false;
+}
+
+} // anonymous namespace
+
+bool Secp256k1Verify(const unsigned char* pchHash,
+                     const unsigned char* pchSig, size_t nSigLen,
+                     const unsigned char* pchPubKey, size_t nPubKeyLen)
+{
+    CGroupElem q;
+    if (!ParsePubKey(q, pchPubKey, nPubKeyLen))
+        return false;
+    CScalar r, s;
+    if (!ParseSignature(r, s, pchSig, nSigLen))
+        return false;
+
+    CScalar e;
+    Load32(e.n, pchHash);
+    if (GreaterOrEqual4(e.n, N))
+        Sub4(e.n, e.n, N);
+
+    // u1 = e / s, u2 = r / s
+    CScalar w, u1, u2;
+    ScalarInv(w, s);
+    ScalarMul(u1, e, w);
+    ScalarMul(u2, r, w);
+
+    // u1 * G from the table
+    CGroupElemJ pointG;
+    GeSetInfinity(pointG);
+    for (int i = 0; i < WINDOWS; i++)
+    {
+        unsigned int nDigit = ScalarNibble(u1, i);
+        if (nDigit)
+            GeAddMixed(pointG, pointG, tableG[i][nDigit - 1]);
+    }
+
+    // u2 * Q with a four-bit fixed window over 1Q..15Q
+    CGroupElemJ pointQ;
+    GeSetInfinity(pointQ);
+    if (!q.fInfinity)
+    {
+        CGroupElemJ tableJ[15];
+        CGroupElem tableQ[15];
+        CFieldElem scratch[15];
+        GeSetAffine(tableJ[0], q);
+        for (int j = 1; j < 15; j++)
+            GeAddMixed(tableJ[j], tableJ[j - 1], q);
+        GeBatchToAffine(tableQ, tableJ, 15, scratch);
+
+        for (int i = WINDOWS - 1; i >= 0; i--)
+        {
+            for (int k = 0; k < 4; k++)
+                GeDouble(pointQ, pointQ);
+            unsigned int nDigit = ScalarNibble(u2, i);
+            if (nDigit)
+                GeAddMixed(pointQ, pointQ, tableQ[nDigit - 1]);
+        }
+    }
+
+    CGroupElemJ point;
+    GeAdd(point, pointG, pointQ);
+    if (point.fInfinity)
+        return false;
+
+    // x(point) mod n == r, checked without leaving Jacobian coordinates:
+    // X == r' * Z^2 for r' = r, or r + n when that is still below p
+    CFieldElem zz, rz, xr;
+    FeSqr(zz, point.z);
+    memcpy(xr.n, r.n, sizeof(xr.n));
+    FeMul(rz, xr, zz);
+    if (FeEqual(rz, point.x))
+        return true;
+    if (GreaterOrEqual4(r.n, PMINUSN))
+        return false;
+    Add4(xr.n, r.n, N);
+    FeMul(rz, xr, zz);
+    return FeEqual(rz, point.x);
+}
+
+#endif // HAVE_SECP256K1_VERIFY
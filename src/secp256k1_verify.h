@@ -0,0 +1,33 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_SECP256K1_VERIFY_H
+#define MIRACLECOIN_SECP256K1_VERIFY_H
+
+#include <stddef.h>
+
+// The built-in verifier needs 128-bit integer arithmetic; builds that ask
+// for it on a compiler without it keep using OpenSSL.
+#if defined(USE_SECP256K1) && defined(__SIZEOF_INT128__)
+#define HAVE_SECP256K1_VERIFY 1
+#endif
+
+#ifdef HAVE_SECP256K1_VERIFY
+
+/** Verify an ECDSA signature over secp256k1 without going through OpenSSL.
+ *
+ * pchHash is the 32-byte digest, most significant byte first, as handed to
+ * ECDSA_verify.  pchSig is the DER-encoded signature and pchPubKey the
+ * serialized public key (compressed, uncompressed or hybrid).  Encodings are
+ * accepted exactly when OpenSSL's strict DER parser and o2i_ECPublicKey
+ * accept them.
+ *
+ * Returns true only for a well-formed, valid signature.
+ */
+bool Secp256k1Verify(const unsigned char* pchHash,
+                     const unsigned char* pchSig, size_t nSigLen,
+                     const unsigned char* pchPubKey, size_t nPubKeyLen);
+
+#endif
+
+#endif // MIRACLECOIN_SECP256K1_VERIFY_H
@@ -0,0 +1,321 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+//
+// Portable kernels
+//
+
+static const uint32_t pSHA256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t pSHA256IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t n)
+{
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+static inline uint32_t Rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+// One round, with the roles of the eight working variables rotating
+// instead of the values moving between them
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, k, w)                                          \
+    do {                                                                                    \
+        uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + (g ^ (e & (f ^ g))) + k + w; \
+        uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) | (c & (a | b)));   \
+        d += t1;                                                                            \
+        h = t1 + t2;                                                                        \
+    } while (0)
+
+// Message schedule, in place over a 16-word window
+#define SHA256_W(i) (w[(i) & 15] += (Rotr(w[((i) - 15) & 15], 7) ^ Rotr(w[((i) - 15) & 15], 18) ^ (w[((i) - 15) & 15] >> 3)) + \
+                                    w[((i) - 7) & 15] +                                                                   \
+                                    (Rotr(w[((i) - 2) & 15], 17) ^ Rotr(w[((i) - 2) & 15], 19) ^ (w[((i) - 2) & 15] >> 10)))
+
+void SHA256TransformGeneric(uint32_t* s, const unsigned char* pblocks, size_t nBlocks)
+{
+    while (nBlocks--)
+    {
+        uint32_t w[16];
+        for (int i = 0; i < 16; i++)
+            w[i] = ReadBE32(pblocks + 4 * i);
+
+        uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 16; i += 8)
+        {
+            SHA256_ROUND(a, b, c, d, e, f, g, h, pSHA256K[i + 0], w[i + 0]);
+            SHA256_ROUND(h, a, b, c, d, e, f, g, pSHA256K[i + 1], w[i + 1]);
+            SHA256_ROUND(g, h, a, b, c, d, e, f, pSHA256K[i + 2], w[i + 2]);
+            SHA256_ROUND(f, g, h, a, b, c, d, e, pSHA256K[i + 3], w[i + 3]);
+            SHA256_ROUND(e, f, g, h, a, b, c, d, pSHA256K[i + 4], w[i + 4]);
+            SHA256_ROUND(d, e, f, g, h, a, b, c, pSHA256K[i + 5], w[i + 5]);
+            SHA256_ROUND(c, d, e, f, g, h, a, b, pSHA256K[i + 6], w[i + 6]);
+            SHA256_ROUND(b, c, d, e, f, g, h, a, pSHA256K[i + 7], w[i + 7]);
+        }
+        for (int i = 16; i < 64; i += 8)
+        {
+            SHA256_ROUND(a, b, c, d, e, f, g, h, pSHA256K[i + 0], SHA256_W(i + 0));
+            SHA256_ROUND(h, a, b, c, d, e, f, g, pSHA256K[i + 1], SHA256_W(i + 1));
+            SHA256_ROUND(g, h, a, b, c, d, e, f, pSHA256K[i + 2], SHA256_W(i + 2));
+            SHA256_ROUND(f, g, h, a, b, c, d, e, pSHA256K[i + 3], SHA256_W(i + 3));
+            SHA256_ROUND(e, f, g, h, a, b, c, d, pSHA256K[i + 4], SHA256_W(i + 4));
+            SHA256_ROUND(d, e, f, g, h, a, b, c, pSHA256K[i + 5], SHA256_W(i + 5));
+            SHA256_ROUND(c, d, e, f, g, h, a, b, pSHA256K[i + 6], SHA256_W(i + 6));
+            SHA256_ROUND(b, c, d, e, f, g, h, a, pSHA256K[i + 7], SHA256_W(i + 7));
+        }
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+        s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+
+        pblocks += 64;
+    }
+}
+
+#undef SHA256_W
+#undef SHA256_ROUND
+
+// The second block of a 64-byte message: padding and the 512-bit length
+static const unsigned char pchPad64[64] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00
+};
+
+// Double SHA-256 of one 64-byte message with the given compression function
+static inline void SHA256D64With(SHA256TransformFunc transform, unsigned char* pout, const unsigned char* pin)
+{
+    uint32_t s[8];
+    unsigned char block[64];
+
+    memcpy(s, pSHA256IV, sizeof(s));
+    transform(s, pin, 1);
+    transform(s, pchPad64, 1);
+
+    // The 32-byte digest padded to one block: 0x80 and a 256-bit length
+    for (int i = 0; i < 8; i++)
+        WriteBE32(block + 4 * i, s[i]);
+    memset(block + 32, 0, 32);
+    block[32] = 0x80;
+    block[62] = 0x01;
+
+    memcpy(s, pSHA256IV, sizeof(s));
+    transform(s, block, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(pout + 4 * i, s[i]);
+}
+
+void SHA256D64Generic(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    for (size_t i = 0; i < nCount; i++)
+        SHA256D64With(SHA256TransformGeneric, pout + 32 * i, pin + 64 * i);
+}
+
+//
+// OpenSSL's block function, which has assembly for most platforms
+//
+
+void SHA256TransformOpenSSL(uint32_t* s, const unsigned char* pblocks, size_t nBlocks)
+{
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    memcpy(ctx.h, s, sizeof(ctx.h));
+    for (size_t i = 0; i < nBlocks; i++)
+        SHA256_Transform(&ctx, pblocks + 64 * i);
+    memcpy(s, ctx.h, sizeof(ctx.h));
+}
+
+void SHA256D64OpenSSL(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    for (size_t i = 0; i < nCount; i++)
+        SHA256D64With(SHA256TransformOpenSSL, pout + 32 * i, pin + 64 * i);
+}
+
+//
+// Engine selection
+//
+
+// Constant-initialized, so hashing during other files' static
+// initialization works before the engine has been selected
+static const CSHA256Engine engineReference = { SHA256TransformGeneric, SHA256D64Generic, "generic", "generic" };
+static CSHA256Engine engineCurrent = { SHA256TransformOpenSSL, SHA256D64OpenSSL, "openssl", "openssl" };
+
+unsigned int SHA256DetectCPU()
+{
+    unsigned int nFeatures = 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    unsigned int eax, ebx, ecx, edx;
+    bool fOSSaveYMM = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        if (ecx & bit_SSE4_1)
+            nFeatures |= SHA256_CPU_SSE41;
+        // The OS has to save the upper halves of the ymm registers
+        if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+        {
+            uint32_t nXCR0Low, nXCR0High;
+            __asm__("xgetbv" : "=a"(nXCR0Low), "=d"(nXCR0High) : "c"(0));
+            fOSSaveYMM = (nXCR0Low & 6) == 6;
+        }
+    }
+    if (__get_cpuid_max(0, NULL) >= 7)
+    {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if ((ebx & bit_AVX2) && fOSSaveYMM)
+            nFeatures |= SHA256_CPU_AVX2;
+        if (ebx & (1U << 29))
+            nFeatures |= SHA256_CPU_SHANI;
+    }
+#endif
+    return nFeatures;
+}
+
+void SHA256SelectEngine(unsigned int nCPUFeatures)
+{
+    // Without any of the x86 extensions, OpenSSL's assembly is still
+    // faster than the portable code
+    CSHA256Engine engine;
+    engine.transform = SHA256TransformOpenSSL;
+    engine.d64 = SHA256D64OpenSSL;
+    engine.pszImpl = engine.pszImplD64 = "openssl";
+
+    if (SHA256HaveX86Kernels())
+    {
+        if ((nCPUFeatures & SHA256_CPU_SHANI) && (nCPUFeatures & SHA256_CPU_SSE41))
+        {
+            engine.transform = SHA256TransformSHANI;
+            engine.d64 = SHA256D64SHANI;
+            engine.pszImpl = engine.pszImplD64 = "shani";
+        }
+        else if (nCPUFeatures & SHA256_CPU_SSE41)
+        {
+            engine.d64 = SHA256D64SSE41;
+            engine.pszImplD64 = "sse4.1 4-way";
+        }
+
+        // Eight lanes still beat the SHA extensions one message at a time
+        if (nCPUFeatures & SHA256_CPU_AVX2)
+        {
+            engine.d64 = SHA256D64AVX2;
+            engine.pszImplD64 = "avx2 8-way";
+        }
+    }
+
+    engineCurrent = engine;
+}
+
+const CSHA256Engine& SHA256GetEngine()
+{
+    return engineCurrent;
+}
+
+const CSHA256Engine& SHA256GetReferenceEngine()
+{
+    return engineReference;
+}
+
+struct CSHA256EngineInit
+{
+    CSHA256EngineInit()
+    {
+        SHA256SelectEngine(SHA256DetectCPU());
+    }
+} instance_of_csha256engineinit;
+
+void SHA256TransformBlocks(uint32_t* s, const unsigned char* pblocks, size_t nBlocks)
+{
+    engineCurrent.transform(s, pblocks, nBlocks);
+}
+
+void SHA256D64(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    engineCurrent.d64(pout, pin, nCount);
+}
+
+//
+// CSHA256
+//
+
+CSHA256::CSHA256()
+{
+    Reset();
+}
+
+CSHA256& CSHA256::Reset()
+{
+    memcpy(s, pSHA256IV, sizeof(s));
+    nBytes = 0;
+    return *this;
+}
+
+CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    size_t nBufSize = nBytes % 64;
+    if (nBufSize && nBufSize + len >= 64)
+    {
+        // Complete the buffered block first
+        memcpy(buf + nBufSize, data, 64 - nBufSize);
+        nBytes += 64 - nBufSize;
+        data += 64 - nBufSize;
+        engineCurrent.transform(s, buf, 1);
+        nBufSize = 0;
+    }
+    if (end - data >= 64)
+    {
+        size_t nBlocks = (end - data) / 64;
+        engineCurrent.transform(s, data, nBlocks);
+        data += 64 * nBlocks;
+        nBytes += 64 * nBlocks;
+    }
+    if (end > data)
+    {
+        memcpy(buf + nBufSize, data, end - data);
+        nBytes += end - data;
+    }
+    return *this;
+}
+
+void CSHA256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    static const unsigned char pad[64] = { 0x80 };
+    unsigned char sizedesc[8];
+    uint64_t nBits = nBytes << 3;
+    WriteBE32(sizedesc, nBits >> 32);
+    WriteBE32(sizedesc + 4, nBits);
+    Write(pad, 1 + ((119 - (nBytes % 64)) % 64));
+    Write(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + 4 * i, s[i]);
+}
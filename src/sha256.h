@@ -0,0 +1,95 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_SHA256_H
+#define MIRACLECOIN_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Streaming SHA-256 on top of whichever compression function
+ * SHA256SelectEngine picked.
+ */
+class CSHA256
+{
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    uint64_t nBytes;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    CSHA256();
+    CSHA256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CSHA256& Reset();
+};
+
+/** Compress nBlocks consecutive 64-byte blocks into the state s. */
+typedef void (*SHA256TransformFunc)(uint32_t* s, const unsigned char* pblocks, size_t nBlocks);
+
+/** Double SHA-256 of nCount independent 64-byte messages stored back to
+ * back at pin; pout receives 32 bytes per message.
+ */
+typedef void (*SHA256D64Func)(unsigned char* pout, const unsigned char* pin, size_t nCount);
+
+/** The kernels SHA-256 hashing currently runs on. */
+struct CSHA256Engine
+{
+    SHA256TransformFunc transform;
+    SHA256D64Func d64;
+    const char* pszImpl;
+    const char* pszImplD64;
+};
+
+/** CPU features relevant to the accelerated kernels. */
+enum
+{
+    SHA256_CPU_SSE41 = (1U << 0),
+    SHA256_CPU_AVX2  = (1U << 1),
+    SHA256_CPU_SHANI = (1U << 2),
+};
+
+/** Feature bits of the running CPU (0 on non-x86 builds). */
+unsigned int SHA256DetectCPU();
+
+/** Pick the fastest kernels the given feature bits allow.  Called once
+ * automatically at startup with SHA256DetectCPU(); calling it with 0 leaves
+ * everything to OpenSSL's block function.  Not thread safe: only call it
+ * before hashing threads start.
+ */
+void SHA256SelectEngine(unsigned int nCPUFeatures);
+
+/** The engine currently in use. */
+const CSHA256Engine& SHA256GetEngine();
+
+/** The engine made only of the portable C kernels. */
+const CSHA256Engine& SHA256GetReferenceEngine();
+
+/** Compress 64-byte blocks with the current engine. */
+void SHA256TransformBlocks(uint32_t* s, const unsigned char* pblocks, size_t nBlocks);
+
+/** Double SHA-256 of many 64-byte messages at once, as merkle tree levels
+ * need: with AVX2 eight messages go through the compression function
+ * together, with SSE4.1 four.  Results are the same as hashing each
+ * message with Hash().
+ */
+void SHA256D64(unsigned char* pout, const unsigned char* pin, size_t nCount);
+
+// Portable kernels
+void SHA256TransformGeneric(uint32_t* s, const unsigned char* pblocks, size_t nBlocks);
+void SHA256D64Generic(unsigned char* pout, const unsigned char* pin, size_t nCount);
+
+// Kernels on OpenSSL's SHA256_Transform
+void SHA256TransformOpenSSL(uint32_t* s, const unsigned char* pblocks, size_t nBlocks);
+void SHA256D64OpenSSL(unsigned char* pout, const unsigned char* pin, size_t nCount);
+
+// Accelerated kernels, see sha256_x86.cpp
+bool SHA256HaveX86Kernels();
+void SHA256TransformSHANI(uint32_t* s, const unsigned char* pblocks, size_t nBlocks);
+void SHA256D64SHANI(unsigned char* pout, const unsigned char* pin, size_t nCount);
+void SHA256D64SSE41(unsigned char* pout, const unsigned char* pin, size_t nCount);
+void SHA256D64AVX2(unsigned char* pout, const unsigned char* pin, size_t nCount);
+
+#endif // MIRACLECOIN_SHA256_H
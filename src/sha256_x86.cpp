@@ -0,0 +1,302 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// x86 SHA-256 kernels: the SHA extensions for single messages, and four-
+// and eight-lane SIMD for batches of 64-byte messages (merkle tree levels).
+// They must produce exactly what SHA256TransformGeneric produces;
+// sha256_tests checks them against it and against known digests.
+//
+// The functions carry their own target attribute so this file builds with
+// the default flags, and only runs when SHA256SelectEngine saw the feature.
+//
+
+#include "sha256.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_SHA256_X86 1
+#endif
+
+#ifdef USE_SHA256_X86
+
+#include <immintrin.h>
+
+// The lane helpers pass vectors by value, but are always inlined into
+// functions built for the matching ISA
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+#define SHA256_SHANI_TARGET __attribute__((target("sha,sse4.1")))
+#define SHA256_SSE41_TARGET __attribute__((target("sse4.1")))
+#define SHA256_AVX2_TARGET __attribute__((target("avx2")))
+
+bool SHA256HaveX86Kernels()
+{
+    return true;
+}
+
+static const uint32_t pSHA256K[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t pSHA256IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t n)
+{
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+//
+// SHA extensions
+//
+// The state lives in two registers as ABEF and CDGH, the layout
+// sha256rnds2 works on; every group of four rounds extends the message
+// schedule with sha256msg1/msg2.
+//
+
+#define SHANI_QUAD(i, m0, m1, m2, m3)                                                   \
+    do {                                                                                \
+        if (i >= 4)                                                                     \
+            m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1),       \
+                                                    _mm_alignr_epi8(m3, m2, 4)), m3);   \
+        __m128i msg = _mm_add_epi32(m0, _mm_load_si128((const __m128i*)&pSHA256K[4 * (i)])); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                            \
+        msg = _mm_shuffle_epi32(msg, 0x0E);                                             \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                            \
+    } while (0)
+
+SHA256_SHANI_TARGET
+void SHA256TransformSHANI(uint32_t* s, const unsigned char* pblocks, size_t nBlocks)
+{
+    const __m128i maskBE = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)s), 0xB1);         // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(s + 4)), 0x1B); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                       // CDGH
+
+    while (nBlocks--)
+    {
+        const __m128i save0 = state0, save1 = state1;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pblocks +  0)), maskBE);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pblocks + 16)), maskBE);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pblocks + 32)), maskBE);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pblocks + 48)), maskBE);
+
+        SHANI_QUAD( 0, m0, m1, m2, m3);
+        SHANI_QUAD( 1, m1, m2, m3, m0);
+        SHANI_QUAD( 2, m2, m3, m0, m1);
+        SHANI_QUAD( 3, m3, m0, m1, m2);
+        SHANI_QUAD( 4, m0, m1, m2, m3);
+        SHANI_QUAD( 5, m1, m2, m3, m0);
+        SHANI_QUAD( 6, m2, m3, m0, m1);
+        SHANI_QUAD( 7, m3, m0, m1, m2);
+        SHANI_QUAD( 8, m0, m1, m2, m3);
+        SHANI_QUAD( 9, m1, m2, m3, m0);
+        SHANI_QUAD(10, m2, m3, m0, m1);
+        SHANI_QUAD(11, m3, m0, m1, m2);
+        SHANI_QUAD(12, m0, m1, m2, m3);
+        SHANI_QUAD(13, m1, m2, m3, m0);
+        SHANI_QUAD(14, m2, m3, m0, m1);
+        SHANI_QUAD(15, m3, m0, m1, m2);
+
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+        pblocks += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);      // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);   // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);   // HGFE
+    _mm_storeu_si128((__m128i*)s, state0);
+    _mm_storeu_si128((__m128i*)(s + 4), state1);
+}
+
+#undef SHANI_QUAD
+
+SHA256_SHANI_TARGET
+void SHA256D64SHANI(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    // Padding block of a 64-byte message, and the padded second-round
+    // block with room for the first digest
+    static const unsigned char pchPad64[64] = { 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00 };
+    unsigned char block[64] = { 0 };
+    block[32] = 0x80;
+    block[62] = 0x01;
+
+    for (size_t n = 0; n < nCount; n++)
+    {
+        uint32_t s[8];
+        memcpy(s, pSHA256IV, sizeof(s));
+        SHA256TransformSHANI(s, pin + 64 * n, 1);
+        SHA256TransformSHANI(s, pchPad64, 1);
+        for (int i = 0; i < 8; i++)
+            WriteBE32(block + 4 * i, s[i]);
+        memcpy(s, pSHA256IV, sizeof(s));
+        SHA256TransformSHANI(s, block, 1);
+        for (int i = 0; i < 8; i++)
+            WriteBE32(pout + 32 * n + 4 * i, s[i]);
+    }
+}
+
+//
+// Multi-lane kernels
+//
+// One 32-bit word of every lane per vector element, written once with GCC
+// vector extensions and instantiated for four lanes (SSE4.1) and eight
+// lanes (AVX2).  The helpers are always inlined into the target-specific
+// entry points, so each instantiation is compiled for the right ISA.
+//
+
+typedef uint32_t SHA256Vec4 __attribute__((vector_size(16)));
+typedef uint32_t SHA256Vec8 __attribute__((vector_size(32)));
+
+#define SHA256_LANES_INLINE inline __attribute__((always_inline))
+
+template<typename V, int N>
+static SHA256_LANES_INLINE V Splat(uint32_t n)
+{
+    V v;
+    for (int l = 0; l < N; l++)
+        v[l] = n;
+    return v;
+}
+
+#define RotrV(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+template<typename V, int N>
+static SHA256_LANES_INLINE void TransformLanes(V* s, V* w)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            V w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            w[i & 15] += (RotrV(w15, 7) ^ RotrV(w15, 18) ^ (w15 >> 3)) + w[(i - 7) & 15] +
+                         (RotrV(w2, 17) ^ RotrV(w2, 19) ^ (w2 >> 10));
+        }
+        V t1 = h + (RotrV(e, 6) ^ RotrV(e, 11) ^ RotrV(e, 25)) + ((e & f) ^ (~e & g)) + Splat<V, N>(pSHA256K[i]) + w[i & 15];
+        V t2 = (RotrV(a, 2) ^ RotrV(a, 13) ^ RotrV(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+// Double SHA-256 of N 64-byte messages, one per lane
+template<typename V, int N>
+static SHA256_LANES_INLINE void D64Lanes(unsigned char* pout, const unsigned char* pin)
+{
+    V s[8], w[16];
+
+    for (int i = 0; i < 8; i++)
+        s[i] = Splat<V, N>(pSHA256IV[i]);
+    for (int i = 0; i < 16; i++)
+        for (int l = 0; l < N; l++)
+            w[i][l] = ReadBE32(pin + 64 * l + 4 * i);
+    TransformLanes<V, N>(s, w);
+
+    // Padding block: 0x80 and the 512-bit length
+    w[0] = Splat<V, N>(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = Splat<V, N>(0);
+    w[15] = Splat<V, N>(512);
+    TransformLanes<V, N>(s, w);
+
+    // Second hash over the 32-byte digest: 0x80 and a 256-bit length
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = s[i];
+        s[i] = Splat<V, N>(pSHA256IV[i]);
+    }
+    w[8] = Splat<V, N>(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = Splat<V, N>(0);
+    w[15] = Splat<V, N>(256);
+    TransformLanes<V, N>(s, w);
+
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < N; l++)
+            WriteBE32(pout + 32 * l + 4 * i, s[i][l]);
+}
+
+SHA256_SSE41_TARGET
+void SHA256D64SSE41(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    for (; nCount >= 4; nCount -= 4, pin += 4 * 64, pout += 4 * 32)
+        D64Lanes<SHA256Vec4, 4>(pout, pin);
+    SHA256D64Generic(pout, pin, nCount);
+}
+
+SHA256_AVX2_TARGET
+void SHA256D64AVX2(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    for (; nCount >= 8; nCount -= 8, pin += 8 * 64, pout += 8 * 32)
+        D64Lanes<SHA256Vec8, 8>(pout, pin);
+    for (; nCount >= 4; nCount -= 4, pin += 4 * 64, pout += 4 * 32)
+        D64Lanes<SHA256Vec4, 4>(pout, pin);
+    SHA256D64Generic(pout, pin, nCount);
+}
+
+#undef RotrV
+
+#else
+
+bool SHA256HaveX86Kernels()
+{
+    return false;
+}
+
+// Never selected on these builds
+void SHA256TransformSHANI(uint32_t* s, const unsigned char* pblocks, size_t nBlocks)
+{
+    SHA256TransformGeneric(s, pblocks, nBlocks);
+}
+
+void SHA256D64SHANI(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    SHA256D64Generic(pout, pin, nCount);
+}
+
+void SHA256D64SSE41(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    SHA256D64Generic(pout, pin, nCount);
+}
+
+void SHA256D64AVX2(unsigned char* pout, const unsigned char* pin, size_t nCount)
+{
+    SHA256D64Generic(pout, pin, nCount);
+}
+
+#endif // USE_SHA256_X86
@@ -0,0 +1,246 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "db.h"
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+// The entry as it was laid out before the fixed-width trust and the stake side table
+class CBlockIndexOld
+{
+public:
+    const uint256* phashBlock;
+    CBlockIndex* pprev;
+    CBlockIndex* pnext;
+    unsigned int nFile;
+    unsigned int nBlockPos;
+    CBigNum bnChainTrust;
+    int nHeight;
+    int64 nMint;
+    int64 nMoneySupply;
+    unsigned int nFlags;
+    uint64 nStakeModifier;
+    unsigned int nStakeModifierChecksum;
+    COutPoint prevoutStake;
+    unsigned int nStakeTime;
+    uint256 hashProofOfStake;
+    int nVersion;
+    uint256 hashMerkleRoot;
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned int nNonce;
+};
+
+#ifdef __GLIBC__
+// Bytes the heap has handed out, including mapped chunks
+static size_t GetHeapInUse()
+{
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    // Older glibc only has the int fields, which wrap past 4GB
+    struct mallinfo mi = mallinfo();
+    return (unsigned int)mi.uordblks + (unsigned int)mi.hblkhd;
+#endif
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(blockindex_size)
+{
+    // What is walked most is in the first cache line
+    BOOST_CHECK(offsetof(CBlockIndex, nChainTrust) + sizeof(uint256) <= 64);
+
+#ifdef __GLIBC__
+    // Heap taken by many entries, the old way and the new way, with a
+    // chain trust as large as the real ones
+    static const int nEntries = 50000;
+    vector<CBlockIndexOld*> vOld;
+    vector<CBlockIndex*> vIndex;
+    vOld.reserve(nEntries);
+    vIndex.reserve(2 * nEntries);
+    uint256 nTrust = ~uint256(0) >> 40;
+
+    size_t nStart = GetHeapInUse();
+    for (int i = 0; i < nEntries; i++)
+    {
+        vOld.push_back(new CBlockIndexOld());
+        vOld.back()->bnChainTrust = CBigNum(nTrust + i);
+    }
+    size_t nOld = (GetHeapInUse() - nStart) / nEntries;
+
+    nStart = GetHeapInUse();
+    for (int i = 0; i < nEntries; i++)
+    {
+        vIndex.push_back(new CBlockIndex());
+        vIndex.back()->nChainTrust = nTrust + i;
+    }
+    size_t nProofOfWork = (GetHeapInUse() - nStart) / nEntries;
+
+    nStart = GetHeapInUse();
+    for (int i = 0; i < nEntries; i++)
+    {
+        vIndex.push_back(new CBlockIndex());
+        vIndex.back()->nChainTrust = nTrust + i;
+        vIndex.back()->SetStake(COutPoint(nTrust, i), i, nTrust);
+    }
+    size_t nProofOfStake = (GetHeapInUse() - nStart) / nEntries;
+
+    BOOST_TEST_MESSAGE(strprintf("block index entry on the heap: %"PRIszu" bytes before, %"PRIszu" now, %"PRIszu" with stake",
+                                 nOld, nProofOfWork, nProofOfStake));
+    BOOST_CHECK(nProofOfWork * 3 < nOld * 2);
+    BOOST_CHECK(nProofOfStake < nOld);
+
+    BOOST_FOREACH(CBlockIndexOld* pindexOld, vOld)
+        delete pindexOld;
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+    {
+        delete pindex->pstake;
+        delete pindex;
+    }
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_pool)
+{
+    // Next to each other, without heap bookkeeping in between; entries
+    // freed earlier come back in the reverse order
+    vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < 100; i++)
+        vIndex.push_back(new CBlockIndex());
+    unsigned int nAdjacent = 0;
+    for (int i = 1; i < 100; i++)
+        if (abs((char*)vIndex[i] - (char*)vIndex[i-1]) == (ptrdiff_t)sizeof(CBlockIndex))
+            nAdjacent++;
+    BOOST_CHECK(nAdjacent >= 90);
+
+    // Freed entries are handed out again
+    CBlockIndex* pindexFreed = vIndex[50];
+    delete pindexFreed;
+    vIndex[50] = new CBlockIndex();
+    BOOST_CHECK(vIndex[50] == pindexFreed);
+    for (int i = 0; i < 100; i++)
+        delete vIndex[i];
+
+    CObjectPool<uint256, 16> pool;
+    for (int i = 0; i < 17; i++)
+        pool.Allocate();
+    BOOST_CHECK_EQUAL(pool.GetAllocatedCount(), 17U);
+    BOOST_CHECK_EQUAL(pool.GetReservedBytes(), 32 * sizeof(uint256));
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_stake)
+{
+    CBlockIndex index;
+    BOOST_CHECK(index.pstake == NULL);
+    BOOST_CHECK(index.GetPrevoutStake().IsNull());
+    BOOST_CHECK_EQUAL(index.GetStakeTime(), 0U);
+    BOOST_CHECK(index.GetProofOfStakeHash() == 0);
+
+    index.SetProofOfStake();
+    index.SetStake(COutPoint(uint256(1), 2), 3, uint256(4));
+    BOOST_REQUIRE(index.pstake != NULL);
+    BOOST_CHECK(index.GetPrevoutStake() == COutPoint(uint256(1), 2));
+    BOOST_CHECK_EQUAL(index.GetStakeTime(), 3U);
+    BOOST_CHECK(index.GetProofOfStakeHash() == uint256(4));
+
+    // Written and read back through the disk format
+    CDiskBlockIndex diskindex(&index);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << diskindex;
+    CDiskBlockIndex diskindexRead;
+    ss >> diskindexRead;
+    BOOST_CHECK(diskindexRead.prevoutStake == COutPoint(uint256(1), 2));
+    BOOST_CHECK_EQUAL(diskindexRead.nStakeTime, 3U);
+    BOOST_CHECK(diskindexRead.hashProofOfStake == uint256(4));
+    delete index.pstake;
+}
+
+static boost::filesystem::path SnapshotPath()
+{
+    return GetDataDir() / "blkindex.snapshot";
+}
+
+static vector<char> ReadSnapshot()
+{
+    vector<char> vch(boost::filesystem::file_size(SnapshotPath()));
+    FILE* file = fopen(SnapshotPath().string().c_str(), "rb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE(fread(&vch[0], 1, vch.size(), file) == vch.size());
+    fclose(file);
+    return vch;
+}
+
+// Write the snapshot back, with the checksum made to match if fRehash
+static void WriteSnapshot(vector<char> vch, bool fRehash)
+{
+    if (fRehash)
+    {
+        uint256 hash = Hash(vch.begin(), vch.end() - sizeof(uint256));
+        memcpy(&vch[vch.size() - sizeof(uint256)], &hash, sizeof(uint256));
+    }
+    FILE* file = fopen(SnapshotPath().string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE(fwrite(&vch[0], 1, vch.size(), file) == vch.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot)
+{
+    BOOST_REQUIRE(pindexBest != NULL);
+    size_t nBlocks = mapBlockIndex.size();
+    uint256 hashGenesis = pindexGenesisBlock->GetBlockHash();
+    uint256 nChainTrust = pindexBest->nChainTrust;
+    unsigned int nStakeModifierChecksum = pindexBest->nStakeModifierChecksum;
+
+    BOOST_REQUIRE(CTxDB::WriteBlockIndexSnapshot());
+    vector<char> vchSnapshot = ReadSnapshot();
+    CTxDB txdb("r");
+
+    // Every snapshot is read once and then removed, whether or not it is used
+    vector<char> vch = vchSnapshot;
+    vch[vch.size() - 1] ^= 1;
+    WriteSnapshot(vch, false);
+    BOOST_CHECK(!txdb.LoadBlockIndexSnapshot());
+    BOOST_CHECK(!boost::filesystem::exists(SnapshotPath()));
+
+    // The magic is the first field, hashBestChain follows the version
+    vch = vchSnapshot;
+    vch[0] ^= 1;
+    WriteSnapshot(vch, true);
+    BOOST_CHECK(!txdb.LoadBlockIndexSnapshot());
+
+    vch = vchSnapshot;
+    vch[2 * sizeof(int)] ^= 1;
+    WriteSnapshot(vch, true);
+    BOOST_CHECK(!txdb.LoadBlockIndexSnapshot());
+
+    // None of these got as far as the block index
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nBlocks);
+
+    // What LoadBlockIndex() does before walking the database instead
+    CTxDB::ClearBlockIndex();
+    BOOST_CHECK(mapBlockIndex.empty());
+    BOOST_CHECK(setStakeSeen.empty());
+    BOOST_CHECK(pindexGenesisBlock == NULL);
+
+    // Read back as it was written, with the chain trust not worked out again
+    WriteSnapshot(vchSnapshot, false);
+    BOOST_REQUIRE(txdb.LoadBlockIndexSnapshot());
+    BOOST_CHECK(!boost::filesystem::exists(SnapshotPath()));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nBlocks);
+    BOOST_REQUIRE(mapBlockIndex.count(hashBestChain));
+    pindexBest = mapBlockIndex[hashBestChain];
+    BOOST_CHECK(pindexGenesisBlock != NULL && pindexGenesisBlock->GetBlockHash() == hashGenesis);
+    BOOST_CHECK(pindexBest->nChainTrust == nChainTrust);
+    BOOST_CHECK_EQUAL(pindexBest->nStakeModifierChecksum, nStakeModifierChecksum);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,83 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "blockstore.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockstore_tests)
+
+static boost::filesystem::path pathTestDir;
+
+static boost::filesystem::path TestFilePath(unsigned int nFile)
+{
+    return pathTestDir / strprintf("blk%04u.dat", nFile);
+}
+
+static void AppendRecords(unsigned int nFile, unsigned int nFirst, unsigned int nCount)
+{
+    CAutoFile fileout = CAutoFile(fopen(TestFilePath(nFile).string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!!fileout);
+    for (unsigned int i = nFirst; i < nFirst + nCount; i++)
+        fileout << i << string(100, (char)i);
+    fflush(fileout);
+}
+
+BOOST_AUTO_TEST_CASE(blockstore_read)
+{
+    pathTestDir = boost::filesystem::temp_directory_path() / strprintf("test_blockstore_%d", getpid());
+    boost::filesystem::remove_all(pathTestDir);
+    boost::filesystem::create_directories(pathTestDir);
+
+    // Records of 105 bytes: a number and a string
+    AppendRecords(1, 0, 10);
+    CBlockStore store(TestFilePath, 2);
+    for (unsigned int i = 0; i < 10; i++)
+    {
+        CBlockFileView view(SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(store.GetView(1, i * 105, view));
+        unsigned int n;
+        string str;
+        view >> n >> str;
+        BOOST_CHECK_EQUAL(n, i);
+        BOOST_CHECK(str == string(100, (char)i));
+    }
+    BOOST_CHECK_EQUAL(store.GetMappedCount(), 1U);
+
+    // Past the end, and files that don't exist
+    CBlockFileView view(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(!store.GetView(1, 10 * 105, view));
+    BOOST_CHECK(!store.GetView(2, 0, view));
+    BOOST_REQUIRE(store.GetView(1, 9 * 105, view));
+    BOOST_CHECK_EQUAL(view.size(), 105U);
+    unsigned int n;
+    string str;
+    BOOST_CHECK_THROW(view >> n >> str >> n, std::ios_base::failure);
+
+    // What is appended shows up once the store is told
+    AppendRecords(1, 10, 5);
+    BOOST_CHECK(!store.GetView(1, 10 * 105, view));
+    store.Appended(1, 15 * 105);
+    BOOST_REQUIRE(store.GetView(1, 14 * 105, view));
+    view >> n;
+    BOOST_CHECK_EQUAL(n, 14U);
+
+    // The least recently used window goes, views of it stay valid
+    CBlockFileView viewOld(SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(store.GetView(1, 0, viewOld));
+    AppendRecords(3, 0, 1);
+    AppendRecords(4, 0, 1);
+    BOOST_CHECK(store.GetView(3, 0, view));
+    BOOST_CHECK(store.GetView(4, 0, view));
+    BOOST_CHECK_EQUAL(store.GetMappedCount(), 2U);
+    viewOld >> n >> str;
+    BOOST_CHECK_EQUAL(n, 0U);
+    BOOST_CHECK(str == string(100, (char)0));
+
+    store.Clear();
+    BOOST_CHECK_EQUAL(store.GetMappedCount(), 0U);
+    boost::filesystem::remove_all(pathTestDir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
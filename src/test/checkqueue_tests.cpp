@@ -0,0 +1,77 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "checkqueue.h"
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+// Counts how many times it has been run, fails if told to
+struct CCountingCheck
+{
+    bool fOk;
+    boost::mutex* pmutex;
+    int* pnCount;
+
+    CCountingCheck() : fOk(true), pmutex(NULL), pnCount(NULL) {}
+    CCountingCheck(bool fOkIn, boost::mutex* pmutexIn, int* pnCountIn) : fOk(fOkIn), pmutex(pmutexIn), pnCount(pnCountIn) {}
+
+    bool operator()()
+    {
+        boost::unique_lock<boost::mutex> lock(*pmutex);
+        (*pnCount)++;
+        return fOk;
+    }
+
+    void swap(CCountingCheck& check)
+    {
+        std::swap(fOk, check.fOk);
+        std::swap(pmutex, check.pmutex);
+        std::swap(pnCount, check.pnCount);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(checkqueue_results)
+{
+    CCheckQueue<CCountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    boost::mutex mutex;
+    for (int nRound = 0; nRound < 20; nRound++)
+    {
+        int nCount = 0;
+        int nChecks = nRound * 37;
+        bool fFail = (nRound % 3 == 1);
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            for (int i = 0; i < nChecks; i += 10)
+            {
+                std::vector<CCountingCheck> vChecks;
+                for (int j = i; j < std::min(i + 10, nChecks); j++)
+                    vChecks.push_back(CCountingCheck(!(fFail && j == nChecks / 2), &mutex, &nCount));
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait() == !(fFail && nChecks > 0));
+        }
+        // Every check is accounted for once the queue has been waited on,
+        // and a failure may cut the rest short
+        if (!fFail || nChecks == 0)
+            BOOST_CHECK_EQUAL(nCount, nChecks);
+        else
+            BOOST_CHECK(nCount <= nChecks);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // Without a queue the controller does nothing and reports success
+    {
+        CCheckQueueControl<CCountingCheck> control(NULL);
+        BOOST_CHECK(control.Wait());
+    }
+
+    queue.Quit();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
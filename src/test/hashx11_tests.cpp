@@ -0,0 +1,118 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "hashx11.h"
+
+BOOST_AUTO_TEST_SUITE(hashx11_tests)
+
+BOOST_AUTO_TEST_CASE(hashx11_genesis)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = 0;
+    block.hashMerkleRoot = uint256("0x1f2791eebf2e5a45a81a8161ca9f198eb25af2f7eafc9dae224ec0f7bf881dc8");
+    block.nTime = 1408199514;
+    block.nBits = 0x1e0fffff;
+    block.nNonce = 545216;
+    BOOST_CHECK(block.GetHash() == hashGenesisBlockOfficial);
+
+    // Same result whichever kernels are selected
+    X11SelectEngine(0);
+    BOOST_CHECK(Hash9(BEGIN(block.nVersion), END(block.nNonce)) == hashGenesisBlockOfficial);
+    X11SelectEngine(X11DetectCPU());
+    BOOST_CHECK(Hash9(BEGIN(block.nVersion), END(block.nNonce)) == hashGenesisBlockOfficial);
+}
+
+BOOST_AUTO_TEST_CASE(hashx11_stages_match_reference)
+{
+    const CX11Engine& engineRef = X11GetReferenceEngine();
+    const CX11Engine& engine = X11GetEngine();
+
+    unsigned char pin[64], pout1[64], pout2[64];
+    for (int n = 0; n < 1000; n++)
+    {
+        RAND_bytes(pin, sizeof(pin));
+        for (int i = 0; i < X11_STAGE_COUNT; i++)
+        {
+            engineRef.stage[i](pin, pout1);
+            engine.stage[i](pin, pout2);
+            BOOST_CHECK_MESSAGE(memcmp(pout1, pout2, 64) == 0, "stage " << i << " (" << engine.pszImpl[i] << ")");
+        }
+    }
+
+    // The four-lane kernels, with a different input in every lane
+    unsigned char pin4[4][64], pout4[4][64];
+    const unsigned char* ppin[4] = { pin4[0], pin4[1], pin4[2], pin4[3] };
+    unsigned char* ppout[4] = { pout4[0], pout4[1], pout4[2], pout4[3] };
+    for (int n = 0; n < 250; n++)
+    {
+        RAND_bytes(&pin4[0][0], sizeof(pin4));
+        for (int i = 0; i < X11_STAGE_COUNT; i++)
+        {
+            engine.stage4[i](ppin, ppout);
+            for (int l = 0; l < 4; l++)
+            {
+                engineRef.stage[i](pin4[l], pout1);
+                BOOST_CHECK_MESSAGE(memcmp(pout1, pout4[l], 64) == 0, "stage " << i << " lane " << l << " (" << engine.pszImpl4[i] << ")");
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hashx11_lengths)
+{
+    std::vector<unsigned char> vch(200);
+    RAND_bytes(&vch[0], vch.size());
+
+    unsigned char pout1[64], pout2[64];
+    for (size_t nLen = 0; nLen <= vch.size(); nLen++)
+    {
+        X11HashReference(&vch[0], nLen, pout1);
+        X11Hash(&vch[0], nLen, pout2);
+        BOOST_CHECK(memcmp(pout1, pout2, 64) == 0);
+    }
+
+    // Empty input goes through blake as a zero-length message
+    X11Hash(NULL, 0, pout2);
+    BOOST_CHECK(memcmp(pout1, pout2, 64) != 0);
+    X11HashReference(&vch[0], 0, pout1);
+    BOOST_CHECK(memcmp(pout1, pout2, 64) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(hashx11_batch)
+{
+    // Odd sizes exercise both the four-lane kernels and the leftovers
+    std::vector<unsigned char> vch(80 * 150);
+    RAND_bytes(&vch[0], vch.size());
+
+    std::vector<unsigned char> vout(64 * 150);
+    unsigned char pout[64];
+    for (size_t nCount = 0; nCount <= 150; nCount += 7)
+    {
+        X11HashBatch(&vch[0], 80, nCount, &vout[0]);
+        for (size_t i = 0; i < nCount; i++)
+        {
+            X11Hash(&vch[i * 80], 80, pout);
+            BOOST_CHECK(memcmp(&vout[i * 64], pout, 64) == 0);
+        }
+    }
+
+    // Precomputed hashes are used, and dropped once the header changes
+    std::vector<CBlock> vBlock(300);
+    std::vector<const CBlock*> vpBlock;
+    for (size_t i = 0; i < vBlock.size(); i++)
+    {
+        vBlock[i].nNonce = i;
+        vpBlock.push_back(&vBlock[i]);
+    }
+    PrecomputeBlockHashes(vpBlock);
+    for (size_t i = 0; i < vBlock.size(); i++)
+    {
+        CBlock block = vBlock[i];
+        BOOST_CHECK(vBlock[i].GetHash() == Hash9(BEGIN(block.nVersion), END(block.nNonce)));
+    }
+    vBlock[0].nNonce++;
+    BOOST_CHECK(vBlock[0].GetHash() == vBlock[1].GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,230 @@
+#include <boost/test/unit_test.hpp>
+
+#include "kvstore.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(kvstore_tests)
+
+// Walks the records of a map
+class CMapCursor : public CKeyValueCursor
+{
+public:
+    const map<string, string>& mapData;
+    map<string, string>::const_iterator mi;
+
+    CMapCursor(const map<string, string>& mapDataIn) : mapData(mapDataIn), mi(mapDataIn.end()) { }
+
+    void Seek(const string& strKey) { mi = mapData.lower_bound(strKey); }
+    bool Valid() const { return mi != mapData.end(); }
+    void Next() { ++mi; }
+    const string& GetKey() const { return mi->first; }
+    const string& GetValue() const { return mi->second; }
+    bool Failed() const { return false; }
+};
+
+// A store in memory that counts what reaches it
+class CCountingStore : public CKeyValueStore
+{
+public:
+    map<string, string> mapData;
+    unsigned int nReads;
+    unsigned int nWrites;
+    size_t nLastBatchSize;
+
+    CCountingStore() : nReads(0), nWrites(0), nLastBatchSize(0) { }
+
+    bool Read(const string& strKey, string& strValueRet)
+    {
+        nReads++;
+        map<string, string>::const_iterator mi = mapData.find(strKey);
+        if (mi == mapData.end())
+            return false;
+        strValueRet = mi->second;
+        return true;
+    }
+
+    bool Exists(const string& strKey)
+    {
+        string strValue;
+        return Read(strKey, strValue);
+    }
+
+    bool Write(const CKeyValueBatch& batch, bool fSync)
+    {
+        nWrites++;
+        nLastBatchSize = batch.size();
+        for (CKeyValueBatch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+        {
+            if (it->second.first)
+                mapData.erase(it->first);
+            else
+                mapData[it->first] = it->second.second;
+        }
+        return true;
+    }
+
+    CKeyValueCursor* NewCursor() { return new CMapCursor(mapData); }
+    bool Sync() { return true; }
+};
+
+BOOST_AUTO_TEST_CASE(kvcache_writeback)
+{
+    CCountingStore store;
+    store.mapData["a"] = "1";
+    CKeyValueCache cache(1 << 20);
+
+    // Hits and misses are both remembered
+    string strValue;
+    BOOST_CHECK(cache.Read(store, "a", strValue) && strValue == "1");
+    BOOST_CHECK(!cache.Read(store, "b", strValue));
+    BOOST_CHECK(cache.Read(store, "a", strValue) && strValue == "1");
+    BOOST_CHECK(!cache.Read(store, "b", strValue));
+    BOOST_CHECK_EQUAL(store.nReads, 2U);
+
+    // Writes stay in memory until flushed, and are read back from there
+    for (int i = 0; i < 100; i++)
+    {
+        CKeyValueBatch batch;
+        batch.Write(strprintf("k%03d", i), "v");
+        batch.Erase("a");
+        BOOST_CHECK(cache.Write(store, batch));
+    }
+    BOOST_CHECK_EQUAL(store.nWrites, 0U);
+    BOOST_CHECK(cache.IsDirty());
+    BOOST_CHECK(!cache.Read(store, "a", strValue));
+    BOOST_CHECK(cache.Read(store, "k042", strValue) && strValue == "v");
+    BOOST_CHECK_EQUAL(store.nReads, 2U);
+
+    // One batch with the final state of each key
+    BOOST_CHECK(cache.Flush(store, true));
+    BOOST_CHECK_EQUAL(store.nWrites, 1U);
+    BOOST_CHECK_EQUAL(store.nLastBatchSize, 101U);
+    BOOST_CHECK(!cache.IsDirty());
+    BOOST_CHECK(!store.mapData.count("a"));
+    BOOST_CHECK_EQUAL(store.mapData.size(), 100U);
+    BOOST_CHECK(cache.Flush(store, false));
+    BOOST_CHECK_EQUAL(store.nWrites, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(kvcache_budget)
+{
+    CCountingStore store;
+    CKeyValueCache cache(10000);
+
+    // Going over the budget flushes and starts over
+    unsigned int nFlushes = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        CKeyValueBatch batch;
+        batch.Write(strprintf("k%04d", i), string(50, 'x'));
+        unsigned int nWritesBefore = store.nWrites;
+        BOOST_CHECK(cache.Write(store, batch));
+        if (store.nWrites != nWritesBefore)
+        {
+            nFlushes++;
+            BOOST_CHECK(cache.GetBytes() == 0);
+        }
+        BOOST_CHECK(cache.GetBytes() < 10000);
+    }
+    BOOST_CHECK(nFlushes > 5 && nFlushes < 100);
+    BOOST_CHECK(cache.Flush(store, false));
+    BOOST_CHECK_EQUAL(store.mapData.size(), 1000U);
+
+    // Without a budget every write goes straight through
+    CKeyValueCache cacheNone(0);
+    CKeyValueBatch batch;
+    batch.Erase("k0000");
+    BOOST_CHECK(cacheNone.Write(store, batch));
+    BOOST_CHECK(!store.mapData.count("k0000"));
+    BOOST_CHECK(!cacheNone.IsDirty());
+}
+
+static unsigned int nBeforeFlushCalls = 0;
+static bool fBeforeFlushResult = true;
+
+static bool BeforeFlush()
+{
+    nBeforeFlushCalls++;
+    return fBeforeFlushResult;
+}
+
+BOOST_AUTO_TEST_CASE(kvcache_beforeflush)
+{
+    CCountingStore store;
+    CKeyValueCache cache(1 << 20);
+    cache.SetBeforeFlush(BeforeFlush);
+
+    CKeyValueBatch batch;
+    batch.Write("a", "1");
+    BOOST_CHECK(cache.Write(store, batch));
+    BOOST_CHECK_EQUAL(nBeforeFlushCalls, 0U);
+
+    // Nothing reaches the store unless the hook succeeds
+    fBeforeFlushResult = false;
+    BOOST_CHECK(!cache.Flush(store, true));
+    BOOST_CHECK_EQUAL(nBeforeFlushCalls, 1U);
+    BOOST_CHECK_EQUAL(store.nWrites, 0U);
+    BOOST_CHECK(cache.IsDirty());
+
+    fBeforeFlushResult = true;
+    BOOST_CHECK(cache.Flush(store, true));
+    BOOST_CHECK_EQUAL(nBeforeFlushCalls, 2U);
+    BOOST_CHECK_EQUAL(store.nWrites, 1U);
+
+    // Not called when there is nothing to write
+    BOOST_CHECK(cache.Flush(store, true));
+    BOOST_CHECK_EQUAL(nBeforeFlushCalls, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(kvcache_cursor)
+{
+    CCountingStore store;
+    store.mapData["p1"] = "1";
+    store.mapData["p2"] = "2";
+    store.mapData["p3"] = "3";
+    store.mapData["p5"] = "5";
+    store.mapData["q1"] = "1";
+    CKeyValueCache cache(1 << 20);
+
+    // Replace, erase and add records in memory only
+    CKeyValueBatch batch;
+    batch.Write("p2", "two");
+    batch.Erase("p3");
+    batch.Write("p4", "4");
+    batch.Erase("p5");
+    batch.Write("p6", "6");
+    batch.Write("q0", "0");
+    BOOST_CHECK(cache.Write(store, batch));
+
+    // The cursor sees them in key order, without writing them out
+    CKeyValueCursor* pcursor = cache.NewCursor(store, "p");
+    string strSeen;
+    for (pcursor->Seek("p"); pcursor->Valid() && pcursor->GetKey()[0] == 'p'; pcursor->Next())
+        strSeen += pcursor->GetKey() + "=" + pcursor->GetValue() + " ";
+    BOOST_CHECK(!pcursor->Failed());
+    BOOST_CHECK_EQUAL(strSeen, "p1=1 p2=two p4=4 p6=6 ");
+    BOOST_CHECK_EQUAL(store.nWrites, 0U);
+    BOOST_CHECK(cache.IsDirty());
+
+    // Changes outside the prefix are left out, the store's records are not
+    pcursor->Seek("p6");
+    BOOST_CHECK(pcursor->Valid() && pcursor->GetKey() == "p6");
+    pcursor->Next();
+    BOOST_CHECK(pcursor->Valid() && pcursor->GetKey() == "q1");
+    pcursor->Next();
+    BOOST_CHECK(!pcursor->Valid());
+    delete pcursor;
+
+    // Once flushed, the store alone gives the same walk
+    BOOST_CHECK(cache.Flush(store, false));
+    pcursor = cache.NewCursor(store, "p");
+    strSeen.clear();
+    for (pcursor->Seek("p"); pcursor->Valid() && pcursor->GetKey()[0] == 'p'; pcursor->Next())
+        strSeen += pcursor->GetKey() + "=" + pcursor->GetValue() + " ";
+    BOOST_CHECK_EQUAL(strSeen, "p1=1 p2=two p4=4 p6=6 ");
+    delete pcursor;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,183 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "lsmdb.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(lsmdb_tests)
+
+static unsigned int nRandState = 1;
+
+static unsigned int NextRand()
+{
+    nRandState = nRandState * 1103515245 + 12345;
+    return nRandState >> 8;
+}
+
+static string RandomKey(unsigned int nKeys)
+{
+    // Shared prefixes like CTxDB's, a few keys of other lengths
+    unsigned int n = NextRand() % nKeys;
+    return strprintf("tx%08x", n * 2654435761U) + string(n % 7 == 0 ? n % 5 : 0, 'k');
+}
+
+static boost::filesystem::path TempStoreDir()
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / strprintf("test_lsmdb_%d_%u", getpid(), NextRand());
+    boost::filesystem::remove_all(path);
+    return path;
+}
+
+// The store holds exactly what the model does, read both ways
+static void CheckStore(CLSMStore& store, const map<string, string>& mapModel, unsigned int nKeys)
+{
+    for (unsigned int i = 0; i < nKeys; i += 3)
+    {
+        string strKey = RandomKey(nKeys), strValue;
+        map<string, string>::const_iterator mi = mapModel.find(strKey);
+        BOOST_CHECK_EQUAL(store.Read(strKey, strValue), mi != mapModel.end());
+        if (mi != mapModel.end())
+            BOOST_CHECK(strValue == mi->second);
+    }
+
+    boost::scoped_ptr<CKeyValueCursor> pcursor(store.NewCursor());
+    map<string, string>::const_iterator mi = mapModel.begin();
+    for (pcursor->Seek(string()); pcursor->Valid(); pcursor->Next(), ++mi)
+    {
+        if (mi == mapModel.end())
+            break;
+        BOOST_CHECK(pcursor->GetKey() == mi->first);
+        BOOST_CHECK(pcursor->GetValue() == mi->second);
+    }
+    BOOST_CHECK(!pcursor->Valid() && !pcursor->Failed());
+    BOOST_CHECK(mi == mapModel.end());
+
+    // Seeking into the middle
+    string strSeek = RandomKey(nKeys);
+    pcursor->Seek(strSeek);
+    mi = mapModel.lower_bound(strSeek);
+    BOOST_CHECK_EQUAL(pcursor->Valid(), mi != mapModel.end());
+    if (pcursor->Valid() && mi != mapModel.end())
+        BOOST_CHECK(pcursor->GetKey() == mi->first);
+}
+
+BOOST_AUTO_TEST_CASE(lsmdb_batch)
+{
+    CKeyValueBatch batch;
+    batch.Write("a", "1");
+    batch.Write("b", "22");
+    batch.Erase("a");
+    batch.Write("b", "3");
+
+    bool fErased;
+    string strValue;
+    BOOST_CHECK(batch.Get("a", fErased, strValue) && fErased);
+    BOOST_CHECK(batch.Get("b", fErased, strValue) && !fErased && strValue == "3");
+    BOOST_CHECK(!batch.Get("c", fErased, strValue));
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+    BOOST_CHECK_EQUAL(batch.GetDataSize(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(lsmdb_model)
+{
+    boost::filesystem::path pathDir = TempStoreDir();
+    const unsigned int nKeys = 20000;
+    map<string, string> mapModel;
+
+    {
+        // A small write buffer, so the data goes through many flushes and
+        // compactions
+        CLSMStore store;
+        BOOST_REQUIRE(store.Open(pathDir, 64 << 10));
+        for (unsigned int nRound = 0; nRound < 40; nRound++)
+        {
+            CKeyValueBatch batch;
+            for (unsigned int i = 0; i < 2000; i++)
+            {
+                string strKey = RandomKey(nKeys);
+                if (NextRand() % 4 == 0)
+                {
+                    batch.Erase(strKey);
+                    mapModel.erase(strKey);
+                }
+                else
+                {
+                    string strValue(NextRand() % 200, (char)NextRand());
+                    batch.Write(strKey, strValue);
+                    mapModel[strKey] = strValue;
+                }
+            }
+            BOOST_CHECK(store.Write(batch, false));
+            if (nRound % 10 == 9)
+                CheckStore(store, mapModel, nKeys);
+        }
+        BOOST_CHECK(store.WaitForCompaction(true));
+        vector<unsigned int> vCounts = store.GetTableCounts();
+        BOOST_CHECK(vCounts[0] < CLSMStore::L0_COMPACTION_TRIGGER);
+        BOOST_CHECK(vCounts[1] > 0);
+        CheckStore(store, mapModel, nKeys);
+
+        // Left in the log and the memory table for the reopen below
+        CKeyValueBatch batch;
+        batch.Write("zz", "last");
+        batch.Erase(mapModel.begin()->first);
+        mapModel["zz"] = "last";
+        mapModel.erase(mapModel.begin());
+        BOOST_CHECK(store.Write(batch, true));
+    }
+
+    {
+        CLSMStore store;
+        BOOST_REQUIRE(store.Open(pathDir, 64 << 10));
+        CheckStore(store, mapModel, nKeys);
+    }
+
+    boost::filesystem::remove_all(pathDir);
+}
+
+BOOST_AUTO_TEST_CASE(lsmdb_recovery)
+{
+    boost::filesystem::path pathDir = TempStoreDir();
+    {
+        CLSMStore store;
+        BOOST_REQUIRE(store.Open(pathDir));
+        CKeyValueBatch batch;
+        batch.Write("a", "1");
+        batch.Write("b", "2");
+        BOOST_CHECK(store.Write(batch, true));
+    }
+
+    // A write torn by a crash is dropped, the ones before it survive
+    {
+        CLSMStore store;
+        BOOST_REQUIRE(store.Open(pathDir));
+        CKeyValueBatch batch;
+        batch.Write("c", "3");
+        BOOST_CHECK(store.Write(batch, true));
+        CKeyValueBatch batch2;
+        batch2.Write("d", string(1000, 'd'));
+        BOOST_CHECK(store.Write(batch2, true));
+    }
+    boost::filesystem::path pathLog;
+    for (boost::filesystem::directory_iterator it(pathDir); it != boost::filesystem::directory_iterator(); ++it)
+        if (it->path().extension() == ".log" && boost::filesystem::file_size(it->path()) > 0)
+            pathLog = it->path();
+    BOOST_REQUIRE(!pathLog.empty());
+    boost::filesystem::resize_file(pathLog, boost::filesystem::file_size(pathLog) - 10);
+
+    CLSMStore store;
+    BOOST_REQUIRE(store.Open(pathDir));
+    string strValue;
+    BOOST_CHECK(store.Read("a", strValue) && strValue == "1");
+    BOOST_CHECK(store.Read("b", strValue) && strValue == "2");
+    BOOST_CHECK(store.Read("c", strValue) && strValue == "3");
+    BOOST_CHECK(!store.Exists("d"));
+    store.Close();
+
+    boost::filesystem::remove_all(pathDir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
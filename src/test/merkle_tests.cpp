@@ -0,0 +1,84 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(merkle_tests)
+
+// The tree as BuildMerkleTree always used to compute it, one pair at a time
+static uint256 NaiveMerkleRoot(const vector<uint256>& vLeaves, vector<uint256>& vTree)
+{
+    vTree = vLeaves;
+    int j = 0;
+    for (int nSize = vLeaves.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (int i = 0; i < nSize; i += 2)
+        {
+            int i2 = min(i + 1, nSize - 1);
+            vTree.push_back(Hash(BEGIN(vTree[j + i]), END(vTree[j + i]),
+                                 BEGIN(vTree[j + i2]), END(vTree[j + i2])));
+        }
+        j += nSize;
+    }
+    return (vTree.empty() ? 0 : vTree.back());
+}
+
+static CTransaction MakeTransaction(unsigned int n)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << n;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = n;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(merkle_build)
+{
+    CBlock block;
+    BOOST_CHECK(block.BuildMerkleTree() == 0);
+
+    // Sizes around the batch boundaries of the multi-lane hashing
+    for (unsigned int nTx = 1; nTx <= 70; nTx++)
+    {
+        block.vtx.push_back(MakeTransaction(nTx));
+
+        vector<uint256> vLeaves, vTree;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            vLeaves.push_back(tx.GetHash());
+        uint256 hashRoot = NaiveMerkleRoot(vLeaves, vTree);
+        BOOST_CHECK(block.BuildMerkleTree() == hashRoot);
+
+        // Every branch leads to the same root
+        for (unsigned int i = 0; i < nTx; i++)
+            BOOST_CHECK(CBlock::CheckMerkleBranch(vLeaves[i], block.GetMerkleBranch(i), i) == hashRoot);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(merkle_update_coinbase)
+{
+    for (unsigned int nTx = 1; nTx <= 33; nTx++)
+    {
+        CBlock block;
+        for (unsigned int i = 0; i < nTx; i++)
+            block.vtx.push_back(MakeTransaction(i));
+
+        // Nothing built yet: falls back to a full build
+        BOOST_CHECK(block.UpdateMerkleTreeCoinbase() == block.BuildMerkleTree());
+
+        for (unsigned int nExtraNonce = 1; nExtraNonce < 4; nExtraNonce++)
+        {
+            block.vtx[0].vin[0].scriptSig = CScript() << nExtraNonce;
+            block.vtx[0].InvalidateHash();
+            uint256 hashRoot = block.UpdateMerkleTreeCoinbase();
+
+            CBlock blockCopy(block);
+            blockCopy.vMerkleTree.clear();
+            BOOST_CHECK(hashRoot == blockCopy.BuildMerkleTree());
+            BOOST_CHECK(block.vMerkleTree == blockCopy.vMerkleTree);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -328,6 +328,92 @@ BOOST_AUTO_TEST_CASE(script_CHECKMULTISIG23)
     BOOST_CHECK(!VerifyScript(badsig6, scriptPubKey23, txTo23, 0, true, 0));
 }    
 
+// VerifyScript's shortcut must agree with the interpreter wherever it applies
+BOOST_AUTO_TEST_CASE(script_standard_shortcut_json)
+{
+    const char* files[] = { "script_valid.json", "script_invalid.json" };
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        Array tests = read_json(files[i]);
+        BOOST_FOREACH(Value& tv, tests)
+        {
+            Array test = tv.get_array();
+            if (test.size() < 2)
+                continue;
+            CScript scriptSig = ParseScript(test[0].get_str());
+            CScript scriptPubKey = ParseScript(test[1].get_str());
+
+            CTransaction tx;
+            BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, tx, 0, true, SIGHASH_NONE) ==
+                                VerifyScriptInterpreted(scriptSig, scriptPubKey, tx, 0, true, SIGHASH_NONE),
+                                write_string(tv, false));
+        }
+    }
+}
+
+static void CheckShortcut(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& tx,
+                          bool fValidatePayToScriptHash, bool fExpected)
+{
+    bool fValid = !fExpected;
+    BOOST_CHECK(VerifyStandardScript(scriptSig, scriptPubKey, tx, 0, fValidatePayToScriptHash, 0, fValid));
+    BOOST_CHECK_EQUAL(fValid, fExpected);
+    BOOST_CHECK_EQUAL(VerifyScriptInterpreted(scriptSig, scriptPubKey, tx, 0, fValidatePayToScriptHash, 0), fExpected);
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_shortcut)
+{
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    key3.MakeNewKey(true);
+
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+
+    // Pay to pubkey hash
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key1.GetPubKey().GetID());
+    CScript scriptSig = sign_multisig(scriptPubKey, key1, txTo);
+    scriptSig.erase(scriptSig.begin()); // no dummy
+    CheckShortcut(scriptSig << key1.GetPubKey(), scriptPubKey, txTo, true, true);
+    CheckShortcut((CScript() << OP_0) + scriptSig, scriptPubKey, txTo, true, true);
+    CheckShortcut(CScript() << OP_0 << key1.GetPubKey(), scriptPubKey, txTo, true, false);
+    CScript scriptSigWrongKey = sign_multisig(scriptPubKey, key2, txTo);
+    scriptSigWrongKey.erase(scriptSigWrongKey.begin());
+    CheckShortcut(scriptSigWrongKey << key2.GetPubKey(), scriptPubKey, txTo, true, false);
+    CheckShortcut(scriptSigWrongKey << key1.GetPubKey(), scriptPubKey, txTo, true, false);
+    bool fValid;
+    BOOST_CHECK(!VerifyStandardScript(scriptSig << OP_1, scriptPubKey, txTo, 0, true, 0, fValid));
+
+    // Pay to pubkey, as coinstakes are
+    scriptPubKey = CScript() << key2.GetPubKey() << OP_CHECKSIG;
+    scriptSig = sign_multisig(scriptPubKey, key2, txTo);
+    scriptSig.erase(scriptSig.begin());
+    CheckShortcut(scriptSig, scriptPubKey, txTo, true, true);
+    CheckShortcut(CScript() << OP_0, scriptPubKey, txTo, true, false);
+    txTo.vout[0].nValue = 2;
+    CheckShortcut(scriptSig, scriptPubKey, txTo, true, false);
+
+    // Pay to script hash, 2 of 3
+    CScript scriptRedeem;
+    scriptRedeem << OP_2 << key1.GetPubKey() << key2.GetPubKey() << key3.GetPubKey() << OP_3 << OP_CHECKMULTISIG;
+    scriptPubKey.SetDestination(scriptRedeem.GetID());
+    vector<CKey> keys;
+    keys.push_back(key1);
+    keys.push_back(key3);
+    scriptSig = sign_multisig(scriptRedeem, keys, txTo);
+    CheckShortcut(CScript(scriptSig) << static_cast<vector<unsigned char> >(scriptRedeem), scriptPubKey, txTo, true, true);
+    scriptSig.erase(scriptSig.begin()); // CHECKMULTISIG's extra element missing
+    CheckShortcut(CScript(scriptSig) << static_cast<vector<unsigned char> >(scriptRedeem), scriptPubKey, txTo, true, false);
+    CheckShortcut(CScript(scriptSig) << static_cast<vector<unsigned char> >(scriptRedeem), scriptPubKey, txTo, false, true);
+    CheckShortcut(CScript(scriptSig) << static_cast<vector<unsigned char> >(CScript() << OP_1), scriptPubKey, txTo, true, false);
+    reverse(keys.begin(), keys.end()); // out of order
+    scriptSig = sign_multisig(scriptRedeem, keys, txTo);
+    CheckShortcut(CScript(scriptSig) << static_cast<vector<unsigned char> >(scriptRedeem), scriptPubKey, txTo, true, false);
+}
+
 BOOST_AUTO_TEST_CASE(script_combineSigs)
 {
     // Test the CombineSignatures function
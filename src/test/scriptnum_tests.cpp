@@ -0,0 +1,112 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "script.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(scriptnum_tests)
+
+static const int64 values[] = { 0, 1, -1, 2, -2, 127, -127, 128, -128, 255, -255, 256, -256,
+                                32767, -32767, 32768, -32768, 65535, -65535, 0x7fffff, -0x7fffff,
+                                0x800000, -0x800000, 0x7fffffff, -0x7fffffff, 0x80000000LL, -0x80000000LL,
+                                0xffffffffLL, -0xffffffffLL, 0xfffffffeLL, -0xfffffffeLL };
+
+static bool SameAsBigNum(const CScriptNum& num, const CBigNum& bn)
+{
+    CScriptValue vch = num.getvch();
+    return valtype(vch.begin(), vch.end()) == bn.getvch();
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_encoding)
+{
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        BOOST_CHECK(SameAsBigNum(CScriptNum(values[i]), CBigNum(values[i])));
+
+        // Round trip through the stack encoding
+        CScriptValue vch = CScriptNum(values[i]).getvch();
+        BOOST_CHECK_EQUAL(CScriptNum::Decode(vch.begin(), vch.size()), values[i]);
+    }
+
+    // Every 0-4 byte operand, including negative zero and non-minimal forms
+    for (unsigned int nLen = 0; nLen <= 4; nLen++)
+    {
+        for (unsigned int k = 0; k < 2000; k++)
+        {
+            valtype vch(nLen);
+            for (unsigned int j = 0; j < nLen; j++)
+                vch[j] = (k * 2654435761U) >> (8 * j);
+            if (nLen > 0 && k < 256)
+                vch[nLen - 1] = k;
+            CBigNum bn(vch);
+            CScriptNum num((CScriptValue(vch)));
+            BOOST_CHECK_EQUAL(num.getint(), bn.getint());
+            BOOST_CHECK(SameAsBigNum(num, CBigNum(bn.getvch())));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_arithmetic)
+{
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        // Only up to four bytes are accepted as operands
+        if (values[i] > 0x7fffffff || values[i] < -0x7fffffff)
+        {
+            BOOST_CHECK_THROW(CScriptNum((CScriptNum(values[i]).getvch())), runtime_error);
+            continue;
+        }
+        CScriptNum num1((CScriptNum(values[i]).getvch()));
+        CBigNum bn1(values[i]);
+        BOOST_CHECK(SameAsBigNum(-num1, -bn1));
+        for (unsigned int j = 0; j < sizeof(values) / sizeof(values[0]); j++)
+        {
+            if (values[j] > 0x7fffffff || values[j] < -0x7fffffff)
+                continue;
+            CScriptNum num2(values[j]);
+            CBigNum bn2(values[j]);
+            BOOST_CHECK(SameAsBigNum(num1 + num2, bn1 + bn2));
+            BOOST_CHECK(SameAsBigNum(num1 - num2, bn1 - bn2));
+            BOOST_CHECK_EQUAL(num1 < num2, bn1 < bn2);
+            BOOST_CHECK_EQUAL(num1 == num2, bn1 == bn2);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scriptstack_ops)
+{
+    // Deeper than the inline slots, with values both inline and on the heap
+    CScriptStack stack;
+    vector<valtype> vExpected;
+    for (unsigned int i = 0; i < 100; i++)
+    {
+        valtype vch(i * 7 % (CScriptValue::MAX_PUSH_SIZE + 1), (unsigned char)i);
+        stack.push_back(vch);
+        vExpected.push_back(vch);
+    }
+
+    stack.erase(10, 3);
+    vExpected.erase(vExpected.begin() + 10, vExpected.begin() + 13);
+    stack.insert(5, stack[50]);
+    vExpected.insert(vExpected.begin() + 5, vExpected[50]);
+    swap(stack[0], stack[60]);
+    swap(vExpected[0], vExpected[60]);
+    stack.pop_back();
+    vExpected.pop_back();
+    stack.push_back(stack[3]);
+    vExpected.push_back(vExpected[3]);
+
+    vector<valtype> vStack;
+    stack.GetVector(vStack);
+    BOOST_CHECK(vStack == vExpected);
+
+    CScriptStack stackCopy(stack);
+    BOOST_CHECK(stackCopy.size() == stack.size());
+    for (unsigned int i = 0; i < stack.size(); i++)
+        BOOST_CHECK(stackCopy[i] == stack[i]);
+
+    BOOST_CHECK_THROW(stack.at(stack.size()), out_of_range);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,87 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "key.h"
+#include "uint256.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(secp256k1_verify_tests)
+
+// CKey::Verify always goes through OpenSSL, so it is the reference for
+// CPubKey::Verify, whichever verifier that was built with
+static void CheckAgainstOpenSSL(CKey& key, const CPubKey& pubkey, uint256 hash, const vector<unsigned char>& vchSig)
+{
+    BOOST_CHECK_EQUAL(pubkey.Verify(hash, vchSig), key.Verify(hash, vchSig));
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_verify_openssl)
+{
+    for (int n = 0; n < 64; n++)
+    {
+        CKey key;
+        key.MakeNewKey(n % 2 == 0);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hash = GetRandHash();
+        if (n == 0)
+            hash = 0;
+        else if (n == 1)
+            hash = ~uint256(0);
+
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        BOOST_CHECK(pubkey.Verify(hash, vchSig));
+        CheckAgainstOpenSSL(key, pubkey, hash, vchSig);
+
+        // Wrong message
+        uint256 hashOther = hash;
+        *hashOther.begin() ^= 1;
+        BOOST_CHECK(!pubkey.Verify(hashOther, vchSig));
+        CheckAgainstOpenSSL(key, pubkey, hashOther, vchSig);
+
+        // Every single-bit corruption of the signature, which covers both
+        // bad numbers and broken DER
+        for (unsigned int i = 0; i < vchSig.size() * 8; i += 3)
+        {
+            vector<unsigned char> vchBad(vchSig);
+            vchBad[i / 8] ^= 1 << (i % 8);
+            CheckAgainstOpenSSL(key, pubkey, hash, vchBad);
+        }
+
+        // Trailing garbage and truncation
+        vector<unsigned char> vchLong(vchSig);
+        vchLong.push_back(0);
+        BOOST_CHECK(!pubkey.Verify(hash, vchLong));
+        CheckAgainstOpenSSL(key, pubkey, hash, vchLong);
+        vector<unsigned char> vchShort(vchSig.begin(), vchSig.end() - 1);
+        BOOST_CHECK(!pubkey.Verify(hash, vchShort));
+        CheckAgainstOpenSSL(key, pubkey, hash, vchShort);
+
+        // Non-minimal encoding of r
+        if (vchSig[3] < 33)
+        {
+            vector<unsigned char> vchPadded;
+            vchPadded.push_back(0x30);
+            vchPadded.push_back(vchSig[1] + 1);
+            vchPadded.push_back(0x02);
+            vchPadded.push_back(vchSig[3] + 1);
+            vchPadded.push_back(0x00);
+            vchPadded.insert(vchPadded.end(), vchSig.begin() + 4, vchSig.end());
+            BOOST_CHECK(!pubkey.Verify(hash, vchPadded));
+        }
+
+        // Corrupted public key
+        vector<unsigned char> vchPubKey = pubkey.Raw();
+        vchPubKey[1 + n % (vchPubKey.size() - 1)] ^= 0x10;
+        CKey keyBad;
+        bool fSetBad = keyBad.SetPubKey(CPubKey(vchPubKey));
+        BOOST_CHECK_EQUAL(CPubKey(vchPubKey).Verify(hash, vchSig), fSetBad && keyBad.Verify(hash, vchSig));
+    }
+
+    CPubKey pubkeyEmpty;
+    BOOST_CHECK(!pubkeyEmpty.Verify(0, vector<unsigned char>(8, 0x30)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
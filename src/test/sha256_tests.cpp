@@ -0,0 +1,106 @@
+#include <boost/test/unit_test.hpp>
+
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "sha256.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+static string SHA256Hex(const string& str)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)str.data(), str.size()).Finalize(hash);
+    return HexStr(hash, hash + sizeof(hash));
+}
+
+// Runs the checks against every engine the CPU can run
+static void CheckAllEngines(void (*check)())
+{
+    unsigned int nFeatures = SHA256DetectCPU();
+    unsigned int vFeatures[] = { 0, nFeatures & SHA256_CPU_SSE41, nFeatures & (SHA256_CPU_SSE41 | SHA256_CPU_AVX2),
+                                 nFeatures & ~SHA256_CPU_AVX2, nFeatures };
+    for (unsigned int i = 0; i < sizeof(vFeatures) / sizeof(vFeatures[0]); i++)
+    {
+        SHA256SelectEngine(vFeatures[i]);
+        BOOST_TEST_MESSAGE("engine " << SHA256GetEngine().pszImpl << ", batches " << SHA256GetEngine().pszImplD64);
+        check();
+    }
+    SHA256SelectEngine(nFeatures);
+}
+
+static void CheckVectors()
+{
+    BOOST_CHECK_EQUAL(SHA256Hex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    BOOST_CHECK_EQUAL(SHA256Hex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    BOOST_CHECK_EQUAL(SHA256Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+                      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    BOOST_CHECK_EQUAL(SHA256Hex(string(1000000, 'a')), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+static void CheckAgainstOpenSSL()
+{
+    vector<unsigned char> vch(1100);
+    RAND_bytes(&vch[0], vch.size());
+    for (unsigned int nLen = 0; nLen < vch.size(); nLen += 1 + nLen / 16)
+    {
+        unsigned char hash1[32], hash2[32];
+        SHA256(&vch[0], nLen, hash1);
+
+        // In uneven pieces, so the buffering is exercised too
+        CSHA256 ctx;
+        for (unsigned int nPos = 0, nStep = 1; nPos < nLen; nPos += nStep, nStep = nStep * 3 % 67 + 1)
+            ctx.Write(&vch[nPos], min(nStep, nLen - nPos));
+        ctx.Finalize(hash2);
+        BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+    }
+}
+
+static void CheckD64()
+{
+    // Counts around the four- and eight-lane boundaries
+    for (unsigned int nCount = 0; nCount <= 19; nCount++)
+    {
+        vector<unsigned char> vchIn(nCount * 64 + 1), vchOut(nCount * 32 + 1);
+        RAND_bytes(&vchIn[0], vchIn.size());
+        SHA256D64(&vchOut[0], &vchIn[0], nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            uint256 hash = Hash(vchIn.begin() + 64 * i, vchIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(&vchOut[32 * i], &hash, 32) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_vectors)
+{
+    CheckAllEngines(CheckVectors);
+}
+
+BOOST_AUTO_TEST_CASE(sha256_openssl)
+{
+    CheckAllEngines(CheckAgainstOpenSSL);
+}
+
+BOOST_AUTO_TEST_CASE(sha256_d64)
+{
+    CheckAllEngines(CheckD64);
+
+    // The portable kernels agree with whatever is selected
+    const CSHA256Engine& engineRef = SHA256GetReferenceEngine();
+    unsigned char pin[9 * 64], pout1[9 * 32], pout2[9 * 32];
+    RAND_bytes(pin, sizeof(pin));
+    engineRef.d64(pout1, pin, 9);
+    SHA256D64(pout2, pin, 9);
+    BOOST_CHECK(memcmp(pout1, pout2, sizeof(pout1)) == 0);
+
+    uint32_t s1[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, s2[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    engineRef.transform(s1, pin, 9);
+    SHA256TransformBlocks(s2, pin, 9);
+    BOOST_CHECK(memcmp(s1, s2, sizeof(s1)) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,142 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "keystore.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+static unsigned int nRandState = 1;
+
+static unsigned int NextRand()
+{
+    nRandState = nRandState * 1103515245 + 12345;
+    return nRandState >> 8;
+}
+
+static CScript RandomScript()
+{
+    static const opcodetype vOps[] = { OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF,
+                                       OP_VERIF, OP_RETURN, OP_CODESEPARATOR };
+    CScript script;
+    unsigned int nOps = NextRand() % 10;
+    while (nOps--)
+    {
+        if (NextRand() % 2)
+            script << vOps[NextRand() % (sizeof(vOps) / sizeof(vOps[0]))];
+        else
+            script << valtype(NextRand() % 80, (unsigned char)NextRand());
+    }
+    return script;
+}
+
+static void RandomTransaction(CTransaction& tx, unsigned int nIns, unsigned int nOuts)
+{
+    tx.nVersion = NextRand();
+    tx.nTime = NextRand();
+    tx.nLockTime = (NextRand() % 2) ? NextRand() : 0;
+    tx.vin.resize(nIns);
+    tx.vout.resize(nOuts);
+    for (unsigned int i = 0; i < nIns; i++)
+    {
+        CTxIn& txin = tx.vin[i];
+        for (unsigned int j = 0; j < 8; j++)
+            ((unsigned int*)txin.prevout.hash.begin())[j] = NextRand();
+        txin.prevout.n = NextRand() % 4;
+        txin.scriptSig = RandomScript();
+        txin.nSequence = (NextRand() % 2) ? NextRand() : (unsigned int)-1;
+    }
+    for (unsigned int i = 0; i < nOuts; i++)
+    {
+        tx.vout[i].nValue = NextRand() % 100000000;
+        tx.vout[i].scriptPubKey = RandomScript();
+    }
+    tx.InvalidateHash();
+}
+
+BOOST_AUTO_TEST_CASE(sighash_context)
+{
+    static const int vHashTypes[] = { 0, SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 4,
+                                      SIGHASH_ALL|SIGHASH_ANYONECANPAY, SIGHASH_NONE|SIGHASH_ANYONECANPAY,
+                                      SIGHASH_SINGLE|SIGHASH_ANYONECANPAY, 0x21, -1 };
+    static const unsigned int vInputCounts[] = { 0, 1, 2, 3, 7, 40 };
+
+    for (unsigned int i = 0; i < sizeof(vInputCounts) / sizeof(vInputCounts[0]); i++)
+    {
+        for (unsigned int nOuts = 0; nOuts <= 4; nOuts++)
+        {
+            CTransaction tx;
+            RandomTransaction(tx, vInputCounts[i], nOuts);
+            CSignatureHashContext context(tx);
+
+            for (int nPass = 0; nPass < 2; nPass++)
+            {
+                // Including the out of range input, which hashes to 1
+                for (unsigned int nIn = 0; nIn <= tx.vin.size(); nIn++)
+                {
+                    for (unsigned int k = 0; k < sizeof(vHashTypes) / sizeof(vHashTypes[0]); k++)
+                    {
+                        CScript scriptCode = RandomScript();
+                        BOOST_CHECK(context.SignatureHash(scriptCode, nIn, vHashTypes[k]) ==
+                                    SignatureHash(scriptCode, tx, nIn, vHashTypes[k]));
+                    }
+                }
+
+                // Signing rewrites scriptSigs while the context is in use
+                for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+                    tx.vin[nIn].scriptSig = RandomScript();
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sighash_context_sign)
+{
+    CBasicKeyStore keystore;
+    CTransaction txFrom;
+    txFrom.vout.resize(5);
+    for (unsigned int i = 0; i < txFrom.vout.size(); i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        if (i < 3)
+            txFrom.vout[i].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+        else
+            txFrom.vout[i].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+        txFrom.vout[i].nValue = 1000;
+    }
+
+    CTransaction txTo;
+    txTo.vin.resize(txFrom.vout.size());
+    txTo.vout.resize(2);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        txTo.vin[i].prevout.hash = txFrom.GetHash();
+        txTo.vin[i].prevout.n = i;
+    }
+    txTo.vout[0].nValue = 3000;
+    txTo.vout[1].nValue = 2000;
+
+    CSignatureHashContext context(txTo);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        BOOST_CHECK(SignSignature(keystore, txFrom, txTo, i, SIGHASH_ALL, &context));
+
+    // Signatures made with the context check out without it, and the other way round
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        BOOST_CHECK(VerifySignature(txFrom, txTo, i, true, 0));
+        BOOST_CHECK(VerifySignature(txFrom, txTo, i, true, 0, &context));
+    }
+
+    txTo.vout[1].nValue = 2001;
+    CSignatureHashContext contextChanged(txTo);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        BOOST_CHECK(!VerifySignature(txFrom, txTo, i, true, 0));
+        BOOST_CHECK(!VerifySignature(txFrom, txTo, i, true, 0, &contextChanged));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
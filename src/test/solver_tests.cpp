@@ -0,0 +1,184 @@
+#include <boost/test/unit_test.hpp>
+
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(solver_tests)
+
+// Solver as it was, comparing the script against each template opcode by opcode
+static bool TemplateSolver(const CScript& scriptPubKey, txnouttype& typeRet, vector<valtype>& vSolutionsRet)
+{
+    map<txnouttype, CScript> mTemplates;
+    mTemplates.insert(make_pair(TX_PUBKEY, CScript() << OP_PUBKEY << OP_CHECKSIG));
+    mTemplates.insert(make_pair(TX_PUBKEYHASH, CScript() << OP_DUP << OP_HASH160 << OP_PUBKEYHASH << OP_EQUALVERIFY << OP_CHECKSIG));
+    mTemplates.insert(make_pair(TX_MULTISIG, CScript() << OP_SMALLINTEGER << OP_PUBKEYS << OP_SMALLINTEGER << OP_CHECKMULTISIG));
+
+    if (scriptPubKey.IsPayToScriptHash())
+    {
+        typeRet = TX_SCRIPTHASH;
+        vSolutionsRet.push_back(valtype(scriptPubKey.begin()+2, scriptPubKey.begin()+22));
+        return true;
+    }
+
+    const CScript& script1 = scriptPubKey;
+    BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
+    {
+        const CScript& script2 = tplate.second;
+        vSolutionsRet.clear();
+
+        opcodetype opcode1, opcode2;
+        vector<unsigned char> vch1, vch2;
+
+        CScript::const_iterator pc1 = script1.begin();
+        CScript::const_iterator pc2 = script2.begin();
+        INFINITE_LOOP
+        {
+            if (pc1 == script1.end() && pc2 == script2.end())
+            {
+                typeRet = tplate.first;
+                if (typeRet == TX_MULTISIG)
+                {
+                    unsigned char m = vSolutionsRet.front()[0];
+                    unsigned char n = vSolutionsRet.back()[0];
+                    if (m < 1 || n < 1 || m > n || vSolutionsRet.size()-2 != n)
+                        return false;
+                }
+                return true;
+            }
+            if (!script1.GetOp(pc1, opcode1, vch1))
+                break;
+            if (!script2.GetOp(pc2, opcode2, vch2))
+                break;
+
+            if (opcode2 == OP_PUBKEYS)
+            {
+                while (vch1.size() >= 33 && vch1.size() <= 120)
+                {
+                    vSolutionsRet.push_back(vch1);
+                    if (!script1.GetOp(pc1, opcode1, vch1))
+                        break;
+                }
+                if (!script2.GetOp(pc2, opcode2, vch2))
+                    break;
+            }
+
+            if (opcode2 == OP_PUBKEY)
+            {
+                if (vch1.size() < 33 || vch1.size() > 120)
+                    break;
+                vSolutionsRet.push_back(vch1);
+            }
+            else if (opcode2 == OP_PUBKEYHASH)
+            {
+                if (vch1.size() != sizeof(uint160))
+                    break;
+                vSolutionsRet.push_back(vch1);
+            }
+            else if (opcode2 == OP_SMALLINTEGER)
+            {
+                if (opcode1 == OP_0 ||
+                    (opcode1 >= OP_1 && opcode1 <= OP_16))
+                {
+                    char n = (char)CScript::DecodeOP_N(opcode1);
+                    vSolutionsRet.push_back(valtype(1, n));
+                }
+                else
+                    break;
+            }
+            else if (opcode1 != opcode2 || vch1 != vch2)
+                break;
+        }
+    }
+
+    vSolutionsRet.clear();
+    typeRet = TX_NONSTANDARD;
+    return false;
+}
+
+static void CheckSolver(const CScript& script)
+{
+    txnouttype type1, type2;
+    vector<valtype> vSolutions1, vSolutions2;
+    bool fSolved1 = TemplateSolver(script, type1, vSolutions1);
+    bool fSolved2 = Solver(script, type2, vSolutions2);
+    BOOST_CHECK_MESSAGE(fSolved1 == fSolved2 && type1 == type2, HexStr(script.begin(), script.end()));
+    if (fSolved1)
+        BOOST_CHECK(vSolutions1 == vSolutions2);
+
+    CScriptSolution solution;
+    BOOST_CHECK_EQUAL(Solver(script, solution), fSolved1);
+    if (fSolved1 && type1 != TX_MULTISIG)
+    {
+        uint160 id = (type1 == TX_PUBKEY ? Hash160(vSolutions1[0]) : uint160(vSolutions1[0]));
+        BOOST_CHECK(solution.GetID() == id);
+    }
+}
+
+static CScript PushWith(opcodetype opcode, const valtype& vch)
+{
+    CScript script;
+    if (opcode < OP_PUSHDATA1)
+        return script << vch;
+    script << opcode;
+    unsigned int nSize = vch.size();
+    script.insert(script.end(), (unsigned char*)&nSize, (unsigned char*)&nSize + (opcode == OP_PUSHDATA1 ? 1 : opcode == OP_PUSHDATA2 ? 2 : 4));
+    script.insert(script.end(), vch.begin(), vch.end());
+    return script;
+}
+
+BOOST_AUTO_TEST_CASE(solver_templates)
+{
+    const unsigned int vKeySizes[] = { 0, 20, 32, 33, 65, 75, 76, 120, 121 };
+    const opcodetype vPushOps[] = { OP_0, OP_PUSHDATA1, OP_PUSHDATA2, OP_PUSHDATA4 };
+    vector<CScript> vScripts;
+
+    for (unsigned int i = 0; i < sizeof(vKeySizes) / sizeof(vKeySizes[0]); i++)
+    {
+        for (unsigned int j = 0; j < sizeof(vPushOps) / sizeof(vPushOps[0]); j++)
+        {
+            valtype vch(vKeySizes[i], 0x02 + i);
+            CScript push = PushWith(vPushOps[j], vch);
+            vScripts.push_back(push + (CScript() << OP_CHECKSIG));
+            vScripts.push_back((CScript() << OP_DUP << OP_HASH160) + push + (CScript() << OP_EQUALVERIFY << OP_CHECKSIG));
+            vScripts.push_back((CScript() << OP_HASH160) + push + (CScript() << OP_EQUAL));
+            vScripts.push_back((CScript() << OP_1) + push + push + (CScript() << OP_2 << OP_CHECKMULTISIG));
+        }
+    }
+
+    // Multisig with every combination of counts, including impossible ones
+    for (int m = 0; m <= 17; m++)
+    {
+        for (int nKeys = 0; nKeys <= 17; nKeys++)
+        {
+            CScript script;
+            script << (m == 0 ? OP_0 : m <= 16 ? CScript::EncodeOP_N(m) : OP_NOP);
+            for (int k = 0; k < nKeys; k++)
+                script << valtype(k % 2 ? 33 : 65, k);
+            script << (nKeys == 0 ? OP_0 : nKeys <= 16 ? CScript::EncodeOP_N(nKeys) : OP_NOP) << OP_CHECKMULTISIG;
+            vScripts.push_back(script);
+            vScripts.push_back(CScript(script.begin(), script.end() - 2) << CScript::EncodeOP_N(min(nKeys + 1, 16)) << OP_CHECKMULTISIG);
+        }
+    }
+
+    // Every truncation and extension of each, and single byte changes
+    BOOST_FOREACH(const CScript& script, vector<CScript>(vScripts))
+    {
+        for (unsigned int n = 0; n < script.size(); n++)
+            vScripts.push_back(CScript(script.begin(), script.begin() + n));
+        vScripts.push_back(script + (CScript() << OP_NOP));
+        vScripts.push_back(script + (CScript() << OP_CHECKSIG));
+        for (unsigned int n = 0; n < script.size(); n += 1 + n / 8)
+        {
+            CScript scriptChanged(script);
+            scriptChanged[n] ^= 1 << (n % 8);
+            vScripts.push_back(scriptChanged);
+        }
+    }
+
+    BOOST_FOREACH(const CScript& script, vScripts)
+        CheckSolver(script);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -261,4 +261,43 @@ BOOST_AUTO_TEST_CASE(test_GetThrow)
     BOOST_CHECK_THROW(t1.GetValueIn(missingInputs), runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(test_HashCache)
+{
+    CTransaction t;
+    t.vin.resize(1);
+    t.vin[0].prevout.hash = GetRandHash();
+    t.vin[0].prevout.n = 0;
+    t.vout.resize(1);
+    t.vout[0].nValue = 90*CENT;
+    t.vout[0].scriptPubKey << OP_1;
+
+    uint256 hash = t.GetHash();
+    BOOST_CHECK(hash == SerializeHash(t));
+
+    // Modifying the transaction requires InvalidateHash():
+    t.vout[0].nValue = 80*CENT;
+    BOOST_CHECK(t.GetHash() == hash);
+    t.InvalidateHash();
+    BOOST_CHECK(t.GetHash() == SerializeHash(t));
+    BOOST_CHECK(t.GetHash() != hash);
+
+    // ... but deserializing does it automatically:
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << t;
+    CTransaction t2;
+    hash = t2.GetHash();
+    ss >> t2;
+    BOOST_CHECK(t2.GetHash() == SerializeHash(t2));
+    BOOST_CHECK(t2.GetHash() == t.GetHash());
+
+    // Block headers are checked against the bytes they were hashed from:
+    CBlock block;
+    block.nBits = 0x1e0fffff;
+    hash = block.GetHash();
+    BOOST_CHECK(hash == Hash9(BEGIN(block.nVersion), END(block.nNonce)));
+    block.nNonce++;
+    BOOST_CHECK(block.GetHash() != hash);
+    BOOST_CHECK(block.GetHash() == Hash9(BEGIN(block.nVersion), END(block.nNonce)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,393 @@
+#include <boost/test/unit_test.hpp>
+
+#include "base58.h"
+#include "db.h"
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(txindex_tests)
+
+// The record as it was written before the spent bitmap
+class CTxIndexOld
+{
+public:
+    CDiskTxPos pos;
+    vector<CDiskTxPos> vSpent;
+
+    IMPLEMENT_SERIALIZE
+    (
+        if (!(nType & SER_GETHASH))
+            READWRITE(nVersion);
+        READWRITE(pos);
+        READWRITE(vSpent);
+    )
+};
+
+BOOST_AUTO_TEST_CASE(txindex_bitmap)
+{
+    CTxIndex txindex(CDiskTxPos(1, 2, 3), 10);
+    BOOST_CHECK_EQUAL(txindex.GetOutputCount(), 10U);
+    BOOST_CHECK(!txindex.IsSpent(9) && !txindex.IsSpent(10));
+
+    for (unsigned int n = 0; n < 10; n += 3)
+        txindex.MarkSpent(n, CDiskTxPos(1, 2, 100 + n));
+    txindex.MarkSpent(10, CDiskTxPos(1, 2, 110));
+    for (unsigned int n = 0; n < 10; n++)
+        BOOST_CHECK_EQUAL(txindex.IsSpent(n), n % 3 == 0);
+    BOOST_CHECK(!txindex.IsSpent(10));
+    BOOST_CHECK(!txindex.IsFullySpent());
+
+    txindex.MarkUnspent(9);
+    BOOST_CHECK(!txindex.IsSpent(9));
+    for (unsigned int n = 0; n < 10; n++)
+        txindex.MarkSpent(n, CDiskTxPos(1, 2, 100 + n));
+    BOOST_CHECK(txindex.IsFullySpent());
+}
+
+BOOST_AUTO_TEST_CASE(txindex_serialize)
+{
+    for (int nKeep = 0; nKeep < 2; nKeep++)
+    {
+        CTxIndex::fKeepSpenders = (nKeep == 1);
+        CTxIndex txindex(CDiskTxPos(1, 2, 3), 17);
+        txindex.MarkSpent(0, CDiskTxPos(4, 5, 6));
+        txindex.MarkSpent(16, CDiskTxPos(7, 8, 9));
+
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << txindex;
+        CTxIndex txindexRead;
+        ss >> txindexRead;
+        BOOST_CHECK(txindexRead == txindex);
+        BOOST_CHECK_EQUAL(txindexRead.GetOutputCount(), 17U);
+        BOOST_CHECK(txindexRead.IsSpent(0) && txindexRead.IsSpent(16) && !txindexRead.IsSpent(1));
+
+        CDiskTxPos posSpender;
+        BOOST_CHECK_EQUAL(txindexRead.GetSpender(16, posSpender), nKeep == 1);
+        if (nKeep == 1)
+            BOOST_CHECK(posSpender == CDiskTxPos(7, 8, 9));
+        BOOST_CHECK(!txindexRead.GetSpender(1, posSpender));
+    }
+    CTxIndex::fKeepSpenders = false;
+
+    // A bitmap with more padding than a byte is rejected
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << (int)(CLIENT_VERSION | TXINDEX_COMPACT) << CDiskTxPos(1, 2, 3) << (unsigned char)9 << vector<unsigned char>(2, 0);
+    ss << vector<pair<unsigned int, CDiskTxPos> >();
+    CTxIndex txindex;
+    BOOST_CHECK_THROW(ss >> txindex, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(txindex_old_format)
+{
+    CTxIndexOld txindexOld;
+    txindexOld.pos = CDiskTxPos(1, 2, 3);
+    txindexOld.vSpent.resize(3);
+    txindexOld.vSpent[1] = CDiskTxPos(4, 5, 6);
+
+    for (int nKeep = 0; nKeep < 2; nKeep++)
+    {
+        CTxIndex::fKeepSpenders = (nKeep == 1);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << txindexOld;
+        size_t nOldSize = ss.size();
+        CTxIndex txindex;
+        ss >> txindex;
+        BOOST_CHECK(txindex.pos == txindexOld.pos);
+        BOOST_CHECK_EQUAL(txindex.GetOutputCount(), 3U);
+        BOOST_CHECK(!txindex.IsSpent(0) && txindex.IsSpent(1) && !txindex.IsSpent(2));
+        CDiskTxPos posSpender;
+        BOOST_CHECK_EQUAL(txindex.GetSpender(1, posSpender), nKeep == 1);
+
+        // Written back in the compact format, and smaller
+        ss << txindex;
+        BOOST_CHECK(ss.size() < nOldSize);
+        int nFormat;
+        memcpy(&nFormat, &ss[0], sizeof(nFormat));
+        BOOST_CHECK(nFormat & TXINDEX_COMPACT);
+    }
+    CTxIndex::fKeepSpenders = false;
+}
+
+BOOST_AUTO_TEST_CASE(txindex_size)
+{
+    // A typical record, two outputs both spent
+    CTxIndexOld txindexOld;
+    txindexOld.vSpent.assign(2, CDiskTxPos(1, 2, 3));
+    CTxIndex txindex(CDiskTxPos(1, 2, 3), 2);
+    txindex.MarkSpent(0, CDiskTxPos(1, 2, 3));
+    txindex.MarkSpent(1, CDiskTxPos(1, 2, 3));
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txindexOld, SER_DISK, CLIENT_VERSION), 41U);
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txindex, SER_DISK, CLIENT_VERSION), 20U);
+
+    // Most of it was the positions
+    CTxIndexOld txindexOldLarge;
+    txindexOldLarge.vSpent.resize(100);
+    CTxIndex txindexLarge(CDiskTxPos(1, 2, 3), 100);
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txindexOldLarge, SER_DISK, CLIENT_VERSION), 1217U);
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txindexLarge, SER_DISK, CLIENT_VERSION), 32U);
+}
+
+BOOST_AUTO_TEST_CASE(blockundo_serialize)
+{
+    CBlockUndo undo;
+    BOOST_CHECK(undo.IsNull());
+    undo.vCreated.push_back(uint256(1));
+    undo.vCreated.push_back(uint256(2));
+    CTxIndex txindex(CDiskTxPos(1, 2, 3), 5);
+    txindex.MarkSpent(3, CDiskTxPos(4, 5, 6));
+    undo.vPrev.push_back(make_pair(uint256(3), txindex));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << undo;
+    CBlockUndo undoRead;
+    ss >> undoRead;
+    BOOST_CHECK(!undoRead.IsNull());
+    BOOST_CHECK(undoRead.vCreated == undo.vCreated);
+    BOOST_REQUIRE_EQUAL(undoRead.vPrev.size(), 1U);
+    BOOST_CHECK(undoRead.vPrev[0].first == uint256(3));
+    BOOST_CHECK(undoRead.vPrev[0].second == txindex);
+    BOOST_CHECK(undoRead.vPrev[0].second.IsSpent(3) && !undoRead.vPrev[0].second.IsSpent(2));
+}
+
+BOOST_AUTO_TEST_CASE(blockundo_connect_disconnect)
+{
+    CTxDB txdb("r+");
+    unsigned int nTime = GetAdjustedTime();
+
+    // An output to spend, with its record pointing at the memory pool
+    CTransaction txPrev;
+    txPrev.nTime = nTime;
+    txPrev.vin.resize(1);
+    txPrev.vin[0].prevout = COutPoint(uint256(123), 0);
+    txPrev.vout.push_back(CTxOut(10 * COIN, CScript() << OP_TRUE));
+    txPrev.vout.push_back(CTxOut(5 * COIN, CScript() << OP_TRUE));
+    uint256 hashPrev = txPrev.GetHash();
+    BOOST_CHECK(mempool.addUnchecked(hashPrev, txPrev));
+    BOOST_CHECK(txdb.UpdateTxIndex(hashPrev, CTxIndex(CDiskTxPos(1, 1, 1), txPrev.vout.size())));
+
+    // A block with a coinbase and a transaction spending the first output
+    CBlock block;
+    block.nTime = nTime;
+    block.vtx.resize(2);
+    block.vtx[0].nTime = nTime;
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].scriptSig = CScript() << 1 << 2;
+    block.vtx[0].vout.push_back(CTxOut(0, CScript() << OP_TRUE));
+    block.vtx[1].nTime = nTime;
+    block.vtx[1].vin.push_back(CTxIn(COutPoint(hashPrev, 0)));
+    block.vtx[1].vout.push_back(CTxOut(1 * COIN, CScript() << OP_TRUE));
+    block.hashPrevBlock = pindexGenesisBlock->GetBlockHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.fChecked = true; // no proof of work or signature
+    uint256 hashCoinBase = block.vtx[0].GetHash();
+    uint256 hashSpend = block.vtx[1].GetHash();
+
+    // An older transaction of the same hash as the coinbase, fully spent, for
+    // the block to overwrite (BIP30)
+    CTxIndex txindexOld(CDiskTxPos(7, 8, 9), 1);
+    txindexOld.MarkSpent(0, CDiskTxPos(7, 8, 10));
+    BOOST_CHECK(txdb.UpdateTxIndex(hashCoinBase, txindexOld));
+
+    CTxIndex txindexPrev;
+    BOOST_CHECK(txdb.ReadTxIndex(hashPrev, txindexPrev));
+    BOOST_CHECK(!txindexPrev.IsSpent(0));
+    BOOST_CHECK(!txdb.ContainsTx(hashSpend));
+
+    uint256 hashBlock = block.GetHash();
+    CBlockIndex index(1, 5000000, block);
+    index.phashBlock = &hashBlock;
+    index.pprev = pindexGenesisBlock;
+    index.nHeight = 1;
+
+    BOOST_REQUIRE(txdb.TxnBegin());
+    BOOST_REQUIRE(block.ConnectBlock(txdb, &index));
+    BOOST_REQUIRE(txdb.TxnCommit());
+    CTxIndex txindex;
+    BOOST_CHECK(txdb.ReadTxIndex(hashPrev, txindex) && txindex.IsSpent(0) && !txindex.IsSpent(1));
+    BOOST_CHECK(txdb.ReadTxIndex(hashCoinBase, txindex) && txindex.pos.nBlockPos == 5000000 && !txindex.IsSpent(0));
+    BOOST_CHECK(txdb.ContainsTx(hashSpend));
+    CBlockUndo undo;
+    BOOST_CHECK(txdb.ReadBlockUndo(hashBlock, undo));
+    BOOST_CHECK_EQUAL(undo.vCreated.size(), 2U);
+    BOOST_CHECK_EQUAL(undo.vPrev.size(), 2U);
+
+    // Taking the block away leaves the records as they were before it
+    BOOST_REQUIRE(txdb.TxnBegin());
+    BOOST_REQUIRE(block.DisconnectBlock(txdb, &index));
+    BOOST_REQUIRE(txdb.TxnCommit());
+    BOOST_CHECK(txdb.ReadTxIndex(hashPrev, txindex) && txindex == txindexPrev);
+    BOOST_CHECK(txdb.ReadTxIndex(hashCoinBase, txindex) && txindex == txindexOld);
+    BOOST_CHECK(!txdb.ContainsTx(hashSpend));
+    BOOST_CHECK(!txdb.ReadBlockUndo(hashBlock, undo));
+
+    // Connecting a block drops the undo record BLOCK_UNDO_DEPTH below it
+    vector<uint256> vHash(BLOCK_UNDO_DEPTH);
+    vector<CBlockIndex*> vIndex(BLOCK_UNDO_DEPTH);
+    for (int i = 0; i < BLOCK_UNDO_DEPTH; i++)
+    {
+        vHash[i] = uint256(1000 + i);
+        vIndex[i] = new CBlockIndex();
+        vIndex[i]->phashBlock = &vHash[i];
+        vIndex[i]->pprev = (i == 0 ? pindexGenesisBlock : vIndex[i - 1]);
+        vIndex[i]->nHeight = i + 1;
+    }
+    BOOST_CHECK(txdb.WriteBlockUndo(vHash[0], undo));
+    BOOST_CHECK(txdb.WriteBlockUndo(vHash[1], undo));
+    index.pprev = vIndex[BLOCK_UNDO_DEPTH - 1];
+    index.nHeight = BLOCK_UNDO_DEPTH + 1;
+    BOOST_REQUIRE(txdb.TxnBegin());
+    BOOST_REQUIRE(block.ConnectBlock(txdb, &index));
+    BOOST_REQUIRE(txdb.TxnCommit());
+    BOOST_CHECK(!txdb.ReadBlockUndo(vHash[0], undo));
+    BOOST_CHECK(txdb.ReadBlockUndo(vHash[1], undo));
+    BOOST_CHECK(txdb.ReadBlockUndo(hashBlock, undo));
+
+    BOOST_REQUIRE(txdb.TxnBegin());
+    BOOST_REQUIRE(block.DisconnectBlock(txdb, &index));
+    BOOST_CHECK(txdb.EraseBlockUndo(vHash[1]));
+    BOOST_CHECK(txdb.EraseTxIndex(hashPrev) && txdb.EraseTxIndex(hashCoinBase));
+    BOOST_REQUIRE(txdb.TxnCommit());
+    for (int i = 0; i < BLOCK_UNDO_DEPTH; i++)
+        delete vIndex[i];
+    mempool.remove(txPrev);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_key_order)
+{
+    // Keys of one destination sort by height as byte strings, and come back
+    CAddrIndexDest dest(CScript() << OP_TRUE);
+    int nHeights[] = { 0, 1, 255, 256, 65536, 1000000 };
+    string strPrev;
+    for (unsigned int i = 0; i < sizeof(nHeights) / sizeof(nHeights[0]); i++)
+    {
+        CAddrIndexKey key(dest, nHeights[i], uint256(100 - i), i % 2 == 1, 7);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << make_pair(string("addr"), key);
+        string strKey(ss.begin(), ss.end());
+        BOOST_CHECK(strPrev < strKey);
+        strPrev = strKey;
+
+        pair<string, CAddrIndexKey> keyRead;
+        ss >> keyRead;
+        BOOST_CHECK_EQUAL(keyRead.second.nHeight, nHeights[i]);
+        BOOST_CHECK(keyRead.second.dest == dest);
+        BOOST_CHECK(keyRead.second.hashTx == uint256(100 - i));
+        BOOST_CHECK_EQUAL(keyRead.second.fSpend, i % 2 == 1);
+        BOOST_CHECK_EQUAL(keyRead.second.nIndex, 7U);
+    }
+
+    // The prefix scanned for a destination is the start of each of its keys
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << make_pair(string("addr"), dest);
+    BOOST_CHECK(strPrev.compare(0, ssPrefix.size(), string(ssPrefix.begin(), ssPrefix.end())) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_dest)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CKeyID keyID = key.GetPubKey().GetID();
+
+    // Coinbases and coinstakes pay to the key itself, other outputs to its
+    // hash; both are filed under the key, where its address looks
+    CScript scriptPubKey;
+    scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+    CScript scriptPubKeyHash;
+    scriptPubKeyHash.SetDestination(keyID);
+    CAddrIndexDest destPubKey(scriptPubKey);
+    BOOST_CHECK(destPubKey.nDestType == CAddrIndexDest::DEST_KEY);
+    BOOST_CHECK(destPubKey.hash == keyID);
+    BOOST_CHECK(CAddrIndexDest(scriptPubKeyHash) == destPubKey);
+    BOOST_CHECK(CAddrIndexDest(CBitcoinAddress(keyID).Get()) == destPubKey);
+
+    // Pay to script hash, under the script hash
+    CScript scriptInner;
+    scriptInner << OP_1 << key.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+    CScriptID scriptID = scriptInner.GetID();
+    CScript scriptP2SH;
+    scriptP2SH.SetDestination(scriptID);
+    CAddrIndexDest destP2SH(scriptP2SH);
+    BOOST_CHECK(destP2SH.nDestType == CAddrIndexDest::DEST_SCRIPTHASH);
+    BOOST_CHECK(destP2SH.hash == scriptID);
+    BOOST_CHECK(CAddrIndexDest(CBitcoinAddress(scriptID).Get()) == destP2SH);
+
+    // Anything else under the hash of the script, apart from a key or script
+    // hash of the same value
+    CAddrIndexDest destBare(scriptInner);
+    BOOST_CHECK(destBare.nDestType == CAddrIndexDest::DEST_SCRIPT);
+    BOOST_CHECK(destBare.hash == Hash160(scriptInner));
+    BOOST_CHECK(destBare != CAddrIndexDest(CAddrIndexDest::DEST_SCRIPTHASH, Hash160(scriptInner)));
+    BOOST_CHECK(CAddrIndexDest(CNoDestination()).IsNull());
+
+    // Each output of the key starts with the prefix scanned for its address
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << make_pair(string("addr"), CAddrIndexDest(CBitcoinAddress(keyID).Get()));
+    for (int i = 0; i < 2; i++)
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << make_pair(string("addr"), CAddrIndexKey(CAddrIndexDest(i == 0 ? scriptPubKey : scriptPubKeyHash), 10, uint256(i), false, 0));
+        BOOST_CHECK(string(ss.begin(), ss.end()).compare(0, ssPrefix.size(), string(ssPrefix.begin(), ssPrefix.end())) == 0);
+    }
+}
+
+// Collects what ReadAddrIndex passes on
+class CAddrIndexCollector : public CAddrIndexVisitor
+{
+public:
+    vector<pair<CAddrIndexKey, CAddrIndexValue> > vEntries;
+
+    bool Visit(const CAddrIndexKey& key, const CAddrIndexValue& value)
+    {
+        vEntries.push_back(make_pair(key, value));
+        return true;
+    }
+};
+
+static unsigned int nFlushes = 0;
+
+static bool CountFlush()
+{
+    nFlushes++;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_read_unflushed)
+{
+    CTxDB::SetCacheSize(1 << 20);
+    CTxDB::SetFlushPolicy(300, CountFlush);
+    CTxDB txdb("r+");
+    CAddrIndexDest dest(CAddrIndexDest::DEST_KEY, uint160(12345));
+    CAddrIndexDest destOther(CAddrIndexDest::DEST_SCRIPT, uint160(12345));
+    CAddrIndexKey keyOut1(dest, 10, uint256(1), false, 0);
+    CAddrIndexKey keyOut2(dest, 11, uint256(2), false, 1);
+    CAddrIndexKey keyOther(destOther, 11, uint256(2), false, 0);
+    BOOST_CHECK(txdb.WriteAddrIndex(keyOut1, CAddrIndexValue(50 * COIN)));
+    BOOST_CHECK(txdb.WriteAddrIndex(keyOut2, CAddrIndexValue(20 * COIN)));
+    BOOST_CHECK(txdb.WriteAddrIndex(keyOther, CAddrIndexValue(1 * COIN)));
+    BOOST_CHECK(txdb.Flush(true));
+
+    // A block spending the first output, and the second taken away again
+    CAddrIndexKey keyOut3(dest, 12, uint256(3), false, 0);
+    CAddrIndexKey keySpend(dest, 12, uint256(3), true, 0);
+    BOOST_CHECK(txdb.WriteAddrIndex(keyOut3, CAddrIndexValue(45 * COIN)));
+    BOOST_CHECK(txdb.WriteAddrIndex(keySpend, CAddrIndexValue(50 * COIN, COutPoint(uint256(1), 0))));
+    BOOST_CHECK(txdb.EraseAddrIndex(keyOut2));
+
+    // Read without writing the cache out, in key order
+    unsigned int nFlushesBefore = nFlushes;
+    CAddrIndexCollector collector;
+    BOOST_CHECK(txdb.ReadAddrIndex(dest, collector));
+    BOOST_CHECK_EQUAL(nFlushes, nFlushesBefore);
+    BOOST_REQUIRE_EQUAL(collector.vEntries.size(), 3U);
+    BOOST_CHECK(collector.vEntries[0].first.nHeight == 10 && collector.vEntries[0].second.nValue == 50 * COIN);
+    BOOST_CHECK(collector.vEntries[1].first.nHeight == 12 && !collector.vEntries[1].first.fSpend);
+    BOOST_CHECK(collector.vEntries[2].first.fSpend && collector.vEntries[2].second.prevout == COutPoint(uint256(1), 0));
+
+    BOOST_CHECK(txdb.EraseAddrIndex(keyOut1) && txdb.EraseAddrIndex(keyOut3) && txdb.EraseAddrIndex(keySpend) && txdb.EraseAddrIndex(keyOther));
+    BOOST_CHECK(txdb.Flush(true));
+    CTxDB::SetFlushPolicy(300, NULL);
+    CTxDB::SetCacheSize(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "uint256.h"
+#include "bignum.h"
 
 BOOST_AUTO_TEST_SUITE(uint256_tests)
 
@@ -15,4 +16,55 @@ BOOST_AUTO_TEST_CASE(uint256_equality)
     BOOST_CHECK(num1+num2 == num3+num2);
 }
 
+BOOST_AUTO_TEST_CASE(uint256_divide)
+{
+    uint256 num1 = 1000;
+    uint256 num2 = 7;
+    BOOST_CHECK((num1 / num2) == 142);
+    BOOST_CHECK((num2 / num1) == 0);
+    BOOST_CHECK((num1 / num1) == 1);
+    BOOST_CHECK_THROW(num1 / uint256(0), std::overflow_error);
+
+    // Agrees with CBigNum over the whole width
+    uint256 num3 = ~uint256(0);
+    uint256 num4 = (uint256(0x12345678) << 100) + 0xabcdef;
+    CBigNum bnQuotient = CBigNum(num3) / CBigNum(num4);
+    BOOST_CHECK((num3 / num4) == bnQuotient.getuint256());
+    BOOST_CHECK((num3 / num3) == 1);
+    bnQuotient = CBigNum(num4) / 3;
+    BOOST_CHECK((num4 / uint256(3)) == bnQuotient.getuint256());
+
+    BOOST_CHECK_EQUAL(uint256(0).bits(), 0U);
+    BOOST_CHECK_EQUAL(uint256(1).bits(), 1U);
+    BOOST_CHECK_EQUAL(num4.bits(), 129U);
+    BOOST_CHECK_EQUAL(num3.bits(), 256U);
+}
+
+BOOST_AUTO_TEST_CASE(uint256_compact)
+{
+    unsigned int nCompacts[] = { 0x1d00ffff, 0x1e0fffff, 0x1c0ffff0, 0x1b0404cb, 0x05009234, 0x03123456, 0x01003456, 0x207fffff };
+    for (unsigned int i = 0; i < sizeof(nCompacts) / sizeof(nCompacts[0]); i++)
+    {
+        bool fNegative, fOverflow;
+        uint256 nTarget;
+        nTarget.SetCompact(nCompacts[i], &fNegative, &fOverflow);
+        BOOST_CHECK(!fNegative && !fOverflow);
+        BOOST_CHECK(nTarget == CBigNum().SetCompact(nCompacts[i]).getuint256());
+
+        // The block trust, 2**256 / (target+1), without going past 256 bits
+        CBigNum bnTrust = (CBigNum(1) << 256) / (CBigNum(nTarget) + 1);
+        BOOST_CHECK(((~nTarget / (nTarget + 1)) + 1) == bnTrust.getuint256());
+    }
+
+    bool fNegative, fOverflow;
+    uint256 nTarget;
+    nTarget.SetCompact(0x04923456, &fNegative, &fOverflow);
+    BOOST_CHECK(fNegative && !fOverflow);
+    nTarget.SetCompact(0xff123456, &fNegative, &fOverflow);
+    BOOST_CHECK(!fNegative && fOverflow);
+    nTarget.SetCompact(0x22000001, &fNegative, &fOverflow);
+    BOOST_CHECK(!fNegative && !fOverflow);
+    BOOST_CHECK(nTarget == (uint256(1) << 248));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
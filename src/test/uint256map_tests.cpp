@@ -0,0 +1,84 @@
+#include <boost/test/unit_test.hpp>
+#include <map>
+
+#include "uint256map.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(uint256map_tests)
+
+BOOST_AUTO_TEST_CASE(siphash_uint256)
+{
+    // The SipHash-2-4 reference key over the bytes 00..1f
+    uint256 val("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val), 0x7127512f72f27cceULL);
+}
+
+BOOST_AUTO_TEST_CASE(uint256map_like_map)
+{
+    // The same random inserts and erases as a std::map, including erases
+    // that leave gaps in runs of probed slots
+    uint256_map<int> mapHash;
+    map<uint256, int> mapTree;
+    BOOST_CHECK(mapHash.begin() == mapHash.end());
+    BOOST_CHECK(mapHash.find(1) == mapHash.end());
+    for (int i = 0; i < 20000; i++)
+    {
+        uint256 key = GetRand(3000);
+        if (GetRand(3) == 0)
+        {
+            BOOST_CHECK_EQUAL(mapHash.erase(key), mapTree.erase(key));
+        }
+        else
+        {
+            bool fInserted = mapHash.insert(make_pair(key, i)).second;
+            BOOST_CHECK_EQUAL(fInserted, mapTree.insert(make_pair(key, i)).second);
+        }
+    }
+    BOOST_CHECK_EQUAL(mapHash.size(), mapTree.size());
+    for (int i = 0; i < 3000; i++)
+    {
+        uint256_map<int>::const_iterator mi = mapHash.find(i);
+        BOOST_CHECK_EQUAL(mi != mapHash.end(), mapTree.count(i) == 1);
+        if (mi != mapHash.end())
+            BOOST_CHECK_EQUAL(mi->second, mapTree[i]);
+    }
+
+    // Iteration visits each entry once
+    map<uint256, int> mapVisited;
+    for (uint256_map<int>::iterator mi = mapHash.begin(); mi != mapHash.end(); ++mi)
+        BOOST_CHECK(mapVisited.insert(*mi).second);
+    BOOST_CHECK(mapVisited == mapTree);
+
+    mapHash[5] = 7;
+    BOOST_CHECK_EQUAL(mapHash[5], 7);
+    BOOST_CHECK_EQUAL(mapHash.count(5), 1U);
+    mapHash.clear();
+    BOOST_CHECK(mapHash.empty());
+    BOOST_CHECK(mapHash.begin() == mapHash.end());
+    BOOST_CHECK_EQUAL(mapHash.count(5), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(uint256map_stable)
+{
+    // Entries stay where they are while the table grows and shrinks around them
+    uint256_map<string> mapHash;
+    vector<pair<const uint256, string>*> vEntry;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint256 key = GetRandHash();
+        vEntry.push_back(&*mapHash.insert(make_pair(key, strprintf("%d", i))).first);
+        if (i % 2)
+            mapHash.erase(vEntry[i - 1]->first);
+    }
+    mapHash.reserve(100000);
+    for (int i = 1; i < 1000; i += 2)
+    {
+        BOOST_CHECK(&*mapHash.find(vEntry[i]->first) == vEntry[i]);
+        BOOST_CHECK(vEntry[i]->second == strprintf("%d", i));
+    }
+    BOOST_CHECK_EQUAL(mapHash.size(), 500U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
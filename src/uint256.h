@@ -8,6 +8,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -152,6 +153,50 @@ public:
         return *this;
     }
 
+    base_uint& operator/=(const base_uint& b)
+    {
+        // Long division, a bit of the quotient at a time
+        base_uint div = b;
+        base_uint num = *this;
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int nNumBits = num.bits();
+        int nDivBits = div.bits();
+        if (nDivBits == 0)
+            throw std::overflow_error("base_uint::operator/= : division by zero");
+        if (nDivBits > nNumBits)
+            return *this;
+        int nShift = nNumBits - nDivBits;
+        div <<= nShift;
+        while (nShift >= 0)
+        {
+            if (num >= div)
+            {
+                num -= div;
+                pn[nShift / 32] |= (1U << (nShift & 31));
+            }
+            div >>= 1;
+            nShift--;
+        }
+        return *this;
+    }
+
+    // Position of the highest bit set, plus one; 0 for zero
+    unsigned int bits() const
+    {
+        for (int i = WIDTH - 1; i >= 0; i--)
+        {
+            if (pn[i])
+            {
+                for (int nBit = 31; nBit > 0; nBit--)
+                    if (pn[i] & (1U << nBit))
+                        return 32 * i + nBit + 1;
+                return 32 * i + 1;
+            }
+        }
+        return 0;
+    }
+
     base_uint& operator+=(uint64 b64)
     {
         base_uint b;
@@ -555,6 +600,32 @@ public:
         return *this;
     }
 
+    /** Set to the value of a compact target (nBits), as CBigNum::SetCompact
+     * does.  Negative values and values that don't fit are flagged, and set
+     * this to what is left of them. */
+    uint256& SetCompact(unsigned int nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = (nWord != 0 && (nCompact & 0x00800000) != 0);
+        if (pfOverflow)
+            *pfOverflow = (nWord != 0 && (nSize > 34 ||
+                                          (nWord > 0xff && nSize > 33) ||
+                                          (nWord > 0xffff && nSize > 32)));
+        return *this;
+    }
+
     explicit uint256(const std::string& str)
     {
         SetHex(str);
@@ -581,6 +652,7 @@ inline const uint256 operator&(const base_uint256& a, const base_uint256& b) { r
 inline const uint256 operator|(const base_uint256& a, const base_uint256& b) { return uint256(a) |= b; }
 inline const uint256 operator+(const base_uint256& a, const base_uint256& b) { return uint256(a) += b; }
 inline const uint256 operator-(const base_uint256& a, const base_uint256& b) { return uint256(a) -= b; }
+inline const uint256 operator/(const base_uint256& a, const base_uint256& b) { return uint256(a) /= b; }
 
 inline bool operator<(const base_uint256& a, const uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const base_uint256& a, const uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -0,0 +1,334 @@
+// Copyright (c) 2014 The MiracleCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MIRACLECOIN_UINT256MAP_H
+#define MIRACLECOIN_UINT256MAP_H
+
+#include "allocators.h"
+#include "uint256.h"
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <openssl/rand.h>
+
+static inline uint64 SipRotl(uint64 x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void SipRound(uint64& v0, uint64& v1, uint64& v2, uint64& v3)
+{
+    v0 += v1; v1 = SipRotl(v1, 13); v1 ^= v0; v0 = SipRotl(v0, 32);
+    v2 += v3; v3 = SipRotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = SipRotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = SipRotl(v1, 17); v1 ^= v2; v2 = SipRotl(v2, 32);
+}
+
+/** SipHash-2-4 of the 32 bytes of val under the key (k0, k1). */
+inline uint64 SipHashUint256(uint64 k0, uint64 k1, const uint256& val)
+{
+    uint64 v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64 v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64 v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64 v3 = 0x7465646279746573ULL ^ k1;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64 d = val.Get64(i);
+        v3 ^= d;
+        SipRound(v0, v1, v2, v3);
+        SipRound(v0, v1, v2, v3);
+        v0 ^= d;
+    }
+    uint64 d = ((uint64)32) << 56;
+    v3 ^= d;
+    SipRound(v0, v1, v2, v3);
+    SipRound(v0, v1, v2, v3);
+    v0 ^= d;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        SipRound(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/** STL-like map from uint256 to T, for the large tables keyed by hashes.
+ *
+ * The table is open-addressed: a flat array of slots, each holding a
+ * pointer to its entry and the low bits of the entry's hash, probed
+ * linearly and kept at most three quarters full.  A lookup reads a slot or
+ * two and then the entry, where a tree reads a node for every level.  Keys
+ * are hashed with SipHash under a key drawn at random for each map, so
+ * hashes chosen by peers can't be made to collide.
+ *
+ * Entries are allocated from a pool and never move: pointers and
+ * references to keys and values stay valid until the entry is erased,
+ * which CBlockIndex::phashBlock and the memory pool's CInPoint rely on.
+ * Iterators are invalidated by insert and erase, and visit the entries in
+ * no particular order.
+ */
+template <typename T> class uint256_map
+{
+public:
+    typedef uint256 key_type;
+    typedef T mapped_type;
+    typedef std::pair<const uint256, T> value_type;
+    typedef size_t size_type;
+
+private:
+    struct CSlot
+    {
+        value_type* pvalue; // NULL if the slot is free
+        unsigned int nHash;
+    };
+
+public:
+    template <typename V, typename S> class iterator_base
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef V value_type;
+        typedef ptrdiff_t difference_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+    private:
+        S* pslot;
+        S* pend;
+
+        friend class uint256_map;
+        template <typename V2, typename S2> friend class iterator_base;
+
+        iterator_base(S* pslotIn, S* pendIn) : pslot(pslotIn), pend(pendIn)
+        {
+            while (pslot != pend && !pslot->pvalue)
+                pslot++;
+        }
+
+    public:
+        iterator_base() : pslot(NULL), pend(NULL) { }
+
+        // iterator to const_iterator
+        template <typename V2, typename S2>
+        iterator_base(const iterator_base<V2, S2>& it) : pslot(it.pslot), pend(it.pend) { }
+
+        V& operator*() const { return *pslot->pvalue; }
+        V* operator->() const { return pslot->pvalue; }
+
+        iterator_base& operator++()
+        {
+            pslot++;
+            while (pslot != pend && !pslot->pvalue)
+                pslot++;
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base ret = *this;
+            ++(*this);
+            return ret;
+        }
+
+        bool operator==(const iterator_base& it) const { return pslot == it.pslot; }
+        bool operator!=(const iterator_base& it) const { return pslot != it.pslot; }
+    };
+
+    typedef iterator_base<value_type, CSlot> iterator;
+    typedef iterator_base<const value_type, const CSlot> const_iterator;
+
+private:
+    std::vector<CSlot> vSlots;
+    size_type nSize;
+    uint64 nKey0;
+    uint64 nKey1;
+    CObjectPool<value_type, 256> pool;
+
+    uint256_map(const uint256_map&);
+    void operator=(const uint256_map&);
+
+    unsigned int HashKey(const uint256& key) const
+    {
+        return (unsigned int)SipHashUint256(nKey0, nKey1, key);
+    }
+
+    // The slot holding key, or the free slot where it would go
+    size_t FindSlot(const uint256& key, unsigned int nHash) const
+    {
+        size_t nMask = vSlots.size() - 1;
+        for (size_t i = nHash & nMask; ; i = (i + 1) & nMask)
+        {
+            const CSlot& slot = vSlots[i];
+            if (!slot.pvalue || (slot.nHash == nHash && slot.pvalue->first == key))
+                return i;
+        }
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<CSlot> vOld;
+        vOld.swap(vSlots);
+        CSlot slotFree = { NULL, 0 };
+        vSlots.assign(nSlots, slotFree);
+        size_t nMask = nSlots - 1;
+        for (size_t i = 0; i < vOld.size(); i++)
+        {
+            if (!vOld[i].pvalue)
+                continue;
+            size_t j = vOld[i].nHash & nMask;
+            while (vSlots[j].pvalue)
+                j = (j + 1) & nMask;
+            vSlots[j] = vOld[i];
+        }
+    }
+
+    void EraseSlot(size_t i)
+    {
+        value_type* pvalue = vSlots[i].pvalue;
+        pvalue->~value_type();
+        pool.Free(pvalue);
+        nSize--;
+
+        // Move back the entries after it that would no longer be found
+        // past the gap, so lookups can stop at the first free slot
+        size_t nMask = vSlots.size() - 1;
+        for (size_t j = (i + 1) & nMask; vSlots[j].pvalue; j = (j + 1) & nMask)
+        {
+            size_t nHome = vSlots[j].nHash & nMask;
+            if (((j - nHome) & nMask) >= ((j - i) & nMask))
+            {
+                vSlots[i] = vSlots[j];
+                i = j;
+            }
+        }
+        vSlots[i].pvalue = NULL;
+    }
+
+    CSlot* SlotsBegin() { return vSlots.empty() ? NULL : &vSlots[0]; }
+    CSlot* SlotsEnd() { return SlotsBegin() + vSlots.size(); }
+    const CSlot* SlotsBegin() const { return vSlots.empty() ? NULL : &vSlots[0]; }
+    const CSlot* SlotsEnd() const { return SlotsBegin() + vSlots.size(); }
+
+public:
+    uint256_map() : nSize(0)
+    {
+        RAND_bytes((unsigned char*)&nKey0, sizeof(nKey0));
+        RAND_bytes((unsigned char*)&nKey1, sizeof(nKey1));
+    }
+
+    ~uint256_map()
+    {
+        clear();
+    }
+
+    iterator begin() { return iterator(SlotsBegin(), SlotsEnd()); }
+    iterator end() { return iterator(SlotsEnd(), SlotsEnd()); }
+    const_iterator begin() const { return const_iterator(SlotsBegin(), SlotsEnd()); }
+    const_iterator end() const { return const_iterator(SlotsEnd(), SlotsEnd()); }
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const key_type& key)
+    {
+        if (nSize == 0)
+            return end();
+        size_t i = FindSlot(key, HashKey(key));
+        if (!vSlots[i].pvalue)
+            return end();
+        return iterator(SlotsBegin() + i, SlotsEnd());
+    }
+
+    const_iterator find(const key_type& key) const
+    {
+        if (nSize == 0)
+            return end();
+        size_t i = FindSlot(key, HashKey(key));
+        if (!vSlots[i].pvalue)
+            return end();
+        return const_iterator(SlotsBegin() + i, SlotsEnd());
+    }
+
+    size_type count(const key_type& key) const
+    {
+        return find(key) == end() ? 0 : 1;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& x)
+    {
+        unsigned int nHash = HashKey(x.first);
+        size_t i = 0;
+        if (!vSlots.empty())
+        {
+            i = FindSlot(x.first, nHash);
+            if (vSlots[i].pvalue)
+                return std::make_pair(iterator(SlotsBegin() + i, SlotsEnd()), false);
+        }
+        if ((nSize + 1) * 4 > vSlots.size() * 3)
+        {
+            Rehash(std::max(vSlots.size() * 2, (size_t)16));
+            i = FindSlot(x.first, nHash);
+        }
+
+        void* p = pool.Allocate();
+        try {
+            vSlots[i].pvalue = new (p) value_type(x);
+        }
+        catch (...) {
+            pool.Free(p);
+            throw;
+        }
+        vSlots[i].nHash = nHash;
+        nSize++;
+        return std::make_pair(iterator(SlotsBegin() + i, SlotsEnd()), true);
+    }
+
+    T& operator[](const key_type& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            it = insert(value_type(key, T())).first;
+        return it->second;
+    }
+
+    void erase(iterator it)
+    {
+        EraseSlot(it.pslot - SlotsBegin());
+    }
+
+    size_type erase(const key_type& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < vSlots.size(); i++)
+        {
+            if (vSlots[i].pvalue)
+            {
+                vSlots[i].pvalue->~value_type();
+                pool.Free(vSlots[i].pvalue);
+            }
+        }
+        std::vector<CSlot>().swap(vSlots);
+        nSize = 0;
+    }
+
+    // Make room for n entries without growing the table on the way
+    void reserve(size_type n)
+    {
+        size_t nSlots = 16;
+        while (nSlots * 3 < n * 4)
+            nSlots *= 2;
+        if (nSlots > vSlots.size())
+            Rehash(nSlots);
+    }
+};
+
+#endif